@@ -0,0 +1,318 @@
+// Scheduler benchmark. Run with "make schedbench".
+//
+//   sched_bench [--policy round-robin|fair|both] [--seconds N] [--quantum MS]
+//               [--batch N] [--interactive N] [--period MS] [--nice N]
+//               [--cpus N]
+//
+// Runs two kinds of job side by side through the kernel's scheduler: batch
+// jobs that never stop computing, and interactive jobs that wake up every
+// --period milliseconds, do a little work and go back to waiting, like a
+// program answering keystrokes. --nice gives the first batch job that nice
+// value (or round robin level) instead of 0.
+//
+// For each policy the results are printed as JSON: the interactive jobs'
+// wakeup latency (from being woken to running) as percentiles, and how
+// fairly the batch jobs shared the CPU, as Jain's index over their CPU time
+// divided by their weight: 1 when every job got exactly its share, 1/N when
+// one job got all of it.
+//
+// With --cpus the jobs run on that many simulated CPUs, each a thread of its
+// own, instead of on the driver's thread. The results then also have each
+// CPU's utilization and the jobs moved to it, and batch cpu_ms over the run's
+// length says how many real CPUs' worth of work the batch jobs got done.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "../lib/seqft/common.h"
+#include "../src/process.h"
+#include "../src/sched.h"
+
+static double seconds     = 2;
+static int    quantum     = SCHED_DEFAULT_QUANTUM_MS;
+static int    batch       = 4;
+static int    interactive = 2;
+static double period      = 0.005;
+static int    first_nice  = 0;
+static int    cpus        = 0;
+
+static volatile BOOL stop;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// A few microseconds of arithmetic the compiler can't skip.
+static void work(int units) {
+    static volatile double sink;
+    double                 x = sink;
+
+    for (int i = 0; i < units * 1000; i++) {
+        x = x * 1.0000001 + 1e-9;
+    }
+
+    sink = x;
+}
+
+static void batch_job(void* arg) {
+    while (!stop) {
+        work(1);
+        sched_preemptPoint();
+    }
+}
+
+typedef struct Waiter {
+    Process* process;
+    double   woken; // When the driver last woke it.
+    double*  latencies;
+    size_t   count;
+    size_t   capacity;
+    size_t   missed; // Wakeups due while it was still busy with the last.
+} Waiter;
+
+static void interactive_job(void* arg) {
+    Waiter* waiter = arg;
+
+    for (;;) {
+        sched_block();
+        if (stop) return;
+
+        if (waiter->count < waiter->capacity) {
+            waiter->latencies[waiter->count++] = now() - waiter->woken;
+        }
+
+        work(50);
+    }
+}
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Weights the fair policy gives nice values, relative to nice 0.
+static double nice_weight(SchedPolicy policy, int nice) {
+    if (policy != SCHED_POLICY_FAIR) return 1;
+
+    double weight = 1;
+    for (int i = 0; i < nice; i++) weight /= 1.25;
+    for (int i = 0; i > nice; i--) weight *= 1.25;
+    return weight;
+}
+
+static void run(SchedPolicy policy, BOOL first) {
+    ProcessTable* table = process_tableNew(batch + interactive + 1);
+
+    // The driver plays the shell's part.
+    process_switch(table, process_spawn(table, "driver", 0));
+    sched_init(table, policy, quantum, 4);
+    sched_startCpus(cpus);
+    stop = FALSE;
+
+    Process* batches[batch];
+    Waiter   waiters[interactive + 1];
+    double   next[interactive + 1];
+
+    for (int i = 0; i < batch; i++) {
+        batches[i] = sched_spawn("batch", batch_job, 0);
+        if (i == 0) sched_setPriority(batches[i]->pid, first_nice);
+    }
+
+    size_t expected = (size_t)(seconds / period) + 2;
+
+    for (int i = 0; i < interactive; i++) {
+        waiters[i]           = (Waiter) {0};
+        waiters[i].capacity  = expected;
+        waiters[i].latencies = xmalloc(sizeof(double) * expected);
+        waiters[i].process   = sched_spawn("interactive", interactive_job, &waiters[i]);
+    }
+
+    // Every job runs up to its first wait or preemption point.
+    double start = now();
+
+    for (int i = 0; i < interactive; i++) {
+        next[i] = start + period * (i + 1) / interactive;
+    }
+
+    while (now() - start < seconds) {
+        double t = now();
+
+        for (int i = 0; i < interactive; i++) {
+            if (t < next[i]) continue;
+
+            if (waiters[i].process->state == PROCESS_BLOCKED) {
+                waiters[i].woken = t;
+                sched_wake(waiters[i].process);
+            } else {
+                waiters[i].missed++;
+            }
+
+            while (next[i] <= t) next[i] += period;
+        }
+
+        if (!sched_cpus()) {
+            sched_runNext();
+            continue;
+        }
+
+        // The CPU threads need the lock to get on, so the driver sleeps
+        // until the next wakeup is due.
+        double due = start + seconds;
+
+        for (int i = 0; i < interactive; i++) {
+            if (next[i] < due) due = next[i];
+        }
+
+        double          wait = due - now();
+        struct timespec ts   = {(time_t)wait, (long)((wait - (time_t)wait) * 1e9)};
+
+        sched_unlock();
+        if (wait > 0) nanosleep(&ts, 0);
+        sched_lock();
+    }
+
+    double elapsed = now() - start;
+
+    // Fairness among the batch jobs, by CPU time per unit of weight.
+    double sum = 0, sum_squares = 0, batch_ms = 0;
+
+    for (int i = 0; i < batch; i++) {
+        double share = batches[i]->cpu_ns / nice_weight(policy, batches[i]->priority);
+
+        sum         += share;
+        sum_squares += share * share;
+        batch_ms    += batches[i]->cpu_ns / 1e6;
+    }
+
+    double fairness = sum_squares > 0 ? sum * sum / (batch * sum_squares) : 1;
+
+    // Interactive latencies, all jobs together.
+    size_t  count     = 0;
+    size_t  missed    = 0;
+    double  active_ms = 0;
+    double* latencies = xmalloc(sizeof(double) * (expected * (size_t)interactive + 1));
+
+    for (int i = 0; i < interactive; i++) {
+        memcpy(latencies + count, waiters[i].latencies, sizeof(double) * waiters[i].count);
+        count     += waiters[i].count;
+        missed    += waiters[i].missed;
+        active_ms += waiters[i].process->cpu_ns / 1e6;
+    }
+
+    qsort(latencies, count, sizeof(double), compare_double);
+
+#define PERCENTILE(p) (count ? latencies[(size_t)((count - 1) * (p))] * 1e6 : 0)
+
+    printf("%s\n    {\"policy\": \"%s\", \"seconds\": %.3f, \"quantum_ms\": %d, \"cpus\": %d, "
+           "\"batch\": {\"jobs\": %d, \"cpu_ms\": %.1f, \"fairness\": %.4f}, "
+           "\"interactive\": {\"jobs\": %d, \"cpu_ms\": %.1f, \"wakeups\": %zu, \"missed\": %zu, "
+           "\"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f}",
+           first ? "" : ",",
+           policy == SCHED_POLICY_FAIR ? "fair" : "round-robin",
+           elapsed,
+           quantum,
+           cpus,
+           batch,
+           batch_ms,
+           fairness,
+           interactive,
+           active_ms,
+           count,
+           missed,
+           PERCENTILE(0.5),
+           PERCENTILE(0.99),
+           PERCENTILE(1.0));
+
+#undef PERCENTILE
+
+    if (sched_cpus()) {
+        SchedCpuStats stats;
+
+        printf(", \"per_cpu\": [");
+
+        for (int i = 0; sched_cpuStats(i, &stats); i++) {
+            printf("%s{\"core\": %d, \"util\": %.3f, \"turns\": %llu, \"migrations\": %llu}",
+                   i ? ", " : "",
+                   stats.core,
+                   stats.elapsed_ns ? (double)stats.busy_ns / stats.elapsed_ns : 0,
+                   (unsigned long long)stats.turns,
+                   (unsigned long long)stats.migrations);
+        }
+
+        printf("]");
+    }
+
+    printf("}");
+
+    // Let every job finish, so the next run starts from nothing.
+    stop = TRUE;
+
+    for (int i = 0; i < interactive; i++) {
+        sched_wake(waiters[i].process);
+    }
+
+    while (sched_runNext()) {}
+
+    for (int i = 0; i < interactive; i++) {
+        xfree(waiters[i].latencies);
+    }
+
+    xfree(latencies);
+    sched_stopCpus();
+    process_tableFree(table);
+}
+
+int main(int argc, char** argv) {
+    const char* policy = "both";
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--policy") == 0 && i + 1 < argc) {
+            policy = argv[++i];
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--quantum") == 0 && i + 1 < argc) {
+            quantum = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--interactive") == 0 && i + 1 < argc) {
+            interactive = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--period") == 0 && i + 1 < argc) {
+            period = atof(argv[++i]) / 1000;
+        } else if (strcmp(argv[i], "--nice") == 0 && i + 1 < argc) {
+            first_nice = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--cpus") == 0 && i + 1 < argc) {
+            cpus = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--policy round-robin|fair|both] [--seconds N] [--quantum MS] "
+                            "[--batch N] [--interactive N] [--period MS] [--nice N] [--cpus N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (batch < 1 || interactive < 0 || period <= 0) {
+        fprintf(stderr, "Need at least one batch job, and a positive period\n");
+        return 1;
+    }
+
+    printf("{\n  \"sched\": [");
+
+    BOOL first = TRUE;
+
+    if (strcmp(policy, "fair") != 0) {
+        run(SCHED_POLICY_ROUND_ROBIN, first);
+        first = FALSE;
+    }
+
+    if (strcmp(policy, "round-robin") != 0) {
+        run(SCHED_POLICY_FAIR, first);
+    }
+
+    printf("\n  ]\n}\n");
+    return 0;
+}
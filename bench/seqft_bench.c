@@ -0,0 +1,681 @@
+// Benchmarks for seqft and the calculator. Run with "make bench".
+//
+//   seqft_bench [--seed N] [--min-time SECONDS] [--filter SUBSTRING]
+//               [--allocator libc|cached] [--stress THREADS] [--gradients]
+//
+// Every benchmark is run for at least --min-time seconds, and the results are
+// printed as JSON: nanoseconds and operations per second, plus the number of
+// heap allocations and bytes per operation, counted by wrapping malloc (see
+// the bench target in the Makefile).
+//
+// --stress runs a correctness check instead: THREADS threads evaluate the same
+// corpus through the reentrant API (sft.h), each with its own context, and
+// every result and error message must match a single threaded run.
+//
+// --gradients checks SftProgram_evalDual instead: every function in FN_LOOKUP
+// is called with one to four variables at random points, and again with the
+// first repeated at the end, and each partial derivative must agree with a
+// central finite difference.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "../lib/seqft/alloc.h"
+#include "../lib/seqft/compiler.h"
+#include "../lib/seqft/evaluator.h"
+#include "../lib/seqft/sft.h"
+#include "../lib/seqft/stack.h"
+#include "../lib/seqft/tokenizer.h"
+#include "../src/coroutine.h"
+#include "../src/programs/calculator.h"
+
+// Allocation counting
+// ----------------------------------------------------------------------------
+
+static size_t alloc_count;
+static size_t alloc_bytes;
+
+extern void* __real_malloc(size_t size);
+extern void* __real_calloc(size_t n, size_t size);
+extern void* __real_realloc(void* ptr, size_t size);
+
+// Atomic so that the stress threads can allocate too.
+#define COUNT_ALLOC(size)                                          \
+    do {                                                           \
+        __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);     \
+        __atomic_fetch_add(&alloc_bytes, (size), __ATOMIC_RELAXED); \
+    } while (0)
+
+void* __wrap_malloc(size_t size) {
+    COUNT_ALLOC(size);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size) {
+    COUNT_ALLOC(n * size);
+    return __real_calloc(n, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    COUNT_ALLOC(size);
+    return __real_realloc(ptr, size);
+}
+
+// Corpus
+// ----------------------------------------------------------------------------
+
+static uint64_t rng_state;
+
+static uint64_t rng_next() {
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+static size_t rng_below(size_t n) {
+    return (size_t)(rng_next() % n);
+}
+
+typedef enum {
+    SHAPE_DEEP, // ((((1+2)*3)-4)...), nested as deep as there are terms.
+    SHAPE_WIDE, // 1+2*3-4..., one long flat run of binary operators.
+    SHAPE_FUNC, // Nested calls of the built-in functions.
+    SHAPE_HEX,  // Like wide, but every number is hexadecimal.
+} Shape;
+
+static const char* shape_names[] = {"deep", "wide", "func", "hex"};
+
+typedef struct Text {
+    char*  data;
+    size_t len;
+    size_t cap;
+} Text;
+
+static void text_append(Text* t, const char* s) {
+    size_t n = strlen(s);
+
+    if (t->len + n + 1 > t->cap) {
+        while (t->len + n + 1 > t->cap) t->cap = t->cap ? t->cap * 2 : 256;
+        t->data = xrealloc(t->data, t->cap);
+    }
+
+    memcpy(t->data + t->len, s, n + 1);
+    t->len += n;
+}
+
+static void text_number(Text* t, BOOL hex) {
+    char number[32];
+    sprintf(number, hex ? "0x%zx" : "%zu", rng_below(hex ? 0xffff : 999) + 1);
+    text_append(t, number);
+}
+
+static const char* random_operator() {
+    static const char* ops[] = {"+", "-", "*", "/"};
+    return ops[rng_below(4)];
+}
+
+static void generate_func(Text* t, size_t terms) {
+    static const char* variadic[] = {"sum", "min", "max", "mean", "hypot"};
+
+    if (terms <= 1) {
+        text_number(t, FALSE);
+        return;
+    }
+
+    if (terms == 2 || rng_below(4) == 0) {
+        text_append(t, rng_below(2) ? "round(" : "ceil(");
+        generate_func(t, terms - 1);
+        text_append(t, "/3)");
+        return;
+    }
+
+    size_t args = 2 + rng_below(terms < 5 ? terms - 1 : 4);
+    if (args > terms) args = terms;
+
+    text_append(t, variadic[rng_below(5)]);
+    text_append(t, "(");
+
+    for (size_t i = 0; i < args; i++) {
+        if (i) text_append(t, ",");
+        generate_func(t, i + 1 == args ? terms - (args - 1) : 1);
+    }
+
+    text_append(t, ")");
+}
+
+// Generates an expression of the given shape with about terms numbers in it.
+// Caller responsible for freeing the returned string.
+static char* generate(Shape shape, size_t terms) {
+    Text t = {0};
+    text_append(&t, "");
+
+    switch (shape) {
+        case SHAPE_DEEP:
+            for (size_t i = 1; i < terms; i++) text_append(&t, "(");
+            text_number(&t, FALSE);
+
+            for (size_t i = 1; i < terms; i++) {
+                text_append(&t, random_operator());
+                text_number(&t, FALSE);
+                text_append(&t, ")");
+            }
+            break;
+
+        case SHAPE_WIDE:
+        case SHAPE_HEX:
+            for (size_t i = 0; i < terms; i++) {
+                if (i) text_append(&t, random_operator());
+                text_number(&t, shape == SHAPE_HEX);
+            }
+            break;
+
+        case SHAPE_FUNC:
+            generate_func(&t, terms);
+            break;
+    }
+
+    return t.data;
+}
+
+// Harness
+// ----------------------------------------------------------------------------
+
+typedef void (*BenchFn)(void* state, size_t iterations);
+
+static double      min_time = 0.25;
+static const char* filter   = 0;
+static BOOL        first    = TRUE;
+static FILE*       report;
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run_bench(const char* name, BenchFn fn, void* state) {
+    if (filter && !strstr(name, filter)) return;
+
+    // Grow the iteration count until one run takes long enough to measure.
+    size_t iterations = 1;
+    double elapsed    = 0;
+    size_t allocs     = 0;
+    size_t bytes      = 0;
+
+    for (;;) {
+        size_t count_before = alloc_count;
+        size_t bytes_before = alloc_bytes;
+        double start        = now();
+
+        fn(state, iterations);
+
+        elapsed = now() - start;
+        allocs  = alloc_count - count_before;
+        bytes   = alloc_bytes - bytes_before;
+
+        if (elapsed >= min_time || iterations >= ((size_t)1 << 40)) break;
+
+        double scale = elapsed > 0 ? min_time * 1.2 / elapsed : 100;
+        if (scale > 100) scale = 100;
+        if (scale < 2) scale = 2;
+
+        iterations = (size_t)(iterations * scale);
+    }
+
+    double ns = elapsed * 1e9 / iterations;
+
+    fprintf(report, "%s\n    {\"name\": \"%s\", \"iterations\": %zu, \"ns_per_op\": %.1f, "
+           "\"ops_per_sec\": %.1f, \"allocs_per_op\": %.2f, \"bytes_per_op\": %.1f}",
+           first ? "" : ",",
+           name,
+           iterations,
+           ns,
+           iterations / elapsed,
+           (double)allocs / iterations,
+           (double)bytes / iterations);
+
+    first = FALSE;
+    fflush(report);
+}
+
+// Benchmarks
+// ----------------------------------------------------------------------------
+
+typedef struct ExprState {
+    char*       expr;
+    size_t      len;
+    Tokenizer*  tokenizer;
+    Sft*        sft;
+    TokenArray* tokens;
+} ExprState;
+
+static void bench_tokenize(void* state, size_t iterations) {
+    ExprState* s = state;
+
+    for (size_t i = 0; i < iterations; i++) {
+        TokenArray_free(Tokenizer_parse(s->tokenizer, s->expr, s->len));
+    }
+}
+
+static void bench_eval(void* state, size_t iterations) {
+    ExprState* s = state;
+    double     result;
+
+    for (size_t i = 0; i < iterations; i++) {
+        Stack_clear(s->sft->operator_stack);
+        Stack_clear(s->sft->number_stack);
+        Sft_evalTokens(s->sft, s->tokens, &result);
+    }
+}
+
+static void bench_calculate(void* state, size_t iterations) {
+    ExprState* s = state;
+
+    for (size_t i = 0; i < iterations; i++) {
+        calculate(s->expr);
+    }
+
+    fflush(stdout);
+}
+
+static void bench_stack_push_pop(void* state, size_t iterations) {
+    Stack* s = state;
+
+    for (size_t i = 0; i < iterations; i++) {
+        double value = (double)i;
+        Stack_pushFrom(s, &value);
+        xfree(Stack_pop(s));
+    }
+}
+
+static void bench_stack_push_drop(void* state, size_t iterations) {
+    Stack* s = state;
+
+    for (size_t i = 0; i < iterations; i++) {
+        double value = (double)i;
+        Stack_pushFrom(s, &value);
+        Stack_drop(s, 1);
+    }
+}
+
+static void bench_stack_push_grow(void* state, size_t iterations) {
+    (void)state;
+
+    // One op is a push onto a stack that starts empty and grows to 1024 items.
+    for (size_t i = 0; i < iterations; i += 1024) {
+        Stack* s = Stack_withCapacity(sizeof(double), 1);
+
+        for (size_t j = 0; j < 1024; j++) {
+            double value = (double)j;
+            Stack_pushFrom(s, &value);
+        }
+
+        Stack_free(s);
+    }
+}
+
+static void yield_forever(void* arg) {
+    (void)arg;
+
+    for (;;) {
+        coroutine_yield();
+    }
+}
+
+static void bench_coroutine_switch(void* state, size_t iterations) {
+    Coroutine* coroutine = state;
+
+    // One op is a resume and the yield back, so two switches.
+    for (size_t i = 0; i < iterations; i++) {
+        coroutine_resume(coroutine);
+    }
+}
+
+static void count_call(void* arg) {
+    *(size_t*)arg += 1;
+}
+
+static void bench_coroutine_spawn(void* state, size_t iterations) {
+    size_t calls = 0;
+
+    // One op is a coroutine made, run to the end and freed.
+    for (size_t i = 0; i < iterations; i++) {
+        Coroutine* coroutine = coroutine_new(count_call, &calls);
+        coroutine_resume(coroutine);
+        coroutine_free(coroutine);
+    }
+}
+
+// Reentrancy stress check
+// ----------------------------------------------------------------------------
+
+#define STRESS_CORPUS 2000
+#define STRESS_ROUNDS 20
+
+typedef struct StressShared {
+    char**     corpus;
+    SftResult* expected;
+    size_t     mismatches;
+} StressShared;
+
+typedef struct StressThread {
+    StressShared* shared;
+    size_t        offset;
+    size_t        mismatches;
+    pthread_t     thread;
+} StressThread;
+
+static BOOL same_result(const SftResult* a, const SftResult* b) {
+    if (a->ok != b->ok) return FALSE;
+
+    if (!a->ok) {
+        return a->error_index == b->error_index &&
+               strcmp(a->error.message, b->error.message) == 0;
+    }
+
+    return memcmp(&a->value, &b->value, sizeof(double)) == 0 ||
+           (a->value != a->value && b->value != b->value);
+}
+
+static void* stress_thread(void* arg) {
+    StressThread* t       = arg;
+    SftContext*   context = SftContext_new();
+
+    // Each thread walks the corpus from a different place, so that threads
+    // are on different expressions at any moment.
+    for (size_t round = 0; round < STRESS_ROUNDS; round++) {
+        for (size_t i = 0; i < STRESS_CORPUS; i++) {
+            size_t    index = (i + t->offset) % STRESS_CORPUS;
+            char*     expr  = t->shared->corpus[index];
+            SftResult result;
+
+            Sft_eval(context, expr, strlen(expr), &result);
+            t->mismatches += !same_result(&result, &t->shared->expected[index]);
+        }
+    }
+
+    SftContext_free(context);
+    return 0;
+}
+
+static int run_stress(size_t threads) {
+    StressShared shared = {0};
+
+    shared.corpus   = xmalloc(sizeof(char*) * STRESS_CORPUS);
+    shared.expected = xmalloc(sizeof(SftResult) * STRESS_CORPUS);
+
+    // A mix of every shape, with some expressions broken on purpose so that
+    // the error paths race too.
+    SftContext* context = SftContext_new();
+
+    for (size_t i = 0; i < STRESS_CORPUS; i++) {
+        char* expr = generate(i % 4, 1 + rng_below(64));
+
+        if (i % 7 == 0) {
+            size_t len = strlen(expr);
+            expr       = xrealloc(expr, len + 2);
+
+            expr[len]     = "+)(,"[rng_below(4)];
+            expr[len + 1] = 0;
+        }
+
+        shared.corpus[i] = expr;
+        Sft_eval(context, expr, strlen(expr), &shared.expected[i]);
+    }
+
+    SftContext_free(context);
+
+    StressThread workers[threads];
+    double       start = now();
+
+    for (size_t i = 0; i < threads; i++) {
+        workers[i] = (StressThread) {.shared = &shared, .offset = i * STRESS_CORPUS / threads};
+        pthread_create(&workers[i].thread, 0, stress_thread, &workers[i]);
+    }
+
+    for (size_t i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, 0);
+        shared.mismatches += workers[i].mismatches;
+    }
+
+    double elapsed     = now() - start;
+    size_t evaluations = threads * STRESS_ROUNDS * STRESS_CORPUS;
+
+    fprintf(report,
+            "{\n  \"stress\": {\"threads\": %zu, \"expressions\": %d, \"evaluations\": %zu, "
+            "\"mismatches\": %zu, \"seconds\": %.3f, \"evals_per_sec\": %.1f}\n}\n",
+            threads,
+            STRESS_CORPUS,
+            evaluations,
+            shared.mismatches,
+            elapsed,
+            evaluations / elapsed);
+
+    for (size_t i = 0; i < STRESS_CORPUS; i++) {
+        xfree(shared.corpus[i]);
+    }
+
+    xfree(shared.corpus);
+    xfree(shared.expected);
+
+    return shared.mismatches ? 1 : 0;
+}
+
+// Gradient check
+// ----------------------------------------------------------------------------
+
+#define GRADIENT_POINTS 100
+#define GRADIENT_MAX_ARGS 4
+
+// A point for one argument: a whole number from -8 to 7 plus a fraction from
+// 0.1 to 0.4, which keeps finite differences clear of the jumps in round
+// (at .5) and ceil (at whole numbers). Every argument gets a different whole
+// number, so min and max never tie.
+static void gradient_point(double* vars, size_t argc) {
+    size_t whole[16];
+
+    for (size_t i = 0; i < 16; i++) whole[i] = i;
+
+    for (size_t i = 0; i < argc; i++) {
+        size_t pick = i + rng_below(16 - i);
+        size_t w    = whole[pick];
+
+        whole[pick] = whole[i];
+        vars[i]     = (double)w - 8 + 0.1 + 0.3 * (rng_next() >> 11) / 9007199254740992.0;
+    }
+}
+
+static void check_gradients(const Function* f, size_t argc, size_t args, size_t* checks, size_t* mismatches) {
+    static const char* names[GRADIENT_MAX_ARGS] = {"a", "b", "c", "d"};
+
+    char     expr[64];
+    SftError error;
+
+    sprintf(expr, "%s(", f->name);
+
+    for (size_t i = 0; i < args; i++) {
+        strcat(expr, names[i < argc ? i : 0]);
+        strcat(expr, i + 1 < args ? "," : ")");
+    }
+
+    Tokenizer*  t       = Tokenizer_new();
+    TokenArray* tokens  = Tokenizer_parse(t, expr, strlen(expr));
+    SftProgram* program = tokens && !t->error ? SftProgram_compile(tokens, &error) : 0;
+
+    TokenArray_free(tokens);
+    Tokenizer_free(t);
+
+    if (!program || program->var_count != argc) {
+        fprintf(stderr, "Couldn't compile %s\n", expr);
+        (*mismatches)++;
+        SftProgram_free(program);
+        return;
+    }
+
+    for (size_t point = 0; point < GRADIENT_POINTS; point++) {
+        double vars[GRADIENT_MAX_ARGS];
+        double value;
+        double grad[GRADIENT_MAX_ARGS];
+
+        gradient_point(vars, argc);
+        SftProgram_evalDual(program, vars, &value, grad);
+
+        // dot of an odd number of arguments is NaN everywhere.
+        if (value != value) break;
+
+        for (size_t i = 0; i < argc; i++) {
+            double x = vars[i];
+            double h = 1e-6;
+
+            vars[i]     = x + h;
+            double high = SftProgram_eval(program, vars);
+            vars[i]     = x - h;
+            double low  = SftProgram_eval(program, vars);
+            vars[i]     = x;
+
+            double expected  = (high - low) / (2 * h);
+            double tolerance = 1e-5 * (fabs(expected) > 1 ? fabs(expected) : 1);
+
+            (*checks)++;
+
+            if (!(fabs(grad[i] - expected) <= tolerance)) {
+                fprintf(stderr, "%s: d/d%s is %g, finite difference %g\n", expr, names[i], grad[i], expected);
+                (*mismatches)++;
+            }
+        }
+    }
+
+    SftProgram_free(program);
+}
+
+static int run_gradients() {
+    size_t checks     = 0;
+    size_t mismatches = 0;
+
+    for (size_t fn = 0; fn < FN_LOOKUP_COUNT; fn++) {
+        const Function* f = &FN_LOOKUP[fn];
+
+        for (size_t argc = f->min_args ? f->min_args : 1; argc <= GRADIENT_MAX_ARGS && argc <= f->max_args; argc++) {
+            // Once with every variable, once more with a repeated at the end,
+            // so that min and max see a tie.
+            for (size_t args = argc; args <= argc + 1 && args <= f->max_args; args++) {
+                check_gradients(f, argc, args, &checks, &mismatches);
+            }
+        }
+    }
+
+    fprintf(report,
+            "{\n  \"gradients\": {\"functions\": %zu, \"checks\": %zu, \"mismatches\": %zu}\n}\n",
+            FN_LOOKUP_COUNT,
+            checks,
+            mismatches);
+
+    return mismatches ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+    uint64_t    seed      = 42;
+    const char* allocator = "libc";
+    size_t      stress    = 0;
+    BOOL        gradients = FALSE;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], 0, 10);
+        } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+            min_time = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--stress") == 0 && i + 1 < argc) {
+            stress = strtoul(argv[++i], 0, 10);
+        } else if (strcmp(argv[i], "--gradients") == 0) {
+            gradients = TRUE;
+        } else if (strcmp(argv[i], "--allocator") == 0 && i + 1 < argc) {
+            allocator = argv[++i];
+            alloc_set(strcmp(allocator, "cached") == 0 ? &ALLOCATOR_CACHED : &ALLOCATOR_LIBC);
+        } else {
+            fprintf(stderr, "Usage: %s [--seed N] [--min-time SECONDS] [--filter SUBSTRING] [--allocator libc|cached] [--stress THREADS] [--gradients]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    rng_state = seed ? seed : 1;
+
+    // calculate() prints every result. The report goes to a duplicate of
+    // stdout, and stdout itself to /dev/null.
+    report = fdopen(dup(STDOUT_FILENO), "w");
+    dup2(open("/dev/null", O_WRONLY), STDOUT_FILENO);
+
+    if (stress) {
+        int status = run_stress(stress);
+        fclose(report);
+        return status;
+    }
+
+    if (gradients) {
+        int status = run_gradients();
+        fclose(report);
+        return status;
+    }
+
+    fprintf(report, "{\n  \"seed\": %llu,\n  \"min_time\": %g,\n  \"allocator\": \"%s\",\n  \"benchmarks\": [",
+           (unsigned long long)seed, min_time, allocator);
+
+    static const size_t sizes[] = {16, 256, 4096};
+
+    for (size_t shape = SHAPE_DEEP; shape <= SHAPE_HEX; shape++) {
+        for (size_t size = 0; size < sizeof(sizes) / sizeof(sizes[0]); size++) {
+            ExprState s = {0};
+            char      name[128];
+
+            s.expr      = generate(shape, sizes[size]);
+            s.len       = strlen(s.expr);
+            s.tokenizer = Tokenizer_new();
+            s.sft       = Sft_new();
+            s.tokens    = Tokenizer_parse(s.tokenizer, s.expr, s.len);
+
+            if (s.tokenizer->error || !s.tokens) {
+                fprintf(stderr, "Generated an invalid expression: %s\n", s.tokenizer->error->message);
+                return 1;
+            }
+
+            sprintf(name, "tokenize/%s/%zu", shape_names[shape], sizes[size]);
+            run_bench(name, bench_tokenize, &s);
+
+            sprintf(name, "eval/%s/%zu", shape_names[shape], sizes[size]);
+            run_bench(name, bench_eval, &s);
+
+            sprintf(name, "calculate/%s/%zu", shape_names[shape], sizes[size]);
+            run_bench(name, bench_calculate, &s);
+
+            TokenArray_free(s.tokens);
+            Tokenizer_free(s.tokenizer);
+            Sft_free(s.sft);
+            xfree(s.expr);
+        }
+    }
+
+    Stack* stack = Stack_withCapacity(sizeof(double), 16);
+    run_bench("stack/push_pop", bench_stack_push_pop, stack);
+    run_bench("stack/push_drop", bench_stack_push_drop, stack);
+    run_bench("stack/push_grow", bench_stack_push_grow, 0);
+    Stack_free(stack);
+
+    Coroutine* coroutine = coroutine_new(yield_forever, 0);
+    run_bench("coroutine/switch", bench_coroutine_switch, coroutine);
+    run_bench("coroutine/spawn", bench_coroutine_spawn, 0);
+    coroutine_free(coroutine);
+
+    fprintf(report, "\n  ]\n}\n");
+    fclose(report);
+    return 0;
+}
@@ -0,0 +1,402 @@
+// Load generator for the evaluation server. Run with "make loadgen".
+//
+//   seqft_loadgen [--socket PATH] [--connections N] [--depth N]
+//                 [--requests N] [--seed N]
+//                 [--transport socket|ring] [--ring NAME] [--compiled]
+//
+// Each connection runs on its own thread and keeps up to --depth requests in
+// flight, topping the pipeline up after every read. The latency of a request
+// is the time from writing it to reading its response. Every response is
+// checked against evaluating the same expression locally, and the results are
+// printed as JSON: throughput, latency percentiles and mismatches.
+//
+// With --transport ring the requests go through the server's shared memory
+// rings instead of the socket, one channel per connection. --compiled then
+// has every connection compile one program up front and send only its id and
+// arguments.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../lib/seqft/alloc.h"
+#include "../lib/seqft/sft.h"
+#include "../src/programs/server.h"
+
+#define LOADGEN_CORPUS 4096
+
+// The program --compiled runs, and the same thing in C to check it.
+#define LOADGEN_PROGRAM "x*y+z/2"
+#define LOADGEN_PROGRAM_C(x, y, z) ((x) * (y) + (z) / 2)
+
+static const char* socket_path = SERVER_DEFAULT_PATH;
+static size_t      connections = 4;
+static size_t      depth       = 16;
+static size_t      requests    = 200000;
+static const char* ring_name   = RING_DEFAULT_NAME;
+static BOOL        use_ring    = FALSE;
+static BOOL        compiled    = FALSE;
+
+static uint64_t rng_state = 1;
+
+static uint64_t rng_next() {
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+// Expressions, and the response the server should send for each.
+static char*  corpus[LOADGEN_CORPUS];
+static char   expected[LOADGEN_CORPUS][32];
+static size_t expected_len[LOADGEN_CORPUS];
+static double expected_value[LOADGEN_CORPUS];
+
+static void make_corpus() {
+    static const char* ops   = "+-*/";
+    static const char* funcs[] = {"sum", "min", "max", "mean"};
+
+    SftContext* context = SftContext_new();
+
+    for (size_t i = 0; i < LOADGEN_CORPUS; i++) {
+        size_t terms = 1 + rng_next() % 32;
+        char*  expr  = xmalloc(terms * 16 + 16);
+        size_t len   = 0;
+        BOOL   func  = rng_next() % 4 == 0;
+
+        if (func) len += sprintf(expr + len, "%s(", funcs[rng_next() % 4]);
+
+        for (size_t t = 0; t < terms; t++) {
+            if (t) expr[len++] = func ? ',' : ops[rng_next() % 4];
+            len += sprintf(expr + len, "%u", (unsigned)(rng_next() % 999) + 1);
+        }
+
+        if (func) expr[len++] = ')';
+        expr[len] = 0;
+
+        SftResult result;
+        Sft_eval(context, expr, len, &result);
+
+        corpus[i]         = expr;
+        expected_value[i] = result.value;
+        expected_len[i] = (size_t)snprintf(expected[i], sizeof(expected[i]), "%.17g\n", result.value);
+    }
+
+    SftContext_free(context);
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef struct Client {
+    pthread_t thread;
+    size_t    requests; // How many to send.
+    size_t    first;    // Corpus index of the first request.
+
+    double* latencies; // Seconds, one per request.
+    size_t  mismatches;
+    BOOL    failed;
+} Client;
+
+static BOOL write_all(int fd, const char* data, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, data, len);
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return FALSE;
+        }
+
+        data += n;
+        len -= (size_t)n;
+    }
+
+    return TRUE;
+}
+
+static void* client_run(void* arg) {
+    Client* c = arg;
+
+    int                fd   = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "Can't connect to %s: %s\n", socket_path, strerror(errno));
+        c->failed = TRUE;
+        close(fd);
+        return 0;
+    }
+
+    // Send times of the requests in flight, in order; responses come back in
+    // the order the requests were sent.
+    double* sent       = xmalloc(sizeof(double) * depth);
+    size_t  sent_count = 0;
+    size_t  received   = 0;
+
+    size_t send_cap = depth * 4 + 4096;
+    char*  send_buf = xmalloc(send_cap);
+
+    size_t in_cap = 64 * 1024;
+    size_t in_len = 0;
+    char*  in     = xmalloc(in_cap);
+
+    while (received < c->requests) {
+        // Top the pipeline up with one write.
+        size_t send_len = 0;
+        double t        = now();
+
+        while (sent_count - received < depth && sent_count < c->requests) {
+            const char* expr = corpus[(c->first + sent_count) % LOADGEN_CORPUS];
+            size_t      len  = strlen(expr);
+
+            if (send_len + len + 4 > send_cap) {
+                send_cap = (send_len + len + 4) * 2;
+                send_buf = xrealloc(send_buf, send_cap);
+            }
+
+            uint32_t header = htonl((uint32_t)len);
+            memcpy(send_buf + send_len, &header, 4);
+            memcpy(send_buf + send_len + 4, expr, len);
+            send_len += 4 + len;
+
+            sent[sent_count % depth] = t;
+            sent_count++;
+        }
+
+        if (send_len && !write_all(fd, send_buf, send_len)) {
+            c->failed = TRUE;
+            break;
+        }
+
+        ssize_t n = read(fd, in + in_len, in_cap - in_len);
+
+        if (n < 0 && errno == EINTR) continue;
+
+        if (n <= 0) {
+            c->failed = TRUE;
+            break;
+        }
+
+        in_len += (size_t)n;
+        t = now();
+
+        size_t at = 0;
+
+        while (in_len - at >= 4) {
+            uint32_t len;
+            memcpy(&len, in + at, 4);
+            len = ntohl(len);
+
+            if (in_len - at - 4 < len) break;
+
+            size_t index = (c->first + received) % LOADGEN_CORPUS;
+
+            if (len != expected_len[index] || memcmp(in + at + 4, expected[index], len) != 0) {
+                c->mismatches++;
+            }
+
+            c->latencies[received] = t - sent[received % depth];
+            received++;
+            at += 4 + len;
+        }
+
+        memmove(in, in + at, in_len - at);
+        in_len -= at;
+    }
+
+    xfree(in);
+    xfree(send_buf);
+    xfree(sent);
+    close(fd);
+
+    return 0;
+}
+
+static BOOL same_value(double a, double b) {
+    return memcmp(&a, &b, sizeof(double)) == 0 || (a != a && b != b);
+}
+
+static void* client_runRing(void* arg) {
+    Client*     c      = arg;
+    RingClient* client = ring_connect(ring_name);
+
+    if (!client) {
+        fprintf(stderr, "Can't connect to the rings at %s\n", ring_name);
+        c->failed = TRUE;
+        return 0;
+    }
+
+    RingCompletion done[RING_SLOTS];
+    uint32_t       program = 0;
+
+    if (compiled) {
+        ring_submitCompile(client, LOADGEN_PROGRAM, strlen(LOADGEN_PROGRAM), 0);
+
+        if (!ring_reap(client, done, 1, TRUE) || !done[0].ok || done[0].var_count != 3) {
+            fprintf(stderr, "Can't compile %s\n", LOADGEN_PROGRAM);
+            c->failed = TRUE;
+            ring_disconnect(client);
+            return 0;
+        }
+
+        program = done[0].program;
+    }
+
+    size_t  ring_depth = depth < RING_SLOTS ? depth : RING_SLOTS;
+    double* sent       = xmalloc(sizeof(double) * RING_SLOTS);
+    size_t  sent_count = 0;
+    size_t  received   = 0;
+
+    while (received < c->requests) {
+        double t = now();
+
+        while (sent_count - received < ring_depth && sent_count < c->requests) {
+            size_t index = (c->first + sent_count) % LOADGEN_CORPUS;
+
+            if (compiled) {
+                double args[3] = {(double)index, (double)(index + 1), (double)(index + 2)};
+                ring_submitRun(client, program, args, 3, sent_count);
+            } else {
+                ring_submitEval(client, corpus[index], strlen(corpus[index]), sent_count);
+            }
+
+            sent[sent_count % RING_SLOTS] = t;
+            sent_count++;
+        }
+
+        ring_flush(client);
+
+        size_t n = ring_reap(client, done, RING_SLOTS, TRUE);
+        t        = now();
+
+        for (size_t i = 0; i < n; i++, received++) {
+            size_t index = (c->first + received) % LOADGEN_CORPUS;
+            double want  = compiled ? LOADGEN_PROGRAM_C((double)index, (double)(index + 1), (double)(index + 2))
+                                    : expected_value[index];
+
+            if (done[i].tag != received || !done[i].ok || !same_value(done[i].value, want)) {
+                c->mismatches++;
+            }
+
+            c->latencies[received] = t - sent[received % RING_SLOTS];
+        }
+    }
+
+    xfree(sent);
+    ring_disconnect(client);
+
+    return 0;
+}
+
+static int compare_double(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--connections") == 0 && i + 1 < argc) {
+            connections = strtoul(argv[++i], 0, 10);
+        } else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+            depth = strtoul(argv[++i], 0, 10);
+        } else if (strcmp(argv[i], "--requests") == 0 && i + 1 < argc) {
+            requests = strtoul(argv[++i], 0, 10);
+        } else if (strcmp(argv[i], "--transport") == 0 && i + 1 < argc) {
+            use_ring = strcmp(argv[++i], "ring") == 0;
+        } else if (strcmp(argv[i], "--ring") == 0 && i + 1 < argc) {
+            ring_name = argv[++i];
+        } else if (strcmp(argv[i], "--compiled") == 0) {
+            compiled = TRUE;
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            rng_state = strtoull(argv[++i], 0, 10) | 1;
+        } else {
+            fprintf(stderr,
+                    "usage: %s [--socket PATH] [--connections N] [--depth N] [--requests N] [--seed N]\n"
+                    "          [--transport socket|ring] [--ring NAME] [--compiled]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    if (!connections) connections = 1;
+    if (!depth) depth = 1;
+
+    make_corpus();
+
+    Client* clients   = xmalloc(sizeof(Client) * connections);
+    double* latencies = xmalloc(sizeof(double) * (requests ? requests : 1));
+    size_t  offset    = 0;
+
+    double start = now();
+
+    for (size_t i = 0; i < connections; i++) {
+        size_t share = requests / connections + (i < requests % connections);
+
+        clients[i] = (Client) {
+            .requests  = share,
+            .first     = offset,
+            .latencies = latencies + offset,
+        };
+
+        offset += share;
+        pthread_create(&clients[i].thread, 0, use_ring ? client_runRing : client_run, &clients[i]);
+    }
+
+    size_t mismatches = 0;
+    BOOL   failed     = FALSE;
+
+    for (size_t i = 0; i < connections; i++) {
+        pthread_join(clients[i].thread, 0);
+        mismatches += clients[i].mismatches;
+        failed |= clients[i].failed;
+    }
+
+    double elapsed = now() - start;
+
+    if (failed) {
+        fprintf(stderr, "A connection failed before all its requests were answered\n");
+        return 1;
+    }
+
+    qsort(latencies, requests, sizeof(double), compare_double);
+
+#define PERCENTILE(p) (requests ? latencies[(size_t)((requests - 1) * (p))] * 1e6 : 0)
+
+    printf("{\n  \"loadgen\": {\"transport\": \"%s\", \"connections\": %zu, \"depth\": %zu, \"requests\": %zu, "
+           "\"seconds\": %.3f, \"requests_per_sec\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f, "
+           "\"max_us\": %.1f, \"mismatches\": %zu}\n}\n",
+           use_ring ? (compiled ? "ring-compiled" : "ring") : "socket",
+           connections,
+           depth,
+           requests,
+           elapsed,
+           requests / elapsed,
+           PERCENTILE(0.5),
+           PERCENTILE(0.99),
+           PERCENTILE(1.0),
+           mismatches);
+
+#undef PERCENTILE
+
+    for (size_t i = 0; i < LOADGEN_CORPUS; i++) xfree(corpus[i]);
+    xfree(latencies);
+    xfree(clients);
+
+    return mismatches ? 1 : 0;
+}
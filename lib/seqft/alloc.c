@@ -0,0 +1,195 @@
+#include "alloc.h"
+#include "common.h"
+
+#include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+const Allocator ALLOCATOR_LIBC = {
+    .allocate   = malloc,
+    .reallocate = realloc,
+    .deallocate = free,
+    .usable     = malloc_usable_size,
+};
+
+static const Allocator* current = &ALLOCATOR_LIBC;
+
+void alloc_set(const Allocator* allocator) {
+    current = allocator ? allocator : &ALLOCATOR_LIBC;
+}
+
+const Allocator* alloc_get() {
+    return current;
+}
+
+__thread AllocAccount* alloc_account;
+
+AllocAccount* alloc_charge(AllocAccount* account) {
+    AllocAccount* previous = alloc_account;
+    alloc_account          = account;
+    return previous;
+}
+
+size_t alloc_accountLive(const AllocAccount* account) {
+    return account->allocated > account->freed
+               ? account->allocated - account->freed
+               : 0;
+}
+
+// Size class cache
+// ----------------------------------------------------------------------------
+
+// Precedes every block, and keeps the memory after it 16 byte aligned.
+typedef struct BlockHeader {
+    size_t size_class; // ALLOC_CLASS_COUNT for blocks too large to cache.
+    size_t capacity;
+} BlockHeader;
+
+typedef struct FreeBlock {
+    struct FreeBlock* next;
+} FreeBlock;
+
+typedef struct ThreadCache {
+    FreeBlock* heads[ALLOC_CLASS_COUNT];
+    size_t     counts[ALLOC_CLASS_COUNT];
+    BOOL       registered;
+} ThreadCache;
+
+static __thread ThreadCache thread_cache;
+
+static pthread_key_t  cache_key;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+// Gives a thread's cached blocks back to the heap when it exits.
+static void cache_flush(void* arg) {
+    ThreadCache* cache = arg;
+
+    for(size_t c = 0; c < ALLOC_CLASS_COUNT; ++c) {
+        while(cache->heads[c]) {
+            FreeBlock* block = cache->heads[c];
+            cache->heads[c]  = block->next;
+            free((BlockHeader*)block - 1);
+        }
+
+        cache->counts[c] = 0;
+    }
+
+    cache->registered = FALSE;
+}
+
+static void cache_createKey() {
+    pthread_key_create(&cache_key, cache_flush);
+}
+
+static size_t size_class_of(size_t size) {
+    if(size <= ALLOC_MIN_CLASS_SIZE) {
+        return 0;
+    }
+
+    // Index of the smallest power of two >= size, counted from 16.
+    return (size_t)(64 - __builtin_clzll((unsigned long long)(size - 1))) - 4;
+}
+
+static void* cached_allocate(size_t size) {
+    size_t c = size_class_of(size);
+
+    if(c < ALLOC_CLASS_COUNT && thread_cache.heads[c]) {
+        FreeBlock* block       = thread_cache.heads[c];
+        thread_cache.heads[c]  = block->next;
+        thread_cache.counts[c] -= 1;
+        return block;
+    }
+
+    size_t capacity =
+        c < ALLOC_CLASS_COUNT ? (size_t)ALLOC_MIN_CLASS_SIZE << c : size;
+
+    BlockHeader* header = malloc(sizeof(BlockHeader) + capacity);
+
+    if(!header) {
+        return 0;
+    }
+
+    header->size_class = c < ALLOC_CLASS_COUNT ? c : ALLOC_CLASS_COUNT;
+    header->capacity   = capacity;
+
+    return header + 1;
+}
+
+static void cached_deallocate(void* memory) {
+    if(!memory) {
+        return;
+    }
+
+    BlockHeader* header = (BlockHeader*)memory - 1;
+    size_t       c      = header->size_class;
+
+    if(c == ALLOC_CLASS_COUNT || thread_cache.counts[c] == ALLOC_CACHE_BLOCKS) {
+        free(header);
+        return;
+    }
+
+    if(!thread_cache.registered) {
+        pthread_once(&cache_once, cache_createKey);
+        pthread_setspecific(cache_key, &thread_cache);
+        thread_cache.registered = TRUE;
+    }
+
+    FreeBlock* block       = memory;
+    block->next            = thread_cache.heads[c];
+    thread_cache.heads[c]  = block;
+    thread_cache.counts[c] += 1;
+}
+
+static void* cached_reallocate(void* memory, size_t size) {
+    if(!memory) {
+        return cached_allocate(size);
+    }
+
+    if(!size) {
+        cached_deallocate(memory);
+        return 0;
+    }
+
+    BlockHeader* header = (BlockHeader*)memory - 1;
+
+    // Still fits, and isn't wasting most of a large block.
+    if(size <= header->capacity &&
+       (header->size_class < ALLOC_CLASS_COUNT || size > header->capacity / 2)) {
+        return memory;
+    }
+
+    if(header->size_class == ALLOC_CLASS_COUNT &&
+       size_class_of(size) >= ALLOC_CLASS_COUNT) {
+        BlockHeader* grown = realloc(header, sizeof(BlockHeader) + size);
+
+        if(!grown) {
+            return 0;
+        }
+
+        grown->capacity = size;
+        return grown + 1;
+    }
+
+    void* moved = cached_allocate(size);
+
+    if(!moved) {
+        return 0;
+    }
+
+    memcpy(moved, memory, header->capacity < size ? header->capacity : size);
+    cached_deallocate(memory);
+
+    return moved;
+}
+
+static size_t cached_usable(void* memory) {
+    return ((BlockHeader*)memory - 1)->capacity;
+}
+
+const Allocator ALLOCATOR_CACHED = {
+    .allocate   = cached_allocate,
+    .reallocate = cached_reallocate,
+    .deallocate = cached_deallocate,
+    .usable     = cached_usable,
+};
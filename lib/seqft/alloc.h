@@ -0,0 +1,61 @@
+#ifndef _H_ALLOC_
+#define _H_ALLOC_
+
+#include <stddef.h>
+
+// The allocator behind xmalloc, xrealloc and xfree, and so behind everything
+// seqft allocates. The kernel points cJSON's hooks at xmalloc and xfree as
+// well, so one allocator serves both libraries.
+//
+// The allocator has to be chosen before anything is allocated, since memory
+// must be freed by the allocator that handed it out. For the same reason,
+// memory libc hands out itself, such as getline's or strdup's, must go back
+// through free and never reach xfree.
+
+typedef struct Allocator {
+    void* (*allocate)(size_t size);
+    void* (*reallocate)(void* memory, size_t size);
+    void  (*deallocate)(void* memory);
+
+    // Bytes actually set aside for a block, which may be more than were asked
+    // for. Used to keep AllocAccounts.
+    size_t (*usable)(void* memory);
+} Allocator;
+
+// Plain malloc, realloc and free. The default.
+extern const Allocator ALLOCATOR_LIBC;
+
+// Keeps a small cache of freed blocks per thread, in power of two size classes
+// from 16 bytes to 4 KiB, so that threads allocating and freeing small blocks
+// rarely reach the shared heap. Larger blocks go straight to malloc.
+extern const Allocator ALLOCATOR_CACHED;
+
+#define ALLOC_MIN_CLASS_SIZE 16
+#define ALLOC_CLASS_COUNT    9   // 16, 32, ... 4096 bytes.
+#define ALLOC_CACHE_BLOCKS   128 // Most blocks of a class one thread keeps.
+
+extern void             alloc_set(const Allocator* allocator);
+extern const Allocator* alloc_get();
+
+// Memory use charged to whoever owns the account, such as a process in the
+// kernel's process table. While a thread is charging an account, every block
+// it gets from xmalloc or xrealloc is added to allocated and every block it
+// gives back is added to freed, by usable size.
+typedef struct AllocAccount {
+    size_t allocated;
+    size_t freed;
+    size_t peak; // Highest allocated - freed seen.
+} AllocAccount;
+
+// The calling thread's account, or 0. Set it with alloc_charge.
+extern __thread AllocAccount* alloc_account;
+
+// Charges the calling thread's allocations to account from now on, or stops
+// charging if it's 0. Returns the account charged before.
+extern AllocAccount* alloc_charge(AllocAccount* account);
+
+// Bytes allocated through account and not yet freed through it. Memory
+// allocated before charging began and freed after doesn't count.
+extern size_t alloc_accountLive(const AllocAccount* account);
+
+#endif // _H_ALLOC_
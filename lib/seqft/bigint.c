@@ -0,0 +1,1261 @@
+#include "bigint.h"
+
+#include <stdio.h>
+
+// Magnitudes
+// ----------------------------------------------------------------------------
+// These work on raw limb arrays. Lengths passed in may include leading zero
+// limbs unless stated otherwise.
+
+static size_t mag_trim(const uint32_t* a, size_t an) {
+    while(an && !a[an - 1]) {
+        --an;
+    }
+
+    return an;
+}
+
+static int mag_cmp(const uint32_t* a, size_t an, const uint32_t* b, size_t bn) {
+    an = mag_trim(a, an);
+    bn = mag_trim(b, bn);
+
+    if(an != bn)
+        return an < bn ? -1 : 1;
+
+    for(size_t i = an; i-- > 0;) {
+        if(a[i] != b[i])
+            return a[i] < b[i] ? -1 : 1;
+    }
+
+    return 0;
+}
+
+// r = a + b, where an >= bn. r needs room for an + 1 limbs, and may alias a.
+static size_t mag_add(uint32_t*       r,
+                      const uint32_t* a,
+                      size_t          an,
+                      const uint32_t* b,
+                      size_t          bn) {
+    uint64_t carry = 0;
+    size_t   i     = 0;
+
+    for(; i < bn; ++i) {
+        carry += (uint64_t)a[i] + b[i];
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+
+    for(; i < an; ++i) {
+        carry += a[i];
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+
+    r[an] = (uint32_t)carry;
+    return mag_trim(r, an + 1);
+}
+
+// r = a - b, where a >= b. r needs room for an limbs, and may alias a.
+static size_t mag_sub(uint32_t*       r,
+                      const uint32_t* a,
+                      size_t          an,
+                      const uint32_t* b,
+                      size_t          bn) {
+    int64_t borrow = 0;
+    size_t  i      = 0;
+
+    for(; i < bn; ++i) {
+        int64_t d = (int64_t)a[i] - b[i] - borrow;
+        borrow    = d < 0;
+        r[i]      = (uint32_t)d;
+    }
+
+    for(; i < an; ++i) {
+        int64_t d = (int64_t)a[i] - borrow;
+        borrow    = d < 0;
+        r[i]      = (uint32_t)d;
+    }
+
+    return mag_trim(r, an);
+}
+
+// r += a in place, propagating the carry at most up to rn limbs.
+static void mag_addAt(uint32_t* r, size_t rn, const uint32_t* a, size_t an) {
+    uint64_t carry = 0;
+    size_t   i     = 0;
+
+    for(; i < an; ++i) {
+        carry += (uint64_t)r[i] + a[i];
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+
+    for(; carry && i < rn; ++i) {
+        carry += r[i];
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+}
+
+// r -= a in place, where r >= a.
+static void mag_subAt(uint32_t* r, size_t rn, const uint32_t* a, size_t an) {
+    int64_t borrow = 0;
+    size_t  i      = 0;
+
+    for(; i < an; ++i) {
+        int64_t d = (int64_t)r[i] - a[i] - borrow;
+        borrow    = d < 0;
+        r[i]      = (uint32_t)d;
+    }
+
+    for(; borrow && i < rn; ++i) {
+        int64_t d = (int64_t)r[i] - borrow;
+        borrow    = d < 0;
+        r[i]      = (uint32_t)d;
+    }
+}
+
+// r = r * m + add, in place over rn limbs. Returns the carry out.
+static uint32_t mag_mulSmallAdd(uint32_t* r, size_t rn, uint32_t m, uint32_t add) {
+    uint64_t carry = add;
+
+    for(size_t i = 0; i < rn; ++i) {
+        carry += (uint64_t)r[i] * m;
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+
+    return (uint32_t)carry;
+}
+
+// a /= d in place over an limbs. Returns the remainder.
+static uint32_t mag_divSmall(uint32_t* a, size_t an, uint32_t d) {
+    uint64_t rem = 0;
+
+    for(size_t i = an; i-- > 0;) {
+        uint64_t cur = (rem << 32) | a[i];
+        a[i]         = (uint32_t)(cur / d);
+        rem          = cur % d;
+    }
+
+    return (uint32_t)rem;
+}
+
+// Multiplication
+// ----------------------------------------------------------------------------
+
+static void mag_mul(uint32_t*       r,
+                    const uint32_t* a,
+                    size_t          an,
+                    const uint32_t* b,
+                    size_t          bn);
+
+// r = a * b. r is an + bn limbs, zeroed by the caller.
+static void mag_mulSchool(uint32_t*       r,
+                          const uint32_t* a,
+                          size_t          an,
+                          const uint32_t* b,
+                          size_t          bn) {
+    for(size_t i = 0; i < an; ++i) {
+        uint64_t ai    = a[i];
+        uint64_t carry = 0;
+
+        if(!ai)
+            continue;
+
+        for(size_t j = 0; j < bn; ++j) {
+            carry += ai * b[j] + r[i + j];
+            r[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+
+        r[i + bn] = (uint32_t)carry;
+    }
+}
+
+// Karatsuba, for an >= bn > an / 2. With m = an / 2, a = a1*B^m + a0 and
+// b = b1*B^m + b0, it computes a*b = z2*B^2m + z1*B^m + z0 from the three
+// products z0 = a0*b0, z2 = a1*b1 and (a0 + a1)(b0 + b1) = z0 + z1 + z2.
+static void mag_mulKaratsuba(uint32_t*       r,
+                             const uint32_t* a,
+                             size_t          an,
+                             const uint32_t* b,
+                             size_t          bn) {
+    size_t m  = an / 2;
+    size_t rn = an + bn;
+
+    // z0 and z2 go straight into their final positions in r.
+    mag_mul(r, a, m, b, m);
+    mag_mul(r + 2 * m, a + m, an - m, b + m, bn - m);
+
+    size_t    s1_cap = an - m + 1;
+    size_t    s2_cap = (bn - m > m ? bn - m : m) + 1;
+    uint32_t* s1     = xmalloc(sizeof(uint32_t) * (s1_cap + s2_cap + s1_cap + s2_cap));
+    uint32_t* s2     = s1 + s1_cap;
+    uint32_t* z1     = s2 + s2_cap;
+
+    size_t s1n = mag_add(s1, a + m, an - m, a, m);
+    size_t s2n = bn - m >= m ? mag_add(s2, b + m, bn - m, b, m)
+                             : mag_add(s2, b, m, b + m, bn - m);
+
+    size_t z1n = s1n + s2n;
+    mag_mul(z1, s1, s1n, s2, s2n);
+
+    mag_subAt(z1, z1n, r, mag_trim(r, 2 * m));
+    mag_subAt(z1, z1n, r + 2 * m, mag_trim(r + 2 * m, rn - 2 * m));
+
+    mag_addAt(r + m, rn - m, z1, mag_trim(z1, z1n));
+
+    xfree(s1);
+}
+
+// NTT over the "Goldilocks" prime p = 2^64 - 2^32 + 1. p - 1 is divisible by
+// 2^32, and with 16 bit digits every coefficient of the product stays below
+// p for any transform length that fits in memory, so one prime is enough and
+// no CRT step is needed.
+
+#define NTT_P       0xFFFFFFFF00000001ULL
+#define NTT_EPSILON 0xFFFFFFFFULL // 2^64 mod p
+#define NTT_ROOT    7             // Generates the multiplicative group.
+
+static inline uint64_t ntt_add(uint64_t a, uint64_t b) {
+    uint64_t s = a + b;
+
+    // On overflow the wrapped sum is off by 2^64, which is congruent to
+    // NTT_EPSILON; subtracting p modulo 2^64 corrects both cases.
+    if(s < a || s >= NTT_P)
+        s -= NTT_P;
+
+    return s;
+}
+
+static inline uint64_t ntt_sub(uint64_t a, uint64_t b) {
+    uint64_t d = a - b;
+
+    if(a < b)
+        d += NTT_P;
+
+    return d;
+}
+
+// Reduces a 128 bit product using 2^64 = 2^32 - 1 and 2^96 = -1 (mod p).
+static inline uint64_t ntt_mul(uint64_t a, uint64_t b) {
+    unsigned __int128 x     = (unsigned __int128)a * b;
+    uint64_t          lo    = (uint64_t)x;
+    uint64_t          hi    = (uint64_t)(x >> 64);
+    uint64_t          hi_hi = hi >> 32;
+    uint64_t          hi_lo = hi & NTT_EPSILON;
+
+    uint64_t t0 = lo - hi_hi;
+
+    if(lo < hi_hi)
+        t0 -= NTT_EPSILON;
+
+    uint64_t t1 = hi_lo * NTT_EPSILON;
+    uint64_t t2 = t0 + t1;
+
+    if(t2 < t0)
+        t2 += NTT_EPSILON;
+
+    if(t2 >= NTT_P)
+        t2 -= NTT_P;
+
+    return t2;
+}
+
+static uint64_t ntt_pow(uint64_t base, uint64_t exp) {
+    uint64_t result = 1;
+
+    while(exp) {
+        if(exp & 1)
+            result = ntt_mul(result, base);
+
+        base = ntt_mul(base, base);
+        exp >>= 1;
+    }
+
+    return result;
+}
+
+static void ntt_transform(uint64_t* a, size_t n, BOOL inverse) {
+    for(size_t i = 1, j = 0; i < n; ++i) {
+        size_t bit = n >> 1;
+
+        for(; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+
+        j ^= bit;
+
+        if(i < j) {
+            uint64_t t = a[i];
+            a[i]       = a[j];
+            a[j]       = t;
+        }
+    }
+
+    for(size_t len = 2; len <= n; len <<= 1) {
+        uint64_t w = ntt_pow(NTT_ROOT, (NTT_P - 1) / len);
+
+        if(inverse)
+            w = ntt_pow(w, NTT_P - 2);
+
+        size_t half = len / 2;
+
+        // Twiddles for this stage, so the inner loop is just a lookup.
+        uint64_t* tw = xmalloc(sizeof(uint64_t) * half);
+        tw[0]        = 1;
+
+        for(size_t k = 1; k < half; ++k) {
+            tw[k] = ntt_mul(tw[k - 1], w);
+        }
+
+        for(size_t i = 0; i < n; i += len) {
+            for(size_t k = 0; k < half; ++k) {
+                uint64_t u = a[i + k];
+                uint64_t v = ntt_mul(a[i + k + half], tw[k]);
+
+                a[i + k]        = ntt_add(u, v);
+                a[i + k + half] = ntt_sub(u, v);
+            }
+        }
+
+        xfree(tw);
+    }
+
+    if(inverse) {
+        uint64_t n_inv = ntt_pow(n % NTT_P, NTT_P - 2);
+
+        for(size_t i = 0; i < n; ++i) {
+            a[i] = ntt_mul(a[i], n_inv);
+        }
+    }
+}
+
+// r = a * b. r is an + bn limbs.
+static void mag_mulNtt(uint32_t*       r,
+                       const uint32_t* a,
+                       size_t          an,
+                       const uint32_t* b,
+                       size_t          bn) {
+    size_t digits = 2 * (an + bn);
+    size_t n      = 1;
+
+    while(n < digits) {
+        n <<= 1;
+    }
+
+    uint64_t* fa = xmalloc(sizeof(uint64_t) * n * 2);
+    uint64_t* fb = fa + n;
+
+    memset(fa, 0, sizeof(uint64_t) * n * 2);
+
+    for(size_t i = 0; i < an; ++i) {
+        fa[2 * i]     = a[i] & 0xFFFF;
+        fa[2 * i + 1] = a[i] >> 16;
+    }
+
+    for(size_t i = 0; i < bn; ++i) {
+        fb[2 * i]     = b[i] & 0xFFFF;
+        fb[2 * i + 1] = b[i] >> 16;
+    }
+
+    ntt_transform(fa, n, FALSE);
+    ntt_transform(fb, n, FALSE);
+
+    for(size_t i = 0; i < n; ++i) {
+        fa[i] = ntt_mul(fa[i], fb[i]);
+    }
+
+    ntt_transform(fa, n, TRUE);
+
+    unsigned __int128 carry = 0;
+
+    for(size_t i = 0; i < an + bn; ++i) {
+        carry += fa[2 * i];
+        uint32_t low = (uint32_t)(carry & 0xFFFF);
+        carry >>= 16;
+
+        carry += fa[2 * i + 1];
+        uint32_t high = (uint32_t)(carry & 0xFFFF);
+        carry >>= 16;
+
+        r[i] = low | (high << 16);
+    }
+
+    xfree(fa);
+}
+
+// r = a * b. r is an + bn limbs and must not overlap either operand.
+static void mag_mul(uint32_t*       r,
+                    const uint32_t* a,
+                    size_t          an,
+                    const uint32_t* b,
+                    size_t          bn) {
+    if(an < bn) {
+        const uint32_t* t  = a;
+        size_t          tn = an;
+        a = b, an = bn;
+        b = t, bn = tn;
+    }
+
+    memset(r, 0, sizeof(uint32_t) * (an + bn));
+
+    if(!bn)
+        return;
+
+    if(bn < BIGINT_KARATSUBA_THRESHOLD) {
+        mag_mulSchool(r, a, an, b, bn);
+    } else if(bn >= BIGINT_NTT_THRESHOLD) {
+        mag_mulNtt(r, a, an, b, bn);
+    } else if(2 * bn <= an) {
+        // Lopsided; multiply b by bn sized slices of a, which keeps each
+        // piece balanced enough for Karatsuba.
+        uint32_t* t = xmalloc(sizeof(uint32_t) * 2 * bn);
+
+        for(size_t off = 0; off < an; off += bn) {
+            size_t cn = an - off < bn ? an - off : bn;
+
+            mag_mul(t, a + off, cn, b, bn);
+            mag_addAt(r + off, an + bn - off, t, cn + bn);
+        }
+
+        xfree(t);
+    } else {
+        mag_mulKaratsuba(r, a, an, b, bn);
+    }
+}
+
+// Division
+// ----------------------------------------------------------------------------
+
+static int clz32(uint32_t x) {
+    return x ? __builtin_clz(x) : 32;
+}
+
+// Knuth's algorithm D (TAOCP vol. 2, 4.3.1), as laid out in Hacker's Delight.
+// q gets un - vn + 1 limbs and rem gets vn limbs; u >= v, vn >= 2, and v has
+// no leading zero limb.
+static void mag_divmod(uint32_t*       q,
+                       uint32_t*       rem,
+                       const uint32_t* u,
+                       size_t          un,
+                       const uint32_t* v,
+                       size_t          vn) {
+    const uint64_t B = (uint64_t)1 << 32;
+    int            s = clz32(v[vn - 1]);
+
+    uint32_t* vs = xmalloc(sizeof(uint32_t) * (vn + un + 1));
+    uint32_t* us = vs + vn;
+
+    // Normalize so the top bit of the divisor is set.
+    for(size_t i = vn - 1; i > 0; --i) {
+        vs[i] = (v[i] << s) | (s ? (uint32_t)((uint64_t)v[i - 1] >> (32 - s)) : 0);
+    }
+
+    vs[0] = v[0] << s;
+
+    us[un] = s ? (uint32_t)((uint64_t)u[un - 1] >> (32 - s)) : 0;
+
+    for(size_t i = un - 1; i > 0; --i) {
+        us[i] = (u[i] << s) | (s ? (uint32_t)((uint64_t)u[i - 1] >> (32 - s)) : 0);
+    }
+
+    us[0] = u[0] << s;
+
+    for(size_t j = un - vn + 1; j-- > 0;) {
+        uint64_t num  = ((uint64_t)us[j + vn] << 32) | us[j + vn - 1];
+        uint64_t qhat = num / vs[vn - 1];
+        uint64_t rhat = num % vs[vn - 1];
+
+        while(qhat >= B ||
+              qhat * vs[vn - 2] > ((rhat << 32) | us[j + vn - 2])) {
+            qhat -= 1;
+            rhat += vs[vn - 1];
+
+            if(rhat >= B)
+                break;
+        }
+
+        // Multiply and subtract.
+        int64_t k = 0;
+        int64_t t;
+
+        for(size_t i = 0; i < vn; ++i) {
+            uint64_t p = qhat * vs[i];
+            t          = (int64_t)us[i + j] - k - (int64_t)(p & 0xFFFFFFFF);
+            us[i + j]  = (uint32_t)t;
+            k          = (int64_t)(p >> 32) - (t >> 32);
+        }
+
+        t          = (int64_t)us[j + vn] - k;
+        us[j + vn] = (uint32_t)t;
+
+        // qhat was one too large; add the divisor back.
+        if(t < 0) {
+            qhat -= 1;
+            uint64_t c = 0;
+
+            for(size_t i = 0; i < vn; ++i) {
+                c += (uint64_t)us[i + j] + vs[i];
+                us[i + j] = (uint32_t)c;
+                c >>= 32;
+            }
+
+            us[j + vn] += (uint32_t)c;
+        }
+
+        q[j] = (uint32_t)qhat;
+    }
+
+    if(rem) {
+        for(size_t i = 0; i < vn; ++i) {
+            rem[i] = (us[i] >> s) |
+                     (s ? (uint32_t)((uint64_t)us[i + 1] << (32 - s)) : 0);
+        }
+    }
+
+    xfree(vs);
+}
+
+// BigInt
+// ----------------------------------------------------------------------------
+
+void BigInt_init(BigInt* n) {
+    memset(n, 0, sizeof(BigInt));
+}
+
+void BigInt_free(BigInt* n) {
+    if(n) {
+        xfree(n->limbs);
+        memset(n, 0, sizeof(BigInt));
+    }
+}
+
+static void BigInt_reserve(BigInt* n, size_t cap) {
+    if(n->cap < cap) {
+        n->limbs = xrealloc(n->limbs, sizeof(uint32_t) * cap);
+        n->cap   = cap;
+    }
+}
+
+static void BigInt_normalize(BigInt* n) {
+    n->len = mag_trim(n->limbs, n->len);
+
+    if(!n->len)
+        n->neg = FALSE;
+}
+
+// Replaces dest with src, taking ownership of its limbs.
+static void BigInt_move(BigInt* dest, BigInt* src) {
+    xfree(dest->limbs);
+    *dest = *src;
+    BigInt_init(src);
+}
+
+void BigInt_setU64(BigInt* n, uint64_t value) {
+    BigInt_reserve(n, 2);
+    n->limbs[0] = (uint32_t)value;
+    n->limbs[1] = (uint32_t)(value >> 32);
+    n->len      = 2;
+    n->neg      = FALSE;
+    BigInt_normalize(n);
+}
+
+void BigInt_copy(BigInt* dest, const BigInt* src) {
+    if(dest == src)
+        return;
+
+    BigInt_reserve(dest, src->len);
+
+    if(src->len) {
+        memcpy(dest->limbs, src->limbs, sizeof(uint32_t) * src->len);
+    }
+
+    dest->len = src->len;
+    dest->neg = src->neg;
+}
+
+static int digit_value(char c) {
+    if(c >= '0' && c <= '9')
+        return c - '0';
+    if(c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return 99;
+}
+
+BOOL BigInt_parse(BigInt* n, const char* digits, size_t len, int base) {
+    n->len = 0;
+    n->neg = FALSE;
+
+    if(base == 10) {
+        // Nine decimal digits at a time fit in a limb.
+        BigInt_reserve(n, len / 9 + 2);
+
+        for(size_t i = 0; i < len;) {
+            uint32_t chunk = 0;
+            uint32_t scale = 1;
+
+            for(size_t k = 0; k < 9 && i < len; ++k, ++i) {
+                int d = digit_value(digits[i]);
+
+                if(d >= 10)
+                    return FALSE;
+
+                chunk = chunk * 10 + d;
+                scale *= 10;
+            }
+
+            uint32_t carry = mag_mulSmallAdd(n->limbs, n->len, scale, chunk);
+
+            if(carry) {
+                n->limbs[n->len++] = carry;
+            }
+        }
+    } else {
+        int bits = base == 16 ? 4 : base == 8 ? 3 : base == 2 ? 1 : 0;
+
+        if(!bits)
+            return FALSE;
+
+        size_t limbs = (len * bits + 31) / 32 + 1;
+        BigInt_reserve(n, limbs);
+        memset(n->limbs, 0, sizeof(uint32_t) * limbs);
+
+        // Fill from the least significant digit up.
+        for(size_t i = 0; i < len; ++i) {
+            int d = digit_value(digits[len - 1 - i]);
+
+            if(d >= base)
+                return FALSE;
+
+            size_t pos = i * bits;
+            n->limbs[pos / 32] |= (uint32_t)d << (pos % 32);
+
+            if(pos % 32 + bits > 32) {
+                n->limbs[pos / 32 + 1] |= (uint32_t)d >> (32 - pos % 32);
+            }
+        }
+
+        n->len = limbs;
+    }
+
+    BigInt_normalize(n);
+    return TRUE;
+}
+
+int BigInt_cmp(const BigInt* a, const BigInt* b) {
+    if(a->neg != b->neg)
+        return a->neg ? -1 : 1;
+
+    int c = mag_cmp(a->limbs, a->len, b->limbs, b->len);
+    return a->neg ? -c : c;
+}
+
+size_t BigInt_bitLength(const BigInt* n) {
+    if(!n->len)
+        return 0;
+
+    return n->len * 32 - clz32(n->limbs[n->len - 1]);
+}
+
+// Adds (or subtracts, if b_neg differs from b's sign) magnitudes with signs.
+static void BigInt_addSigned(BigInt*       r,
+                             const BigInt* a,
+                             const BigInt* b,
+                             BOOL          b_neg) {
+    BigInt t;
+    BigInt_init(&t);
+
+    if(a->neg == b_neg) {
+        const BigInt* big   = a->len >= b->len ? a : b;
+        const BigInt* small = a->len >= b->len ? b : a;
+
+        BigInt_reserve(&t, big->len + 1);
+        t.len = mag_add(t.limbs, big->limbs, big->len, small->limbs, small->len);
+        t.neg = a->neg;
+    } else {
+        int c = mag_cmp(a->limbs, a->len, b->limbs, b->len);
+
+        const BigInt* big   = c >= 0 ? a : b;
+        const BigInt* small = c >= 0 ? b : a;
+
+        BigInt_reserve(&t, big->len + 1);
+        t.len = mag_sub(t.limbs, big->limbs, big->len, small->limbs, small->len);
+        t.neg = c >= 0 ? a->neg : b_neg;
+    }
+
+    BigInt_normalize(&t);
+    BigInt_move(r, &t);
+}
+
+void BigInt_add(BigInt* r, const BigInt* a, const BigInt* b) {
+    BigInt_addSigned(r, a, b, b->neg);
+}
+
+void BigInt_sub(BigInt* r, const BigInt* a, const BigInt* b) {
+    BigInt_addSigned(r, a, b, !b->neg);
+}
+
+void BigInt_neg(BigInt* r, const BigInt* a) {
+    BigInt_copy(r, a);
+    r->neg = r->len ? !a->neg : FALSE;
+}
+
+void BigInt_mul(BigInt* r, const BigInt* a, const BigInt* b) {
+    BigInt t;
+    BigInt_init(&t);
+
+    BigInt_reserve(&t, a->len + b->len + 1);
+    mag_mul(t.limbs, a->limbs, a->len, b->limbs, b->len);
+
+    t.len = a->len + b->len;
+    t.neg = a->neg != b->neg;
+
+    BigInt_normalize(&t);
+    BigInt_move(r, &t);
+}
+
+BOOL BigInt_divmod(BigInt* q, BigInt* rem, const BigInt* a, const BigInt* b) {
+    if(!b->len)
+        return FALSE;
+
+    BigInt tq, tr;
+    BigInt_init(&tq);
+    BigInt_init(&tr);
+
+    if(mag_cmp(a->limbs, a->len, b->limbs, b->len) < 0) {
+        BigInt_copy(&tr, a);
+    } else if(b->len == 1) {
+        BigInt_copy(&tq, a);
+        tq.neg = FALSE;
+
+        BigInt_setU64(&tr, mag_divSmall(tq.limbs, tq.len, b->limbs[0]));
+    } else {
+        BigInt_reserve(&tq, a->len - b->len + 1);
+        BigInt_reserve(&tr, b->len);
+
+        mag_divmod(tq.limbs, tr.limbs, a->limbs, a->len, b->limbs, b->len);
+
+        tq.len = a->len - b->len + 1;
+        tr.len = b->len;
+    }
+
+    tq.neg = a->neg != b->neg;
+    tr.neg = a->neg;
+
+    BigInt_normalize(&tq);
+    BigInt_normalize(&tr);
+
+    if(q) {
+        BigInt_move(q, &tq);
+    }
+
+    if(rem) {
+        BigInt_move(rem, &tr);
+    }
+
+    BigInt_free(&tq);
+    BigInt_free(&tr);
+
+    return TRUE;
+}
+
+BOOL BigInt_pow(BigInt* r, const BigInt* base, const BigInt* exp) {
+    if(exp->neg)
+        return FALSE;
+
+    size_t exp_bits  = BigInt_bitLength(exp);
+    size_t base_bits = BigInt_bitLength(base);
+
+    // 0, 1 and -1 stay small no matter the exponent.
+    BOOL trivial = base_bits <= 1;
+
+    uint64_t exp_low = exp_bits ? exp->limbs[0] : 0;
+
+    if(!trivial &&
+       (exp_bits > 32 || (uint64_t)base_bits * exp_low > BIGINT_MAX_BITS)) {
+        return FALSE;
+    }
+
+    BigInt result, square;
+    BigInt_init(&result);
+    BigInt_init(&square);
+
+    BigInt_setU64(&result, 1);
+    BigInt_copy(&square, base);
+
+    // Right to left binary exponentiation.
+    for(size_t bit = 0; bit < exp_bits; ++bit) {
+        if(exp->limbs[bit / 32] >> (bit % 32) & 1) {
+            BigInt_mul(&result, &result, &square);
+        }
+
+        if(bit + 1 < exp_bits) {
+            BigInt_mul(&square, &square, &square);
+        }
+    }
+
+    BigInt_free(&square);
+    BigInt_move(r, &result);
+
+    return TRUE;
+}
+
+// Moves n up by limbs whole limbs, multiplying it by 2^(32 limbs).
+static void BigInt_shiftUp(BigInt* n, size_t limbs) {
+    if(!n->len || !limbs)
+        return;
+
+    BigInt_reserve(n, n->len + limbs);
+    memmove(n->limbs + limbs, n->limbs, sizeof(uint32_t) * n->len);
+    memset(n->limbs, 0, sizeof(uint32_t) * limbs);
+    n->len += limbs;
+}
+
+// Drops the low limbs limbs of n, rounding its magnitude down.
+static void BigInt_shiftDown(BigInt* n, size_t limbs) {
+    if(limbs >= n->len) {
+        n->len = 0;
+    } else if(limbs) {
+        memmove(n->limbs, n->limbs + limbs, sizeof(uint32_t) * (n->len - limbs));
+        n->len -= limbs;
+    }
+
+    BigInt_normalize(n);
+}
+
+// Sets mu to floor(2^64m / p), where p has m limbs, for dividing by p with
+// BigInt_divBarrett. If root is given, p is root squared and root_mu is
+// root's mu, which squared is already right in about half of mu's limbs; one
+// Newton step then gets the rest, so this costs a few multiplications rather
+// than a long division.
+static void BigInt_reciprocal(BigInt*       mu,
+                              const BigInt* p,
+                              const BigInt* root,
+                              const BigInt* root_mu) {
+    size_t m = p->len;
+
+    BigInt power, e, t;
+    BigInt_init(&power);
+    BigInt_init(&e);
+    BigInt_init(&t);
+
+    BigInt_setU64(&power, 1);
+    BigInt_shiftUp(&power, 2 * m);
+
+    if(!root || m < 2 * BIGINT_KARATSUBA_THRESHOLD) {
+        BigInt_divmod(mu, 0, &power, p);
+    } else {
+        // root_mu^2 is about 2^128r / p, for r limbs in root.
+        BigInt_mul(mu, root_mu, root_mu);
+        BigInt_shiftDown(mu, 4 * root->len - 2 * m);
+
+        // mu += mu * (2^64m - p * mu) / 2^64m
+        BigInt_mul(&t, p, mu);
+        BigInt_sub(&e, &power, &t);
+        BigInt_mul(&t, mu, &e);
+        BigInt_shiftDown(&t, 2 * m);
+        BigInt_add(mu, mu, &t);
+
+        // That leaves mu a few units out, which a short division fixes.
+        BigInt_mul(&t, p, mu);
+        BigInt_sub(&e, &power, &t);
+        BigInt_divmod(&t, &e, &e, p);
+        BigInt_add(mu, mu, &t);
+
+        if(e.neg) {
+            BigInt_setU64(&t, 1);
+            BigInt_sub(mu, mu, &t);
+        }
+    }
+
+    BigInt_free(&power);
+    BigInt_free(&e);
+    BigInt_free(&t);
+}
+
+// Barrett reduction: q = x / p and r = x % p for 0 <= x < 2^64m, where p has
+// m limbs and mu is from BigInt_reciprocal. Two multiplications instead of a
+// long division; the estimate of q is at most two short.
+static void BigInt_divBarrett(BigInt*       q,
+                              BigInt*       r,
+                              const BigInt* x,
+                              const BigInt* p,
+                              const BigInt* mu) {
+    size_t m = p->len;
+
+    BigInt t;
+    BigInt_init(&t);
+
+    BigInt_copy(q, x);
+    BigInt_shiftDown(q, m - 1);
+    BigInt_mul(q, q, mu);
+    BigInt_shiftDown(q, m + 1);
+
+    BigInt_mul(&t, q, p);
+    BigInt_sub(r, x, &t);
+    BigInt_setU64(&t, 1);
+
+    while(BigInt_cmp(r, p) >= 0) {
+        BigInt_sub(r, r, p);
+        BigInt_add(q, q, &t);
+    }
+
+    BigInt_free(&t);
+}
+
+// Writes a in decimal so that it ends just before p, zero padded to width
+// digits, and returns where it starts. Peels off nine digits at a time from a
+// scratch copy, which is quadratic, so it's kept to small numbers.
+static char* mag_writeDecimal(const uint32_t* a, size_t an, char* p, size_t width) {
+    uint32_t* limbs = xmalloc(sizeof(uint32_t) * (an + 1));
+    char*     end   = p;
+    size_t    len   = mag_trim(a, an);
+
+    memcpy(limbs, a, sizeof(uint32_t) * len);
+
+    while(len) {
+        uint32_t chunk = mag_divSmall(limbs, len, 1000000000);
+        len            = mag_trim(limbs, len);
+
+        for(int k = 0; k < 9 && (len || chunk); ++k) {
+            *--p = '0' + chunk % 10;
+            chunk /= 10;
+        }
+    }
+
+    while((size_t)(end - p) < width) {
+        *--p = '0';
+    }
+
+    xfree(limbs);
+    return p;
+}
+
+// Like mag_writeDecimal, for 0 <= x < powers[level]^2, where powers[i] is
+// 10^(9 * 2^i) and mu[i] its reciprocal. Splits x by powers[level] and writes
+// the halves separately, so big numbers convert at the speed of multiplication.
+static char* BigInt_writeDecimal(const BigInt* x,
+                                 const BigInt* powers,
+                                 const BigInt* mu,
+                                 size_t        level,
+                                 char*         p,
+                                 size_t        width) {
+    if(!level || x->len <= BIGINT_DECIMAL_THRESHOLD)
+        return mag_writeDecimal(x->limbs, x->len, p, width);
+
+    size_t half = (size_t)9 << level;
+
+    BigInt q, r;
+    BigInt_init(&q);
+    BigInt_init(&r);
+
+    BigInt_divBarrett(&q, &r, x, &powers[level], &mu[level]);
+
+    // The low half keeps its leading zeros unless there's nothing above it.
+    p = BigInt_writeDecimal(&r, powers, mu, level - 1, p, width || q.len ? half : 0);
+    p = BigInt_writeDecimal(&q, powers, mu, level - 1, p, width > half ? width - half : 0);
+
+    BigInt_free(&q);
+    BigInt_free(&r);
+
+    return p;
+}
+
+char* BigInt_toString(const BigInt* n, int base) {
+    static const char* DIGITS = "0123456789abcdef";
+
+    const char* prefix = base == 16 ? "0x" : base == 8 ? "0o" : base == 2 ? "0b" : "";
+    size_t      plen   = strlen(prefix);
+    size_t      bits   = BigInt_bitLength(n);
+
+    if(base == 10) {
+        size_t cap = bits / 3 + 3;
+        char*  out = csrxmalloc(cap);
+        char*  end = out + cap - 1;
+        char*  p;
+
+        *end = '\0';
+
+        if(n->len <= BIGINT_DECIMAL_THRESHOLD) {
+            p = mag_writeDecimal(n->limbs, n->len, end, 0);
+        } else {
+            // 10^9, 10^18, 10^36, ... each the square of the last, up to the
+            // first whose square is bigger than n.
+            BigInt powers[64], mu[64];
+            BigInt abs   = *n;
+            size_t level = 0;
+
+            abs.neg = FALSE;
+
+            BigInt_init(&powers[0]);
+            BigInt_init(&mu[0]);
+            BigInt_setU64(&powers[0], 1000000000);
+            BigInt_reciprocal(&mu[0], &powers[0], 0, 0);
+
+            while(2 * powers[level].len - 1 <= abs.len) {
+                ++level;
+
+                BigInt_init(&powers[level]);
+                BigInt_init(&mu[level]);
+                BigInt_mul(&powers[level], &powers[level - 1], &powers[level - 1]);
+                BigInt_reciprocal(&mu[level],
+                                  &powers[level],
+                                  &powers[level - 1],
+                                  &mu[level - 1]);
+            }
+
+            p = BigInt_writeDecimal(&abs, powers, mu, level, end, 0);
+
+            for(size_t i = 0; i <= level; ++i) {
+                BigInt_free(&powers[i]);
+                BigInt_free(&mu[i]);
+            }
+        }
+
+        if(p == end) {
+            *--p = '0';
+        }
+
+        if(n->neg) {
+            *--p = '-';
+        }
+
+        memmove(out, p, end - p + 1);
+
+        return out;
+    }
+
+    int    k      = base == 16 ? 4 : base == 8 ? 3 : 1;
+    size_t ndigit = bits ? (bits + k - 1) / k : 1;
+    char*  out    = csrxmalloc(ndigit + plen + 2);
+    char*  p      = out;
+
+    if(n->neg) {
+        *p++ = '-';
+    }
+
+    memcpy(p, prefix, plen);
+    p += plen;
+
+    for(size_t i = ndigit; i-- > 0;) {
+        size_t   pos = i * k;
+        uint32_t d   = pos / 32 < n->len ? n->limbs[pos / 32] >> (pos % 32) : 0;
+
+        if(pos % 32 + k > 32 && pos / 32 + 1 < n->len) {
+            d |= n->limbs[pos / 32 + 1] << (32 - pos % 32);
+        }
+
+        *p++ = DIGITS[d & ((1u << k) - 1)];
+    }
+
+    *p = '\0';
+    return out;
+}
+
+// Evaluation
+// ----------------------------------------------------------------------------
+
+static SftError* BigInt_fail(SftError* error, const char* message) {
+    snprintf(error->message, sizeof(error->message), "%s\n\n", message);
+    return error;
+}
+
+static SftError* BigInt_loadConst(const SftProgram* program,
+                                  size_t            index,
+                                  BigInt*           out,
+                                  SftError*         error) {
+    const char* lit = program->literals ? program->literals[index] : 0;
+
+    if(!lit) {
+        double d = program->consts[index];
+
+        if(d != floor(d) || fabs(d) >= 9007199254740992.0) {
+            return BigInt_fail(error,
+                               "Integer mode needs exact literals; tokenize "
+                               "with keep_literals");
+        }
+
+        BigInt_setU64(out, (uint64_t)fabs(d));
+        out->neg = d < 0 && out->len;
+        return 0;
+    }
+
+    size_t len  = strlen(lit);
+    int    base = 10;
+
+    if(strchr(lit, '.')) {
+        return BigInt_fail(
+            error, "Floating point numbers aren't allowed in integer mode");
+    }
+
+    if(len > 2 && lit[0] == '0') {
+        base = lit[1] == 'x' ? 16 : lit[1] == 'o' ? 8 : lit[1] == 'b' ? 2 : 10;
+    }
+
+    BOOL ok = base == 10 ? BigInt_parse(out, lit, len, 10)
+                         : BigInt_parse(out, lit + 2, len - 2, base);
+
+    return ok ? 0 : BigInt_fail(error, "Invalid character in number.");
+}
+
+static SftError* BigInt_call(const Function* f,
+                             BigInt*         args,
+                             size_t          argc,
+                             BigInt*         out,
+                             SftError*       error) {
+    // round and ceil are the identity on integers.
+    if(!strcmp(f->name, "round") || !strcmp(f->name, "ceil")) {
+        BigInt_copy(out, &args[0]);
+    }
+
+    else if(!strcmp(f->name, "sum")) {
+        BigInt acc;
+        BigInt_init(&acc);
+
+        for(size_t i = 0; i < argc; ++i) {
+            BigInt_add(&acc, &acc, &args[i]);
+        }
+
+        BigInt_move(out, &acc);
+    }
+
+    else if(!strcmp(f->name, "min") || !strcmp(f->name, "max")) {
+        int    want = f->name[1] == 'i' ? -1 : 1;
+        size_t best = 0;
+
+        for(size_t i = 1; i < argc; ++i) {
+            if(BigInt_cmp(&args[i], &args[best]) == want) {
+                best = i;
+            }
+        }
+
+        BigInt_copy(out, &args[best]);
+    }
+
+    else if(!strcmp(f->name, "dot")) {
+        if(argc % 2) {
+            return BigInt_fail(
+                error, "dot needs two vectors of the same length");
+        }
+
+        BigInt acc, prod;
+        BigInt_init(&acc);
+        BigInt_init(&prod);
+
+        for(size_t i = 0; i < argc / 2; ++i) {
+            BigInt_mul(&prod, &args[i], &args[i + argc / 2]);
+            BigInt_add(&acc, &acc, &prod);
+        }
+
+        BigInt_free(&prod);
+        BigInt_move(out, &acc);
+    }
+
+    else {
+        snprintf(error->message,
+                 sizeof(error->message),
+                 "Function '%s' isn't available in integer mode\n\n",
+                 f->name);
+        return error;
+    }
+
+    return 0;
+}
+
+SftError* BigInt_evalProgram(const SftProgram* program,
+                             BigInt*           out,
+                             SftError*         error) {
+    if(program->var_count) {
+        snprintf(error->message,
+                 sizeof(error->message),
+                 "Unknown variable '%s'\n\n",
+                 program->vars[0]);
+        return error;
+    }
+
+    BigInt*   stack  = xmalloc(sizeof(BigInt) * (program->max_depth + 1));
+    size_t    sp     = 0;
+    SftError* failed = 0;
+
+    for(size_t i = 0; i <= program->max_depth; ++i) {
+        BigInt_init(&stack[i]);
+    }
+
+    for(size_t i = 0; i < program->code_len && !failed; ++i) {
+        SftInstr in = program->code[i];
+        BigInt*  u  = sp >= 2 ? &stack[sp - 2] : 0;
+        BigInt*  v  = sp >= 1 ? &stack[sp - 1] : 0;
+
+        switch(in.op) {
+            case OP_CONST:
+                failed = BigInt_loadConst(program, in.arg, &stack[sp], error);
+                sp += 1;
+                break;
+            case OP_ADD:
+                BigInt_add(u, u, v);
+                sp -= 1;
+                break;
+            case OP_SUB:
+                BigInt_sub(u, u, v);
+                sp -= 1;
+                break;
+            case OP_MUL:
+                BigInt_mul(u, u, v);
+                sp -= 1;
+                break;
+            case OP_DIV:
+            case OP_MOD:
+                if(!BigInt_divmod(in.op == OP_DIV ? u : 0,
+                                  in.op == OP_MOD ? u : 0,
+                                  u,
+                                  v)) {
+                    failed = BigInt_fail(error, "Division by zero");
+                }
+                sp -= 1;
+                break;
+            case OP_POW:
+                if(!BigInt_pow(u, u, v)) {
+                    failed = BigInt_fail(
+                        error,
+                        v->neg ? "Negative exponents aren't allowed in "
+                                 "integer mode"
+                               : "Result is too large");
+                }
+                sp -= 1;
+                break;
+            case OP_NEG:
+                BigInt_neg(v, v);
+                break;
+            case OP_CALL: {
+                size_t first = sp - in.argc;
+                BigInt result;
+                BigInt_init(&result);
+
+                failed = BigInt_call(
+                    &FN_LOOKUP[in.arg], &stack[first], in.argc, &result, error);
+
+                BigInt_move(&stack[first], &result);
+                sp = first + 1;
+                break;
+            }
+            default:
+                failed = BigInt_fail(error, "Invalid program");
+                break;
+        }
+    }
+
+    if(!failed) {
+        BigInt_move(out, &stack[0]);
+    }
+
+    for(size_t i = 0; i <= program->max_depth; ++i) {
+        BigInt_free(&stack[i]);
+    }
+
+    xfree(stack);
+    return failed;
+}
@@ -0,0 +1,81 @@
+#ifndef _H_BIGINT_
+#define _H_BIGINT_
+
+#include "common.h"
+#include "compiler.h"
+#include "evaluator.h"
+
+#include <stdint.h>
+
+// Arbitrary precision signed integers, used by the calculator's integer mode.
+//
+// Magnitudes are little endian arrays of 32 bit limbs. Multiplication picks
+// an algorithm by operand size: schoolbook for small operands, Karatsuba in
+// the middle, and a number theoretic transform over the prime 2^64 - 2^32 + 1
+// for very large ones. Division is Knuth's algorithm D, except that decimal
+// output divides by powers of ten with Barrett reduction, so that printing a
+// huge number costs about as much as multiplying it.
+
+typedef struct BigInt {
+    uint32_t* limbs; // No leading zero limbs; zero has len 0.
+    size_t    len;
+    size_t    cap;
+    BOOL      neg;
+} BigInt;
+
+// Operands below this many limbs are multiplied with the schoolbook method.
+#define BIGINT_KARATSUBA_THRESHOLD 32
+
+// Operands from this many limbs up are multiplied with the NTT.
+#define BIGINT_NTT_THRESHOLD 1024
+
+// Numbers up to this many limbs are printed in decimal nine digits at a time;
+// bigger ones are split in halves by powers of ten first.
+#define BIGINT_DECIMAL_THRESHOLD 64
+
+// Results that would need more bits than this are refused by BigInt_pow
+// rather than aborting in xmalloc.
+#define BIGINT_MAX_BITS ((uint64_t)1 << 32)
+
+extern void BigInt_init(BigInt* n);
+extern void BigInt_free(BigInt* n);
+
+extern void BigInt_setU64(BigInt* n, uint64_t value);
+extern void BigInt_copy(BigInt* dest, const BigInt* src);
+
+// Parses digits (without any base prefix or sign) in base 2, 8, 10 or 16.
+// Returns FALSE if a digit isn't valid for the base.
+extern BOOL BigInt_parse(BigInt* n, const char* digits, size_t len, int base);
+
+extern int    BigInt_cmp(const BigInt* a, const BigInt* b);
+extern size_t BigInt_bitLength(const BigInt* n);
+
+// Arithmetic. The result may alias either operand.
+extern void BigInt_add(BigInt* r, const BigInt* a, const BigInt* b);
+extern void BigInt_sub(BigInt* r, const BigInt* a, const BigInt* b);
+extern void BigInt_mul(BigInt* r, const BigInt* a, const BigInt* b);
+extern void BigInt_neg(BigInt* r, const BigInt* a);
+
+// Truncating division, like C's / and %. Either q or rem may be 0. Returns
+// FALSE on division by zero.
+extern BOOL BigInt_divmod(BigInt*       q,
+                          BigInt*       rem,
+                          const BigInt* a,
+                          const BigInt* b);
+
+// Square and multiply. Returns FALSE if exp is negative, or the result would
+// exceed BIGINT_MAX_BITS.
+extern BOOL BigInt_pow(BigInt* r, const BigInt* base, const BigInt* exp);
+
+// Formats n in base 2, 8, 10 or 16, with the same 0b/0o/0x prefixes the
+// tokenizer accepts. Caller responsible for freeing the returned string.
+extern char* BigInt_toString(const BigInt* n, int base);
+
+// Evaluates a compiled program with big integers. Constants are read from
+// program->literals when present (compile with Tokenizer.keep_literals set),
+// so they're exact regardless of size. Returns 0 on success, or the error.
+extern SftError* BigInt_evalProgram(const SftProgram* program,
+                                    BigInt*           out,
+                                    SftError*         error);
+
+#endif // _H_BIGINT_
@@ -1,4 +1,5 @@
 #include "common.h"
+#include "alloc.h"
 #include <stdio.h>
 #include <stdint.h>
 
@@ -8,47 +9,334 @@
     #define dprintf(v, ...)
 #endif
 
+#ifdef SFT_ALLOC_PROFILE
+static void profile_alloc(void* ptr, size_t size, void* site);
+static void profile_free(void* ptr, void* site);
+#endif
+
+static void account_alloc(AllocAccount* account, void* ptr) {
+    account->allocated += alloc_get()->usable(ptr);
+
+    size_t live = alloc_accountLive(account);
+
+    if(live > account->peak) {
+        account->peak = live;
+    }
+}
+
+static void account_free(AllocAccount* account, void* ptr) {
+    account->freed += alloc_get()->usable(ptr);
+}
+
 // A wrapper to malloc that aborts the program immediately if malloc fails.
 void* xmalloc(size_t size) {
-    void* ptr = malloc(size);
+    void* ptr = alloc_get()->allocate(size);
 
     if(!ptr) {
         perror("Failed to malloc; out of memory.");
         abort();
     }
+
+    if(alloc_account) {
+        account_alloc(alloc_account, ptr);
+    }
+
+#ifdef SFT_ALLOC_PROFILE
+    profile_alloc(ptr, size, __builtin_return_address(0));
+#endif
+
     return ptr;
 }
 
 // A wrapper to realloc that aborts the program immediately if realloc fails.
 void* xrealloc(void* memory, size_t size) {
-    void* ptr = realloc(memory, size);
+#ifdef SFT_ALLOC_PROFILE
+    if(memory) {
+        profile_free(memory, __builtin_return_address(0));
+    }
+#endif
+
+    if(alloc_account && memory) {
+        account_free(alloc_account, memory);
+    }
+
+    void* ptr = alloc_get()->reallocate(memory, size);
 
     if(!ptr && size != 0) {
         perror("Failed to realloc; out of memory.");
         abort();
     }
 
+    if(alloc_account && ptr) {
+        account_alloc(alloc_account, ptr);
+    }
+
+#ifdef SFT_ALLOC_PROFILE
+    if(ptr) {
+        profile_alloc(ptr, size, __builtin_return_address(0));
+    }
+#endif
+
     return ptr;
 }
 
-size_t filter_whitespace(const char* input, size_t len, char* dest) {
-    char buffer[len + 2];
-    memset(buffer, 0, len + 2);
+void xfree(void* memory) {
+    if(!memory) {
+        return;
+    }
 
-    for(int i = 0, j = 0; i < len; ++i) {
-        if(!isspace(input[i])) {
-            buffer[j] = input[i];
-            ++j;
+#ifdef SFT_ALLOC_PROFILE
+    profile_free(memory, __builtin_return_address(0));
+#endif
+
+    if(alloc_account) {
+        account_free(alloc_account, memory);
+    }
+
+    alloc_get()->deallocate(memory);
+}
+
+#ifdef SFT_ALLOC_PROFILE
+#include <pthread.h>
+
+// Every live block, in an open addressing table keyed by address. The
+// profiler's own memory comes straight from calloc, so it isn't recorded.
+typedef struct AllocRecord {
+    void*  ptr;
+    void*  site;
+    size_t size;
+    size_t region; // Value of profile.region when allocated.
+} AllocRecord;
+
+static struct {
+    pthread_mutex_t lock;
+
+    AllocRecord* records;
+    size_t       capacity;
+    size_t       count;
+
+    size_t region;
+    size_t live_bytes;
+    size_t peak_bytes;
+    size_t allocs;
+    size_t frees;
+    size_t bytes;
+} profile = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static size_t profile_slot(void* ptr) {
+    uint64_t h = (uint64_t)(uintptr_t)ptr * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(h >> 20) & (profile.capacity - 1);
+}
+
+static void profile_insert(AllocRecord record) {
+    size_t i = profile_slot(record.ptr);
+
+    while(profile.records[i].ptr) {
+        i = (i + 1) & (profile.capacity - 1);
+    }
+
+    profile.records[i] = record;
+    profile.count++;
+}
+
+static void profile_grow() {
+    AllocRecord* old      = profile.records;
+    size_t       old_size = profile.capacity;
+
+    profile.capacity = old_size ? old_size * 2 : 4096;
+    profile.records  = calloc(profile.capacity, sizeof(AllocRecord));
+    profile.count    = 0;
+
+    if(!profile.records) {
+        perror("Failed to grow the allocation profile; out of memory.");
+        abort();
+    }
+
+    for(size_t i = 0; i < old_size; ++i) {
+        if(old[i].ptr) {
+            profile_insert(old[i]);
         }
     }
 
-    if(dest) {
-        size_t buflen = strlen(buffer);
-        memcpy(dest, buffer, buflen + 1);
-        return buflen;
-    } else {
+    free(old);
+}
+
+static void profile_alloc(void* ptr, size_t size, void* site) {
+    pthread_mutex_lock(&profile.lock);
+
+    if((profile.count + 1) * 2 > profile.capacity) {
+        profile_grow();
+    }
+
+    profile_insert((AllocRecord) {
+        .ptr = ptr, .site = site, .size = size, .region = profile.region});
+
+    profile.allocs++;
+    profile.bytes += size;
+    profile.live_bytes += size;
+
+    if(profile.live_bytes > profile.peak_bytes) {
+        profile.peak_bytes = profile.live_bytes;
+    }
+
+    pthread_mutex_unlock(&profile.lock);
+}
+
+static void profile_free(void* ptr, void* site) {
+    pthread_mutex_lock(&profile.lock);
+
+    size_t i = profile.capacity ? profile_slot(ptr) : 0;
+
+    while(profile.capacity && profile.records[i].ptr &&
+          profile.records[i].ptr != ptr) {
+        i = (i + 1) & (profile.capacity - 1);
+    }
+
+    if(!profile.capacity || !profile.records[i].ptr) {
+        pthread_mutex_unlock(&profile.lock);
+        fprintf(stderr,
+                "[alloc] Freeing %p from %p, which xmalloc never returned "
+                "or was already freed\n",
+                ptr,
+                site);
+        return;
+    }
+
+    profile.frees++;
+    profile.live_bytes -= profile.records[i].size;
+    profile.records[i].ptr = 0;
+    profile.count--;
+
+    // Shift back any records after the hole that were displaced past it.
+    size_t hole = i;
+
+    for(size_t j = (i + 1) & (profile.capacity - 1); profile.records[j].ptr;
+        j = (j + 1) & (profile.capacity - 1)) {
+        size_t home = profile_slot(profile.records[j].ptr);
+
+        if(((j - home) & (profile.capacity - 1)) >=
+           ((j - hole) & (profile.capacity - 1))) {
+            profile.records[hole]  = profile.records[j];
+            profile.records[j].ptr = 0;
+            hole                   = j;
+        }
+    }
+
+    pthread_mutex_unlock(&profile.lock);
+}
+
+void alloc_profile_begin() {
+    pthread_mutex_lock(&profile.lock);
+
+    profile.region++;
+    profile.peak_bytes = profile.live_bytes;
+    profile.allocs     = 0;
+    profile.frees      = 0;
+    profile.bytes      = 0;
+
+    pthread_mutex_unlock(&profile.lock);
+}
+
+typedef struct LeakSite {
+    void*  site;
+    size_t blocks;
+    size_t bytes;
+} LeakSite;
+
+static int compare_leak_sites(const void* a, const void* b) {
+    const LeakSite* x = a;
+    const LeakSite* y = b;
+    return x->bytes < y->bytes ? 1 : x->bytes > y->bytes ? -1 : 0;
+}
+
+void alloc_profile_end(const char* label, AllocStats* out) {
+    pthread_mutex_lock(&profile.lock);
+
+    AllocStats stats = {
+        .allocs     = profile.allocs,
+        .frees      = profile.frees,
+        .bytes      = profile.bytes,
+        .live_bytes = profile.live_bytes,
+        .peak_bytes = profile.peak_bytes,
+    };
+
+    LeakSite* sites      = 0;
+    size_t    site_count = 0;
+
+    for(size_t i = 0; i < profile.capacity; ++i) {
+        AllocRecord* record = &profile.records[i];
+
+        if(!record->ptr || record->region != profile.region) {
+            continue;
+        }
+
+        stats.leaked_blocks++;
+        stats.leaked_bytes += record->size;
+
+        size_t s = 0;
+        while(s < site_count && sites[s].site != record->site) ++s;
+
+        if(s == site_count) {
+            sites = realloc(sites, sizeof(LeakSite) * (site_count + 1));
+            sites[site_count++] = (LeakSite) {.site = record->site};
+        }
+
+        sites[s].blocks++;
+        sites[s].bytes += record->size;
+    }
+
+    profile.region++;
+    pthread_mutex_unlock(&profile.lock);
+
+    fprintf(stderr,
+            "[alloc] %s: %zu allocs (%zu bytes), %zu frees, %zu bytes live, "
+            "%zu peak, %zu leaked blocks (%zu bytes)\n",
+            label ? label : "region",
+            stats.allocs,
+            stats.bytes,
+            stats.frees,
+            stats.live_bytes,
+            stats.peak_bytes,
+            stats.leaked_blocks,
+            stats.leaked_bytes);
+
+    qsort(sites, site_count, sizeof(LeakSite), compare_leak_sites);
+
+    for(size_t s = 0; s < site_count; ++s) {
+        fprintf(stderr,
+                "[alloc]     leaked %zu blocks (%zu bytes) allocated from %p\n",
+                sites[s].blocks,
+                sites[s].bytes,
+                sites[s].site);
+    }
+
+    free(sites);
+
+    if(out) {
+        *out = stats;
+    }
+}
+#endif
+
+// Copies input into dest with all whitespace removed, and returns the length
+// of the result. Writes straight into dest rather than through a buffer on the
+// stack, so that multi-megabyte expressions don't overflow it.
+size_t filter_whitespace(const char* input, size_t len, char* dest) {
+    if(!dest) {
         return 0;
     }
+
+    size_t j = 0;
+
+    for(size_t i = 0; i < len && input[i]; ++i) {
+        if(!isspace((unsigned char)input[i])) {
+            dest[j] = input[i];
+            ++j;
+        }
+    }
+
+    dest[j] = '\0';
+    return j;
 }
 
 char* read_input(const char* prompt) {
@@ -64,7 +352,7 @@ char* read_input(const char* prompt) {
     while((c = fgetc(stdin)) != '\n') {
         if(len + 1 >= size) {
             size   = size ? size * 2 : 256;
-            buffer = realloc(buffer, size);
+            buffer = xrealloc(buffer, size);
         }
 
         buffer[len++] = c;
@@ -74,6 +362,17 @@ char* read_input(const char* prompt) {
     return buffer;
 }
 
+size_t sft_hashName(const char* name) {
+    size_t hash = 14695981039346656037ULL;
+
+    for(; *name; ++name) {
+        hash ^= (unsigned char)*name;
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
 void minmax(int64_t* n1, int64_t* n2, int64_t** min, int64_t** max) {
     if(*n1 < *n2) {
         *min = n1;
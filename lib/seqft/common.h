@@ -40,6 +40,10 @@ extern void* xmalloc(size_t size);
 // A wrapper to realloc that aborts the program immediately if realloc fails.
 extern void* xrealloc(void* memory, size_t size);
 
+// Frees memory from xmalloc or xrealloc. Everything seqft allocates should go
+// back through here, so that the allocation profiler sees it.
+extern void xfree(void* memory);
+
 // An alias for xmalloc meaning "call site responsible" that explicitly states 
 // that the caller of malloc is not responsible for freeing the memory, and
 // that the corresponding free() should be found at the call site, or elsewhere. 
@@ -47,10 +51,44 @@ extern void* xrealloc(void* memory, size_t size);
 // help when searching for malloc/free pairs via ripgrep.
 #define csrxmalloc xmalloc
 
+// Allocation profiling
+// ----------------------------------------------------------------------------
+// Building with -DSFT_ALLOC_PROFILE makes xmalloc, xrealloc and xfree record
+// the size and call site of every allocation. alloc_profile_begin() starts a
+// region, and alloc_profile_end() prints what happened in it to stderr: the
+// allocation and free counts, live and peak bytes, and every block allocated
+// in the region that's still live, grouped by the address it was allocated
+// from (resolve those with addr2line -f -e Neptune). Without the flag both
+// do nothing.
+
+typedef struct AllocStats {
+    size_t allocs;
+    size_t frees;
+    size_t bytes;         // Total requested by the region's allocations.
+    size_t live_bytes;    // Live at the end of the region, overall.
+    size_t peak_bytes;    // Highest live_bytes reached during the region.
+    size_t leaked_blocks; // Allocated in the region and never freed.
+    size_t leaked_bytes;
+} AllocStats;
+
+#ifdef SFT_ALLOC_PROFILE
+extern void alloc_profile_begin();
+
+// Prints the report headed with label, and copies the numbers into out if
+// it's non-zero.
+extern void alloc_profile_end(const char* label, AllocStats* out);
+#else
+#define alloc_profile_begin()         do { } while (0)
+#define alloc_profile_end(label, out) do { } while (0)
+#endif
+
 extern size_t filter_whitespace(const char* input, size_t len, char* dest);
 
 extern char* read_input(const char* prompt);
 
+// FNV-1a of a NUL terminated name, for the hash tables keyed by name.
+extern size_t sft_hashName(const char* name);
+
 
 extern void minmax(int64_t* n1, int64_t* n2, int64_t** min, int64_t** max);
 
@@ -0,0 +1,565 @@
+#include "compiler.h"
+
+// An entry in the operator cellar while compiling. Function calls carry their
+// index into FN_LOOKUP, resolved once here rather than on every evaluation.
+typedef struct PendingOp {
+    TokenType type;
+    int       fn;
+    size_t    depth;
+} PendingOp;
+
+typedef struct Compiler {
+    Stack*    code;
+    Stack*    consts;
+    Stack*    literals;
+    Stack*    vars;
+    Stack*    operators;
+    size_t    depth;
+    size_t    max_depth;
+    SftError* error;
+} Compiler;
+
+static SftOpcode opcode_for(TokenType type) {
+    switch(type) {
+        case TT_ADD:
+            return OP_ADD;
+        case TT_SUB:
+            return OP_SUB;
+        case TT_DIV:
+            return OP_DIV;
+        case TT_MOD:
+            return OP_MOD;
+        case TT_MUL:
+            return OP_MUL;
+        case TT_POW:
+            return OP_POW;
+        default:
+            return OP_NEG;
+    }
+}
+
+static void Compiler_push(Compiler* c, SftInstr instr) {
+    Stack_pushFrom(c->code, &instr);
+}
+
+static void Compiler_grow(Compiler* c) {
+    c->depth += 1;
+
+    if(c->depth > c->max_depth) {
+        c->max_depth = c->depth;
+    }
+}
+
+// Emits the instruction for an operator popped off the cellar. Returns non-zero
+// if there aren't enough numbers for it, mirroring the errors Sft reports.
+static BOOL Compiler_emitOperator(Compiler* c, PendingOp op) {
+    Token token = {.type = op.type, .f64 = 0, .func = 0};
+    char  token_string[TOKEN_STRING_SIZE];
+
+    if(op.type & TT_BOP) {
+        if(c->depth < 2) {
+            sprintf(c->error->message,
+                    "Invalid expression, missing '%s' for binary operator "
+                    "'%s'\n\n",
+                    c->depth ? "num1" : "num2",
+                    Token_toString(&token, token_string));
+
+            return TRUE;
+        }
+
+        c->depth -= 1;
+    } else if(op.type & TT_UOP) {
+        if(c->depth < 1) {
+            sprintf(c->error->message,
+                    "Invalid expression, missing '%s' for unary operator "
+                    "'%s'\n\n",
+                    "num",
+                    Token_toString(&token, token_string));
+
+            return TRUE;
+        }
+    } else {
+        sprintf(c->error->message,
+                "Invalid expression, unexpected '%s'\n\n",
+                Token_toString(&token, token_string));
+
+        return TRUE;
+    }
+
+    Compiler_push(c, (SftInstr) {.op = opcode_for(op.type)});
+    return FALSE;
+}
+
+static size_t Compiler_var(Compiler* c, const char* name) {
+    for(size_t i = 0; i < Stack_getCount(c->vars); ++i) {
+        char** existing = Stack_itemAt(c->vars, i);
+
+        if(!strcmp(*existing, name)) {
+            return i;
+        }
+    }
+
+    size_t len  = strlen(name);
+    char*  copy = xmalloc(len + 1);
+    memcpy(copy, name, len + 1);
+    Stack_pushFrom(c->vars, &copy);
+
+    return Stack_getCount(c->vars) - 1;
+}
+
+static void free_string(void* item) {
+    xfree(*(char**)item);
+}
+
+SftProgram* SftProgram_compile(TokenArray* tokens, SftError* error) {
+    Compiler c = {
+        .code      = Stack_withCapacity(sizeof(SftInstr), 64),
+        .consts    = Stack_withCapacity(sizeof(double), 32),
+        .literals  = Stack_withCapacity(sizeof(char*), 32),
+        .vars      = Stack_withCapacity(sizeof(char*), 8),
+        .operators = Stack_withCapacity(sizeof(PendingOp), 32),
+        .depth     = 0,
+        .max_depth = 0,
+        .error     = error,
+    };
+
+    Stack_setDeallocator(c.vars, free_string);
+    Stack_setDeallocator(c.literals, free_string);
+
+    BOOL failed = FALSE;
+    BOOL has_literals = FALSE;
+
+    for(size_t i = 0; i < tokens->count && !failed; ++i) {
+        Token token = tokens->tokens[i];
+        char  token_string[TOKEN_STRING_SIZE];
+
+        if(token.type & TT_NUM) {
+            char* literal = 0;
+
+            if(token.lit) {
+                size_t len = strlen(token.lit);
+                literal    = xmalloc(len + 1);
+                memcpy(literal, token.lit, len + 1);
+                has_literals = TRUE;
+            }
+
+            Stack_pushFrom(c.consts, &token.f64);
+            Stack_pushFrom(c.literals, &literal);
+            Compiler_push(&c,
+                          (SftInstr) {
+                              .op  = OP_CONST,
+                              .arg = Stack_getCount(c.consts) - 1,
+                          });
+            Compiler_grow(&c);
+        }
+
+        else if(token.type & TT_VAR) {
+            Compiler_push(
+                &c,
+                (SftInstr) {.op = OP_VAR, .arg = Compiler_var(&c, token.func)});
+            Compiler_grow(&c);
+        }
+
+        // Same rule as eval_x_is_operator.
+        else if(token.type & TT_OPS) {
+            while(!Stack_empty(c.operators) && !failed) {
+                PendingOp* top = Stack_getHead(c.operators);
+
+                if(top->type & TT_OPA || top->type < token.type)
+                    break;
+
+                PendingOp op = *top;
+                Stack_drop(c.operators, 1);
+                failed = Compiler_emitOperator(&c, op);
+            }
+
+            Stack_pushFrom(c.operators, &(PendingOp) {.type = token.type});
+        }
+
+        // Same rule as eval_x_is_comma.
+        else if(token.type & TT_COM) {
+            while(!failed) {
+                PendingOp* top = Stack_getHead(c.operators);
+
+                if(Stack_empty(c.operators) || (top->type & TT_OPA && top->fn < 0)) {
+                    sprintf(error->message,
+                            "Invalid expression, ',' outside of a function "
+                            "call\n\n");
+                    failed = TRUE;
+                    break;
+                }
+
+                if(top->type & TT_OPA)
+                    break;
+
+                PendingOp op = *top;
+                Stack_drop(c.operators, 1);
+                failed = Compiler_emitOperator(&c, op);
+            }
+        }
+
+        else if(token.type & TT_OPA) {
+            PendingOp op = {.type = TT_OPA, .fn = -1, .depth = c.depth};
+
+            if(token.func) {
+                op.fn = Sft_findFunction(token.func);
+
+                if(op.fn < 0) {
+                    sprintf(error->message,
+                            "No such function '%.200s'\n\n",
+                            token.func);
+                    failed = TRUE;
+                }
+            }
+
+            Stack_pushFrom(c.operators, &op);
+        }
+
+        // Same rule as eval_x_is_close_paren.
+        else if(token.type & TT_CPA) {
+            BOOL matched = FALSE;
+
+            while(!Stack_empty(c.operators) && !failed) {
+                PendingOp op = *(PendingOp*)Stack_getHead(c.operators);
+                Stack_drop(c.operators, 1);
+
+                if(op.type & TT_OPA) {
+                    matched = TRUE;
+
+                    if(op.fn >= 0) {
+                        size_t argc = c.depth - op.depth;
+
+                        if(Sft_checkArity(&FN_LOOKUP[op.fn],
+                                          argc,
+                                          error->message,
+                                          sizeof(error->message))) {
+                            failed = TRUE;
+                            break;
+                        }
+
+                        Compiler_push(&c,
+                                      (SftInstr) {
+                                          .op   = OP_CALL,
+                                          .arg  = op.fn,
+                                          .argc = argc,
+                                      });
+
+                        c.depth = op.depth;
+                        Compiler_grow(&c);
+                    }
+
+                    break;
+                }
+
+                failed = Compiler_emitOperator(&c, op);
+            }
+
+            if(!matched && !failed) {
+                sprintf(error->message,
+                        "Invalid expression, unmatched ')'\n\n");
+                failed = TRUE;
+            }
+        }
+
+        else {
+            sprintf(error->message,
+                    "Invalid expression, unexpected '%s'\n\n",
+                    Token_toString(&token, token_string));
+            failed = TRUE;
+        }
+    }
+
+    // Evaluate the remaining operators.
+    while(!Stack_empty(c.operators) && !failed) {
+        PendingOp op = *(PendingOp*)Stack_getHead(c.operators);
+        Stack_drop(c.operators, 1);
+
+        if(op.type & TT_OPA) {
+            sprintf(error->message,
+                    "Invalid expression, missing ')'\n\n");
+            failed = TRUE;
+            break;
+        }
+
+        failed = Compiler_emitOperator(&c, op);
+    }
+
+    if(!failed && c.depth != 1) {
+        sprintf(error->message,
+                c.depth ? "Invalid expression, missing operator\n\n"
+                        : "Invalid expression, nothing to evaluate\n\n");
+        failed = TRUE;
+    }
+
+    SftProgram* program = 0;
+
+    if(!failed) {
+        program = csrxmalloc(sizeof(SftProgram));
+
+        program->code_len    = Stack_cloneData(c.code, (void**)&program->code);
+        program->const_count = Stack_cloneData(c.consts,
+                                               (void**)&program->consts);
+        program->var_count   = Stack_cloneData(c.vars, (void**)&program->vars);
+        program->max_depth   = c.max_depth;
+        program->literals    = 0;
+
+        if(has_literals) {
+            Stack_cloneData(c.literals, (void**)&program->literals);
+            Stack_clear(c.literals);
+        }
+
+        // The names now belong to the program.
+        Stack_clear(c.vars);
+    }
+
+    Stack_free(c.code);
+    Stack_free(c.consts);
+    Stack_free(c.literals);
+    Stack_free(c.vars);
+    Stack_free(c.operators);
+
+    return program;
+}
+
+void SftProgram_free(SftProgram* program) {
+    if(!program)
+        return;
+
+    for(size_t i = 0; i < program->var_count; ++i) {
+        xfree(program->vars[i]);
+    }
+
+    if(program->literals) {
+        for(size_t i = 0; i < program->const_count; ++i) {
+            xfree(program->literals[i]);
+        }
+    }
+
+    xfree(program->code);
+    xfree(program->consts);
+    xfree(program->literals);
+    xfree(program->vars);
+    xfree(program);
+}
+
+BOOL SftProgram_findVar(const SftProgram* program,
+                        const char*       name,
+                        size_t*           out_index) {
+    for(size_t i = 0; i < program->var_count; ++i) {
+        if(!strcmp(program->vars[i], name)) {
+            if(out_index)
+                *out_index = i;
+
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+// Evaluation
+// ----------------------------------------------------------------------------
+
+// Programs small enough to evaluate without allocating a scratch stack.
+#define SFT_PROGRAM_SMALL_DEPTH 64
+
+double SftProgram_eval(const SftProgram* program, const double* vars) {
+    double  small[SFT_PROGRAM_SMALL_DEPTH];
+    double* stack = program->max_depth <= SFT_PROGRAM_SMALL_DEPTH
+                        ? small
+                        : xmalloc(sizeof(double) * program->max_depth);
+    size_t  sp    = 0;
+
+    // Compiling and loading both insist on one number being left, but an
+    // empty program shouldn't return whatever was on the stack.
+    stack[0] = NAN;
+
+    for(size_t i = 0; i < program->code_len; ++i) {
+        SftInstr in = program->code[i];
+
+        switch(in.op) {
+            case OP_CONST:
+                stack[sp++] = program->consts[in.arg];
+                break;
+            case OP_VAR:
+                stack[sp++] = vars[in.arg];
+                break;
+            case OP_ADD:
+                sp -= 1;
+                stack[sp - 1] = stack[sp - 1] + stack[sp];
+                break;
+            case OP_SUB:
+                sp -= 1;
+                stack[sp - 1] = stack[sp - 1] - stack[sp];
+                break;
+            case OP_DIV:
+                sp -= 1;
+                stack[sp - 1] = stack[sp - 1] / stack[sp];
+                break;
+            case OP_MOD:
+                sp -= 1;
+                stack[sp - 1] = eval_binary_op(TT_MOD, stack[sp - 1], stack[sp]);
+                break;
+            case OP_MUL:
+                sp -= 1;
+                stack[sp - 1] = stack[sp - 1] * stack[sp];
+                break;
+            case OP_POW:
+                sp -= 1;
+                stack[sp - 1] = pow(stack[sp - 1], stack[sp]);
+                break;
+            case OP_NEG:
+                stack[sp - 1] = -stack[sp - 1];
+                break;
+            case OP_CALL: {
+                double* args = stack + sp - in.argc;
+                double  r    = FN_LOOKUP[in.arg].ptr(args, in.argc);
+                sp -= in.argc;
+                stack[sp++] = r;
+                break;
+            }
+        }
+    }
+
+    double result = stack[0];
+
+    if(stack != small) {
+        xfree(stack);
+    }
+
+    return result;
+}
+
+void SftProgram_evalDual(const SftProgram* program,
+                         const double*     vars,
+                         double*           out_value,
+                         double*           out_grad) {
+    size_t n     = program->var_count;
+    size_t depth = program->max_depth;
+
+    // One value and one gradient row per stack slot, plus a scratch row for
+    // accumulating the chain rule through function calls.
+    double* values = xmalloc(sizeof(double) * (depth + (depth + 1) * n + 1));
+    double* grads  = values + depth;
+    double* tmp    = grads + depth * n;
+    size_t  sp     = 0;
+
+    for(size_t i = 0; i < program->code_len; ++i) {
+        SftInstr in = program->code[i];
+
+        // Operands of binary (u, v) and unary (v) operators.
+        size_t  ui = sp >= 2 ? sp - 2 : 0;
+        size_t  vi = sp >= 1 ? sp - 1 : 0;
+        double* u  = &values[ui];
+        double  v  = values[vi];
+        double* du = &grads[ui * n];
+        double* dv = &grads[vi * n];
+
+        switch(in.op) {
+            case OP_CONST:
+            case OP_VAR: {
+                double* g = &grads[sp * n];
+                memset(g, 0, sizeof(double) * n);
+
+                if(in.op == OP_VAR) {
+                    values[sp] = vars[in.arg];
+                    g[in.arg]  = 1;
+                } else {
+                    values[sp] = program->consts[in.arg];
+                }
+
+                sp += 1;
+                break;
+            }
+
+            case OP_ADD:
+                for(size_t k = 0; k < n; ++k)
+                    du[k] += dv[k];
+                *u += v;
+                sp -= 1;
+                break;
+
+            case OP_SUB:
+                for(size_t k = 0; k < n; ++k)
+                    du[k] -= dv[k];
+                *u -= v;
+                sp -= 1;
+                break;
+
+            case OP_MUL:
+                for(size_t k = 0; k < n; ++k)
+                    du[k] = du[k] * v + *u * dv[k];
+                *u *= v;
+                sp -= 1;
+                break;
+
+            case OP_DIV:
+                for(size_t k = 0; k < n; ++k)
+                    du[k] = (du[k] * v - *u * dv[k]) / (v * v);
+                *u /= v;
+                sp -= 1;
+                break;
+
+            // Both operands are truncated to integers first, so the result is
+            // piecewise constant.
+            case OP_MOD:
+                memset(du, 0, sizeof(double) * n);
+                *u = eval_binary_op(TT_MOD, *u, v);
+                sp -= 1;
+                break;
+
+            // d(u^v) = v*u^(v-1) du + u^v ln(u) dv. The second term is only
+            // defined for u > 0, so it's left out entirely when dv is zero,
+            // which keeps ordinary powers of negative bases differentiable.
+            case OP_POW: {
+                double r = pow(*u, v);
+                double a = v == 0 ? 0 : v * pow(*u, v - 1);
+                double b = *u > 0 ? r * log(*u) : (*u == 0 && v > 0 ? 0 : NAN);
+
+                for(size_t k = 0; k < n; ++k)
+                    du[k] = a * du[k] + (dv[k] != 0 ? b * dv[k] : 0);
+
+                *u = r;
+                sp -= 1;
+                break;
+            }
+
+            case OP_NEG:
+                for(size_t k = 0; k < n; ++k)
+                    dv[k] = -dv[k];
+                values[sp - 1] = -v;
+                break;
+
+            case OP_CALL: {
+                const Function* f = &FN_LOOKUP[in.arg];
+                size_t    first = sp - in.argc;
+                double*   args  = &values[first];
+
+                memset(tmp, 0, sizeof(double) * n);
+
+                for(size_t j = 0; j < in.argc; ++j) {
+                    double  partial = f->dptr(args, in.argc, j);
+                    double* g       = &grads[(first + j) * n];
+
+                    if(partial == 0)
+                        continue;
+
+                    for(size_t k = 0; k < n; ++k)
+                        tmp[k] += partial * g[k];
+                }
+
+                double r = f->ptr(args, in.argc);
+
+                values[first] = r;
+                memcpy(&grads[first * n], tmp, sizeof(double) * n);
+                sp = first + 1;
+                break;
+            }
+        }
+    }
+
+    *out_value = values[0];
+    memcpy(out_grad, grads, sizeof(double) * n);
+
+    xfree(values);
+}
@@ -0,0 +1,77 @@
+#ifndef _H_COMPILER_
+#define _H_COMPILER_
+
+#include "common.h"
+#include "evaluator.h"
+#include "tokenizer.h"
+
+#include <stdint.h>
+
+// A compiled expression is a flat postfix program for a small stack machine.
+// Compiling follows exactly the same operator cellar rules as Sft_evalTokens,
+// so a program produces the same result as evaluating its tokens directly,
+// but it can be evaluated any number of times without tokenizing again, and
+// it can reference variables, which are bound by index at evaluation time.
+
+typedef enum {
+    OP_CONST = 0, // Push consts[arg].
+    OP_VAR   = 1, // Push vars[arg].
+    OP_ADD   = 2,
+    OP_SUB   = 3,
+    OP_DIV   = 4,
+    OP_MOD   = 5,
+    OP_MUL   = 6,
+    OP_POW   = 7,
+    OP_NEG   = 8,
+    OP_CALL  = 9, // Call FN_LOOKUP[arg] with the top argc numbers.
+} SftOpcode;
+
+typedef struct SftInstr {
+    uint32_t op;
+    uint32_t arg;
+    uint32_t argc;
+} SftInstr;
+
+typedef struct SftProgram {
+    SftInstr* code;
+    size_t    code_len;
+    double*   consts;
+    size_t    const_count;
+
+    // Source text of each constant, when the tokens were produced with
+    // Tokenizer.keep_literals set. 0 otherwise.
+    char** literals;
+
+    char** vars;
+    size_t var_count;
+
+    // The deepest the number stack gets while running the program.
+    size_t max_depth;
+} SftProgram;
+
+// Compiles the tokens into a newly allocated program. Returns 0 and writes a
+// message into error if the expression is malformed. Caller responsible for
+// freeing the program with SftProgram_free.
+extern SftProgram* SftProgram_compile(TokenArray* tokens, SftError* error);
+
+extern void SftProgram_free(SftProgram* program);
+
+// Looks up the index of a variable, which is the order in which it first
+// appears in the expression. Returns FALSE if the program doesn't use it.
+extern BOOL SftProgram_findVar(const SftProgram* program,
+                               const char*       name,
+                               size_t*           out_index);
+
+// Evaluates the program with vars[i] bound to program->vars[i].
+extern double SftProgram_eval(const SftProgram* program, const double* vars);
+
+// Forward mode automatic differentiation. Evaluates the program over dual
+// numbers in a single pass, writing the value to out_value and the partial
+// derivative with respect to every variable to out_grad, which must have room
+// for program->var_count doubles.
+extern void SftProgram_evalDual(const SftProgram* program,
+                                const double*     vars,
+                                double*           out_value,
+                                double*           out_grad);
+
+#endif // _H_COMPILER_
@@ -1,4 +1,5 @@
 #include "evaluator.h"
+#include "simd.h"
 
 
 double sft_round(double nums[], size_t len) {
@@ -17,11 +18,149 @@ double sft_ceil(double nums[], size_t len) {
     return ceil(num);
 }
 
-Function FN_LOOKUP[] = {
-    (Function) {.ptr = sft_round, .name = "round"},
-    (Function) {.ptr = sft_ceil,  .name = "ceil" }
+// Both are step functions, so their derivative is zero wherever it exists.
+double sft_round_deriv(double nums[], size_t len, size_t arg) {
+    return 0;
+}
+
+double sft_ceil_deriv(double nums[], size_t len, size_t arg) {
+    return 0;
+}
+
+double sft_sum(double nums[], size_t len) {
+    return simd_sum(nums, len);
+}
+
+double sft_sum_deriv(double nums[], size_t len, size_t arg) {
+    return 1;
+}
+
+double sft_min(double nums[], size_t len) {
+    return simd_min(nums, len);
+}
+
+// Where several arguments tie for the extremum, only the first of them moves
+// it, so only the first gets a derivative of 1.
+static size_t sft_findFirst(const double* nums, size_t len, double value) {
+    size_t i = 0;
+
+    while(i < len && nums[i] != value)
+        ++i;
+
+    return i;
+}
+
+double sft_min_deriv(double nums[], size_t len, size_t arg) {
+    return sft_findFirst(nums, len, simd_min(nums, len)) == arg ? 1 : 0;
+}
+
+double sft_max(double nums[], size_t len) {
+    return simd_max(nums, len);
+}
+
+double sft_max_deriv(double nums[], size_t len, size_t arg) {
+    return sft_findFirst(nums, len, simd_max(nums, len)) == arg ? 1 : 0;
+}
+
+double sft_mean(double nums[], size_t len) {
+    return len ? simd_sum(nums, len) / len : NAN;
+}
+
+double sft_mean_deriv(double nums[], size_t len, size_t arg) {
+    return 1.0 / len;
+}
+
+// Scaled by the largest magnitude so that squaring can't overflow/underflow.
+// Like C's hypot, an infinity wins over NaN, and otherwise NaN wins.
+double sft_hypot(double nums[], size_t len) {
+    double scale = simd_absmax(nums, len);
+
+    if(isinf(scale))
+        return scale;
+
+    // absmax never picks a NaN, so this is either all zeros or has NaNs.
+    if(scale == 0)
+        return simd_sumsq(nums, len, 1);
+
+    return scale * sqrt(simd_sumsq(nums, len, 1 / scale));
+}
+
+double sft_hypot_deriv(double nums[], size_t len, size_t arg) {
+    double h = sft_hypot(nums, len);
+    return h == 0 ? 0 : nums[arg] / h;
+}
+
+double sft_dot(double nums[], size_t len) {
+    if(len % 2)
+        return NAN;
+
+    return simd_dot(nums, nums + len / 2, len / 2);
+}
+
+double sft_dot_deriv(double nums[], size_t len, size_t arg) {
+    if(len % 2)
+        return NAN;
+
+    return nums[(arg + len / 2) % len];
+}
+
+const Function FN_LOOKUP[] = {
+    (Function) {.ptr = sft_round, .dptr = sft_round_deriv, .name = "round",
+                .min_args = 1, .max_args = 1},
+    (Function) {.ptr = sft_ceil,  .dptr = sft_ceil_deriv,  .name = "ceil",
+                .min_args = 1, .max_args = 1},
+    (Function) {.ptr = sft_sum,   .dptr = sft_sum_deriv,   .name = "sum",
+                .min_args = 0, .max_args = SFT_VARIADIC},
+    (Function) {.ptr = sft_min,   .dptr = sft_min_deriv,   .name = "min",
+                .min_args = 1, .max_args = SFT_VARIADIC},
+    (Function) {.ptr = sft_max,   .dptr = sft_max_deriv,   .name = "max",
+                .min_args = 1, .max_args = SFT_VARIADIC},
+    (Function) {.ptr = sft_mean,  .dptr = sft_mean_deriv,  .name = "mean",
+                .min_args = 1, .max_args = SFT_VARIADIC},
+    (Function) {.ptr = sft_hypot, .dptr = sft_hypot_deriv, .name = "hypot",
+                .min_args = 1, .max_args = SFT_VARIADIC},
+    (Function) {.ptr = sft_dot,   .dptr = sft_dot_deriv,   .name = "dot",
+                .min_args = 2, .max_args = SFT_VARIADIC},
 };
 
+const size_t FN_LOOKUP_COUNT = sizeof(FN_LOOKUP) / sizeof(FN_LOOKUP[0]);
+
+int Sft_findFunction(const char* name) {
+    for(size_t i = 0; i < FN_LOOKUP_COUNT; ++i) {
+        if(!strcmp(FN_LOOKUP[i].name, name)) {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+BOOL Sft_checkArity(const Function* f,
+                    size_t          argc,
+                    char*           message,
+                    size_t          message_size) {
+    if(argc < f->min_args) {
+        snprintf(message,
+                 message_size,
+                 "Invalid expression, missing argument for function '%s'\n\n",
+                 f->name);
+        return TRUE;
+    }
+
+    if(argc > f->max_args) {
+        snprintf(message,
+                 message_size,
+                 "Invalid expression, function '%s' takes at most %zu "
+                 "argument%s\n\n",
+                 f->name,
+                 f->max_args,
+                 f->max_args == 1 ? "" : "s");
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
 #ifdef DEBUG
     #define debug_step(drawer, ...)   \
         Sft_draw(drawer);             \
@@ -42,10 +181,9 @@ void Sft_draw(SftDrawer* drawer) {
 
     for(int i = 0; i < drawer->tarray->count; ++i) {
         Token token = drawer->tarray->tokens[i];
+        char  as_string[TOKEN_STRING_SIZE];
 
-        char* as_string = Token_toString(&token);
-
-        fprintf(stderr, "%s ", as_string);
+        fprintf(stderr, "%s ", Token_toString(&token, as_string));
     }
 
     fprintf(stderr, "\n");
@@ -57,9 +195,9 @@ void Sft_draw(SftDrawer* drawer) {
             fprintf(stderr, "^");
             break;
         } else {
-            char* as_string = Token_toString(&token);
+            char as_string[TOKEN_STRING_SIZE];
 
-            size_t astr_len = strlen(as_string);
+            size_t astr_len = strlen(Token_toString(&token, as_string));
 
             for(int i = 0; i < astr_len; ++i) {
                 fprintf(stderr, " ");
@@ -78,6 +216,7 @@ void Sft_draw(SftDrawer* drawer) {
     // -------------------------------
     char* matrix[12][2];
     char* empty = " ";
+    char  operator_strings[12][TOKEN_STRING_SIZE];
 
     for(int i = 0; i < 12; ++i) {
         matrix[i][0] = empty;
@@ -101,7 +240,7 @@ void Sft_draw(SftDrawer* drawer) {
 
         Token* token = Stack_itemAt(ostack, i);
 
-        char* as_string = Token_toString(token);
+        char* as_string = Token_toString(token, operator_strings[i]);
 
         if(strlen(as_string) > 1) {
             as_string[1] = '\0';
@@ -122,7 +261,7 @@ void Sft_draw(SftDrawer* drawer) {
 
         double* number = Stack_itemAt(nstack, i);
 
-        char* as_string = (char*)malloc(256);
+        char* as_string = (char*)xmalloc(256);
         memset(as_string, 0, 256);
 
         snprintf(as_string, 256, "%.2f", *number);
@@ -153,17 +292,26 @@ void Sft_draw(SftDrawer* drawer) {
 
 
 Sft* Sft_new() {
-    Sft* sft = malloc(sizeof(Sft));
+    Sft* sft = xmalloc(sizeof(Sft));
 
+    // The operator cellar holds copies of tokens whose names still belong to
+    // the TokenArray being evaluated, so it mustn't free them.
     sft->operator_stack = Stack_withCapacity(sizeof(Token), 100);
     sft->number_stack   = Stack_withCapacity(sizeof(double), 100);
-
-    Stack_setDeallocator(sft->operator_stack,
-                         (void (*)(void*))Token_freeMembers);
+    sft->drawer         = 0;
 
     return sft;
 }
 
+void Sft_free(Sft* sft) {
+    if(!sft)
+        return;
+
+    Stack_free(sft->operator_stack);
+    Stack_free(sft->number_stack);
+    xfree(sft);
+}
+
 
 
 
@@ -219,49 +367,54 @@ SftError* eval_x_is_operator(Sft* sft, Token token) {
         if(top->type < token.type)
             break;
 
-        Token* operator_token = Stack_pop(operator_cellar);
+        Token operator_token;
+        Stack_popInto(operator_cellar, &operator_token);
+        char  token_string[TOKEN_STRING_SIZE];
         DEBUGBLOCK({ Sft_draw(drawer); });
 
         double result_to_push = 0;
 
         // Eval binary operators.
-        if(operator_token->type & TT_BOP) {
-            double* num2 = Stack_pop(number_cellar);
+        if(operator_token.type & TT_BOP) {
+            double num2;
+            BOOL   has_num2 = Stack_popInto(number_cellar, &num2);
             DEBUGBLOCK({ Sft_draw(drawer); });
 
-            double* num1 = Stack_pop(number_cellar);
+            double num1;
+            BOOL   has_num1 = Stack_popInto(number_cellar, &num1);
             DEBUGBLOCK({ Sft_draw(drawer); });
 
-            if(!num2 || !num1) {
+            if(!has_num2 || !has_num1) {
                 sprintf(sft->error.message,
                         "Invalid expression, missing '%s' for binary operator "
                         "'%s'\n\n",
-                        num1 ? "num1" : "num2",
-                        Token_toString(operator_token));
+                        has_num1 ? "num1" : "num2",
+                        Token_toString(&operator_token, token_string));
 
                 return &sft->error;
             }
 
-            result_to_push = eval_binary_op(operator_token->type, *num1, *num2);
+            result_to_push = eval_binary_op(operator_token.type, num1, num2);
         }
 
         // Eval unary operators.
-        else if(operator_token->type & TT_UOP) {
-            double* num = Stack_pop(number_cellar);
+        else if(operator_token.type & TT_UOP) {
+            double num;
+            BOOL   has_num = Stack_popInto(number_cellar, &num);
 
-            if(!num) {
+            if(!has_num) {
                 sprintf(sft->error.message,
                         "Invalid expression, missing '%s' for unary operator "
                         "'%s'\n\n",
                         "num",
-                        Token_toString(operator_token));
+                        Token_toString(&operator_token, token_string));
 
                 return &sft->error;
             }
 
             DEBUGBLOCK({ Sft_draw(drawer); });
 
-            result_to_push = eval_unary_op(operator_token->type, *num);
+            result_to_push = eval_unary_op(operator_token.type, num);
         }
 
         // Add calculation result to number cellar.
@@ -272,6 +425,72 @@ SftError* eval_x_is_operator(Sft* sft, Token token) {
     return 0;
 }
 
+// Evaluates operators back to the open paren of the enclosing function call,
+// leaving the argument on the number cellar, and the paren where it is.
+SftError* eval_x_is_comma(Sft* sft, Token token) {
+    Stack*     operator_cellar = sft->operator_stack;
+    Stack*     number_cellar   = sft->number_stack;
+
+    while(1) {
+        Token* top = Stack_getHead(operator_cellar);
+
+        if(Stack_empty(operator_cellar) || (top->type == TT_OPA && !top->func)) {
+            sprintf(sft->error.message,
+                    "Invalid expression, ',' outside of a function call\n\n");
+
+            return &sft->error;
+        }
+
+        if(top->type == TT_OPA)
+            break;
+
+        Token operator_token;
+        Stack_popInto(operator_cellar, &operator_token);
+        char  token_string[TOKEN_STRING_SIZE];
+        double result_to_push = 0;
+
+        if(operator_token.type & TT_BOP) {
+            double num2;
+            BOOL   has_num2 = Stack_popInto(number_cellar, &num2);
+            double num1;
+            BOOL   has_num1 = Stack_popInto(number_cellar, &num1);
+
+            if(!has_num2 || !has_num1) {
+                sprintf(sft->error.message,
+                        "Invalid expression, missing '%s' for binary operator "
+                        "'%s'\n\n",
+                        has_num1 ? "num1" : "num2",
+                        Token_toString(&operator_token, token_string));
+
+                return &sft->error;
+            }
+
+            result_to_push = eval_binary_op(operator_token.type, num1, num2);
+        }
+
+        else if(operator_token.type & TT_UOP) {
+            double num;
+            BOOL   has_num = Stack_popInto(number_cellar, &num);
+
+            if(!has_num) {
+                sprintf(sft->error.message,
+                        "Invalid expression, missing '%s' for unary operator "
+                        "'%s'\n\n",
+                        "num",
+                        Token_toString(&operator_token, token_string));
+
+                return &sft->error;
+            }
+
+            result_to_push = eval_unary_op(operator_token.type, num);
+        }
+
+        Stack_pushFrom(number_cellar, &result_to_push);
+    }
+
+    return 0;
+}
+
 SftError* eval_x_is_close_paren(Sft* sft, Token token) {
 
     Stack*     operator_cellar = sft->operator_stack;
@@ -288,86 +507,90 @@ SftError* eval_x_is_close_paren(Sft* sft, Token token) {
 
         if(top->type == TT_OPA) {
             if(top->func) {
+                int fn = Sft_findFunction(top->func);
 
-                int found_func = 0;
-
-                for(int i = 0; i < 2; ++i) {
-                    Function* f = &FN_LOOKUP[i];
+                if(fn >= 0) {
+                    const Function* f = &FN_LOOKUP[fn];
 
-                    if(!strcmp(f->name, top->func)) {
-                        found_func = 1;
+                    // Everything pushed onto the number cellar since the open
+                    // paren is an argument, and they're already contiguous.
+                    size_t depth = Stack_getCount(number_cellar);
+                    size_t argc  = depth > top->depth ? depth - top->depth : 0;
 
-                        double* num = Stack_pop(number_cellar);
-
-                        DEBUGBLOCK({ Sft_draw(drawer); });
+                    if(Sft_checkArity(f,
+                                      argc,
+                                      sft->error.message,
+                                      sizeof(sft->error.message))) {
+                        return &sft->error;
+                    }
 
-                        if(!num) {
-                            sprintf(sft->error.message,
-                                    "Invalid expression, missing argument for"
-                                    "function '%s'\n\n",
-                                    Token_toString(top));
+                    double* nums =
+                        argc ? Stack_itemAt(number_cellar, depth - argc) : 0;
+                    double result = f->ptr(nums, argc);
 
-                            return &sft->error;
-                        }
+                    Stack_drop(number_cellar, argc);
+                    Stack_pushFrom(number_cellar, &result);
+                    DEBUGBLOCK({ Sft_draw(drawer); });
+                } else {
+                    snprintf(sft->error.message,
+                             sizeof(sft->error.message),
+                             "No such function '%.200s'\n\n",
+                             top->func);
 
-                        double nums[1] = {*num};
-                        double result  = f->ptr(nums, 1);
-                        Stack_pushFrom(number_cellar, &result);
-                        DEBUGBLOCK({ Sft_draw(drawer); });
-                        break;
-                    }
-                }
-
-                if(!found_func) {
-                    printf("\nNo such function '%s'\n", top->func);
+                    return &sft->error;
                 }
             }
 
-            free(Stack_pop(operator_cellar));
+            Stack_drop(operator_cellar, 1);
             DEBUGBLOCK({ Sft_draw(drawer); });
             break;
         }
 
-        Token* operator_token = Stack_pop(operator_cellar);
+        Token operator_token;
+        Stack_popInto(operator_cellar, &operator_token);
+        char  token_string[TOKEN_STRING_SIZE];
         DEBUGBLOCK({ Sft_draw(drawer); });
 
         // Eval binary operators.
-        if(operator_token->type & TT_BOP) {
-            double* num2 = Stack_pop(number_cellar);
+        if(operator_token.type & TT_BOP) {
+            double num2;
+            BOOL   has_num2 = Stack_popInto(number_cellar, &num2);
             DEBUGBLOCK({ Sft_draw(drawer); });
 
-            double* num1 = Stack_pop(number_cellar);
+            double num1;
+            BOOL   has_num1 = Stack_popInto(number_cellar, &num1);
             DEBUGBLOCK({ Sft_draw(drawer); });
 
-            if(!num2 || !num1) {
+            if(!has_num2 || !has_num1) {
                 sprintf(sft->error.message,
                         "Invalid expression, missing '%s' for binary operator "
                         "'%s'\n\n",
-                        num1 ? "num1" : "num2",
-                        Token_toString(operator_token));
+                        has_num1 ? "num1" : "num2",
+                        Token_toString(&operator_token, token_string));
 
                 return &sft->error;
             }
 
-            result_to_push = eval_binary_op(operator_token->type, *num1, *num2);
+            result_to_push = eval_binary_op(operator_token.type, num1, num2);
         }
 
         // Eval unary operators.
-        else if(operator_token->type & TT_UOP) {
-            double* num = Stack_pop(number_cellar);
+        else if(operator_token.type & TT_UOP) {
+            double num;
+            BOOL   has_num = Stack_popInto(number_cellar, &num);
 
-            if(!num) {
+            if(!has_num) {
                 sprintf(sft->error.message,
                         "Invalid expression, missing '%s' for unary operator "
                         "'%s'\n\n",
                         "num",
-                        Token_toString(operator_token));
+                        Token_toString(&operator_token, token_string));
 
                 return &sft->error;
             }
 
             DEBUGBLOCK({ Sft_draw(drawer); });
-            result_to_push = eval_unary_op(operator_token->type, *num);
+            result_to_push = eval_unary_op(operator_token.type, num);
         }
 
         // Add calculation result to number cellar.
@@ -380,11 +603,10 @@ SftError* eval_x_is_close_paren(Sft* sft, Token token) {
 
 
 
-SftError* Sft_evalTokens(Sft* sft, TokenArray* tokens, double* out_result) {
-    SftDrawer* drawer = (SftDrawer*)malloc(sizeof(SftDrawer));
-    drawer->sft       = sft;
-    drawer->tarray    = tokens;
-    drawer->padding   = 0;
+SftError* Sft_evalTokens(Sft* sft, const TokenArray* tokens, double* out_result) {
+    SftDrawer  drawer_state = {.sft = sft, .tarray = tokens, .padding = 0};
+    SftDrawer* drawer       = &drawer_state;
+    sft->drawer             = drawer;
 
     // Iterate from left to right.
     for(int i = 0; i < tokens->count; ++i) {
@@ -399,6 +621,16 @@ SftError* Sft_evalTokens(Sft* sft, TokenArray* tokens, double* out_result) {
             Stack_pushFrom(sft->number_stack, &token.f64);
         }
 
+        // Variables can only be bound when evaluating a compiled SftProgram.
+        else if(token.type & TT_VAR) {
+            snprintf(sft->error.message,
+                     sizeof(sft->error.message),
+                     "Unknown variable '%s'\n\n",
+                     token.func);
+
+            return &sft->error;
+        }
+
         // If token is an operator, evaluate operators until either
         // - Operator cellar is empty.
         //
@@ -406,7 +638,7 @@ SftError* Sft_evalTokens(Sft* sft, TokenArray* tokens, double* out_result) {
         //
         // - The precedence of the operator at the top of the operator
         //   cellar is LOWER than the precedence of t.
-        else if(token.type & (TT_OPS | TT_COM)) {
+        else if(token.type & TT_OPS) {
             // The first time we encounter an operator, simply add it, no
             // evaluation.
 
@@ -423,9 +655,22 @@ SftError* Sft_evalTokens(Sft* sft, TokenArray* tokens, double* out_result) {
             Stack_pushFrom(sft->operator_stack, &token);
         }
 
-        // If X is an open parenthesis, push X onto the operator cellar.
+        // If X is a comma, evaluate operators back to the function's open
+        // parenthesis, completing the argument.
+        else if(token.type & TT_COM) {
+            debug_step(drawer, "\n> Evaluate Argument\n");
+            SftError* error = eval_x_is_comma(sft, token);
+
+            if(error) {
+                return error;
+            }
+        }
+
+        // If X is an open parenthesis, push X onto the operator cellar, noting
+        // how many numbers came before it.
         else if(token.type & TT_OPA) {
             debug_step(drawer, "\n> Push Operator\n");
+            token.depth = Stack_getCount(sft->number_stack);
             Stack_pushFrom(sft->operator_stack, &token);
         }
 
@@ -451,43 +696,48 @@ SftError* Sft_evalTokens(Sft* sft, TokenArray* tokens, double* out_result) {
             break;
         }
 
-        Token* operator_token = Stack_pop(sft->operator_stack);
+        Token operator_token;
+        Stack_popInto(sft->operator_stack, &operator_token);
+        char  token_string[TOKEN_STRING_SIZE];
 
         double result_to_push = 0;
 
         // Eval binary operators.
-        if(operator_token->type & TT_BOP) {
-            double* num2 = Stack_pop(sft->number_stack);
-            double* num1 = Stack_pop(sft->number_stack);
+        if(operator_token.type & TT_BOP) {
+            double num2;
+            BOOL   has_num2 = Stack_popInto(sft->number_stack, &num2);
+            double num1;
+            BOOL   has_num1 = Stack_popInto(sft->number_stack, &num1);
 
-            if(!num2 || !num1) {
+            if(!has_num2 || !has_num1) {
                 sprintf(sft->error.message,
                         "Invalid expression, missing '%s' for binary operator "
                         "'%s'\n\n",
-                        num1 ? "num2" : "num1",
-                        Token_toString(operator_token));
+                        has_num1 ? "num2" : "num1",
+                        Token_toString(&operator_token, token_string));
 
                 return &sft->error;
             }
 
-            result_to_push = eval_binary_op(operator_token->type, *num1, *num2);
+            result_to_push = eval_binary_op(operator_token.type, num1, num2);
         }
 
         // Eval unary operators.
-        else if(operator_token->type & TT_UOP) {
-            double* num = Stack_pop(sft->number_stack);
+        else if(operator_token.type & TT_UOP) {
+            double num;
+            BOOL   has_num = Stack_popInto(sft->number_stack, &num);
 
-            if(!num) {
+            if(!has_num) {
                 sprintf(sft->error.message,
                         "Invalid expression, missing '%s' for unary operator "
                         "'%s'\n\n",
                         "num",
-                        Token_toString(operator_token));
+                        Token_toString(&operator_token, token_string));
 
                 return &sft->error;
             }
 
-            result_to_push = eval_unary_op(operator_token->type, *num);
+            result_to_push = eval_unary_op(operator_token.type, num);
         }
 
         // Add calculation result to number cellar.
@@ -495,12 +745,12 @@ SftError* Sft_evalTokens(Sft* sft, TokenArray* tokens, double* out_result) {
     }
 
     debug_step(drawer, "\n> Pop Result\n");
-    double* result = Stack_pop(sft->number_stack);
+    double result;
+    BOOL   has_result = Stack_popInto(sft->number_stack, &result);
     DEBUGBLOCK({ Sft_draw(drawer); });
 
-    if(result) {
-        *out_result = *result;
-        free(result);
+    if(has_result) {
+        *out_result = result;
     }
 
     return NULL;
@@ -10,16 +10,60 @@
 #include <string.h>
 #include <unistd.h>
 
+// max_args value for functions that take any number of arguments.
+#define SFT_VARIADIC SIZE_MAX
+
 typedef struct {
     char* name;
     double (*ptr)(double nums[], size_t len);
+
+    // Partial derivative of ptr with respect to nums[arg], used by forward
+    // mode automatic differentiation (see SftProgram_evalDual).
+    double (*dptr)(double nums[], size_t len, size_t arg);
+
+    size_t min_args;
+    size_t max_args;
 } Function;
 
 extern double sft_round(double nums[], size_t len);
+extern double sft_round_deriv(double nums[], size_t len, size_t arg);
 
 extern double sft_ceil(double nums[], size_t len);
+extern double sft_ceil_deriv(double nums[], size_t len, size_t arg);
+
+// Aggregates. These reduce all of their arguments with the SIMD kernels in
+// simd.h. dot takes two vectors of equal length, one after the other, e.g.
+// dot(a1, a2, b1, b2), and is NaN for an odd number of arguments.
+extern double sft_sum(double nums[], size_t len);
+extern double sft_sum_deriv(double nums[], size_t len, size_t arg);
+
+extern double sft_min(double nums[], size_t len);
+extern double sft_min_deriv(double nums[], size_t len, size_t arg);
+
+extern double sft_max(double nums[], size_t len);
+extern double sft_max_deriv(double nums[], size_t len, size_t arg);
+
+extern double sft_mean(double nums[], size_t len);
+extern double sft_mean_deriv(double nums[], size_t len, size_t arg);
 
-extern Function FN_LOOKUP[];
+extern double sft_hypot(double nums[], size_t len);
+extern double sft_hypot_deriv(double nums[], size_t len, size_t arg);
+
+extern double sft_dot(double nums[], size_t len);
+extern double sft_dot_deriv(double nums[], size_t len, size_t arg);
+
+extern const Function FN_LOOKUP[];
+extern const size_t FN_LOOKUP_COUNT;
+
+// Returns the index of the function called name in FN_LOOKUP, or -1.
+extern int Sft_findFunction(const char* name);
+
+// Writes an error message and returns TRUE if f can't be called with argc
+// arguments.
+extern BOOL Sft_checkArity(const Function* f,
+                           size_t          argc,
+                           char*           message,
+                           size_t          message_size);
 
 typedef struct SftDrawer SftDrawer;
 
@@ -35,27 +79,34 @@ typedef struct {
 } Sft;
 
 typedef struct SftDrawer {
-    Sft*        sft;
-    TokenArray* tarray;
-    size_t      tarray_idx;
-    size_t      padding;
+    Sft*              sft;
+    const TokenArray* tarray;
+    size_t            tarray_idx;
+    size_t            padding;
 } SftDrawer;
 
 extern void Sft_draw(SftDrawer* drawer);
 
 extern Sft* Sft_new();
 
+// Frees an Sft made with Sft_new.
+extern void Sft_free(Sft* sft);
+
 extern double eval_binary_op(TokenType operator_type, double num1, double num2);
 
 extern double eval_unary_op(TokenType operator_type, double num);
 
 extern SftError* eval_x_is_operator(Sft* sft, Token token);
 
+extern SftError* eval_x_is_comma(Sft* sft, Token token);
+
 extern SftError* eval_x_is_close_paren(Sft* sft, Token token);
 
 // Returns pointer to SftError stored internally in Sft instance on error.
 // Does not allocate any new memory when returning an error. The Sft's
 // SftError field is used as the "last error" buffer.
-extern SftError* Sft_evalTokens(Sft* sft, TokenArray* tokens, double* out_result);
+extern SftError* Sft_evalTokens(Sft*              sft,
+                                const TokenArray* tokens,
+                                double*           out_result);
 
 #endif // _H_EVALUATOR_
\ No newline at end of file
@@ -0,0 +1,476 @@
+#include "image.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Writing
+// ----------------------------------------------------------------------------
+
+typedef struct ImageBuffer {
+    char*  data;
+    size_t len;
+    size_t cap;
+} ImageBuffer;
+
+static size_t ImageBuffer_reserve(ImageBuffer* b, size_t n) {
+    // Every section starts 8 byte aligned.
+    size_t at = (b->len + 7) & ~(size_t)7;
+
+    if(at + n > b->cap) {
+        while(at + n > b->cap) {
+            b->cap = b->cap ? b->cap * 2 : 4096;
+        }
+
+        b->data = xrealloc(b->data, b->cap);
+    }
+
+    memset(b->data + b->len, 0, at + n - b->len);
+    b->len = at + n;
+
+    return at;
+}
+
+static uint32_t ImageBuffer_string(ImageBuffer* strings, const char* s) {
+    if(!s || !*s)
+        return 0; // Offset 0 is always the empty string.
+
+    size_t n  = strlen(s) + 1;
+    size_t at = strings->len;
+
+    if(at + n > strings->cap) {
+        while(at + n > strings->cap) {
+            strings->cap = strings->cap ? strings->cap * 2 : 4096;
+        }
+
+        strings->data = xrealloc(strings->data, strings->cap);
+    }
+
+    memcpy(strings->data + at, s, n);
+    strings->len += n;
+
+    return (uint32_t)at;
+}
+
+BOOL SftImage_write(const char*              path,
+                    const SftProgram* const* programs,
+                    const char* const*       names,
+                    const char* const*       sources,
+                    size_t                   count,
+                    SftError*                error) {
+
+    ImageBuffer b       = {0};
+    ImageBuffer strings = {0};
+
+    strings.cap     = 4096;
+    strings.data    = xmalloc(strings.cap);
+    strings.data[0] = 0;
+    strings.len     = 1;
+
+    size_t header    = ImageBuffer_reserve(&b, sizeof(SftImageHeader));
+    size_t table     = ImageBuffer_reserve(&b, sizeof(SftImageProgram) * count);
+    size_t functions = ImageBuffer_reserve(&b, sizeof(uint32_t) * FN_LOOKUP_COUNT);
+
+    for(size_t i = 0; i < FN_LOOKUP_COUNT; ++i) {
+        uint32_t name = ImageBuffer_string(&strings, FN_LOOKUP[i].name);
+        memcpy(b.data + functions + i * sizeof(uint32_t), &name, sizeof(uint32_t));
+    }
+
+    for(size_t i = 0; i < count; ++i) {
+        const SftProgram* p = programs[i];
+        SftImageProgram   entry = {0};
+
+        entry.name        = ImageBuffer_string(&strings, names ? names[i] : 0);
+        entry.source      = ImageBuffer_string(&strings, sources ? sources[i] : 0);
+        entry.code_len    = (uint32_t)p->code_len;
+        entry.const_count = (uint32_t)p->const_count;
+        entry.var_count   = (uint32_t)p->var_count;
+        entry.max_depth   = (uint32_t)p->max_depth;
+
+        entry.code_offset = ImageBuffer_reserve(&b, sizeof(SftInstr) * p->code_len);
+        memcpy(b.data + entry.code_offset, p->code, sizeof(SftInstr) * p->code_len);
+
+        entry.consts_offset = ImageBuffer_reserve(&b, sizeof(double) * p->const_count);
+        memcpy(b.data + entry.consts_offset, p->consts, sizeof(double) * p->const_count);
+
+        entry.vars_offset = ImageBuffer_reserve(&b, sizeof(uint32_t) * p->var_count);
+
+        for(size_t v = 0; v < p->var_count; ++v) {
+            uint32_t name = ImageBuffer_string(&strings, p->vars[v]);
+            memcpy(b.data + entry.vars_offset + v * sizeof(uint32_t), &name, sizeof(uint32_t));
+        }
+
+        memcpy(b.data + table + i * sizeof(SftImageProgram), &entry, sizeof(entry));
+    }
+
+    size_t string_table = ImageBuffer_reserve(&b, strings.len);
+    memcpy(b.data + string_table, strings.data, strings.len);
+
+    SftImageHeader h = {0};
+
+    memcpy(h.magic, SFT_IMAGE_MAGIC, 4);
+    h.version          = SFT_IMAGE_VERSION;
+    h.byte_order       = SFT_IMAGE_BYTE_ORDER;
+    h.program_count    = (uint32_t)count;
+    h.function_count   = (uint32_t)FN_LOOKUP_COUNT;
+    h.programs_offset  = table;
+    h.functions_offset = functions;
+    h.strings_offset   = string_table;
+    h.strings_size     = strings.len;
+    h.file_size        = b.len;
+
+    memcpy(b.data + header, &h, sizeof(h));
+    xfree(strings.data);
+
+    // Written next to the destination and renamed over it, so that processes
+    // with the old image mapped keep a consistent copy.
+    size_t tmp_len = strlen(path) + 5;
+    char   tmp[tmp_len];
+    snprintf(tmp, tmp_len, "%s.tmp", path);
+
+    FILE* f  = fopen(tmp, "wb");
+    BOOL  ok = f && fwrite(b.data, 1, b.len, f) == b.len;
+
+    if(f && fclose(f) != 0)
+        ok = FALSE;
+
+    if(ok && rename(tmp, path) != 0)
+        ok = FALSE;
+
+    if(!ok) {
+        snprintf(error->message, sizeof(error->message),
+                 "Can't write %s: %s\n\n", path, strerror(errno));
+        unlink(tmp);
+    }
+
+    xfree(b.data);
+    return ok;
+}
+
+// Loading
+// ----------------------------------------------------------------------------
+
+static BOOL SftImage_fail(SftError* error, const char* path, const char* why) {
+    snprintf(error->message, sizeof(error->message),
+             "Invalid image %s: %s\n\n", path, why);
+    return FALSE;
+}
+
+// TRUE if count items of size bytes at offset lie inside the mapping.
+static BOOL SftImage_inside(const SftImage* image, uint64_t offset, uint64_t count, size_t size) {
+    if(offset > image->map_size)
+        return FALSE;
+
+    return count <= (image->map_size - offset) / size;
+}
+
+static const char* SftImage_string(const SftImage*       image,
+                                   const SftImageHeader* h,
+                                   uint32_t              offset) {
+    if(offset >= h->strings_size)
+        return 0;
+
+    return (const char*)image->map + h->strings_offset + offset;
+}
+
+// Runs through the code the way SftProgram_eval would, checking every
+// operand and that the stack never goes deeper than max_depth.
+static BOOL SftImage_checkCode(const SftInstr* code,
+                               size_t          code_len,
+                               size_t          const_count,
+                               size_t          var_count,
+                               size_t          function_count,
+                               size_t          max_depth) {
+    size_t depth = 0;
+
+    for(size_t i = 0; i < code_len; ++i) {
+        SftInstr in = code[i];
+
+        switch(in.op) {
+            case OP_CONST:
+            case OP_VAR:
+                if(in.arg >= (in.op == OP_CONST ? const_count : var_count))
+                    return FALSE;
+                depth++;
+                break;
+            case OP_ADD:
+            case OP_SUB:
+            case OP_DIV:
+            case OP_MOD:
+            case OP_MUL:
+            case OP_POW:
+                if(depth < 2)
+                    return FALSE;
+                depth--;
+                break;
+            case OP_NEG:
+                if(depth < 1)
+                    return FALSE;
+                break;
+            case OP_CALL: {
+                if(in.arg >= function_count || depth < in.argc)
+                    return FALSE;
+
+                const Function* f = &FN_LOOKUP[in.arg];
+
+                if(in.argc < f->min_args ||
+                   (f->max_args != SFT_VARIADIC && in.argc > f->max_args))
+                    return FALSE;
+
+                depth = depth - in.argc + 1;
+                break;
+            }
+            default:
+                return FALSE;
+        }
+
+        if(depth > max_depth)
+            return FALSE;
+    }
+
+    return depth == 1;
+}
+
+static BOOL SftImage_load(SftImage* image, const char* path, SftError* error) {
+    SftImageHeader h;
+
+    if(image->map_size < sizeof(h))
+        return SftImage_fail(error, path, "too short");
+
+    memcpy(&h, image->map, sizeof(h));
+
+    if(memcmp(h.magic, SFT_IMAGE_MAGIC, 4) != 0)
+        return SftImage_fail(error, path, "not an image");
+
+    if(h.byte_order != SFT_IMAGE_BYTE_ORDER)
+        return SftImage_fail(error, path, "written on a machine with a different byte order");
+
+    if(h.version != SFT_IMAGE_VERSION)
+        return SftImage_fail(error, path, "unsupported version");
+
+    if(h.file_size != image->map_size ||
+       !SftImage_inside(image, h.programs_offset, h.program_count, sizeof(SftImageProgram)) ||
+       !SftImage_inside(image, h.functions_offset, h.function_count, sizeof(uint32_t)) ||
+       !SftImage_inside(image, h.strings_offset, h.strings_size, 1) ||
+       h.strings_size == 0 || h.programs_offset % 8 || h.functions_offset % 4 ||
+       ((const char*)image->map)[h.strings_offset + h.strings_size - 1] != 0)
+        return SftImage_fail(error, path, "truncated or damaged");
+
+    // Every function is in the table once and must be one of ours, so a
+    // longer table is damaged. That also bounds remap, which is on the stack.
+    if(h.function_count > FN_LOOKUP_COUNT)
+        return SftImage_fail(error, path, "truncated or damaged");
+
+    // Map the image's function numbers to FN_LOOKUP indices.
+    const uint32_t* functions = (const uint32_t*)((const char*)image->map + h.functions_offset);
+    uint32_t        remap[h.function_count ? h.function_count : 1];
+    BOOL            renumber = FALSE;
+
+    for(size_t i = 0; i < h.function_count; ++i) {
+        const char* name = SftImage_string(image, &h, functions[i]);
+        int         fn   = name ? Sft_findFunction(name) : -1;
+
+        if(fn < 0) {
+            snprintf(error->message, sizeof(error->message),
+                     "Invalid image %s: no such function '%.100s'\n\n", path, name ? name : "");
+            return FALSE;
+        }
+
+        remap[i] = (uint32_t)fn;
+        renumber |= remap[i] != i;
+    }
+
+    image->count      = h.program_count;
+    image->programs   = xmalloc(sizeof(SftProgram) * (image->count ? image->count : 1));
+    image->names      = xmalloc(sizeof(char*) * (image->count ? image->count : 1));
+    image->sources    = xmalloc(sizeof(char*) * (image->count ? image->count : 1));
+    image->owned_code = xmalloc(sizeof(SftInstr*) * (image->count ? image->count : 1));
+
+    memset(image->owned_code, 0, sizeof(SftInstr*) * (image->count ? image->count : 1));
+
+    const SftImageProgram* entries =
+        (const SftImageProgram*)((const char*)image->map + h.programs_offset);
+
+    size_t total_vars = 0;
+
+    for(size_t i = 0; i < image->count; ++i) {
+        if(!SftImage_inside(image, entries[i].vars_offset, entries[i].var_count, sizeof(uint32_t)))
+            return SftImage_fail(error, path, "truncated or damaged");
+
+        total_vars += entries[i].var_count;
+    }
+
+    image->var_names = xmalloc(sizeof(char*) * (total_vars ? total_vars : 1));
+    char** vars      = image->var_names;
+
+    for(size_t i = 0; i < image->count; ++i) {
+        const SftImageProgram* e = &entries[i];
+        SftProgram*            p = &image->programs[i];
+
+        if(!SftImage_inside(image, e->code_offset, e->code_len, sizeof(SftInstr)) ||
+           !SftImage_inside(image, e->consts_offset, e->const_count, sizeof(double)) ||
+           e->code_offset % 4 || e->consts_offset % 8 || e->vars_offset % 4 ||
+           !SftImage_string(image, &h, e->name) || !SftImage_string(image, &h, e->source))
+            return SftImage_fail(error, path, "truncated or damaged");
+
+        const SftInstr* code = (const SftInstr*)((const char*)image->map + e->code_offset);
+
+        if(renumber) {
+            SftInstr* copy = xmalloc(sizeof(SftInstr) * (e->code_len ? e->code_len : 1));
+
+            for(size_t j = 0; j < e->code_len; ++j) {
+                copy[j] = code[j];
+
+                if(copy[j].op == OP_CALL) {
+                    if(copy[j].arg >= h.function_count) {
+                        xfree(copy);
+                        return SftImage_fail(error, path, "truncated or damaged");
+                    }
+
+                    copy[j].arg = remap[copy[j].arg];
+                }
+            }
+
+            image->owned_code[i] = copy;
+            code                 = copy;
+        }
+
+        // Without renumbering, function numbers must also be in the image's
+        // own table, which is a prefix of FN_LOOKUP.
+        if(!SftImage_checkCode(code, e->code_len, e->const_count, e->var_count,
+                               renumber ? FN_LOOKUP_COUNT : h.function_count, e->max_depth))
+            return SftImage_fail(error, path, "invalid program");
+
+        const uint32_t* var_offsets = (const uint32_t*)((const char*)image->map + e->vars_offset);
+
+        for(size_t v = 0; v < e->var_count; ++v) {
+            const char* name = SftImage_string(image, &h, var_offsets[v]);
+
+            if(!name || !*name)
+                return SftImage_fail(error, path, "truncated or damaged");
+
+            vars[v] = (char*)name;
+        }
+
+        // The mapping is read only; nothing frees or writes through these.
+        p->code        = (SftInstr*)code;
+        p->code_len    = e->code_len;
+        p->consts      = (double*)((const char*)image->map + e->consts_offset);
+        p->const_count = e->const_count;
+        p->literals    = 0;
+        p->vars        = vars;
+        p->var_count   = e->var_count;
+        p->max_depth   = e->max_depth;
+
+        image->names[i]   = SftImage_string(image, &h, e->name);
+        image->sources[i] = SftImage_string(image, &h, e->source);
+
+        vars += e->var_count;
+    }
+
+    // Twice as many slots as programs, so probes stay short.
+    image->index_size = 16;
+    while(image->index_size < image->count * 2) {
+        image->index_size *= 2;
+    }
+
+    image->index = xmalloc(sizeof(size_t) * image->index_size);
+    memset(image->index, 0, sizeof(size_t) * image->index_size);
+
+    for(size_t i = 0; i < image->count; ++i) {
+        if(!*image->names[i])
+            continue;
+
+        size_t slot = sft_hashName(image->names[i]) & (image->index_size - 1);
+
+        while(image->index[slot]) {
+            slot = (slot + 1) & (image->index_size - 1);
+        }
+
+        image->index[slot] = i + 1;
+    }
+
+    return TRUE;
+}
+
+SftImage* SftImage_open(const char* path, SftError* error) {
+    int fd = open(path, O_RDONLY);
+
+    if(fd < 0) {
+        snprintf(error->message, sizeof(error->message),
+                 "Can't open %s: %s\n\n", path, strerror(errno));
+        return 0;
+    }
+
+    struct stat st;
+    SftImage*   image = xmalloc(sizeof(SftImage));
+
+    memset(image, 0, sizeof(SftImage));
+
+    if(fstat(fd, &st) == 0 && st.st_size > 0) {
+        image->map_size = (size_t)st.st_size;
+        image->map      = mmap(0, image->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if(image->map == MAP_FAILED)
+            image->map = 0;
+    }
+
+    close(fd);
+
+    if(!image->map) {
+        SftImage_fail(error, path, "empty or unreadable");
+        SftImage_close(image);
+        return 0;
+    }
+
+    if(!SftImage_load(image, path, error)) {
+        SftImage_close(image);
+        return 0;
+    }
+
+    return image;
+}
+
+void SftImage_close(SftImage* image) {
+    if(!image)
+        return;
+
+    if(image->owned_code) {
+        for(size_t i = 0; i < image->count; ++i) {
+            xfree(image->owned_code[i]);
+        }
+    }
+
+    if(image->map)
+        munmap(image->map, image->map_size);
+
+    xfree(image->programs);
+    xfree(image->names);
+    xfree(image->sources);
+    xfree(image->var_names);
+    xfree(image->owned_code);
+    xfree(image->index);
+    xfree(image);
+}
+
+const SftProgram* SftImage_find(const SftImage* image, const char* name) {
+    if(!image->index_size)
+        return 0;
+
+    size_t slot = sft_hashName(name) & (image->index_size - 1);
+
+    while(image->index[slot]) {
+        size_t i = image->index[slot] - 1;
+
+        if(!strcmp(image->names[i], name))
+            return &image->programs[i];
+
+        slot = (slot + 1) & (image->index_size - 1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,95 @@
+#ifndef _H_IMAGE_
+#define _H_IMAGE_
+
+#include "common.h"
+#include "compiler.h"
+
+#include <stdint.h>
+
+// Precompiled expression images
+// ----------------------------------------------------------------------------
+// A file of compiled programs, so formulas that are used again and again
+// don't have to be tokenized and compiled again every time a process starts.
+// Images are mapped rather than read, and programs run straight out of the
+// mapping: loading one only checks it and points SftPrograms into it.
+//
+// The layout is the header, then the program table, the function table, each
+// program's code, constants and variables, and finally the string table. All
+// integers and doubles are in the byte order of the machine that wrote the
+// image, and every section is 8 byte aligned. OP_CALL instructions number
+// functions by the image's own function table, which holds their names, so an
+// image stays valid when FN_LOOKUP changes; the code is only copied and
+// renumbered at load time in that case.
+
+#define SFT_IMAGE_MAGIC      "SFTC"
+#define SFT_IMAGE_VERSION    1
+#define SFT_IMAGE_BYTE_ORDER 0x01020304
+
+typedef struct SftImageHeader {
+    char     magic[4];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t program_count;
+    uint32_t function_count;
+    uint32_t reserved;
+
+    uint64_t programs_offset;  // SftImageProgram[program_count].
+    uint64_t functions_offset; // uint32_t string offsets[function_count].
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t file_size;
+} SftImageHeader;
+
+typedef struct SftImageProgram {
+    uint32_t name;   // String offsets.
+    uint32_t source;
+
+    uint64_t code_offset; // SftInstr[code_len].
+    uint32_t code_len;
+    uint32_t const_count;
+    uint64_t consts_offset; // double[const_count].
+    uint64_t vars_offset;   // uint32_t string offsets[var_count].
+    uint32_t var_count;
+    uint32_t max_depth;
+} SftImageProgram;
+
+typedef struct SftImage {
+    void*  map;
+    size_t map_size;
+
+    // programs[i] points into the mapping, apart from code that had to be
+    // renumbered, which is in owned_code[i].
+    size_t       count;
+    SftProgram*  programs;
+    const char** names;
+    const char** sources;
+
+    char**     var_names;
+    SftInstr** owned_code;
+
+    // Open addressing table of program index + 1 (0 is empty), keyed by name.
+    size_t* index;
+    size_t  index_size;
+} SftImage;
+
+// Writes count programs to path, replacing it atomically. names[i] is how
+// programs[i] is looked up and sources[i] its expression; either may be 0.
+// Returns FALSE and writes a message into error on failure.
+extern BOOL SftImage_write(const char*              path,
+                           const SftProgram* const* programs,
+                           const char* const*       names,
+                           const char* const*       sources,
+                           size_t                   count,
+                           SftError*                error);
+
+// Maps and checks the image at path. Returns 0 and writes a message into
+// error if it can't be read, or isn't a valid image. Every program in the
+// image is checked, so a damaged file can't make SftProgram_eval misbehave.
+extern SftImage* SftImage_open(const char* path, SftError* error);
+
+extern void SftImage_close(SftImage* image);
+
+// Returns the program called name, or 0.
+extern const SftProgram* SftImage_find(const SftImage* image, const char* name);
+
+#endif // _H_IMAGE_
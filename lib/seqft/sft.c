@@ -0,0 +1,86 @@
+#include "sft.h"
+
+#include <stdio.h>
+
+SftContext* SftContext_new() {
+    SftContext* context = xmalloc(sizeof(SftContext));
+
+    context->tokenizer    = Tokenizer_new();
+    context->sft          = Sft_new();
+    context->stripped_cap = 256;
+    context->stripped     = xmalloc(context->stripped_cap);
+
+    return context;
+}
+
+void SftContext_free(SftContext* context) {
+    if(!context)
+        return;
+
+    Tokenizer_free(context->tokenizer);
+    Sft_free(context->sft);
+    xfree(context->stripped);
+    xfree(context);
+}
+
+static BOOL Sft_fail(SftResult* result, size_t index, const char* message) {
+    result->ok          = FALSE;
+    result->value       = 0;
+    result->error_index = index;
+
+    snprintf(result->error.message, sizeof(result->error.message), "%s", message);
+    return FALSE;
+}
+
+BOOL Sft_eval(SftContext* context,
+              const char* expr,
+              size_t      len,
+              SftResult*  result) {
+
+    if(len + 1 > context->stripped_cap) {
+        while(len + 1 > context->stripped_cap) {
+            context->stripped_cap *= 2;
+        }
+
+        context->stripped = xrealloc(context->stripped, context->stripped_cap);
+    }
+
+    size_t stripped_len = filter_whitespace(expr, len, context->stripped);
+
+    if(!stripped_len) {
+        return Sft_fail(result, 0, "Invalid expression, nothing to evaluate\n\n");
+    }
+
+    Tokenizer*  t = context->tokenizer;
+    TokenArray* tokens =
+        Tokenizer_parseStripped(t, context->stripped, stripped_len);
+
+    if(t->error || !tokens) {
+        BOOL failed = Sft_fail(result,
+                               t->error ? t->error->index : 0,
+                               t->error ? t->error->message : "Invalid expression.");
+
+        TokenArray_free(tokens);
+        return failed;
+    }
+
+    // A failed evaluation can leave anything on the cellars.
+    Stack_clear(context->sft->operator_stack);
+    Stack_clear(context->sft->number_stack);
+
+    double    value = 0;
+    SftError* error = Sft_evalTokens(context->sft, tokens, &value);
+
+    TokenArray_free(tokens);
+
+    if(error) {
+        return Sft_fail(result, SIZE_MAX, error->message);
+    }
+
+    result->ok          = TRUE;
+    result->value       = value;
+    result->error_index = 0;
+    result->error.message[0] = 0;
+
+    return TRUE;
+}
@@ -0,0 +1,49 @@
+#ifndef _H_SFT_
+#define _H_SFT_
+
+#include "common.h"
+#include "evaluator.h"
+#include "tokenizer.h"
+
+#include <stdint.h>
+
+// Reentrant evaluation API
+// ----------------------------------------------------------------------------
+// For embedding seqft in threaded programs. Each thread evaluates through its
+// own SftContext; any number of contexts can be used at the same time, but a
+// context must not be used by two threads at once. Inputs are only read, and
+// each call reports its value or error in an SftResult owned by the caller.
+//
+// seqft keeps no mutable global state of its own: FN_LOOKUP is const, tokens
+// are never written to once made, and errors are per context or per call.
+// The one process wide setting is the allocator (see alloc.h), which has to be
+// picked before any threads start.
+
+typedef struct SftResult {
+    BOOL   ok;
+    double value;
+
+    // Set when ok is FALSE. error_index is the offending position in the
+    // expression with its whitespace removed, for errors found while
+    // tokenizing, and SIZE_MAX for errors found while evaluating.
+    size_t   error_index;
+    SftError error;
+} SftResult;
+
+typedef struct SftContext {
+    Tokenizer* tokenizer;
+    Sft*       sft;
+    char*      stripped;
+    size_t     stripped_cap;
+} SftContext;
+
+extern SftContext* SftContext_new();
+extern void        SftContext_free(SftContext* context);
+
+// Evaluates the first len chars of expr. Returns result->ok.
+extern BOOL Sft_eval(SftContext* context,
+                     const char* expr,
+                     size_t      len,
+                     SftResult*  result);
+
+#endif // _H_SFT_
@@ -0,0 +1,178 @@
+#include "simd.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// 16 byte vectors are the widest every target has without extra -m flags
+// (SSE2 on x86-64, NEON on arm64), so throughput comes from unrolling over
+// several independent accumulators instead.
+typedef double  f64x2 __attribute__((vector_size(16)));
+typedef int64_t i64x2 __attribute__((vector_size(16)));
+
+#define LANES 2
+#define UNROLL 4
+
+// The arguments come straight off the number cellar, which makes no alignment
+// promises, so loads go through memcpy and let the compiler pick an unaligned
+// load instruction.
+static inline f64x2 load(const double* p) {
+    f64x2 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline f64x2 splat(double d) {
+    return (f64x2) {d, d};
+}
+
+// C has no vector ternary, so select through the comparison mask instead.
+static inline f64x2 select_lt(f64x2 a, f64x2 b) {
+    i64x2 m = a < b;
+    return (f64x2)((m & (i64x2)a) | (~m & (i64x2)b));
+}
+
+static inline f64x2 select_gt(f64x2 a, f64x2 b) {
+    i64x2 m = a > b;
+    return (f64x2)((m & (i64x2)a) | (~m & (i64x2)b));
+}
+
+static inline f64x2 vabs(f64x2 a) {
+    i64x2 mask = (i64x2) {INT64_MAX, INT64_MAX};
+    return (f64x2)((i64x2)a & mask);
+}
+
+static inline double hsum(f64x2 v) {
+    return v[0] + v[1];
+}
+
+double simd_sum(const double* nums, size_t len) {
+    // Independent accumulators hide the latency of the adds.
+    f64x2  acc[UNROLL] = {splat(0), splat(0), splat(0), splat(0)};
+    size_t i           = 0;
+
+    for(; i + UNROLL * LANES <= len; i += UNROLL * LANES) {
+        for(int u = 0; u < UNROLL; ++u) {
+            acc[u] += load(nums + i + u * LANES);
+        }
+    }
+
+    double sum = hsum((acc[0] + acc[1]) + (acc[2] + acc[3]));
+
+    for(; i < len; ++i) {
+        sum += nums[i];
+    }
+
+    return sum;
+}
+
+double simd_min(const double* nums, size_t len) {
+    if(!len)
+        return NAN;
+
+    f64x2  acc = splat(nums[0]);
+    size_t i   = 0;
+
+    for(; i + LANES <= len; i += LANES) {
+        acc = select_lt(load(nums + i), acc);
+    }
+
+    double min = acc[0];
+
+    for(int l = 1; l < LANES; ++l) {
+        min = acc[l] < min ? acc[l] : min;
+    }
+
+    for(; i < len; ++i) {
+        min = nums[i] < min ? nums[i] : min;
+    }
+
+    return min;
+}
+
+double simd_max(const double* nums, size_t len) {
+    if(!len)
+        return NAN;
+
+    f64x2  acc = splat(nums[0]);
+    size_t i   = 0;
+
+    for(; i + LANES <= len; i += LANES) {
+        acc = select_gt(load(nums + i), acc);
+    }
+
+    double max = acc[0];
+
+    for(int l = 1; l < LANES; ++l) {
+        max = acc[l] > max ? acc[l] : max;
+    }
+
+    for(; i < len; ++i) {
+        max = nums[i] > max ? nums[i] : max;
+    }
+
+    return max;
+}
+
+double simd_absmax(const double* nums, size_t len) {
+    f64x2  acc = splat(0);
+    size_t i   = 0;
+
+    for(; i + LANES <= len; i += LANES) {
+        acc = select_gt(vabs(load(nums + i)), acc);
+    }
+
+    double max = 0;
+
+    for(int l = 0; l < LANES; ++l) {
+        max = acc[l] > max ? acc[l] : max;
+    }
+
+    for(; i < len; ++i) {
+        double a = fabs(nums[i]);
+        max      = a > max ? a : max;
+    }
+
+    return max;
+}
+
+double simd_sumsq(const double* nums, size_t len, double scale) {
+    f64x2  s           = splat(scale);
+    f64x2  acc[UNROLL] = {splat(0), splat(0), splat(0), splat(0)};
+    size_t i           = 0;
+
+    for(; i + UNROLL * LANES <= len; i += UNROLL * LANES) {
+        for(int u = 0; u < UNROLL; ++u) {
+            f64x2 a = load(nums + i + u * LANES) * s;
+            acc[u] += a * a;
+        }
+    }
+
+    double sum = hsum((acc[0] + acc[1]) + (acc[2] + acc[3]));
+
+    for(; i < len; ++i) {
+        double a = nums[i] * scale;
+        sum += a * a;
+    }
+
+    return sum;
+}
+
+double simd_dot(const double* a, const double* b, size_t len) {
+    f64x2  acc[UNROLL] = {splat(0), splat(0), splat(0), splat(0)};
+    size_t i           = 0;
+
+    for(; i + UNROLL * LANES <= len; i += UNROLL * LANES) {
+        for(int u = 0; u < UNROLL; ++u) {
+            acc[u] += load(a + i + u * LANES) * load(b + i + u * LANES);
+        }
+    }
+
+    double sum = hsum((acc[0] + acc[1]) + (acc[2] + acc[3]));
+
+    for(; i < len; ++i) {
+        sum += a[i] * b[i];
+    }
+
+    return sum;
+}
@@ -0,0 +1,23 @@
+#ifndef _H_SIMD_
+#define _H_SIMD_
+
+#include <stddef.h>
+
+// Reductions over contiguous arrays of doubles, written with GCC vector
+// extensions so they compile to packed SSE2/NEON arithmetic. They back the
+// aggregate functions in FN_LOOKUP, whose arguments already sit contiguously
+// on the number cellar.
+
+extern double simd_sum(const double* nums, size_t len);
+extern double simd_min(const double* nums, size_t len);
+extern double simd_max(const double* nums, size_t len);
+
+// Largest absolute value.
+extern double simd_absmax(const double* nums, size_t len);
+
+// Sum of (nums[i] * scale)^2.
+extern double simd_sumsq(const double* nums, size_t len, double scale);
+
+extern double simd_dot(const double* a, const double* b, size_t len);
+
+#endif // _H_SIMD_
@@ -0,0 +1,316 @@
+#include "solver.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+static double SftClosure_call(SftClosure* f, double x) {
+    f->vars[f->var] = x;
+    f->evaluations++;
+
+    return SftProgram_eval(f->program, f->vars);
+}
+
+static BOOL Sft_solverFail(SftClosure* f, SftSolution* out, const char* message, double x) {
+    out->evaluations = f->evaluations;
+    snprintf(out->error.message, sizeof(out->error.message), message, x);
+    return FALSE;
+}
+
+static BOOL Sft_solverDone(SftClosure* f, SftSolution* out, double value, double error_bound) {
+    out->value            = value;
+    out->error_bound      = error_bound;
+    out->evaluations      = f->evaluations;
+    out->error.message[0] = 0;
+    return TRUE;
+}
+
+// Root finding
+// ----------------------------------------------------------------------------
+
+#define SFT_SOLVE_MAX_ITERATIONS 200
+
+BOOL Sft_solve(SftClosure* f, double lo, double hi, double tol, SftSolution* out) {
+    if(tol <= 0)
+        tol = SFT_SOLVE_TOL;
+
+    f->evaluations = 0;
+
+    if(!isfinite(lo) || !isfinite(hi))
+        return Sft_solverFail(f, out, "solve: the bracket must be finite\n\n", 0);
+
+    double a  = lo, b = hi;
+    double fa = SftClosure_call(f, a);
+    double fb = SftClosure_call(f, b);
+
+    if(isnan(fa))
+        return Sft_solverFail(f, out, "solve: the function is undefined at %g\n\n", a);
+    if(isnan(fb))
+        return Sft_solverFail(f, out, "solve: the function is undefined at %g\n\n", b);
+
+    if(fa == 0)
+        return Sft_solverDone(f, out, a, 0);
+    if(fb == 0)
+        return Sft_solverDone(f, out, b, 0);
+
+    if((fa > 0) == (fb > 0))
+        return Sft_solverFail(f, out, "solve: the function has the same sign at both ends\n\n", 0);
+
+    // b is the best estimate so far, and the root stays between b and c.
+    // Each step interpolates (inverse quadratic, or secant with only two
+    // points), falling back to bisection whenever that isn't converging.
+    double c = a, fc = fa;
+    double d = b - a, e = d;
+
+    for(size_t i = 0; i < SFT_SOLVE_MAX_ITERATIONS; ++i) {
+        if((fb > 0) == (fc > 0)) {
+            c  = a;
+            fc = fa;
+            d  = e = b - a;
+        }
+
+        if(fabs(fc) < fabs(fb)) {
+            a  = b;
+            b  = c;
+            c  = a;
+            fa = fb;
+            fb = fc;
+            fc = fa;
+        }
+
+        double tol1 = 2 * DBL_EPSILON * fabs(b) + 0.5 * tol;
+        double xm   = 0.5 * (c - b);
+
+        if(fabs(xm) <= tol1 || fb == 0)
+            return Sft_solverDone(f, out, b, fabs(xm));
+
+        if(fabs(e) >= tol1 && fabs(fa) > fabs(fb)) {
+            double s = fb / fa;
+            double p, q;
+
+            if(a == c) {
+                p = 2 * xm * s;
+                q = 1 - s;
+            } else {
+                double r;
+                q = fa / fc;
+                r = fb / fc;
+                p = s * (2 * xm * q * (q - r) - (b - a) * (r - 1));
+                q = (q - 1) * (r - 1) * (s - 1);
+            }
+
+            if(p > 0)
+                q = -q;
+            p = fabs(p);
+
+            if(2 * p < fmin(3 * xm * q - fabs(tol1 * q), fabs(e * q))) {
+                e = d;
+                d = p / q;
+            } else {
+                d = e = xm;
+            }
+        } else {
+            d = e = xm;
+        }
+
+        a  = b;
+        fa = fb;
+        b += fabs(d) > tol1 ? d : copysign(tol1, xm);
+        fb = SftClosure_call(f, b);
+
+        if(isnan(fb))
+            return Sft_solverFail(f, out, "solve: the function is undefined at %g\n\n", b);
+    }
+
+    return Sft_solverFail(f, out, "solve: no convergence, last estimate %g\n\n", b);
+}
+
+// Integration
+// ----------------------------------------------------------------------------
+
+// Nodes of the 15 point Kronrod rule on [-1, 1]; the odd ones are also the
+// nodes of the 7 point Gauss rule it extends.
+static const double GK_NODES[8] = {
+    0.991455371120812639206854697526329,
+    0.949107912342758524526189684047851,
+    0.864864423359769072789712788640926,
+    0.741531185599394439863864773280788,
+    0.586087235467691130294144845693013,
+    0.405845151377397166906606412076961,
+    0.207784955007898467600689403773245,
+    0.000000000000000000000000000000000,
+};
+
+static const double K15_WEIGHTS[8] = {
+    0.022935322010529224963732008058970,
+    0.063092092629978553290700663189204,
+    0.104790010322250183839876322541518,
+    0.140653259715525918745189590510238,
+    0.169004726639267902826583426598550,
+    0.190350578064785409913256402421014,
+    0.204432940075298892414161999234649,
+    0.209482141084727828012999174891714,
+};
+
+static const double G7_WEIGHTS[4] = {
+    0.129484966168869693270611432679082,
+    0.279705391489276667901467771423780,
+    0.381830050505118944950369775488975,
+    0.417959183673469387755102040816327,
+};
+
+typedef struct GkInterval {
+    double a, b;
+    double value, error;
+} GkInterval;
+
+// Returns FALSE if f isn't finite at one of the nodes.
+static BOOL gauss_kronrod(SftClosure* f, GkInterval* in) {
+    double center = 0.5 * (in->a + in->b);
+    double half   = 0.5 * (in->b - in->a);
+
+    double fc      = SftClosure_call(f, center);
+    double kronrod = fc * K15_WEIGHTS[7];
+    double gauss   = fc * G7_WEIGHTS[3];
+
+    for(size_t i = 0; i < 7; ++i) {
+        double dx  = half * GK_NODES[i];
+        double sum = SftClosure_call(f, center - dx) + SftClosure_call(f, center + dx);
+
+        kronrod += K15_WEIGHTS[i] * sum;
+
+        if(i % 2 == 1)
+            gauss += G7_WEIGHTS[i / 2] * sum;
+    }
+
+    in->value = kronrod * half;
+    in->error = fabs((kronrod - gauss) * half);
+
+    return isfinite(in->value);
+}
+
+BOOL Sft_integrate(SftClosure* f, double a, double b, double tol, SftSolution* out) {
+    if(tol <= 0)
+        tol = SFT_INTEGRATE_TOL;
+
+    f->evaluations = 0;
+
+    if(!isfinite(a) || !isfinite(b))
+        return Sft_solverFail(f, out, "integrate: the bounds must be finite\n\n", 0);
+
+    // Integrated from the lower bound up, so the splits always have a < b,
+    // and negated if the bounds came the other way round.
+    double sign = a > b ? -1 : 1;
+
+    GkInterval intervals[SFT_INTEGRATE_MAX_INTERVALS];
+    size_t     count = 1;
+
+    intervals[0] = (GkInterval) {.a = fmin(a, b), .b = fmax(a, b)};
+
+    if(!gauss_kronrod(f, &intervals[0]))
+        return Sft_solverFail(f, out, "integrate: the function isn't finite near %g\n\n", 0.5 * (a + b));
+
+    double value = intervals[0].value;
+    double error = intervals[0].error;
+
+    while(error > fmax(tol, tol * fabs(value))) {
+        if(count == SFT_INTEGRATE_MAX_INTERVALS) {
+            return Sft_solverFail(f, out,
+                                  "integrate: no convergence, estimated error %g\n\n", error);
+        }
+
+        // Split the interval contributing the most error.
+        size_t worst = 0;
+
+        for(size_t i = 1; i < count; ++i) {
+            if(intervals[i].error > intervals[worst].error)
+                worst = i;
+        }
+
+        GkInterval left  = {.a = intervals[worst].a};
+        GkInterval right = {.b = intervals[worst].b};
+
+        left.b = right.a = 0.5 * (left.a + right.b);
+
+        if(left.b <= left.a || right.b <= right.a) {
+            return Sft_solverFail(f, out,
+                                  "integrate: no convergence, estimated error %g\n\n", error);
+        }
+
+        if(!gauss_kronrod(f, &left) || !gauss_kronrod(f, &right)) {
+            return Sft_solverFail(f, out,
+                                  "integrate: the function isn't finite near %g\n\n", left.b);
+        }
+
+        value += left.value + right.value - intervals[worst].value;
+        error += left.error + right.error - intervals[worst].error;
+
+        intervals[worst]   = left;
+        intervals[count++] = right;
+    }
+
+    // Sum again from scratch rather than trusting the running totals, which
+    // pick up rounding error from every split.
+    value = error = 0;
+
+    for(size_t i = 0; i < count; ++i) {
+        value += intervals[i].value;
+        error += intervals[i].error;
+    }
+
+    return Sft_solverDone(f, out, sign * value, error);
+}
+
+// Minimization
+// ----------------------------------------------------------------------------
+
+#define SFT_MINIMIZE_MAX_ITERATIONS 500
+
+BOOL Sft_minimize(SftClosure* f, double lo, double hi, double tol, SftSolution* out) {
+    if(tol <= 0)
+        tol = SFT_MINIMIZE_TOL;
+
+    f->evaluations = 0;
+
+    if(!isfinite(lo) || !isfinite(hi))
+        return Sft_solverFail(f, out, "minimize: the bracket must be finite\n\n", 0);
+
+    // 1 / golden ratio. Each step keeps the golden section of the bracket
+    // that holds the smaller of the two inner points, so one of them is
+    // reused and only one new evaluation is needed.
+    const double invphi = 0.6180339887498948482;
+
+    double a  = fmin(lo, hi), b = fmax(lo, hi);
+    double x1 = b - invphi * (b - a);
+    double x2 = a + invphi * (b - a);
+    double f1 = SftClosure_call(f, x1);
+    double f2 = SftClosure_call(f, x2);
+
+    // Relative to the bracket, but never finer than the spacing of doubles
+    // around it.
+    double width = tol * (b - a) + 4 * DBL_EPSILON * fmax(fabs(a), fabs(b));
+
+    for(size_t i = 0; i < SFT_MINIMIZE_MAX_ITERATIONS && b - a > width; ++i) {
+        if(isnan(f1) || isnan(f2)) {
+            return Sft_solverFail(f, out, "minimize: the function is undefined at %g\n\n",
+                                  isnan(f1) ? x1 : x2);
+        }
+
+        if(f1 < f2) {
+            b  = x2;
+            x2 = x1;
+            f2 = f1;
+            x1 = b - invphi * (b - a);
+            f1 = SftClosure_call(f, x1);
+        } else {
+            a  = x1;
+            x1 = x2;
+            f1 = f2;
+            x2 = a + invphi * (b - a);
+            f2 = SftClosure_call(f, x2);
+        }
+    }
+
+    return Sft_solverDone(f, out, f1 < f2 ? x1 : x2, b - a);
+}
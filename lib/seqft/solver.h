@@ -0,0 +1,50 @@
+#ifndef _H_SOLVER_
+#define _H_SOLVER_
+
+#include "common.h"
+#include "compiler.h"
+
+// Numeric methods over compiled programs. The function being solved is a
+// program with one of its variables left free, so every evaluation is a run
+// of SftProgram_eval, with no tokenizing or cellar shuffling: thousands of
+// evaluations cost about as much as tokenizing the expression a few times.
+
+typedef struct SftClosure {
+    const SftProgram* program;
+    double*           vars; // A binding for every program variable.
+    size_t            var;  // Index of the free one, overwritten every call.
+    size_t            evaluations;
+} SftClosure;
+
+typedef struct SftSolution {
+    double   value;       // The root, integral or minimizer.
+    double   error_bound; // Estimated absolute error of value.
+    size_t   evaluations;
+    SftError error;
+} SftSolution;
+
+// Tolerances used when 0 is passed for tol.
+#define SFT_SOLVE_TOL     1e-15 // Absolute, in x; the method adds 2 eps |x|.
+#define SFT_INTEGRATE_TOL 1e-10 // Relative to the integral, and absolute.
+#define SFT_MINIMIZE_TOL  1e-8  // Relative to the width of the bracket.
+
+// Intervals adaptive integration may split [a, b] into.
+#define SFT_INTEGRATE_MAX_INTERVALS 2000
+
+// Brent's method. Finds x in [lo, hi] with f(x) = 0; f(lo) and f(hi) must
+// have opposite signs. Returns FALSE and writes a message into out->error on
+// failure.
+extern BOOL Sft_solve(SftClosure* f, double lo, double hi, double tol, SftSolution* out);
+
+// Globally adaptive Gauss-Kronrod (G7, K15) quadrature of f over [a, b], or
+// minus that over [b, a] when a > b. The interval with the largest error
+// estimate is bisected until the total estimate is within tol. Returns FALSE
+// if f isn't finite somewhere it was sampled, or the tolerance wasn't met
+// within the interval limit.
+extern BOOL Sft_integrate(SftClosure* f, double a, double b, double tol, SftSolution* out);
+
+// Golden section search for the x in [lo, hi] where f is smallest, for f
+// unimodal on the bracket.
+extern BOOL Sft_minimize(SftClosure* f, double lo, double hi, double tol, SftSolution* out);
+
+#endif // _H_SOLVER_
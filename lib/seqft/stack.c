@@ -60,10 +60,10 @@ void Stack_free(Stack* s) {
             }
         }
 
-        free(s->base);
+        xfree(s->base);
     }
 
-    free(s);
+    xfree(s);
 }
 
 // ----------------------------------------------------------------------------
@@ -99,8 +99,10 @@ Stack* Stack_shrinkToFit(Stack* s) {
 // ----------------------------------------------------------------------------
 
 Stack* Stack_pushFrom(Stack* s, void* item) {
+    // Grow geometrically; expanding one item at a time turns large pushes
+    // (e.g. tokenizing a multi-megabyte expression) into a realloc per item.
     if(((s->count + 1) * s->item_size) > s->allocated) {
-        Stack_expandBy(s, 1);
+        Stack_expandBy(s, s->count ? s->count : 1);
     }
 
     void* dest = s->base + (s->item_size * s->count);
@@ -126,6 +128,18 @@ void* Stack_pop(Stack* s) {
     return item_copy;
 }
 
+BOOL Stack_popInto(Stack* s, void* out) {
+    if(s->count == 0)
+        return FALSE;
+
+    memcpy(out, s->head, s->item_size);
+
+    s->head -= s->item_size;
+    s->count -= 1;
+
+    return TRUE;
+}
+
 // Always reallocates Stack to fit smaller size. Does not allocate memory for
 // a copy. Will memcpy the popped item to cpyout if non-zero. Provide ptr to
 // item being popped to custom deallocator (if present). Won't realloc to 0;
@@ -165,6 +179,27 @@ void Stack_rePop(Stack* s, void* cpyout) {
     s->allocated = required_alloc;
 }
 
+// Discards up to n items from the top of the stack without copying them,
+// passing them through the custom deallocator (if present). Like Stack_pop,
+// it does not reallocate.
+void Stack_drop(Stack* s, size_t n) {
+    if(!s || !s->base)
+        return;
+
+    if(n > s->count) {
+        n = s->count;
+    }
+
+    if(s->deallocator) {
+        for(size_t i = s->count - n; i < s->count; ++i) {
+            s->deallocator(Stack_itemAt(s, i));
+        }
+    }
+
+    s->count -= n;
+    s->head = s->count ? s->base + (s->count - 1) * s->item_size : s->base;
+}
+
 // This function does not reallocate memory, not is it intended to. It simply
 // resets the stack count to 0 and sets the head to the base. To realloc the
 // stack, and free its members via the custom deallocator (if set), use the
@@ -194,7 +229,7 @@ void Stack_reClear(Stack* s) { if(!s || !s->base)
 
     // s->base      = xrealloc(s->base, required_alloc);
 
-    free(s->base);
+    xfree(s->base);
     s->base = xmalloc(required_alloc);
 
     s->allocated = required_alloc;
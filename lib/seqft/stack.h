@@ -41,6 +41,11 @@ extern Stack* Stack_pushFrom(Stack* s, void* item);
 // not considered anymore, and is overwritten if a new item is pushed.
 extern void* Stack_pop(Stack* s);
 
+// Same as Stack_pop, but copies the item into out rather than into newly
+// allocated memory. Returns FALSE, leaving out untouched, if the stack is
+// empty.
+extern BOOL Stack_popInto(Stack* s, void* out);
+
 // Always reallocates Stack to fit smaller size. Does not allocate memory for
 // a copy. Will memcpy the popped item to cpyout if non-zero. Provide ptr to
 // item being popped to custom deallocator (if present). Won't realloc to 0;
@@ -48,6 +53,11 @@ extern void* Stack_pop(Stack* s);
 // default_capacity is not specified/zero, defaults to STACK_DEFAULT_ALLOC.
 extern void Stack_rePop(Stack* s, void* cpyout);
 
+// Discards up to n items from the top of the stack without copying them,
+// passing them through the custom deallocator (if present). Like Stack_pop,
+// it does not reallocate.
+extern void Stack_drop(Stack* s, size_t n);
+
 // This function does not reallocate memory, not is it intended to. It simply
 // resets the stack count to 0 and sets the head to the base. To realloc the
 // stack, and free its members via the custom deallocator (if set), use the
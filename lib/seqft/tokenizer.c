@@ -2,9 +2,11 @@
 #include "common.h"
 #include "stack.h"
 #include <ctype.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 /*  Rules:
  *
@@ -76,63 +78,66 @@
  *         - Always: add the token for the operator, if it's a valid operator.
  * */
 
-char* Token_toString(Token* token) {
-    memset(token->str, 0, sizeof(token->str));
+char* Token_toString(const Token* token, char* dest) {
+    memset(dest, 0, TOKEN_STRING_SIZE);
 
     if(token->type == TT_OPA && token->func) {
-        memcpy(token->str, token->func, strlen(token->func));
-        token->str[strlen(token->func)] = '(';
+        snprintf(dest, TOKEN_STRING_SIZE, "%s(", token->func);
     }
 
     else if(token->type == TT_NUM) {
-        snprintf(token->str, sizeof(token->str), "%.2f", token->f64);
+        snprintf(dest, TOKEN_STRING_SIZE, "%.2f", token->f64);
+    }
+
+    else if(token->type == TT_VAR && token->func) {
+        snprintf(dest, TOKEN_STRING_SIZE, "%s", token->func);
     }
 
     else if(token->type == TT_ADD) {
-        token->str[0] = '+';
+        dest[0] = '+';
     }
 
     else if(token->type == TT_COM) {
-        token->str[0] = ',';
+        dest[0] = ',';
     }
 
     else if(token->type == TT_SUB) {
-        token->str[0] = '-';
+        dest[0] = '-';
     }
 
     else if(token->type == TT_DIV) {
-        token->str[0] = '/';
+        dest[0] = '/';
     }
 
     else if(token->type == TT_MOD) {
-        token->str[0] = '%';
+        dest[0] = '%';
     }
 
     else if(token->type == TT_MUL) {
-        token->str[0] = '*';
+        dest[0] = '*';
     }
 
     else if(token->type == TT_POW) {
-        token->str[0] = '^';
+        dest[0] = '^';
     }
 
     else if(token->type == TT_NEG) {
-        token->str[0] = '~';
+        dest[0] = '~';
     }
 
     else if(token->type == TT_OPA) {
-        token->str[0] = '(';
+        dest[0] = '(';
     }
 
     else if(token->type == TT_CPA) {
-        token->str[0] = ')';
+        dest[0] = ')';
     }
 
     else {
-        token->str[0] = '?';
+        dest[0] = '?';
     }
 
-    return token->str;
+    return dest;
 }
 
 void Token_print(Token* t) {
@@ -143,14 +148,19 @@ void Token_print(Token* t) {
            t->f64,
            t->func ? t->func : "null");
 
-    free(b);
+    xfree(b);
 }
 
 void Token_freeMembers(Token* t) {
     if(t && t->func) {
-        free(t->func);
+        xfree(t->func);
         t->func = 0;
     }
+
+    if(t && t->lit) {
+        xfree(t->lit);
+        t->lit = 0;
+    }
 }
 
 void TokenArray_freeMembers(TokenArray* t) {
@@ -159,14 +169,14 @@ void TokenArray_freeMembers(TokenArray* t) {
             Token_freeMembers(&t->tokens[i]);
         }
 
-        free(t->tokens);
+        xfree(t->tokens);
     }
 }
 
 void TokenArray_free(TokenArray* t) {
     if(t) {
         TokenArray_freeMembers(t);
-        free(t);
+        xfree(t);
     }
 }
 
@@ -193,6 +203,9 @@ char* TokenType_toString(TokenType ttype) {
         case TT_NUM:
             sprintf(buffer, "Number");
             break;
+        case TT_VAR:
+            sprintf(buffer, "Variable");
+            break;
         case TT_ADD:
             sprintf(buffer, "Operator [ + ]");
             break;
@@ -220,6 +233,9 @@ char* TokenType_toString(TokenType ttype) {
         case TT_CPA:
             sprintf(buffer, "Operator [ ) ]");
             break;
+        case TT_COM:
+            sprintf(buffer, "Separator [ , ]");
+            break;
         default:
             sprintf(buffer, "Unknown Token Type: %b", ttype);
             break;
@@ -251,7 +267,7 @@ Tokenizer* Tokenizer_new() {
     t->tt_map['^'] = TT_POW;
     t->tt_map['~'] = TT_NEG;
     t->tt_map['('] = TT_OPA;
-    t->tt_map[','] = TT_OPA;
+    t->tt_map[','] = TT_COM;
     t->tt_map[')'] = TT_CPA;
 
     return t;
@@ -262,10 +278,10 @@ void Tokenizer_free(Tokenizer* t) {
         Stack_free(t->tokens);
         Stack_free(t->stacc);
         if(t->error) {
-            free(t->error);
+            xfree(t->error);
             t->error = 0;
         }
-        free(t);
+        xfree(t);
     }
 }
 
@@ -279,7 +295,7 @@ void Tokenizer_addToken(Tokenizer* t, Token* token) {
 
         if(token_str) {
             printf("Added token to stack %s\n", token_str);
-            free(token_str);
+            xfree(token_str);
         }
     }
 #endif
@@ -287,14 +303,17 @@ void Tokenizer_addToken(Tokenizer* t, Token* token) {
     t->accfl = ACC_NIL;
 }
 
+// Keeps the stacks' memory, so a tokenizer kept for many expressions doesn't
+// allocate anything for each one once it has seen the longest.
 void Tokenizer_clear(Tokenizer* t) {
-    Stack_reClear(t->tokens);
-    Stack_reClear(t->stacc);
+    Stack_drop(t->tokens, Stack_getCount(t->tokens));
+    Stack_clear(t->tokens);
+    Stack_clear(t->stacc);
 
     t->accfl = ACC_NIL;
 
     if(t->error) {
-        free(t->error);
+        xfree(t->error);
         t->error = 0;
     }
 }
@@ -303,7 +322,7 @@ void Tokenizer_error(Tokenizer* t, const char* message, size_t expr_index) {
     IterErr error = {.message = message, .index = expr_index};
 
     if(t->error) {
-        free(t->error);
+        xfree(t->error);
         t->error = 0;
     }
 
@@ -353,6 +372,12 @@ BOOL Tokenizer_parseAccNum(Tokenizer* t) {
 
     memcpy(buffer, begin, len);
 
+    if(t->keep_literals) {
+        token.lit = (char*)xmalloc(count + 1);
+        memcpy(token.lit, base_ptr, count);
+        token.lit[count] = '\0';
+    }
+
     if(is_float) {
         token.f64 = atof(buffer);
     } else {
@@ -363,6 +388,17 @@ BOOL Tokenizer_parseAccNum(Tokenizer* t) {
     return 0;
 }
 
+void Tokenizer_parseAccVar(Tokenizer* t) {
+    size_t count = Stack_getCount(t->stacc);
+    Token  token = {.type = TT_VAR, .f64 = 0, .func = 0};
+
+    token.func = (char*)xmalloc(count + 1);
+    memcpy(token.func, Stack_getBase(t->stacc), count);
+    token.func[count] = '\0';
+
+    Tokenizer_addToken(t, &token);
+}
+
 TokenArray* Tokenizer_parse(Tokenizer* t, const char* cexpr, size_t expr_len) {
     Tokenizer_clear(t);
 
@@ -380,10 +416,18 @@ TokenArray* Tokenizer_parse(Tokenizer* t, const char* cexpr, size_t expr_len) {
              cexpr,
              strlen(cexpr));
 
-    for(int i = 0; i < expr_len; ++i) {
+    return Tokenizer_parseStripped(t, expr, expr_len);
+}
+
+TokenArray* Tokenizer_parseStripped(Tokenizer* t,
+                                    const char* expr,
+                                    size_t      expr_len) {
+    Tokenizer_clear(t);
+
+    for(size_t i = 0; i < expr_len; ++i) {
         char c = expr[i];
 
-        TokenType op = t->tt_map[c];
+        TokenType op = t->tt_map[(unsigned char)c];
 
         // It's an operator. Parse the accumulator, and add the operator token.
         // ------------------------------------------------------------------------
@@ -395,14 +439,18 @@ TokenArray* Tokenizer_parse(Tokenizer* t, const char* cexpr, size_t expr_len) {
                 token.func, Stack_getBase(t->stacc), Stack_getCount(t->stacc));
 
             Tokenizer_addToken(t, &token);
-        } else if(op & (TT_OPS | TT_PAS) && t->accfl & ACC_NUM) {
+        } else if(op & TT_DEL && t->accfl & ACC_FUN) {
+            // A name that isn't followed by ( is a variable.
+            Tokenizer_parseAccVar(t);
+            Tokenizer_addToken(t, &(Token) {.type = op, .f64 = 0, .func = 0});
+        } else if(op & TT_DEL && t->accfl & ACC_NUM) {
             // Returns non-zero on error.
             if(Tokenizer_parseAccNum(t)) {
                 return 0;
             }
 
             Tokenizer_addToken(t, &(Token) {.type = op, .f64 = 0, .func = 0});
-        } else if(op & (TT_OPS | TT_PAS)) {
+        } else if(op & TT_DEL) {
             Token token = {.type = op, .f64 = 0, .func = 0};
             Tokenizer_addToken(t, &token);
         }
@@ -469,7 +517,7 @@ TokenArray* Tokenizer_parse(Tokenizer* t, const char* cexpr, size_t expr_len) {
             // this must be decimal, in which case a leading zero is illegal.
             if(t->accfl & ACC_DTZ) {
                 Tokenizer_error(
-                    t, "Leading zero in number is illegal in this context.", 0);
+                    t, "Leading zero in number is illegal in this context.", i);
                 return 0;
             }
 
@@ -484,27 +532,17 @@ TokenArray* Tokenizer_parse(Tokenizer* t, const char* cexpr, size_t expr_len) {
         }
     }
 
-    // If there's any remaining elements in the accumulator, and
-    // a function is being accumulated, then that's an error, since an open
-    // paren is needed to complete it.
-    //
-    // A number is fine though.
+    // If there's any remaining elements in the accumulator, then it's either
+    // a number, or a name with no opening parenthesis, i.e. a variable.
 
     if(!Stack_empty(t->stacc)) {
         if(t->accfl & ACC_FUN) {
-            Tokenizer_error(
-                t, "Function with no opening parenthesis.", expr_len);
-            return 0;
+            Tokenizer_parseAccVar(t);
         } else if(t->accfl & ACC_NUM) {
             Tokenizer_parseAccNum(t);
         }
     }
 
-    if(t->accfl & ACC_FUN) {
-        Tokenizer_error(t, "Function with no opening parenthesis.", expr_len);
-        return 0;
-    }
-
     TokenArray* tkr = csrxmalloc(sizeof(TokenArray));
 
     size_t item_size  = Stack_getItemSize(t->tokens);
@@ -516,7 +554,7 @@ TokenArray* Tokenizer_parse(Tokenizer* t, const char* cexpr, size_t expr_len) {
     tkr->tokens = csrxmalloc(mem_to_copy);
     memcpy(tkr->tokens, base_ptr, mem_to_copy);
 
-    for(int i = 0; i < item_count; ++i) {
+    for(size_t i = 0; i < item_count; ++i) {
         Token* t = &tkr->tokens[i];
         if(t->func) {
             size_t func_len = strlen(t->func);
@@ -525,12 +563,184 @@ TokenArray* Tokenizer_parse(Tokenizer* t, const char* cexpr, size_t expr_len) {
             memcpy(new_func, t->func, func_len);
             t->func = new_func;
         }
+
+        if(t->lit) {
+            size_t lit_len = strlen(t->lit);
+            char*  new_lit = csrxmalloc(lit_len + 1);
+            memcpy(new_lit, t->lit, lit_len + 1);
+            t->lit = new_lit;
+        }
     }
 
     tkr->count = item_count;
 
-    Stack_reClear(t->tokens);
-    Stack_reClear(t->stacc);
+    Stack_drop(t->tokens, item_count);
+    Stack_clear(t->stacc);
+
+    return tkr;
+}
+
+// Parallel tokenization
+// ----------------------------------------------------------------------------
+
+typedef struct TokenizerChunk {
+    const char* expr;
+    size_t      offset;
+    size_t      len;
+    Tokenizer*  tokenizer;
+    TokenArray* tokens;
+} TokenizerChunk;
+
+static void* Tokenizer_parseChunk(void* arg) {
+    TokenizerChunk* chunk = arg;
+
+    chunk->tokens = Tokenizer_parseStripped(
+        chunk->tokenizer, chunk->expr + chunk->offset, chunk->len);
+
+    return 0;
+}
+
+// Every operator or parenthesis flushes whatever is being accumulated, so the
+// tokenizer is always back in the ACC_NIL state right after one. That makes the
+// position following such a character a safe place to cut the expression.
+static size_t Tokenizer_nextBoundary(Tokenizer* t,
+                                     const char* expr,
+                                     size_t      from,
+                                     size_t      expr_len) {
+    for(size_t i = from; i < expr_len; ++i) {
+        if(t->tt_map[(unsigned char)expr[i]] & TT_DEL) {
+            return i + 1;
+        }
+    }
+
+    return expr_len;
+}
+
+TokenArray* Tokenizer_parseParallel(Tokenizer*  t,
+                                    const char* cexpr,
+                                    size_t      expr_len,
+                                    size_t      threads) {
+    if(expr_len < TOKENIZER_PARALLEL_THRESHOLD) {
+        return Tokenizer_parse(t, cexpr, expr_len);
+    }
+
+    Tokenizer_clear(t);
+
+    // Too large to strip on the stack like Tokenizer_parse does.
+    char* expr = xmalloc(expr_len + 1);
+    expr_len   = filter_whitespace(cexpr, expr_len, expr);
+
+    if(!expr_len) {
+        perror("Could not filter whitespace from expression!\n");
+        abort();
+    }
+
+    if(!threads) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads     = online > 0 ? (size_t)online : 1;
+    }
+
+    // Don't bother splitting into chunks smaller than the threshold.
+    size_t max_chunks = expr_len / (TOKENIZER_PARALLEL_THRESHOLD / 4) + 1;
+
+    if(threads > max_chunks) {
+        threads = max_chunks;
+    }
+
+    TokenizerChunk* chunks = xmalloc(sizeof(TokenizerChunk) * threads);
+    size_t          count  = 0;
+    size_t          begin  = 0;
+
+    while(begin < expr_len) {
+        size_t target = (expr_len / threads) * (count + 1);
+        size_t end    = count + 1 == threads
+                            ? expr_len
+                            : Tokenizer_nextBoundary(
+                               t, expr, target > begin ? target : begin,
+                               expr_len);
+
+        chunks[count] = (TokenizerChunk) {
+            .expr      = expr,
+            .offset    = begin,
+            .len       = end - begin,
+            .tokenizer = Tokenizer_new(),
+            .tokens    = 0,
+        };
+
+        chunks[count].tokenizer->keep_literals = t->keep_literals;
+
+        ++count;
+        begin = end;
+    }
+
+    pthread_t workers[count];
+    BOOL      spawned[count];
+
+    // The first chunk is tokenized on the calling thread.
+    for(size_t i = 1; i < count; ++i) {
+        spawned[i] = !pthread_create(
+            &workers[i], 0, Tokenizer_parseChunk, &chunks[i]);
+
+        if(!spawned[i]) {
+            Tokenizer_parseChunk(&chunks[i]);
+        }
+    }
+
+    Tokenizer_parseChunk(&chunks[0]);
+
+    for(size_t i = 1; i < count; ++i) {
+        if(spawned[i]) {
+            pthread_join(workers[i], 0);
+        }
+    }
+
+    // Report the leftmost error, as the serial tokenizer would have stopped
+    // there, with its index translated back into the whole expression.
+    size_t total = 0;
+
+    for(size_t i = 0; i < count; ++i) {
+        Tokenizer* ct = chunks[i].tokenizer;
+
+        if(ct->error && !t->error) {
+            Tokenizer_error(
+                t, ct->error->message, ct->error->index + chunks[i].offset);
+        }
+
+        if(chunks[i].tokens) {
+            total += chunks[i].tokens->count;
+        }
+    }
+
+    TokenArray* tkr = 0;
+
+    if(!t->error) {
+        tkr         = csrxmalloc(sizeof(TokenArray));
+        tkr->tokens = csrxmalloc(sizeof(Token) * (total ? total : 1));
+        tkr->count  = 0;
+
+        // Token ownership (including func strings) moves into the stitched
+        // array, so only the chunk arrays themselves are freed.
+        for(size_t i = 0; i < count; ++i) {
+            TokenArray* part = chunks[i].tokens;
+
+            memcpy(tkr->tokens + tkr->count,
+                   part->tokens,
+                   sizeof(Token) * part->count);
+
+            tkr->count += part->count;
+            xfree(part->tokens);
+            xfree(part);
+            chunks[i].tokens = 0;
+        }
+    }
+
+    for(size_t i = 0; i < count; ++i) {
+        TokenArray_free(chunks[i].tokens);
+        Tokenizer_free(chunks[i].tokenizer);
+    }
+
+    xfree(chunks);
+    xfree(expr);
 
     return tkr;
 }
@@ -9,7 +9,8 @@
 //  - Number accumulation.
 //  - Number base determination.
 //  - Function name accumulation & association with ( left parenthesis.
-//    * In the future, functions with multiple arguments.
+//    * A name that isn't followed by ( becomes a TT_VAR token instead.
+//    * Arguments are separated by , (TT_COM).
 //
 //  The state of the accumulator has to be checked for every charater in the
 //  expression to ensure the character is compliant with the rules of what is
@@ -38,6 +39,7 @@ typedef enum {
     TT_MUL = 0x00000020, //: *
     TT_POW = 0x00000040, //: ^
     TT_NEG = 0x00000080, //: ~  UNARY
+    TT_VAR = 0x00000100, //: Name not followed by (
     TT_COM = 0x00010000, //: ,
     TT_OPA = 0x00100000, //: (
     TT_CPA = 0x00200000, //: )
@@ -46,13 +48,22 @@ typedef enum {
     TT_BOP = TT_ADD | TT_SUB | TT_DIV | TT_MOD | TT_MUL | TT_POW,
     TT_OPS = TT_UOP | TT_BOP,
     TT_PAS = TT_OPA | TT_CPA,
+    TT_DEL = TT_OPS | TT_PAS | TT_COM, // Anything that ends an accumulation.
 } TokenType;
 
 typedef struct Token {
     TokenType type;
     double    f64;
     char*     func;
-    char      str[256];
+
+    // The number exactly as written, including any base prefix. Only set when
+    // the tokenizer's keep_literals flag is, since most callers just need f64.
+    char* lit;
+
+    // Set on open parens pushed onto the operator cellar: the depth of the
+    // number cellar at that point, so that a function's argument count is
+    // known once its close paren is reached.
+    size_t depth;
 } Token;
 
 typedef enum {
@@ -75,7 +86,13 @@ typedef struct {
     size_t count;
 } TokenArray;
 
-extern char* Token_toString(Token* token);
+// Room Token_toString needs. Longer function names are cut short.
+#define TOKEN_STRING_SIZE 64
+
+// Writes a short representation of the token, like "+" or "sum(", into dest,
+// which must have room for TOKEN_STRING_SIZE chars, and returns dest. Only
+// reads the token, so tokens can be shared between threads.
+extern char* Token_toString(const Token* token, char* dest);
 
 extern void Token_print(Token* t);
 
@@ -91,6 +108,10 @@ typedef struct Tokenizer {
     Stack*    stacc; // haha, get it?... I'll see myself out.
     Stack*    tokens;
     IterErr*  error;
+
+    // Copy the source text of every number into Token.lit, for callers (like
+    // integer mode) that can't afford the precision lost converting to f64.
+    BOOL keep_literals;
 } Tokenizer;
 
 // Returns a newly allocated string representing the token. Caller responsible
@@ -101,7 +122,30 @@ extern Tokenizer*  Tokenizer_new();
 extern TokenArray* Tokenizer_parse(Tokenizer*  t,
                                    const char* cexpr,
                                    size_t      expr_len);
+
+// Same as Tokenizer_parse, but expects an expression that has already been
+// stripped of whitespace, and doesn't make a copy of it.
+extern TokenArray* Tokenizer_parseStripped(Tokenizer*  t,
+                                           const char* expr,
+                                           size_t      expr_len);
+
+// Expressions shorter than this are always tokenized serially; splitting them
+// costs more than it saves.
+#define TOKENIZER_PARALLEL_THRESHOLD (256 * 1024)
+
+// Tokenizes very large expressions by cutting the stripped expression into
+// chunks right after operator characters, tokenizing the chunks on separate
+// threads, and stitching the results back into one TokenArray. Passing 0 for
+// threads uses one thread per online CPU. Errors are reported through t->error
+// exactly like Tokenizer_parse, with indices into the whole stripped
+// expression. Falls back to Tokenizer_parse below the threshold.
+extern TokenArray* Tokenizer_parseParallel(Tokenizer*  t,
+                                           const char* cexpr,
+                                           size_t      expr_len,
+                                           size_t      threads);
+
 extern BOOL        Tokenizer_parseAccNum(Tokenizer* t);
+extern void        Tokenizer_parseAccVar(Tokenizer* t);
 extern void        Tokenizer_error(Tokenizer*  t,
                                    const char* message,
                                    size_t      expr_index);
@@ -1,11 +1,26 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lib/seqft/alloc.h"
+#include "console.h"
 
 // Forward declaration of kernel_main function
 // This is so I don't have to make a header file cuz I hate header files
 int kernel_main();
+int kernel_script(const char* path);
+
+// Same deal, from src/programs/batch.h
+long calculator_batch(const char* path, size_t jobs);
+
+// And from src/programs/server.h
+int calculator_serve(const char* path, const char* ring, const char* programs);
+
+// And src/programs/compile.h
+long calculator_compile(const char* input, const char* output);
 
 int bootloader() {
-    printf("Booting...\n");
+    console_literal(console, "Booting...\n");
     kernel_main();
     return 0;
 }
@@ -13,6 +28,63 @@ int bootloader() {
 // Pretend this doesnt exist
 // When I tried setting the entry point to bootloader it didnt work
 // So I just made this I guess
-int main() {
+//
+// "Neptune --batch [file] [--jobs N]" skips booting and evaluates every line
+// of the file (or of stdin) with the calculator, for scripts and nightly jobs.
+// "Neptune --serve [socket] [--ring name] [--programs image]" answers the same
+// requests over a UNIX socket, and over shared memory rings for clients on the
+// same host. "Neptune --compile formulas image" precompiles formulas for it.
+// "Neptune --script [file]" runs shell commands from the file (or stdin)
+// with no prompts.
+int main(int argc, char** argv) {
+    // Has to happen before anything is allocated.
+    alloc_set(&ALLOCATOR_CACHED);
+
+    if (argc > 1 && strcmp(argv[1], "--batch") == 0) {
+        const char* path = 0;
+        size_t      jobs = 0;
+
+        for (int i = 2; i < argc; i++) {
+            if ((strcmp(argv[i], "--jobs") == 0 || strcmp(argv[i], "-j") == 0) && i + 1 < argc) {
+                jobs = strtoul(argv[++i], 0, 10);
+            } else {
+                path = argv[i];
+            }
+        }
+
+        return calculator_batch(path, jobs) == 0 ? 0 : 1;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--serve") == 0) {
+        const char* path     = 0;
+        const char* ring     = 0;
+        const char* programs = 0;
+
+        for (int i = 2; i < argc; i++) {
+            if (strcmp(argv[i], "--ring") == 0 && i + 1 < argc) {
+                ring = argv[++i];
+            } else if (strcmp(argv[i], "--programs") == 0 && i + 1 < argc) {
+                programs = argv[++i];
+            } else {
+                path = argv[i];
+            }
+        }
+
+        return calculator_serve(path, ring, programs) == 0 ? 0 : 1;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--script") == 0) {
+        return kernel_script(argc > 2 ? argv[2] : 0) == 0 ? 0 : 1;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--compile") == 0) {
+        if (argc != 4) {
+            fprintf(stderr, "usage: %s --compile formulas image\n", argv[0]);
+            return 2;
+        }
+
+        return calculator_compile(argv[2], argv[3]) == 0 ? 0 : 1;
+    }
+
     return bootloader();
 }
\ No newline at end of file
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "commands.h"
+
+// Every command, in registration order. Pointers into this are handed out,
+// so it's a list of separate allocations rather than one growing array.
+static Command** commands;
+static size_t    commands_len;
+static size_t    commands_cap;
+
+// Open addressing table from names (and aliases) to commands.
+typedef struct CommandSlot {
+    const char* name; // 0 for empty.
+    Command*    command;
+} CommandSlot;
+
+static CommandSlot* table;
+static size_t       table_size;
+static size_t       table_used;
+
+static CommandSlot* command_slot(const char* name) {
+    size_t mask = table_size - 1;
+    size_t slot = sft_hashName(name) & mask;
+
+    while (table[slot].name && strcmp(table[slot].name, name) != 0) {
+        slot = (slot + 1) & mask;
+    }
+
+    return &table[slot];
+}
+
+// Keeps the table at most half full, so probes stay short.
+static void command_reserve() {
+    if ((table_used + 1) * 2 <= table_size) return;
+
+    CommandSlot* old      = table;
+    size_t       old_size = table_size;
+
+    table_size = table_size ? table_size * 2 : 64;
+    table      = xmalloc(sizeof(CommandSlot) * table_size);
+    memset(table, 0, sizeof(CommandSlot) * table_size);
+
+    for (size_t i = 0; i < old_size; i++) {
+        if (old[i].name) *command_slot(old[i].name) = old[i];
+    }
+
+    xfree(old);
+}
+
+static void command_bind(const char* name, Command* command) {
+    command_reserve();
+
+    CommandSlot* slot = command_slot(name);
+
+    if (!slot->name) {
+        slot->name = name;
+        table_used++;
+    }
+
+    slot->command = command;
+}
+
+void command_register(const char* name, const char* help, CommandFn fn) {
+    if (table_size) {
+        CommandSlot* existing = command_slot(name);
+
+        if (existing->name && strcmp(existing->command->name, name) == 0) {
+            existing->command->help = help;
+            existing->command->fn   = fn;
+            return;
+        }
+    }
+
+    if (commands_len == commands_cap) {
+        commands_cap = commands_cap ? commands_cap * 2 : 16;
+        commands     = xrealloc(commands, sizeof(Command*) * commands_cap);
+    }
+
+    Command* command = xmalloc(sizeof(Command));
+
+    command->name = name;
+    command->help = help;
+    command->fn   = fn;
+
+    commands[commands_len++] = command;
+    command_bind(name, command);
+}
+
+BOOL command_alias(const char* alias, const char* name) {
+    const Command* command = command_find(name);
+    if (!command) return FALSE;
+
+    command_bind(alias, (Command*)command);
+    return TRUE;
+}
+
+const Command* command_find(const char* name) {
+    if (!table_size) return 0;
+    return command_slot(name)->command;
+}
+
+size_t command_count() {
+    return commands_len;
+}
+
+const Command* command_at(size_t i) {
+    return i < commands_len ? commands[i] : 0;
+}
+
+size_t command_aliases(const Command* command, char* dest, size_t size) {
+    size_t count = 0;
+    size_t at    = 0;
+
+    if (size) dest[0] = 0;
+
+    for (size_t i = 0; i < table_size; i++) {
+        if (!table[i].name || table[i].command != command || table[i].name == command->name) continue;
+
+        int n = snprintf(at < size ? dest + at : 0, at < size ? size - at : 0,
+                         "%s%s", count ? ", " : "", table[i].name);
+        at += (size_t)n;
+        count++;
+    }
+
+    return count;
+}
+
+BOOL command_dispatch(Shell* shell, char* line) {
+    char*  words[COMMAND_INLINE_ARGS + 1];
+    char** argv     = words;
+    int    argc     = 0;
+    int    capacity = COMMAND_INLINE_ARGS;
+
+    for (char* c = line; *c;) {
+        while (isspace((unsigned char)*c)) c++;
+        if (!*c) break;
+
+        if (argc == capacity) {
+            char** grown = xmalloc(sizeof(char*) * ((size_t)capacity * 2 + 1));
+            memcpy(grown, argv, sizeof(char*) * (size_t)argc);
+
+            if (argv != words) xfree(argv);
+            argv      = grown;
+            capacity *= 2;
+        }
+
+        argv[argc++] = c;
+
+        while (*c && !isspace((unsigned char)*c)) c++;
+        if (*c) *c++ = 0;
+    }
+
+    argv[argc] = 0;
+
+    const Command* command = 0;
+
+    if (argc) {
+        for (char* c = argv[0]; *c; c++) {
+            *c = (char)tolower((unsigned char)*c);
+        }
+
+        command = command_find(argv[0]);
+        if (command) command->fn(shell, argc, argv);
+    }
+
+    if (argv != words) xfree(argv);
+
+    return !argc || command;
+}
@@ -0,0 +1,60 @@
+#ifndef COMMANDS_H
+#define COMMANDS_H
+
+#include "../lib/seqft/common.h"
+#include "process.h"
+
+// The terminal's command registry. Commands are registered by name at
+// startup and looked up through an open addressing hash table, so dispatch
+// costs the same however many commands there are. A command can have any
+// number of aliases, which share its entry.
+
+// What every command gets to work with.
+typedef struct Shell {
+    ProcessTable* processes; // The shell itself is the current process.
+    int           maxthreadsperprocess;
+
+    // FALSE when running a script: commands mustn't prompt for anything.
+    BOOL interactive;
+} Shell;
+
+// argv[0] is the name the command was invoked by, lowercased.
+typedef void (*CommandFn)(Shell* shell, int argc, char** argv);
+
+typedef struct Command {
+    const char* name;
+    const char* help;
+    CommandFn   fn;
+} Command;
+
+// Lines with more words than this have their argv allocated rather than on
+// the stack; there's no limit.
+#define COMMAND_INLINE_ARGS 64
+
+// Registers a command. The strings are kept, not copied, so they have to
+// live for the rest of the program, like literals. Registering a name again
+// replaces its command.
+extern void command_register(const char* name, const char* help, CommandFn fn);
+
+// Makes alias another name for the command called name. Returns FALSE if
+// there's no such command.
+extern BOOL command_alias(const char* alias, const char* name);
+
+// Returns the command called name, or reached by that alias, or 0.
+extern const Command* command_find(const char* name);
+
+// Number of commands registered, not counting aliases, and the i-th of them
+// in registration order.
+extern size_t         command_count();
+extern const Command* command_at(size_t i);
+
+// Writes the aliases of command into dest, separated by ", ". Returns how
+// many there were.
+extern size_t command_aliases(const Command* command, char* dest, size_t size);
+
+// Splits line into words, in place, and runs the command named by the first.
+// Returns FALSE if there's no such command; an empty line does nothing and
+// returns TRUE.
+extern BOOL command_dispatch(Shell* shell, char* line);
+
+#endif // COMMANDS_H
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "console.h"
+
+static Console stdout_console = {.fd = STDOUT_FILENO};
+
+__thread Console* console = &stdout_console;
+
+static void console_flushAtExit() {
+    console_flush(&stdout_console);
+}
+
+void console_init(Console* c, int fd) {
+    c->fd     = fd;
+    c->count  = 0;
+    c->used   = 0;
+    c->writes = 0;
+}
+
+void console_flush(Console* c) {
+    struct iovec iov[CONSOLE_MAX_PIECES];
+    size_t       first = 0;
+
+    for (size_t i = 0; i < c->count; i++) {
+        iov[i].iov_base = (void*)(c->pieces[i].data ? c->pieces[i].data : c->buffer + c->pieces[i].offset);
+        iov[i].iov_len  = c->pieces[i].len;
+    }
+
+    while (first < c->count) {
+        ssize_t n = writev(c->fd, iov + first, (int)(c->count - first));
+        c->writes++;
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break; // Nowhere to put it; drop it rather than spin.
+        }
+
+        // Skip whatever was written, which may end part way into a piece.
+        while (first < c->count && (size_t)n >= iov[first].iov_len) {
+            n -= (ssize_t)iov[first++].iov_len;
+        }
+
+        if (first < c->count) {
+            iov[first].iov_base = (char*)iov[first].iov_base + n;
+            iov[first].iov_len -= (size_t)n;
+        }
+    }
+
+    c->count = 0;
+    c->used  = 0;
+}
+
+// Makes room for one more piece.
+static void console_reserve(Console* c) {
+    static BOOL registered = FALSE;
+
+    if (!registered && c == &stdout_console) {
+        atexit(console_flushAtExit);
+        registered = TRUE;
+    }
+
+    if (c->count == CONSOLE_MAX_PIECES) {
+        console_flush(c);
+    }
+}
+
+// Only called after console_reserve, so that a flush can't happen between
+// writing to the buffer and adding the piece for it.
+static void console_addBuffered(Console* c, size_t offset, size_t len) {
+    // Text formatted right after the last piece just makes it longer.
+    if (c->count && !c->pieces[c->count - 1].data &&
+        c->pieces[c->count - 1].offset + c->pieces[c->count - 1].len == offset) {
+        c->pieces[c->count - 1].len += len;
+        return;
+    }
+
+    c->pieces[c->count].data   = 0;
+    c->pieces[c->count].offset = offset;
+    c->pieces[c->count].len    = len;
+    c->count++;
+}
+
+void console_literal(Console* c, const char* s) {
+    console_reserve(c);
+
+    c->pieces[c->count].data   = s;
+    c->pieces[c->count].offset = 0;
+    c->pieces[c->count].len    = strlen(s);
+    c->count++;
+}
+
+void console_write(Console* c, const char* data, size_t len) {
+    console_reserve(c);
+
+    if (len > CONSOLE_BUFFER_SIZE - c->used) {
+        console_flush(c);
+
+        // Too big to buffer at all: send it along with nothing else.
+        if (len > CONSOLE_BUFFER_SIZE) {
+            c->pieces[0].data = data;
+            c->pieces[0].len  = len;
+            c->count          = 1;
+            console_flush(c);
+            return;
+        }
+    }
+
+    memcpy(c->buffer + c->used, data, len);
+    console_addBuffered(c, c->used, len);
+    c->used += len;
+}
+
+void console_vprintf(Console* c, const char* format, va_list args) {
+    va_list again;
+    va_copy(again, args);
+
+    console_reserve(c);
+
+    size_t room = CONSOLE_BUFFER_SIZE - c->used;
+    int    n    = vsnprintf(c->buffer + c->used, room, format, args);
+
+    if (n >= 0 && (size_t)n < room) {
+        console_addBuffered(c, c->used, (size_t)n);
+        c->used += (size_t)n;
+    } else if (n >= 0) {
+        // Didn't fit in what was left; format it again somewhere it does.
+        char* text = xmalloc((size_t)n + 1);
+        vsnprintf(text, (size_t)n + 1, format, again);
+        console_write(c, text, (size_t)n);
+        xfree(text);
+    }
+
+    va_end(again);
+}
+
+void console_printf(Console* c, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    console_vprintf(c, format, args);
+    va_end(args);
+}
+
+void console_clear(Console* c) {
+    console_literal(c, CONSOLE_CLEAR);
+}
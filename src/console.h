@@ -0,0 +1,63 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include "../lib/seqft/common.h"
+
+// Buffered terminal output. Everything the shell prints goes into its
+// session's console, which hands it to the terminal in one writev when the
+// session is about to wait for input, or when the buffer fills up. Formatted
+// text is copied into the buffer; literals are referenced where they are and
+// only gathered up by the writev.
+
+#define CONSOLE_BUFFER_SIZE (64 * 1024)
+#define CONSOLE_MAX_PIECES  64
+
+// Screen control, written straight to the terminal rather than running
+// clear(1): home the cursor, clear the screen, then the scrollback.
+#define CONSOLE_CLEAR "\x1b[H\x1b[2J\x1b[3J"
+
+typedef struct Console {
+    int fd;
+
+    // Pending output, in order. A piece with data set is a literal; one
+    // without is the len bytes at offset in buffer.
+    struct {
+        const char* data;
+        size_t      offset;
+        size_t      len;
+    } pieces[CONSOLE_MAX_PIECES];
+    size_t count;
+
+    char   buffer[CONSOLE_BUFFER_SIZE];
+    size_t used;
+
+    size_t writes; // System calls made, for measuring.
+} Console;
+
+// The calling thread's console, on standard output. The main thread's is
+// flushed at exit as well; the scheduler's CPU threads have one each.
+extern __thread Console* console;
+
+extern void console_init(Console* c, int fd);
+
+extern void console_write(Console* c, const char* data, size_t len);
+extern void console_printf(Console* c, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+extern void console_vprintf(Console* c, const char* format, va_list args);
+
+// Queues s without copying it, so it has to outlive the next flush; meant
+// for string literals.
+extern void console_literal(Console* c, const char* s);
+
+// Clears the screen with CONSOLE_CLEAR.
+extern void console_clear(Console* c);
+
+// Writes everything pending with one writev (more only if the terminal takes
+// part of it). Call before waiting for input.
+extern void console_flush(Console* c);
+
+#endif // CONSOLE_H
@@ -0,0 +1,202 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "coroutine.h"
+
+#if !defined(__x86_64__)
+#include <ucontext.h>
+#endif
+
+struct Coroutine {
+    CoroutineFn fn;
+    void*       arg;
+    BOOL        done;
+
+    char*      stack;  // Start of the mapping, guard page included.
+    Coroutine* caller; // What was running when this was last resumed.
+
+#if defined(__x86_64__)
+    void* sp;        // Saved stack pointer, while suspended.
+    void* caller_sp; // The resumer's, while this runs.
+#else
+    ucontext_t context;
+    ucontext_t caller_context;
+#endif
+};
+
+static __thread Coroutine* running;
+
+// Stacks of freed coroutines, for the next ones.
+static __thread char*  pool[COROUTINE_POOL_SIZE];
+static __thread size_t pool_len;
+
+static size_t page_size() {
+    static size_t size;
+    if (!size) size = (size_t)sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+static size_t mapping_size() {
+    return COROUTINE_STACK_SIZE + page_size();
+}
+
+static char* stack_get() {
+    if (pool_len) return pool[--pool_len];
+
+    char* stack = mmap(0, mapping_size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (stack == MAP_FAILED) {
+        perror("Failed to map a coroutine stack");
+        abort();
+    }
+
+    // Running off the end faults instead of scribbling on whatever's below.
+    mprotect(stack, page_size(), PROT_NONE);
+
+    return stack;
+}
+
+static void stack_put(char* stack) {
+    if (pool_len < COROUTINE_POOL_SIZE) {
+        pool[pool_len++] = stack;
+    } else {
+        munmap(stack, mapping_size());
+    }
+}
+
+// Context switch
+// ----------------------------------------------------------------------------
+
+#if defined(__x86_64__)
+
+// Saves the callee saved registers and the SSE and x87 control words on the
+// current stack, stores the stack pointer in *save, then does the reverse
+// from load. Everything else is caller saved, so the C compiler has already
+// taken care of it around the call.
+extern void coroutine_swap(void** save, void* load);
+
+__asm__(".text\n"
+        ".p2align 4\n"
+        ".globl coroutine_swap\n"
+        ".hidden coroutine_swap\n"
+        ".type coroutine_swap, @function\n"
+        "coroutine_swap:\n"
+        "    pushq %rbp\n"
+        "    pushq %rbx\n"
+        "    pushq %r12\n"
+        "    pushq %r13\n"
+        "    pushq %r14\n"
+        "    pushq %r15\n"
+        "    subq $8, %rsp\n"
+        "    stmxcsr (%rsp)\n"
+        "    fnstcw 4(%rsp)\n"
+        "    movq %rsp, (%rdi)\n"
+        "    movq %rsi, %rsp\n"
+        "    ldmxcsr (%rsp)\n"
+        "    fldcw 4(%rsp)\n"
+        "    addq $8, %rsp\n"
+        "    popq %r15\n"
+        "    popq %r14\n"
+        "    popq %r13\n"
+        "    popq %r12\n"
+        "    popq %rbx\n"
+        "    popq %rbp\n"
+        "    ret\n"
+        ".size coroutine_swap, .-coroutine_swap\n");
+
+#endif
+
+static void coroutine_start() {
+    Coroutine* self = running;
+
+    self->fn(self->arg);
+    self->done = TRUE;
+
+    running = self->caller;
+
+#if defined(__x86_64__)
+    coroutine_swap(&self->sp, self->caller_sp);
+#else
+    swapcontext(&self->context, &self->caller_context);
+#endif
+}
+
+Coroutine* coroutine_new(CoroutineFn fn, void* arg) {
+    Coroutine* coroutine = xmalloc(sizeof(Coroutine));
+
+    coroutine->fn     = fn;
+    coroutine->arg    = arg;
+    coroutine->done   = FALSE;
+    coroutine->stack  = stack_get();
+    coroutine->caller = 0;
+
+#if defined(__x86_64__)
+    // The first switch in pops a frame laid out like coroutine_swap's own,
+    // then returns into coroutine_start with the stack aligned as if it had
+    // been called.
+    uint64_t* top = (uint64_t*)(coroutine->stack + mapping_size());
+
+    top[-1] = 0; // coroutine_start's return address; it never returns.
+    top[-2] = (uint64_t)(uintptr_t)coroutine_start;
+
+    for (int i = 3; i <= 8; i++) {
+        top[-i] = 0; // rbp, rbx, r12 to r15.
+    }
+
+    top[-9] = (uint64_t)0x037F << 32 | 0x1F80; // Default x87 and SSE control.
+
+    coroutine->sp = &top[-9];
+#else
+    getcontext(&coroutine->context);
+    coroutine->context.uc_stack.ss_sp   = coroutine->stack + page_size();
+    coroutine->context.uc_stack.ss_size = COROUTINE_STACK_SIZE;
+    coroutine->context.uc_link          = 0;
+    makecontext(&coroutine->context, coroutine_start, 0);
+#endif
+
+    return coroutine;
+}
+
+void coroutine_free(Coroutine* coroutine) {
+    if (!coroutine) return;
+
+    stack_put(coroutine->stack);
+    xfree(coroutine);
+}
+
+BOOL coroutine_resume(Coroutine* coroutine) {
+    if (coroutine->done) return FALSE;
+
+    coroutine->caller = running;
+    running           = coroutine;
+
+#if defined(__x86_64__)
+    coroutine_swap(&coroutine->caller_sp, coroutine->sp);
+#else
+    swapcontext(&coroutine->caller_context, &coroutine->context);
+#endif
+
+    return !coroutine->done;
+}
+
+void coroutine_yield() {
+    Coroutine* self = running;
+    running         = self->caller;
+
+#if defined(__x86_64__)
+    coroutine_swap(&self->sp, self->caller_sp);
+#else
+    swapcontext(&self->context, &self->caller_context);
+#endif
+}
+
+Coroutine* coroutine_current() {
+    return running;
+}
+
+BOOL coroutine_done(const Coroutine* coroutine) {
+    return coroutine->done;
+}
@@ -0,0 +1,49 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#include "../lib/seqft/common.h"
+
+// Stackful coroutines, so that built in programs can wait for input without
+// holding up the shell or each other, all on one thread. A coroutine runs
+// until it yields or returns, and coroutine_resume picks it up from there.
+//
+// On x86-64 a switch saves and restores the callee saved registers and
+// nothing else, so it costs a few nanoseconds; elsewhere it falls back to
+// ucontext, which also makes a system call for the signal mask. Stacks are
+// mmap'd with a guard page below them, and kept in a pool when coroutines
+// are freed so that starting a coroutine seldom needs a system call at all.
+
+typedef struct Coroutine Coroutine;
+
+typedef void (*CoroutineFn)(void* arg);
+
+// Room for a coroutine's locals and calls. Pages are only backed by memory
+// once they're touched, so the unused part costs address space alone.
+#define COROUTINE_STACK_SIZE (128 * 1024)
+
+// Most stacks kept for reuse.
+#define COROUTINE_POOL_SIZE 16
+
+// A suspended coroutine that will call fn(arg) when first resumed.
+extern Coroutine* coroutine_new(CoroutineFn fn, void* arg);
+
+// Frees the coroutine and gives its stack back to the pool. A coroutine
+// freed before it finished is simply abandoned: nothing on its stack is
+// cleaned up.
+extern void coroutine_free(Coroutine* coroutine);
+
+// Runs the coroutine until it yields or returns. Returns TRUE if it yielded,
+// and FALSE once it has returned. Resuming a finished coroutine does
+// nothing.
+extern BOOL coroutine_resume(Coroutine* coroutine);
+
+// Suspends the running coroutine, going back to whoever resumed it. Must be
+// called from inside a coroutine.
+extern void coroutine_yield();
+
+// The coroutine running on this thread, or 0 outside of any.
+extern Coroutine* coroutine_current();
+
+extern BOOL coroutine_done(const Coroutine* coroutine);
+
+#endif // COROUTINE_H
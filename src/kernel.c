@@ -1,8 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <string.h>
 #include "../lib/cJSON.h"
+#include "../lib/seqft/common.h"
 
+#include "console.h"
+#include "pool.h"
+#include "sched.h"
 #include "terminal.h"
 
 char* read_config(const char *filepath) {
@@ -11,7 +16,7 @@ char* read_config(const char *filepath) {
     long filesize;
 
     if (file == NULL) {
-        printf("Error: Unable to open file %s\n", filepath);
+        console_printf(console, "Error: Unable to open file %s\n", filepath);
         return NULL;
     }
 
@@ -21,7 +26,7 @@ char* read_config(const char *filepath) {
 
     content = (char *)malloc((filesize + 1) * sizeof(char));
     if (content == NULL) {
-        printf("Error: Memory allocation failed\n");
+        console_literal(console, "Error: Memory allocation failed\n");
         fclose(file);
         return NULL;
     }
@@ -34,20 +39,28 @@ char* read_config(const char *filepath) {
 }
 
 int kernel_main() {
-    printf("Kernel has started!\n");
-    printf("Do you want to configure the kernel? [Y/N]: ");
-    char kernel_config;
-    scanf(" %c", &kernel_config);
+    console_literal(console, "Kernel has started!\n");
+    console_literal(console, "Do you want to configure the kernel? [Y/N]: ");
+    char line[100];
+    char kernel_config = terminal_readLine(line, sizeof(line)) ? line[strspn(line, " \t")] : 'n';
     kernel_config = tolower(kernel_config);
 
     int maxprocessesint;
     int maxthreadsperprocessint;
+    int quantumint;
+    int prioritylevelsint;
+    int cpusint;
+    SchedPolicy policy;
+
+    console_literal(console, "Checking kernel configuration...\n");
+
+    // cJSON shares seqft's allocator.
+    cJSON_InitHooks(&(cJSON_Hooks) {.malloc_fn = xmalloc, .free_fn = xfree});
 
-    printf("Checking kernel configuration...\n");
     char* kerneljson = read_config("config/kernel.json");
     cJSON *json = cJSON_Parse(kerneljson);
     if (json == NULL) {
-        printf("Error parsing JSON.\n");
+        console_literal(console, "Error parsing JSON.\n");
         return 1;
     }
 
@@ -55,36 +68,127 @@ int kernel_main() {
     cJSON *maxprocesses = cJSON_GetObjectItem(json, "max-processes");
     if (cJSON_IsNumber(maxprocesses)) {
         maxprocessesint = (int)maxprocesses->valueint;
-        printf("Max Processes: %d\n", maxprocessesint);
+        console_printf(console, "Max Processes: %d\n", maxprocessesint);
     } else {
         maxprocessesint = 10;
-        printf("Error: max-processes is not defined or there was an error parsing! Defaulting to 10.\n");
+        console_literal(console, "Error: max-processes is not defined or there was an error parsing! Defaulting to 10.\n");
     }
 
     // Get max threads per process value from kernel.json
     cJSON *maxthreadsperprocess = cJSON_GetObjectItem(json, "max-threads-per-process");
     if (cJSON_IsNumber(maxthreadsperprocess)) {
         maxthreadsperprocessint = (int)maxthreadsperprocess->valueint;
-        printf("Max Threads per Process: %d\n", maxthreadsperprocessint);
+        console_printf(console, "Max Threads per Process: %d\n", maxthreadsperprocessint);
     } else {
         maxthreadsperprocessint = 10;
-        printf("Error: max-threads-per-process is not defined or there was an error parsing! Defaulting to 10.\n");
+        console_literal(console, "Error: max-threads-per-process is not defined or there was an error parsing! Defaulting to 10.\n");
+    }
+
+    // Get the scheduler's time slice, in milliseconds of CPU time
+    cJSON *quantum = cJSON_GetObjectItem(json, "quantum-ms");
+    if (cJSON_IsNumber(quantum) && quantum->valueint > 0) {
+        quantumint = (int)quantum->valueint;
+        console_printf(console, "Quantum: %d ms\n", quantumint);
+    } else {
+        quantumint = SCHED_DEFAULT_QUANTUM_MS;
+        console_printf(console, "Error: quantum-ms is not defined or there was an error parsing! Defaulting to %d.\n", quantumint);
+    }
+
+    // Get the number of scheduler priority levels
+    cJSON *prioritylevels = cJSON_GetObjectItem(json, "priority-levels");
+    if (cJSON_IsNumber(prioritylevels) && prioritylevels->valueint > 0) {
+        prioritylevelsint = (int)prioritylevels->valueint;
+        console_printf(console, "Priority Levels: %d\n", prioritylevelsint);
+    } else {
+        prioritylevelsint = 4;
+        console_literal(console, "Error: priority-levels is not defined or there was an error parsing! Defaulting to 4.\n");
+    }
+
+    // Get the number of simulated CPUs; 0 runs jobs on the shell's thread
+    cJSON *cpus = cJSON_GetObjectItem(json, "cpus");
+    if (cJSON_IsNumber(cpus) && cpus->valueint >= 0) {
+        cpusint = (int)cpus->valueint;
+        console_printf(console, "CPUs: %d\n", cpusint);
+    } else {
+        cpusint = 0;
+        console_literal(console, "Error: cpus is not defined or there was an error parsing! Defaulting to 0.\n");
+    }
+
+    // Get the scheduling policy: "round-robin" or "fair"
+    cJSON *scheduler = cJSON_GetObjectItem(json, "scheduler");
+    if (cJSON_IsString(scheduler) && strcmp(scheduler->valuestring, "fair") == 0) {
+        policy = SCHED_POLICY_FAIR;
+        console_literal(console, "Scheduler: fair\n");
+    } else if (cJSON_IsString(scheduler) && strcmp(scheduler->valuestring, "round-robin") == 0) {
+        policy = SCHED_POLICY_ROUND_ROBIN;
+        console_literal(console, "Scheduler: round-robin\n");
+    } else {
+        policy = SCHED_POLICY_ROUND_ROBIN;
+        console_literal(console, "Error: scheduler is not defined or there was an error parsing! Defaulting to round-robin.\n");
     }
 
     if (kernel_config == 'y') {
-        printf("Configuring kernel...\n");
-        printf("Kernel configuration will hopefully be added soon!\n");
+        console_literal(console, "Configuring kernel...\n");
+        console_literal(console, "Kernel configuration will hopefully be added soon!\n");
     } else if (kernel_config == 'n') {
-        printf("Kernel configuration not edited...\n");
+        console_literal(console, "Kernel configuration not edited...\n");
 
         free(kerneljson);
         cJSON_Delete(json);
     } else {
-        printf("Invalid input. Defaulting to no\n");
+        console_literal(console, "Invalid input. Defaulting to no\n");
     }
 
-    int processes = 1;
-    osmain(&processes, maxprocessesint, maxthreadsperprocessint);
+    // The shell is the first process, and everything else is its child.
+    ProcessTable* processes = process_tableNew(maxprocessesint);
+    process_switch(processes, process_spawn(processes, "shell", 0));
+    sched_init(processes, policy, quantumint, prioritylevelsint);
+    pool_start(pool_defaultWorkers());
+
+    // Everything the shell and its jobs hand to the pool shares this limit,
+    // including jobs on CPU threads.
+    pool_setLimit(maxthreadsperprocessint > 0 ? (size_t)maxthreadsperprocessint : 1);
+    sched_startCpus(cpusint);
+
+    osmain(processes, maxthreadsperprocessint);
 
     return 0;
-}
\ No newline at end of file
+}
+// "Neptune --script": the same limits as kernel_main, read without any
+// questions or messages, and a script in place of the shell. A missing or
+// broken config just means the defaults.
+int kernel_script(const char* path) {
+    int maxprocessesint         = 10;
+    int maxthreadsperprocessint = 10;
+
+    cJSON_InitHooks(&(cJSON_Hooks) {.malloc_fn = xmalloc, .free_fn = xfree});
+
+    FILE* config = fopen("config/kernel.json", "r");
+
+    if (config) {
+        fclose(config);
+
+        char*  kerneljson = read_config("config/kernel.json");
+        cJSON* json       = cJSON_Parse(kerneljson);
+
+        cJSON* maxprocesses         = cJSON_GetObjectItem(json, "max-processes");
+        cJSON* maxthreadsperprocess = cJSON_GetObjectItem(json, "max-threads-per-process");
+
+        if (cJSON_IsNumber(maxprocesses)) maxprocessesint = maxprocesses->valueint;
+        if (cJSON_IsNumber(maxthreadsperprocess)) maxthreadsperprocessint = maxthreadsperprocess->valueint;
+
+        free(kerneljson);
+        cJSON_Delete(json);
+    }
+
+    ProcessTable* processes = process_tableNew(maxprocessesint);
+    process_switch(processes, process_spawn(processes, "shell", 0));
+    pool_start(pool_defaultWorkers());
+    pool_setLimit(maxthreadsperprocessint > 0 ? (size_t)maxthreadsperprocessint : 1);
+
+    int failed = osscript(path, processes, maxthreadsperprocessint);
+
+    pool_stop();
+    process_tableFree(processes);
+    return failed;
+}
@@ -0,0 +1,430 @@
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pool.h"
+#include "sync.h"
+
+// Chase-Lev deques
+// ----------------------------------------------------------------------------
+// From "Correct and Efficient Work-Stealing for Weak Memory Models" (Lê et
+// al., 2013). The owner pushes and takes at bottom; thieves take from top.
+// When the owner and a thief go for the last task, a compare and swap on top
+// decides which of them gets it.
+
+typedef struct DequeArray {
+    int64_t            size; // A power of two.
+    struct DequeArray* retired;
+    PoolTask*          slots[];
+} DequeArray;
+
+typedef struct Deque {
+    int64_t top __attribute__((aligned(64)));
+    int64_t bottom __attribute__((aligned(64)));
+
+    DequeArray* array;
+} Deque;
+
+// What deque_steal returns when it lost a race and should be tried again.
+#define DEQUE_ABORT ((PoolTask*)1)
+
+static DequeArray* deque_newArray(int64_t size) {
+    DequeArray* array = xmalloc(sizeof(DequeArray) + sizeof(PoolTask*) * (size_t)size);
+
+    array->size    = size;
+    array->retired = 0;
+
+    return array;
+}
+
+static void deque_init(Deque* deque) {
+    deque->top    = 0;
+    deque->bottom = 0;
+    deque->array  = deque_newArray(POOL_DEQUE_SIZE);
+}
+
+static void deque_free(Deque* deque) {
+    for (DequeArray* array = deque->array; array;) {
+        DequeArray* retired = array->retired;
+        xfree(array);
+        array = retired;
+    }
+}
+
+static PoolTask* slot_load(DequeArray* array, int64_t i) {
+    return __atomic_load_n(&array->slots[i & (array->size - 1)], __ATOMIC_RELAXED);
+}
+
+static void slot_store(DequeArray* array, int64_t i, PoolTask* task) {
+    __atomic_store_n(&array->slots[i & (array->size - 1)], task, __ATOMIC_RELAXED);
+}
+
+static void deque_push(Deque* deque, PoolTask* task) {
+    int64_t     bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    int64_t     top    = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    DequeArray* array  = __atomic_load_n(&deque->array, __ATOMIC_RELAXED);
+
+    // Thieves may still be reading the old array, so it's kept until the
+    // pool stops rather than freed.
+    if (bottom - top > array->size - 1) {
+        DequeArray* grown = deque_newArray(array->size * 2);
+
+        for (int64_t i = top; i < bottom; i++) {
+            slot_store(grown, i, slot_load(array, i));
+        }
+
+        grown->retired = array;
+        array          = grown;
+        __atomic_store_n(&deque->array, array, __ATOMIC_RELEASE);
+    }
+
+    slot_store(array, bottom, task);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+}
+
+static PoolTask* deque_take(Deque* deque) {
+    int64_t     bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    DequeArray* array  = __atomic_load_n(&deque->array, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    int64_t   top  = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+    PoolTask* task = 0;
+
+    if (top <= bottom) {
+        task = slot_load(array, bottom);
+
+        if (top == bottom) {
+            if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, FALSE,
+                                             __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                task = 0;
+            }
+
+            __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+
+    return task;
+}
+
+static PoolTask* deque_steal(Deque* deque) {
+    int64_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+
+    if (top >= bottom) return 0;
+
+    DequeArray* array = __atomic_load_n(&deque->array, __ATOMIC_ACQUIRE);
+    PoolTask*   task  = slot_load(array, top);
+
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, FALSE,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return DEQUE_ABORT;
+    }
+
+    return task;
+}
+
+// Pool
+// ----------------------------------------------------------------------------
+
+typedef struct Worker {
+    Deque     deque;
+    pthread_t thread;
+    size_t    index;
+} Worker;
+
+static Worker* workers;
+static size_t  worker_count;
+static BOOL    started;
+static BOOL    stopping;
+
+static pthread_mutex_t start_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Tasks submitted by threads that aren't workers, first in first out.
+static pthread_mutex_t inject_lock = PTHREAD_MUTEX_INITIALIZER;
+static PoolTask**      inject;
+static size_t          inject_head;
+static size_t          inject_len;
+static size_t          inject_cap;
+static size_t          inject_count; // inject_len, for checking without the lock.
+
+// Idle workers sleep on epoch, which submitters bump when anyone's asleep.
+static uint32_t epoch;
+static uint32_t sleepers;
+
+// The worker the calling thread is, if it's one.
+static __thread Worker* self;
+static __thread size_t  limit;
+
+static void inject_push(PoolTask* task) {
+    pthread_mutex_lock(&inject_lock);
+
+    if (inject_len == inject_cap) {
+        size_t     cap   = inject_cap ? inject_cap * 2 : 64;
+        PoolTask** tasks = xmalloc(sizeof(PoolTask*) * cap);
+
+        for (size_t i = 0; i < inject_len; i++) {
+            tasks[i] = inject[(inject_head + i) % inject_cap];
+        }
+
+        xfree(inject);
+        inject      = tasks;
+        inject_cap  = cap;
+        inject_head = 0;
+    }
+
+    inject[(inject_head + inject_len) % inject_cap] = task;
+    inject_len++;
+    __atomic_store_n(&inject_count, inject_len, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&inject_lock);
+}
+
+static PoolTask* inject_pop() {
+    if (!__atomic_load_n(&inject_count, __ATOMIC_ACQUIRE)) return 0;
+
+    PoolTask* task = 0;
+    pthread_mutex_lock(&inject_lock);
+
+    if (inject_len) {
+        task        = inject[inject_head];
+        inject_head = (inject_head + 1) % inject_cap;
+        inject_len--;
+        __atomic_store_n(&inject_count, inject_len, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&inject_lock);
+    return task;
+}
+
+// Looks everywhere for a task, starting with the calling worker's own deque.
+// Sets *contended if a steal lost a race, since there may be work left even
+// though none was found.
+static PoolTask* find_work(Worker* me, BOOL* contended) {
+    PoolTask* task = me ? deque_take(&me->deque) : 0;
+
+    if (!task) task = inject_pop();
+
+    size_t start = me ? me->index + 1 : 0;
+
+    for (size_t i = 0; !task && i < worker_count; i++) {
+        Worker* victim = &workers[(start + i) % worker_count];
+
+        if (victim == me) continue;
+
+        task = deque_steal(&victim->deque);
+
+        if (task == DEQUE_ABORT) {
+            *contended = TRUE;
+            task       = 0;
+        }
+    }
+
+    return task;
+}
+
+static void run_task(PoolTask* task) {
+    PoolGroup* group = task->group;
+
+    task->fn(task->arg);
+
+    // The task may be gone as soon as the group is done.
+    __atomic_fetch_sub(&group->pending, 1, __ATOMIC_RELEASE);
+}
+
+static void* worker_main(void* arg) {
+    Worker* me = arg;
+    self       = me;
+
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+        BOOL      contended = FALSE;
+        PoolTask* task      = find_work(me, &contended);
+
+        if (task) {
+            run_task(task);
+            continue;
+        }
+
+        if (contended) continue;
+
+        // Announce the nap before the last look around, so a submitter
+        // either sees us asleep or we see its task.
+        __atomic_fetch_add(&sleepers, 1, __ATOMIC_SEQ_CST);
+        uint32_t seen = __atomic_load_n(&epoch, __ATOMIC_SEQ_CST);
+
+        task = find_work(me, &contended);
+
+        if (!task && !contended && !__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+            sync_futexWait(&epoch, seen);
+        }
+
+        __atomic_fetch_sub(&sleepers, 1, __ATOMIC_SEQ_CST);
+
+        if (task) run_task(task);
+    }
+
+    return 0;
+}
+
+static void wake_workers(int count) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&sleepers, __ATOMIC_SEQ_CST)) {
+        __atomic_fetch_add(&epoch, 1, __ATOMIC_SEQ_CST);
+        sync_futexWake(&epoch, count);
+    }
+}
+
+void pool_start(size_t count) {
+    pthread_mutex_lock(&start_lock);
+
+    if (!__atomic_load_n(&started, __ATOMIC_ACQUIRE)) {
+        workers      = xmalloc(sizeof(Worker) * (count ? count : 1));
+        worker_count = 0;
+        stopping     = FALSE;
+
+        for (size_t i = 0; i < count; i++) {
+            deque_init(&workers[i].deque);
+            workers[i].index = i;
+        }
+
+        // Stealing walks every worker, so all of them have to be in place
+        // before any starts.
+        for (size_t i = 0; i < count; i++) {
+            if (pthread_create(&workers[i].thread, 0, worker_main, &workers[i])) break;
+            worker_count++;
+        }
+
+        for (size_t i = worker_count; i < count; i++) {
+            deque_free(&workers[i].deque);
+        }
+
+        __atomic_store_n(&started, TRUE, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&start_lock);
+}
+
+size_t pool_defaultWorkers() {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 1 ? (size_t)online - 1 : 0;
+}
+
+static void ensure_started() {
+    if (__atomic_load_n(&started, __ATOMIC_ACQUIRE)) return;
+    pool_start(pool_defaultWorkers());
+}
+
+void pool_stop() {
+    pthread_mutex_lock(&start_lock);
+
+    if (started) {
+        __atomic_store_n(&stopping, TRUE, __ATOMIC_RELEASE);
+        __atomic_fetch_add(&epoch, 1, __ATOMIC_SEQ_CST);
+        sync_futexWake(&epoch, INT_MAX);
+
+        for (size_t i = 0; i < worker_count; i++) {
+            pthread_join(workers[i].thread, 0);
+            deque_free(&workers[i].deque);
+        }
+
+        xfree(workers);
+        workers      = 0;
+        worker_count = 0;
+        started      = FALSE;
+    }
+
+    pthread_mutex_unlock(&start_lock);
+}
+
+size_t pool_workers() {
+    ensure_started();
+    return worker_count;
+}
+
+void pool_setLimit(size_t threads) {
+    limit = threads;
+}
+
+size_t pool_limit() {
+    ensure_started();
+
+    size_t threads = worker_count + 1;
+    return limit && limit < threads ? limit : threads;
+}
+
+void pool_submit(PoolTask* task) {
+    ensure_started();
+
+    __atomic_fetch_add(&task->group->pending, 1, __ATOMIC_RELAXED);
+
+    if (self) {
+        deque_push(&self->deque, task);
+    } else {
+        inject_push(task);
+    }
+
+    wake_workers(1);
+}
+
+void pool_wait(PoolGroup* group) {
+    while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE)) {
+        BOOL      contended = FALSE;
+        PoolTask* task      = find_work(self, &contended);
+
+        if (task) {
+            run_task(task);
+        } else {
+            // What's left is running on other workers.
+            sched_yield();
+        }
+    }
+}
+
+typedef struct PoolRange {
+    void (*fn)(void* arg, size_t begin, size_t end);
+    void*  arg;
+    size_t begin;
+    size_t end;
+} PoolRange;
+
+static void run_range(void* arg) {
+    PoolRange* range = arg;
+    range->fn(range->arg, range->begin, range->end);
+}
+
+void pool_parallelFor(size_t count,
+                      void (*fn)(void* arg, size_t begin, size_t end),
+                      void*  arg) {
+    size_t parts = pool_limit();
+
+    if (parts > count) parts = count;
+
+    if (parts <= 1) {
+        if (count) fn(arg, 0, count);
+        return;
+    }
+
+    PoolGroup group = {0};
+    PoolTask  tasks[parts];
+    PoolRange ranges[parts];
+    size_t    per = (count + parts - 1) / parts;
+
+    for (size_t i = 1; i < parts; i++) {
+        size_t begin = i * per < count ? i * per : count;
+        size_t end   = begin + per < count ? begin + per : count;
+
+        ranges[i] = (PoolRange) {fn, arg, begin, end};
+        tasks[i]  = (PoolTask) {run_range, &ranges[i], &group};
+        pool_submit(&tasks[i]);
+    }
+
+    fn(arg, 0, per < count ? per : count);
+    pool_wait(&group);
+}
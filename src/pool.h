@@ -0,0 +1,67 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "../lib/seqft/common.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The kernel's thread pool, so that programs can do work in parallel without
+// starting threads of their own. Each worker has a Chase-Lev deque: it
+// pushes and takes tasks at one end without locking, and idle workers steal
+// from the other end with a compare and swap. Tasks submitted from outside
+// the pool go through a shared queue. Workers with nothing to do park on a
+// futex until more work arrives.
+//
+// A thread can have a limit on how many threads work on its tasks at once,
+// itself included. The kernel sets it from max-threads-per-process.
+
+typedef void (*PoolFn)(void* arg);
+
+// Tasks submitted together, so they can be waited for together.
+typedef struct PoolGroup {
+    size_t pending;
+} PoolGroup;
+
+// Owned by whoever submits it, and must stay put until its group is done.
+typedef struct PoolTask {
+    PoolFn     fn;
+    void*      arg;
+    PoolGroup* group;
+} PoolTask;
+
+// Slots a deque starts with; it doubles when full.
+#define POOL_DEQUE_SIZE 256
+
+// Starts workers threads, unless the pool is already running. It starts
+// itself on first use if the kernel hasn't, with pool_defaultWorkers().
+extern void pool_start(size_t workers);
+
+// A worker for every CPU but one, the one whoever waits on a task runs on.
+extern size_t pool_defaultWorkers();
+
+// Stops and joins the workers, once the work they have is done.
+extern void pool_stop();
+
+extern size_t pool_workers();
+
+// Sets how many threads may work on the calling thread's tasks at once,
+// including itself; 0 means no limit beyond the pool's size.
+extern void pool_setLimit(size_t threads);
+
+// How many parts it's worth splitting the calling thread's work into.
+extern size_t pool_limit();
+
+extern void pool_submit(PoolTask* task);
+
+// Returns once every task in group has finished, running tasks itself in
+// the meantime rather than sleeping.
+extern void pool_wait(PoolGroup* group);
+
+// Calls fn(arg, begin, end) over [0, count) split into at most pool_limit()
+// ranges, one of them on the calling thread, and waits for all of them.
+extern void pool_parallelFor(size_t count,
+                             void (*fn)(void* arg, size_t begin, size_t end),
+                             void*  arg);
+
+#endif // POOL_H
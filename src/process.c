@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "process.h"
+
+static uint64_t thread_cpu_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Each thread runs one process at a time, whichever table it's from.
+static __thread Process* current;
+
+static size_t hash_pid(int pid) {
+    // Knuth's multiplicative hash; consecutive PIDs land far apart.
+    return (size_t)((uint32_t)pid * 2654435761U);
+}
+
+ProcessTable* process_tableNew(int capacity) {
+    if (capacity < 1) capacity = 1;
+
+    ProcessTable* table = xmalloc(sizeof(ProcessTable));
+
+    table->slots     = xmalloc(sizeof(Process) * (size_t)capacity);
+    table->capacity  = capacity;
+    table->count     = 0;
+    table->free_head = 0;
+    table->next_pid  = 1;
+
+    memset(table->slots, 0, sizeof(Process) * (size_t)capacity);
+
+    for (int i = 0; i < capacity; i++) {
+        table->slots[i].state     = PROCESS_FREE;
+        table->slots[i].next_free = i + 1 < capacity ? i + 1 : -1;
+    }
+
+    // At most half full, so probes stay short.
+    table->index_size = 16;
+    while (table->index_size < (size_t)capacity * 2) table->index_size *= 2;
+
+    table->index = xmalloc(sizeof(int) * table->index_size);
+    memset(table->index, 0, sizeof(int) * table->index_size);
+
+    return table;
+}
+
+void process_tableFree(ProcessTable* table) {
+    if (current) process_switch(table, 0);
+
+    xfree(table->index);
+    xfree(table->slots);
+    xfree(table);
+}
+
+static size_t index_find(ProcessTable* table, int pid) {
+    size_t mask = table->index_size - 1;
+    size_t i    = hash_pid(pid) & mask;
+
+    while (table->index[i] && table->slots[table->index[i] - 1].pid != pid) {
+        i = (i + 1) & mask;
+    }
+
+    return i;
+}
+
+Process* process_find(ProcessTable* table, int pid) {
+    if (pid <= 0) return 0;
+
+    int slot = table->index[index_find(table, pid)];
+    return slot ? &table->slots[slot - 1] : 0;
+}
+
+Process* process_spawn(ProcessTable* table, const char* name, int parent) {
+    if (table->free_head < 0) return 0;
+
+    // PIDs aren't reused until they wrap, and then only ones nobody holds.
+    // There are never more live PIDs than slots, so this ends quickly.
+    int pid = table->next_pid;
+    while (process_find(table, pid)) {
+        pid = pid % PROCESS_MAX_PID + 1;
+    }
+    table->next_pid = pid % PROCESS_MAX_PID + 1;
+
+    int      slot    = table->free_head;
+    Process* process = &table->slots[slot];
+
+    table->free_head = process->next_free;
+    table->count++;
+
+    memset(process, 0, sizeof(Process));
+    process->pid       = pid;
+    process->parent    = parent;
+    process->state     = PROCESS_READY;
+    process->next_free = -1;
+    snprintf(process->name, sizeof(process->name), "%s", name);
+
+    table->index[index_find(table, pid)] = slot + 1;
+
+    return process;
+}
+
+BOOL process_exit(ProcessTable* table, int pid) {
+    Process* process = process_find(table, pid);
+
+    if (!process) return FALSE;
+    if (process == current) process_switch(table, 0);
+
+    // Backward shift deletion: pull later entries of the probe run into the
+    // hole, so lookups never need tombstones.
+    size_t mask = table->index_size - 1;
+    size_t hole = index_find(table, pid);
+    size_t i    = hole;
+
+    for (;;) {
+        i = (i + 1) & mask;
+        if (!table->index[i]) break;
+
+        size_t home = hash_pid(table->slots[table->index[i] - 1].pid) & mask;
+
+        // Only move the entry if its home isn't cyclically within (hole, i].
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            table->index[hole] = table->index[i];
+            hole               = i;
+        }
+    }
+    table->index[hole] = 0;
+
+    int slot = (int)(process - table->slots);
+
+    process->state     = PROCESS_FREE;
+    process->pid       = 0;
+    process->next_free = table->free_head;
+    table->free_head   = slot;
+    table->count--;
+
+    return TRUE;
+}
+
+Process* process_switch(ProcessTable* table, Process* process) {
+    Process* previous = current;
+    uint64_t now      = thread_cpu_ns();
+
+    if (previous) {
+        previous->cpu_ns += now - previous->run_ns;
+        if (previous->state == PROCESS_RUNNING) previous->state = PROCESS_READY;
+    }
+
+    if (process) {
+        process->run_ns = now;
+        process->state  = PROCESS_RUNNING;
+        process->switches++;
+    }
+
+    alloc_charge(process ? &process->memory : 0);
+    current = process;
+
+    return previous;
+}
+
+Process* process_current(const ProcessTable* table) {
+    return current;
+}
+
+uint64_t process_cpuTime(const ProcessTable* table, const Process* process) {
+    if (process == current) {
+        return process->cpu_ns + (thread_cpu_ns() - process->run_ns);
+    }
+
+    return process->cpu_ns;
+}
+
+const char* process_stateName(ProcessState state) {
+    switch (state) {
+        case PROCESS_FREE:    return "free";
+        case PROCESS_READY:   return "ready";
+        case PROCESS_RUNNING: return "running";
+        case PROCESS_BLOCKED: return "blocked";
+        case PROCESS_ZOMBIE:  return "zombie";
+    }
+
+    return "unknown";
+}
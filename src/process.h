@@ -0,0 +1,93 @@
+#ifndef PROCESS_H
+#define PROCESS_H
+
+#include "../lib/seqft/alloc.h"
+#include "../lib/seqft/common.h"
+
+#include <stdint.h>
+
+// The kernel's process table. Every slot is allocated up front, sized by
+// max-processes in config/kernel.json, and free slots are kept on a list, so
+// spawning and exiting a process never allocates and costs O(1). Processes
+// are looked up by PID through an open addressing hash table.
+//
+// One process at a time is current on each thread. CPU time and memory are
+// charged to whichever process is current, and process_switch moves the
+// charge. Threads only share a table under the scheduler's lock.
+
+typedef enum ProcessState {
+    PROCESS_FREE,    // Slot isn't in use.
+    PROCESS_READY,   // Waiting for its turn.
+    PROCESS_RUNNING, // The current process.
+    PROCESS_BLOCKED, // Waiting on something other than the CPU.
+    PROCESS_ZOMBIE,  // Finished, but still in the table.
+} ProcessState;
+
+#define PROCESS_NAME_SIZE 32
+
+// PIDs count up to this and then wrap around to 1, skipping any in use.
+#define PROCESS_MAX_PID 32768
+
+typedef struct Process {
+    int          pid;
+    int          parent; // 0 for none.
+    ProcessState state;
+    char         name[PROCESS_NAME_SIZE];
+
+    uint64_t     cpu_ns;  // Thread CPU time used, not counting the current run.
+    uint64_t     run_ns;  // When the current run started, if it's current.
+    AllocAccount memory;
+
+    int      priority;    // Scheduler level; 0 is the highest.
+    uint64_t switches;    // Times it was made current.
+    uint64_t preemptions; // Turns it lost to the scheduler's timer.
+
+    // What it's blocked on, like a lock or the shell's input, or 0, and the
+    // next process waiting on the same lock.
+    const void*     waiting_on;
+    struct Process* wait_next;
+
+    int next_free; // Next slot on the free list, or -1, while it's free.
+} Process;
+
+typedef struct ProcessTable {
+    Process* slots;
+    int      capacity;
+    int      count;
+    int      free_head;
+    int      next_pid;
+
+    // Open addressing table of slot index + 1 (0 is empty), keyed by PID.
+    int*   index;
+    size_t index_size;
+} ProcessTable;
+
+// A table with room for capacity processes (at least one).
+extern ProcessTable* process_tableNew(int capacity);
+extern void          process_tableFree(ProcessTable* table);
+
+// Takes a free slot for a new, ready process. Returns 0 if the table is full.
+extern Process* process_spawn(ProcessTable* table, const char* name, int parent);
+
+// Returns the process with pid, or 0.
+extern Process* process_find(ProcessTable* table, int pid);
+
+// Removes the process from the table and frees its slot. Returns FALSE if
+// there's no such process. Exiting the current process leaves no process
+// current.
+extern BOOL process_exit(ProcessTable* table, int pid);
+
+// The calling thread's current process, or 0.
+extern Process* process_current(const ProcessTable* table);
+
+// Makes process (which may be 0) the calling thread's current one, charging the CPU time and
+// memory used since the last switch to the one before. Returns the process
+// that was current.
+extern Process* process_switch(ProcessTable* table, Process* process);
+
+// CPU time used by process so far, including its current run.
+extern uint64_t process_cpuTime(const ProcessTable* table, const Process* process);
+
+extern const char* process_stateName(ProcessState state);
+
+#endif // PROCESS_H
@@ -0,0 +1,561 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+#include "calculator.h"
+
+void batch_outputInit(BatchOutput* out, int fd, size_t cap) {
+    out->data = xmalloc(cap);
+    out->len  = 0;
+    out->cap  = cap;
+    out->fd   = fd;
+}
+
+void batch_outputFlush(BatchOutput* out) {
+    size_t written = 0;
+
+    while (out->fd >= 0 && written < out->len) {
+        ssize_t n = write(out->fd, out->data + written, out->len - written);
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        written += (size_t)n;
+    }
+
+    out->len = 0;
+}
+
+void batch_outputFree(BatchOutput* out) {
+    xfree(out->data);
+    out->data = 0;
+    out->len  = out->cap = 0;
+}
+
+// Makes room for at least n more bytes.
+static char* batch_outputReserve(BatchOutput* out, size_t n) {
+    if (out->len + n > out->cap) {
+        if (out->fd >= 0) {
+            batch_outputFlush(out);
+        }
+
+        if (n > out->cap - out->len) {
+            while (out->len + n > out->cap) out->cap *= 2;
+            out->data = xrealloc(out->data, out->cap);
+        }
+    }
+
+    return out->data + out->len;
+}
+
+void batch_outputAppend(BatchOutput* out, const char* s, size_t n) {
+    memcpy(batch_outputReserve(out, n), s, n);
+    out->len += n;
+}
+
+static void batch_error(BatchOutput* out, const char* message, size_t len) {
+    // Messages from the evaluator end with blank lines meant for the shell.
+    while (len && (message[len - 1] == '\n')) len--;
+
+    batch_outputAppend(out, "error: ", 7);
+    batch_outputAppend(out, message, len);
+    batch_outputAppend(out, "\n", 1);
+}
+
+BOOL batch_evalLine(SftContext*  context,
+                    const char*  line,
+                    size_t       len,
+                    BatchOutput* out) {
+
+    size_t blank = 0;
+    while (blank < len && isspace((unsigned char)line[blank])) blank++;
+
+    if (blank == len) {
+        batch_outputAppend(out, "\n", 1);
+        return TRUE;
+    }
+
+    SftResult result;
+
+    if (!Sft_eval(context, line, len, &result)) {
+        char message[320];
+        int  n = result.error_index == SIZE_MAX
+                     ? snprintf(message, sizeof(message), "%s", result.error.message)
+                     : snprintf(message, sizeof(message), "%s (column %zu)",
+                                result.error.message, result.error_index + 1);
+
+        batch_error(out, message, (size_t)n < sizeof(message) ? (size_t)n : sizeof(message) - 1);
+        return FALSE;
+    }
+
+    char* dest = batch_outputReserve(out, 32);
+    out->len += (size_t)snprintf(dest, 32, "%.17g\n", result.value);
+    return TRUE;
+}
+
+static long batch_evalBuffer(SftContext*  context,
+                             const char*  data,
+                             size_t       len,
+                             BatchOutput* out,
+                             size_t*      consumed) {
+    long        failed = 0;
+    const char* begin  = data;
+    const char* end    = data + len;
+
+    for (;;) {
+        const char* newline = memchr(begin, '\n', (size_t)(end - begin));
+
+        if (!newline) break;
+
+        size_t line_len = (size_t)(newline - begin);
+        if (line_len && begin[line_len - 1] == '\r') line_len--;
+
+        failed += !batch_evalLine(context, begin, line_len, out);
+        begin = newline + 1;
+    }
+
+    *consumed = (size_t)(begin - data);
+    return failed;
+}
+
+static long batch_serial(int fd, const char* map, size_t map_size) {
+    SftContext* context = SftContext_new();
+    BatchOutput out;
+    batch_outputInit(&out, STDOUT_FILENO, BATCH_OUTPUT_SIZE);
+
+    long   failed   = 0;
+    size_t consumed = 0;
+
+    if (map) {
+        failed += batch_evalBuffer(context, map, map_size, &out, &consumed);
+
+        // The last line needn't end with a newline.
+        if (consumed < map_size) {
+            failed += !batch_evalLine(context, map + consumed, map_size - consumed, &out);
+        }
+    } else {
+        size_t cap  = BATCH_OUTPUT_SIZE;
+        size_t len  = 0;
+        char*  data = xmalloc(cap);
+
+        for (;;) {
+            if (len == cap) {
+                cap *= 2;
+                data = xrealloc(data, cap);
+            }
+
+            ssize_t n = read(fd, data + len, cap - len);
+
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+
+            len += (size_t)n;
+            failed += batch_evalBuffer(context, data, len, &out, &consumed);
+
+            // Carry the incomplete last line over to the next read.
+            memmove(data, data + consumed, len - consumed);
+            len -= consumed;
+        }
+
+        if (len) {
+            failed += !batch_evalLine(context, data, len, &out);
+        }
+
+        xfree(data);
+    }
+
+    batch_outputFlush(&out);
+    batch_outputFree(&out);
+    SftContext_free(context);
+
+    return failed;
+}
+
+// Parallel pipeline
+// ----------------------------------------------------------------------------
+//
+// A reader splits the input into line aligned chunks and queues them for the
+// evaluator threads, each of which has its own SftContext. Finished chunks
+// go to the writer, which holds on to any that arrive early so that output is
+// written in input order. The number of chunks alive at once is capped, so a
+// slow writer stalls the reader rather than letting buffered output grow.
+
+typedef struct BatchChunk {
+    size_t      seq;
+    const char* data;
+    size_t      len;
+    char*       owned; // Buffer data points into when it was read, not mapped.
+    BatchOutput out;
+    long        failed;
+} BatchChunk;
+
+typedef struct BatchQueue {
+    BatchChunk**    items;
+    size_t          cap;
+    size_t          head;
+    size_t          count;
+    BOOL            closed;
+    pthread_mutex_t lock;
+    pthread_cond_t  not_empty;
+    pthread_cond_t  not_full;
+} BatchQueue;
+
+static void batch_queueInit(BatchQueue* q, size_t cap) {
+    q->items  = xmalloc(sizeof(BatchChunk*) * cap);
+    q->cap    = cap;
+    q->head   = 0;
+    q->count  = 0;
+    q->closed = FALSE;
+
+    pthread_mutex_init(&q->lock, 0);
+    pthread_cond_init(&q->not_empty, 0);
+    pthread_cond_init(&q->not_full, 0);
+}
+
+static void batch_queueDestroy(BatchQueue* q) {
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+    xfree(q->items);
+}
+
+static void batch_queuePush(BatchQueue* q, BatchChunk* chunk) {
+    pthread_mutex_lock(&q->lock);
+
+    while (q->count == q->cap) {
+        pthread_cond_wait(&q->not_full, &q->lock);
+    }
+
+    q->items[(q->head + q->count) % q->cap] = chunk;
+    q->count++;
+
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// Returns 0 once the queue is closed and drained.
+static BatchChunk* batch_queuePop(BatchQueue* q) {
+    pthread_mutex_lock(&q->lock);
+
+    while (!q->count && !q->closed) {
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    }
+
+    BatchChunk* chunk = 0;
+
+    if (q->count) {
+        chunk   = q->items[q->head];
+        q->head = (q->head + 1) % q->cap;
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+    }
+
+    pthread_mutex_unlock(&q->lock);
+    return chunk;
+}
+
+static void batch_queueClose(BatchQueue* q) {
+    pthread_mutex_lock(&q->lock);
+    q->closed = TRUE;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+typedef struct BatchPipeline {
+    int         fd;
+    const char* map;
+    size_t      map_size;
+
+    BatchQueue work;
+    BatchQueue done;
+
+    // Chunks read but not yet written, and the most there may be.
+    size_t          in_flight;
+    size_t          max_in_flight;
+    pthread_mutex_t credit_lock;
+    pthread_cond_t  credit;
+
+    // The last worker to finish closes the done queue, which ends the writer.
+    size_t workers_left;
+} BatchPipeline;
+
+static void batch_workerExit(BatchPipeline* p) {
+    pthread_mutex_lock(&p->credit_lock);
+    BOOL last = --p->workers_left == 0;
+    pthread_mutex_unlock(&p->credit_lock);
+
+    if (last) batch_queueClose(&p->done);
+}
+
+static const char* last_newline(const char* data, size_t len) {
+    while (len--) {
+        if (data[len] == '\n') return data + len;
+    }
+    return 0;
+}
+
+static BatchChunk* batch_chunkNew(BatchPipeline* p, size_t seq) {
+    pthread_mutex_lock(&p->credit_lock);
+
+    while (p->in_flight == p->max_in_flight) {
+        pthread_cond_wait(&p->credit, &p->credit_lock);
+    }
+
+    p->in_flight++;
+    pthread_mutex_unlock(&p->credit_lock);
+
+    BatchChunk* chunk = xmalloc(sizeof(BatchChunk));
+    memset(chunk, 0, sizeof(BatchChunk));
+    chunk->seq = seq;
+
+    return chunk;
+}
+
+static void batch_chunkFree(BatchPipeline* p, BatchChunk* chunk) {
+    batch_outputFree(&chunk->out);
+    xfree(chunk->owned);
+    xfree(chunk);
+
+    pthread_mutex_lock(&p->credit_lock);
+    p->in_flight--;
+    pthread_cond_signal(&p->credit);
+    pthread_mutex_unlock(&p->credit_lock);
+}
+
+static void* batch_reader(void* arg) {
+    BatchPipeline* p   = arg;
+    size_t         seq = 0;
+
+    if (p->map) {
+        size_t offset = 0;
+
+        while (offset < p->map_size) {
+            size_t end = offset + BATCH_CHUNK_SIZE;
+
+            if (end >= p->map_size) {
+                end = p->map_size;
+            } else {
+                const char* newline = memchr(p->map + end, '\n', p->map_size - end);
+                end = newline ? (size_t)(newline - p->map) + 1 : p->map_size;
+            }
+
+            BatchChunk* chunk = batch_chunkNew(p, seq++);
+            chunk->data = p->map + offset;
+            chunk->len  = end - offset;
+
+            batch_queuePush(&p->work, chunk);
+            offset = end;
+        }
+    } else {
+        char*  carry     = 0;
+        size_t carry_len = 0;
+        BOOL   eof       = FALSE;
+
+        while (!eof) {
+            BatchChunk* chunk = batch_chunkNew(p, seq++);
+            size_t      cap   = BATCH_CHUNK_SIZE > carry_len * 2 ? BATCH_CHUNK_SIZE : carry_len * 2;
+            size_t      len   = carry_len;
+
+            chunk->owned = xmalloc(cap);
+            memcpy(chunk->owned, carry, carry_len);
+
+            // Fill the buffer, growing it if a single line doesn't fit.
+            for (;;) {
+                if (len == cap) {
+                    if (last_newline(chunk->owned, len)) break;
+
+                    cap *= 2;
+                    chunk->owned = xrealloc(chunk->owned, cap);
+                }
+
+                ssize_t n = read(p->fd, chunk->owned + len, cap - len);
+
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) {
+                    eof = TRUE;
+                    break;
+                }
+
+                len += (size_t)n;
+            }
+
+            const char* newline = last_newline(chunk->owned, len);
+            size_t      end     = eof || !newline ? len : (size_t)(newline - chunk->owned) + 1;
+
+            xfree(carry);
+            carry_len = len - end;
+            carry     = xmalloc(carry_len ? carry_len : 1);
+            memcpy(carry, chunk->owned + end, carry_len);
+
+            chunk->data = chunk->owned;
+            chunk->len  = end;
+
+            batch_queuePush(&p->work, chunk);
+        }
+
+        xfree(carry);
+    }
+
+    batch_queueClose(&p->work);
+    return 0;
+}
+
+static void* batch_worker(void* arg) {
+    BatchPipeline* p       = arg;
+    SftContext*    context = SftContext_new();
+    BatchChunk*    chunk;
+
+    while ((chunk = batch_queuePop(&p->work))) {
+        size_t consumed = 0;
+
+        batch_outputInit(&chunk->out, -1, chunk->len + 64);
+        chunk->failed = batch_evalBuffer(context, chunk->data, chunk->len, &chunk->out, &consumed);
+
+        // Only the last chunk can end without a newline.
+        if (consumed < chunk->len) {
+            chunk->failed += !batch_evalLine(
+                context, chunk->data + consumed, chunk->len - consumed, &chunk->out);
+        }
+
+        batch_queuePush(&p->done, chunk);
+    }
+
+    SftContext_free(context);
+    batch_workerExit(p);
+    return 0;
+}
+
+static long batch_parallel(int fd, const char* map, size_t map_size, size_t jobs) {
+    BatchPipeline p = {.fd = fd, .map = map, .map_size = map_size};
+
+    p.max_in_flight = jobs * 4;
+    batch_queueInit(&p.work, jobs * 2);
+    batch_queueInit(&p.done, p.max_in_flight);
+    pthread_mutex_init(&p.credit_lock, 0);
+    pthread_cond_init(&p.credit, 0);
+
+    pthread_t reader;
+    pthread_t workers[jobs];
+    size_t    started = 0;
+
+    p.workers_left = jobs;
+
+    for (size_t i = 0; i < jobs; i++) {
+        if (!pthread_create(&workers[started], 0, batch_worker, &p)) {
+            started++;
+        } else {
+            batch_workerExit(&p);
+        }
+    }
+
+    if (!started || pthread_create(&reader, 0, batch_reader, &p)) {
+        // Without threads there's no pipeline; close the work queue so any
+        // workers that did start exit, then do it all here.
+        batch_queueClose(&p.work);
+
+        for (size_t i = 0; i < started; i++) {
+            pthread_join(workers[i], 0);
+        }
+
+        pthread_mutex_destroy(&p.credit_lock);
+        pthread_cond_destroy(&p.credit);
+        batch_queueDestroy(&p.work);
+        batch_queueDestroy(&p.done);
+
+        return batch_serial(fd, map, map_size);
+    }
+
+    // The writer runs here. Sequence numbers of the chunks in flight always
+    // span fewer than max_in_flight values, so seq % max_in_flight is a free
+    // slot for a chunk that finished early.
+    BatchChunk* held[p.max_in_flight];
+    size_t      next   = 0;
+    long        failed = 0;
+
+    memset(held, 0, sizeof(held));
+
+    for (;;) {
+        while (held[next % p.max_in_flight]) {
+            BatchChunk* chunk = held[next % p.max_in_flight];
+            held[next % p.max_in_flight] = 0;
+
+            chunk->out.fd = STDOUT_FILENO;
+            batch_outputFlush(&chunk->out);
+            failed += chunk->failed;
+
+            batch_chunkFree(&p, chunk);
+            next++;
+        }
+
+        BatchChunk* chunk = batch_queuePop(&p.done);
+
+        if (!chunk) break;
+
+        held[chunk->seq % p.max_in_flight] = chunk;
+    }
+
+    pthread_join(reader, 0);
+
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(workers[i], 0);
+    }
+
+    pthread_mutex_destroy(&p.credit_lock);
+    pthread_cond_destroy(&p.credit);
+    batch_queueDestroy(&p.work);
+    batch_queueDestroy(&p.done);
+
+    return failed;
+}
+
+long calculator_batch(const char* path, size_t jobs) {
+    BOOL from_stdin = !path || strcmp(path, "-") == 0;
+    int  fd         = from_stdin ? STDIN_FILENO : open(path, O_RDONLY);
+
+    if (fd < 0) {
+        fprintf(stderr, "Error: Unable to open file %s\n", path);
+        return -1;
+    }
+
+    if (!jobs) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = online > 1 ? (size_t)online : 1;
+    }
+
+    // Regular files are mapped and evaluated in place. Pipes, and anything
+    // else mmap refuses, are read in large chunks instead.
+    struct stat st;
+    char*       map      = 0;
+    size_t      map_size = 0;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        map_size = (size_t)st.st_size;
+        map      = mmap(0, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (map == MAP_FAILED) {
+            map = 0;
+        } else {
+            madvise(map, map_size, MADV_SEQUENTIAL);
+        }
+    }
+
+    // Small inputs aren't worth the threads.
+    long failed = jobs > 1 && (!map || map_size > BATCH_CHUNK_SIZE)
+                      ? batch_parallel(fd, map, map_size, jobs)
+                      : batch_serial(fd, map, map_size);
+
+    if (map) munmap(map, map_size);
+    if (!from_stdin) close(fd);
+
+    return failed;
+}
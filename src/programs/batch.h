@@ -0,0 +1,47 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+
+#include "../../lib/seqft/sft.h"
+
+// Non-interactive calculator. Reads newline separated expressions and writes
+// one line of output per line of input: the result printed with %.17g, an
+// empty line for an empty input line, or "error: " followed by the message.
+
+// Output is collected here and handed to write(2) in large pieces rather than
+// going through stdio a line at a time.
+typedef struct BatchOutput {
+    char*  data;
+    size_t len;
+    size_t cap;
+    int    fd; // Flushed to this descriptor when full; -1 to only grow.
+} BatchOutput;
+
+#define BATCH_OUTPUT_SIZE (1 << 20)
+
+extern void batch_outputInit(BatchOutput* out, int fd, size_t cap);
+extern void batch_outputAppend(BatchOutput* out, const char* s, size_t n);
+extern void batch_outputFlush(BatchOutput* out);
+extern void batch_outputFree(BatchOutput* out);
+
+// Evaluates one line (without its newline) and appends the output line to
+// out. Returns FALSE if the line failed.
+extern BOOL batch_evalLine(SftContext*  context,
+                           const char*  line,
+                           size_t       len,
+                           BatchOutput* out);
+
+// Input is split into chunks of about this many bytes, ending at a newline,
+// when evaluating on several threads.
+#define BATCH_CHUNK_SIZE (256 * 1024)
+
+// Evaluates every line of the file at path, which is mapped rather than
+// read, or of standard input if path is 0 or "-". Output goes to standard
+// output, in input order. With jobs > 1 the lines are evaluated by that many
+// threads, each with its own SftContext; 0 uses one per online CPU.
+// Returns the number of lines that failed, or -1 if the input couldn't be
+// opened.
+extern long calculator_batch(const char* path, size_t jobs);
+
+#endif // BATCH_H
@@ -1,77 +1,237 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <ctype.h>
 
+#include "../../lib/seqft/bigint.h"
+#include "../../lib/seqft/compiler.h"
 #include "../../lib/seqft/evaluator.h"
 #include "../../lib/seqft/tokenizer.h"
+#include "../console.h"
+#include "../sched.h"
+#include "../sync.h"
 #include "../terminal.h"
+#include "calculator.h"
+#include "cells.h"
+#include "solvers.h"
 
-void Sft_cleanup(Sft* sft) {
-    if (!sft) return;
-    Stack_free(sft->operator_stack);
-    Stack_free(sft->number_stack);
-    free(sft);
+static CalcMode calc_mode = CALC_FLOAT;
+static int      calc_base = 10;
+static Sheet*   calc_sheet;
+
+// Every calculator job shares the state above, and with the scheduler's CPU
+// threads they may run at the same time, so they take turns with an input.
+// One that has to wait sleeps, and its CPU goes to another job.
+static SyncMutex calc_lock = SYNC_MUTEX_INIT("calculator");
+
+void calculator_setMode(CalcMode mode) {
+    calc_mode = mode;
 }
 
-void calculate(const char* expr) {
-    Tokenizer* t   = Tokenizer_new();
-    Sft*       sft = Sft_new();
+void calculator_setBase(int base) {
+    calc_base = base;
+}
+
+// Handles "name=expr": defines the cell and prints every cell recomputed.
+static void calculator_assign(const char* expr, const char* eq) {
+    char name[100];
+    size_t name_len = 0;
+
+    for (const char* c = expr; c < eq && name_len < sizeof(name) - 1; c++) {
+        if (!isspace((unsigned char)*c)) name[name_len++] = *c;
+    }
+    name[name_len] = 0;
+
+    if (!calc_sheet) calc_sheet = sheet_new();
+
+    SftError error;
+
+    if (!sheet_define(calc_sheet, name, eq + 1, &error)) {
+        console_printf(console, "%s", error.message);
+        return;
+    }
+
+    for (size_t i = 0; i < Stack_getCount(calc_sheet->recomputed); i++) {
+        Cell* cell = &calc_sheet->cells[*(size_t*)Stack_itemAt(calc_sheet->recomputed, i)];
+
+        if (cell->failed) {
+            console_printf(console, "%s = ? (%s)\n", cell->name, cell->error);
+        } else {
+            console_printf(console, "%s = %f\n", cell->name, cell->value);
+        }
+    }
+}
+
+static BOOL has_variables(TokenArray* tokens) {
+    for (size_t i = 0; i < tokens->count; i++) {
+        if (tokens->tokens[i].type == TT_VAR) return TRUE;
+    }
+    return FALSE;
+}
+
+// Kept between calls; a script runs thousands of expressions, and making
+// these costs more than evaluating a short one. Made by calculate, before
+// its allocation profile begins, so they don't show up as leaked there.
+static Tokenizer* calc_tokenizer;
+static Sft*       calc_sft;
+
+static void calculate_expr(const char* expr) {
+    if (calc_mode == CALC_FLOAT && solvers_isCall(expr)) {
+        SftSolution solution;
+
+        if (!solvers_run(expr, calc_sheet, &solution)) {
+            console_printf(console, "%s", solution.error.message);
+        } else {
+            console_printf(console, "Result: %f\n", solution.value);
+        }
+        return;
+    }
+
+    const char* eq = strchr(expr, '=');
+
+    if (eq && calc_mode == CALC_FLOAT) {
+        calculator_assign(expr, eq);
+        return;
+    }
+
+    // A failed evaluation can leave anything on the cellars.
+    Stack_clear(calc_sft->operator_stack);
+    Stack_clear(calc_sft->number_stack);
 
     size_t expr_len = strlen(expr);
 
     if(!expr_len) {
-        Sft_cleanup(sft);        // ← added
-        Tokenizer_free(t);
         return;
     }
 
-    TokenArray* token_array = Tokenizer_parse(t, expr, expr_len);
+    // Integer mode needs the exact text of each number, not just its f64.
+    calc_tokenizer->keep_literals = calc_mode == CALC_INTEGER;
 
-    if(t->error) {
-        highlight_error(expr, expr_len, *t->error, 2);
+    TokenArray* token_array = Tokenizer_parseParallel(calc_tokenizer, expr, expr_len, 0);
+
+    if(calc_tokenizer->error) {
+        highlight_error(expr, expr_len, *calc_tokenizer->error, 2);
         TokenArray_free(token_array);
-        Sft_cleanup(sft);        // ← added
-        Tokenizer_free(t);
         return;
     }
 
-    if(token_array) {
+    if(token_array && calc_mode == CALC_INTEGER) {
+        SftError    error;
+        SftProgram* program = SftProgram_compile(token_array, &error);
+        BigInt      result;
+        BigInt_init(&result);
+
+        if(!program || BigInt_evalProgram(program, &result, &error)) {
+            console_printf(console, "%s", error.message);
+        } else {
+            char* as_string = BigInt_toString(&result, calc_base);
+            console_printf(console, "Result: %s\n", as_string);
+            xfree(as_string);
+        }
+
+        BigInt_free(&result);
+        SftProgram_free(program);
+    } else if(token_array && calc_sheet && has_variables(token_array)) {
+        double   result = 0;
+        SftError error;
+
+        if (!sheet_eval(calc_sheet, expr, &result, &error)) {
+            console_printf(console, "%s", error.message);
+        } else {
+            console_printf(console, "Result: %f\n", result);
+        }
+    } else if(token_array) {
         double result = 0;
 
-        SftError* error = Sft_evalTokens(sft, token_array, &result);
+        SftError* error = Sft_evalTokens(calc_sft, token_array, &result);
 
         if(error) {
-            printf("%s", error->message);
+            console_printf(console, "%s", error->message);
         } else {
-            printf("Result: %f\n", result);
+            console_printf(console, "Result: %f\n", result);
         }
     }
 
     TokenArray_free(token_array);
-    Sft_cleanup(sft);            // ← added
-    Tokenizer_free(t);
+}
+
+void calculate(const char* expr) {
+    if (!calc_tokenizer) {
+        calc_tokenizer = Tokenizer_new();
+        calc_sft       = Sft_new();
+    }
+
+    // Without SFT_ALLOC_PROFILE these do nothing.
+    alloc_profile_begin();
+    calculate_expr(expr);
+    alloc_profile_end(expr, 0);
+}
+
+static BOOL calculator_handle(const char* input) {
+    if (strcasecmp(input, "exit") == 0) {
+        return FALSE;
+    } else if (strcasecmp(input, "int") == 0) {
+        calculator_setMode(CALC_INTEGER);
+        console_literal(console, "Integer mode: results are exact.\n");
+    } else if (strcasecmp(input, "float") == 0) {
+        calculator_setMode(CALC_FLOAT);
+        console_literal(console, "Floating point mode.\n");
+    } else if (strcasecmp(input, "dec") == 0) {
+        calculator_setBase(10);
+    } else if (strcasecmp(input, "hex") == 0) {
+        calculator_setBase(16);
+    } else if (strcasecmp(input, "oct") == 0) {
+        calculator_setBase(8);
+    } else if (strcasecmp(input, "bin") == 0) {
+        calculator_setBase(2);
+    } else {
+        // Function and cell names are lower case, however the input's typed.
+        size_t len  = strlen(input);
+        char*  expr = xmalloc(len + 1);
+
+        for (size_t i = 0; i <= len; i++) {
+            expr[i] = (char)tolower((unsigned char)input[i]);
+        }
+
+        calculate(expr);
+        xfree(expr);
+    }
+
+    return TRUE;
+}
+
+BOOL calculator_input(const char* input) {
+    // A job that's had its share of the CPU lets the others run first.
+    sched_preemptPoint();
+
+    sync_mutexLock(&calc_lock);
+    BOOL more = calculator_handle(input);
+    sync_mutexUnlock(&calc_lock);
+
+    return more;
 }
 
 void calculator() {
-    char expr[100];
+    char line[256];
     int loop = 1;
     while (loop == 1) {
-        if (loop == 0) {
+        console_literal(console, "Enter expression: ");
+
+        // Waits here, as a job, while the shell and other programs run.
+        if (!terminal_readLine(line, sizeof(line))) {
             break;
         }
 
-        printf("Enter expression: ");
-        scanf("%99s", expr);
+        // Each word is an input of its own, as it was when this used scanf.
+        char* word = line;
+        while (loop == 1 && *(word += strspn(word, " \t"))) {
+            size_t len = strcspn(word, " \t");
+            BOOL   end = word[len] == '\0';
 
-        for (int i = 0; expr[i]; i++) {
-            expr[i] = tolower(expr[i]);
-        }
-
-        if (strcmp(expr, "exit") == 0) {
-            loop = 0;
-        } else {
-            calculate(expr);
+            word[len] = '\0';
+            loop      = calculator_input(word) ? 1 : 0;
+            word     += len + !end;
         }
     }
 }
\ No newline at end of file
@@ -1,8 +1,25 @@
 #ifndef CALCULATOR_H
 #define CALCULATOR_H
 
+#include "../../lib/seqft/evaluator.h"
+
+typedef enum {
+    CALC_FLOAT,   // Evaluate with doubles.
+    CALC_INTEGER, // Evaluate with exact big integers.
+} CalcMode;
+
+// Selects how calculate() evaluates expressions.
+extern void calculator_setMode(CalcMode mode);
+
+// Selects the base (2, 8, 10 or 16) integer mode prints results in.
+extern void calculator_setBase(int base);
+
 extern void calculate(const char* expr);
 
+// Handles one line typed at the calculator's prompt: an expression, or one
+// of the mode and base switches. Returns FALSE for "exit".
+extern BOOL calculator_input(const char* input);
+
 extern void calculator();
 
 #endif // CALCULATOR_H
\ No newline at end of file
@@ -0,0 +1,484 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "../../lib/seqft/evaluator.h"
+#include "../../lib/seqft/tokenizer.h"
+#include "../pool.h"
+#include "cells.h"
+
+static void sheet_insertIndex(Sheet* sheet, size_t cell) {
+    size_t mask = sheet->index_size - 1;
+    size_t slot = sft_hashName(sheet->cells[cell].name) & mask;
+
+    while (sheet->index[slot]) {
+        slot = (slot + 1) & mask;
+    }
+
+    sheet->index[slot] = cell + 1;
+}
+
+static void sheet_growIndex(Sheet* sheet) {
+    xfree(sheet->index);
+
+    sheet->index_size *= 2;
+    sheet->index = xmalloc(sizeof(size_t) * sheet->index_size);
+    memset(sheet->index, 0, sizeof(size_t) * sheet->index_size);
+
+    for (size_t i = 0; i < sheet->count; i++) {
+        sheet_insertIndex(sheet, i);
+    }
+}
+
+static BOOL sheet_lookup(Sheet* sheet, const char* name, size_t* out) {
+    size_t mask = sheet->index_size - 1;
+    size_t slot = sft_hashName(name) & mask;
+
+    while (sheet->index[slot]) {
+        size_t cell = sheet->index[slot] - 1;
+
+        if (strcmp(sheet->cells[cell].name, name) == 0) {
+            *out = cell;
+            return TRUE;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    return FALSE;
+}
+
+static char* copy_string(const char* s) {
+    size_t len  = strlen(s);
+    char*  copy = xmalloc(len + 1);
+    memcpy(copy, s, len + 1);
+    return copy;
+}
+
+// Finds a cell by name, creating an undefined placeholder if there isn't one.
+static size_t sheet_cell(Sheet* sheet, const char* name) {
+    size_t found;
+
+    if (sheet_lookup(sheet, name, &found)) {
+        return found;
+    }
+
+    if (sheet->count == sheet->capacity) {
+        sheet->capacity *= 2;
+        sheet->cells = xrealloc(sheet->cells, sizeof(Cell) * sheet->capacity);
+    }
+
+    Cell* cell = &sheet->cells[sheet->count];
+    memset(cell, 0, sizeof(Cell));
+
+    cell->name       = copy_string(name);
+    cell->dependents = Stack_withCapacity(sizeof(size_t), 4);
+
+    sheet->count++;
+
+    if (sheet->count * 2 > sheet->index_size) {
+        sheet_growIndex(sheet);
+    } else {
+        sheet_insertIndex(sheet, sheet->count - 1);
+    }
+
+    return sheet->count - 1;
+}
+
+Sheet* sheet_new() {
+    Sheet* sheet = xmalloc(sizeof(Sheet));
+    memset(sheet, 0, sizeof(Sheet));
+
+    sheet->capacity   = 16;
+    sheet->cells      = xmalloc(sizeof(Cell) * sheet->capacity);
+    sheet->index_size = 32;
+    sheet->index      = xmalloc(sizeof(size_t) * sheet->index_size);
+    sheet->recomputed = Stack_withCapacity(sizeof(size_t), 16);
+
+    sheet->parallel_threshold = SHEET_PARALLEL_THRESHOLD;
+
+    memset(sheet->index, 0, sizeof(size_t) * sheet->index_size);
+    return sheet;
+}
+
+void sheet_free(Sheet* sheet) {
+    if (!sheet) return;
+
+    for (size_t i = 0; i < sheet->count; i++) {
+        Cell* cell = &sheet->cells[i];
+
+        xfree(cell->name);
+        xfree(cell->expr);
+        xfree(cell->deps);
+        SftProgram_free(cell->program);
+        Stack_free(cell->dependents);
+    }
+
+    Stack_free(sheet->recomputed);
+    xfree(sheet->cells);
+    xfree(sheet->index);
+    xfree(sheet);
+}
+
+Cell* sheet_find(Sheet* sheet, const char* name) {
+    size_t found;
+    return sheet_lookup(sheet, name, &found) ? &sheet->cells[found] : 0;
+}
+
+static SftProgram* compile_expr(const char* expr, SftError* error) {
+    size_t len = strlen(expr);
+    size_t nonspace = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        nonspace += !isspace((unsigned char)expr[i]);
+    }
+
+    if (!nonspace) {
+        sprintf(error->message, "Invalid expression, nothing to evaluate\n\n");
+        return 0;
+    }
+
+    Tokenizer*  t       = Tokenizer_new();
+    TokenArray* tokens  = Tokenizer_parse(t, expr, len);
+    SftProgram* program = 0;
+
+    if (t->error) {
+        snprintf(error->message, sizeof(error->message), "%s\n\n", t->error->message);
+    } else if (tokens) {
+        program = SftProgram_compile(tokens, error);
+    }
+
+    TokenArray_free(tokens);
+    Tokenizer_free(t);
+
+    return program;
+}
+
+// Evaluation
+// ----------------------------------------------------------------------------
+
+static void sheet_evalCell(Sheet* sheet, size_t index) {
+    Cell* cell = &sheet->cells[index];
+
+    cell->failed = FALSE;
+
+    if (!cell->defined) {
+        cell->failed = TRUE;
+        snprintf(cell->error, sizeof(cell->error), "'%s' is undefined", cell->name);
+        return;
+    }
+
+    size_t n = cell->program->var_count;
+    double vars[n ? n : 1];
+
+    for (size_t i = 0; i < n; i++) {
+        Cell* dep = &sheet->cells[cell->deps[i]];
+
+        if (!dep->defined || dep->failed) {
+            cell->failed = TRUE;
+            snprintf(cell->error, sizeof(cell->error),
+                     dep->defined ? "'%s' has an error" : "'%s' is undefined",
+                     dep->name);
+            return;
+        }
+
+        vars[i] = dep->value;
+    }
+
+    cell->value = SftProgram_eval(cell->program, vars);
+}
+
+typedef struct LevelSlice {
+    Sheet*  sheet;
+    size_t* cells;
+    size_t  count;
+} LevelSlice;
+
+static void sheet_evalSlice(void* arg) {
+    LevelSlice* slice = arg;
+
+    for (size_t i = 0; i < slice->count; i++) {
+        sheet_evalCell(slice->sheet, slice->cells[i]);
+    }
+}
+
+// Every cell in a level only reads cells from earlier levels, so a level can
+// be split across the kernel's pool with no locking at all.
+static void sheet_evalLevel(Sheet* sheet, size_t* cells, size_t count) {
+    size_t threads = pool_limit();
+
+    if (count < sheet->parallel_threshold || threads == 1) {
+        for (size_t i = 0; i < count; i++) {
+            sheet_evalCell(sheet, cells[i]);
+        }
+        return;
+    }
+
+    if (threads > count / (sheet->parallel_threshold / 2 + 1) + 1) {
+        threads = count / (sheet->parallel_threshold / 2 + 1) + 1;
+    }
+
+    PoolGroup  group = {0};
+    PoolTask   tasks[threads];
+    LevelSlice slices[threads];
+    size_t     per = (count + threads - 1) / threads;
+
+    for (size_t i = 0; i < threads; i++) {
+        size_t begin = i * per < count ? i * per : count;
+        size_t end   = begin + per < count ? begin + per : count;
+
+        slices[i] = (LevelSlice) {.sheet = sheet, .cells = cells + begin, .count = end - begin};
+
+        if (i > 0) {
+            tasks[i] = (PoolTask) {.fn = sheet_evalSlice, .arg = &slices[i], .group = &group};
+            pool_submit(&tasks[i]);
+        }
+    }
+
+    sheet_evalSlice(&slices[0]);
+    pool_wait(&group);
+}
+
+// Recomputes the cell at root and everything that transitively depends on it.
+static void sheet_recompute(Sheet* sheet, size_t root) {
+    Stack* dirty = Stack_withCapacity(sizeof(size_t), 16);
+    Stack* work  = Stack_withCapacity(sizeof(size_t), 16);
+
+    Stack_clear(sheet->recomputed);
+
+    // Collect the dirty set.
+    sheet->cells[root].dirty = TRUE;
+    Stack_pushFrom(dirty, &root);
+    Stack_pushFrom(work, &root);
+
+    while (!Stack_empty(work)) {
+        size_t index = *(size_t*)Stack_getHead(work);
+        Stack_drop(work, 1);
+
+        Stack* dependents = sheet->cells[index].dependents;
+
+        for (size_t i = 0; i < Stack_getCount(dependents); i++) {
+            size_t dependent = *(size_t*)Stack_itemAt(dependents, i);
+
+            if (!sheet->cells[dependent].dirty) {
+                sheet->cells[dependent].dirty = TRUE;
+                Stack_pushFrom(dirty, &dependent);
+                Stack_pushFrom(work, &dependent);
+            }
+        }
+    }
+
+    // Kahn's algorithm over the dirty set: a cell is ready once none of the
+    // cells it reads are still waiting to be recomputed.
+    size_t  count = Stack_getCount(dirty);
+    size_t* level = xmalloc(sizeof(size_t) * count);
+    size_t  level_count = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        size_t index = *(size_t*)Stack_itemAt(dirty, i);
+        Cell*  cell  = &sheet->cells[index];
+
+        cell->pending = 0;
+
+        for (size_t d = 0; cell->program && d < cell->program->var_count; d++) {
+            cell->pending += sheet->cells[cell->deps[d]].dirty;
+        }
+
+        if (!cell->pending) {
+            level[level_count++] = index;
+        }
+    }
+
+    while (level_count) {
+        sheet_evalLevel(sheet, level, level_count);
+
+        size_t next_count = 0;
+
+        for (size_t i = 0; i < level_count; i++) {
+            Cell* cell = &sheet->cells[level[i]];
+            Stack_pushFrom(sheet->recomputed, &level[i]);
+
+            for (size_t j = 0; j < Stack_getCount(cell->dependents); j++) {
+                size_t dependent = *(size_t*)Stack_itemAt(cell->dependents, j);
+
+                // Dependents come after everything in this level was read, so
+                // the slots already consumed can be reused for the next one.
+                if (sheet->cells[dependent].dirty && --sheet->cells[dependent].pending == 0) {
+                    level[next_count++] = dependent;
+                }
+            }
+        }
+
+        level_count = next_count;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        sheet->cells[*(size_t*)Stack_itemAt(dirty, i)].dirty = FALSE;
+    }
+
+    xfree(level);
+    Stack_free(dirty);
+    Stack_free(work);
+}
+
+// Definitions
+// ----------------------------------------------------------------------------
+
+// Is target among the cells that index reads, directly or not? Walks with
+// an explicit stack, as a chain of cells can be far longer than the
+// calculator's coroutine stack would allow recursing down.
+static BOOL sheet_reaches(Sheet* sheet, size_t index, size_t target, BOOL* seen, Stack* work) {
+    Stack_clear(work);
+    Stack_pushFrom(work, &index);
+
+    while (!Stack_empty(work)) {
+        size_t current = *(size_t*)Stack_getHead(work);
+        Stack_drop(work, 1);
+
+        if (current == target) return TRUE;
+        if (seen[current]) continue;
+
+        seen[current] = TRUE;
+
+        Cell* cell = &sheet->cells[current];
+
+        for (size_t i = 0; cell->program && i < cell->program->var_count; i++) {
+            Stack_pushFrom(work, &cell->deps[i]);
+        }
+    }
+
+    return FALSE;
+}
+
+static void remove_dependent(Stack* dependents, size_t index) {
+    size_t count = Stack_getCount(dependents);
+
+    for (size_t i = 0; i < count; i++) {
+        size_t* item = Stack_itemAt(dependents, i);
+
+        if (*item == index) {
+            *item = *(size_t*)Stack_itemAt(dependents, count - 1);
+            Stack_drop(dependents, 1);
+            return;
+        }
+    }
+}
+
+static BOOL valid_name(const char* name) {
+    if (!isalpha((unsigned char)name[0])) return FALSE;
+
+    for (const char* c = name; *c; c++) {
+        if (!isalnum((unsigned char)*c) && *c != '_') return FALSE;
+    }
+
+    return Sft_findFunction(name) < 0;
+}
+
+BOOL sheet_define(Sheet* sheet, const char* name, const char* expr, SftError* error) {
+    if (!valid_name(name)) {
+        snprintf(error->message, sizeof(error->message),
+                 "Invalid cell name '%.64s'\n\n", name);
+        return FALSE;
+    }
+
+    SftProgram* program = compile_expr(expr, error);
+
+    if (!program) {
+        return FALSE;
+    }
+
+    // Refuse definitions that would make the cell depend on itself. Only
+    // cells that already exist can lead back to it, and nothing is created
+    // until the definition is accepted.
+    size_t index;
+    BOOL   exists = sheet_lookup(sheet, name, &index);
+    BOOL*  seen   = xmalloc(sizeof(BOOL) * (sheet->count ? sheet->count : 1));
+    Stack* work   = Stack_withCapacity(sizeof(size_t), 16);
+
+    memset(seen, 0, sizeof(BOOL) * sheet->count);
+
+    for (size_t i = 0; i < program->var_count; i++) {
+        size_t dep;
+        BOOL   cycle = strcmp(program->vars[i], name) == 0;
+
+        if (!cycle && exists && sheet_lookup(sheet, program->vars[i], &dep)) {
+            cycle = sheet_reaches(sheet, dep, index, seen, work);
+        }
+
+        if (cycle) {
+            snprintf(error->message, sizeof(error->message),
+                     "'%s' would depend on itself through '%s'\n\n",
+                     name, program->vars[i]);
+
+            xfree(seen);
+            Stack_free(work);
+            SftProgram_free(program);
+            return FALSE;
+        }
+    }
+
+    xfree(seen);
+    Stack_free(work);
+
+    index        = sheet_cell(sheet, name);
+    size_t* deps = xmalloc(sizeof(size_t) * (program->var_count ? program->var_count : 1));
+
+    for (size_t i = 0; i < program->var_count; i++) {
+        deps[i] = sheet_cell(sheet, program->vars[i]);
+    }
+
+    Cell* cell = &sheet->cells[index];
+
+    for (size_t i = 0; cell->program && i < cell->program->var_count; i++) {
+        remove_dependent(sheet->cells[cell->deps[i]].dependents, index);
+    }
+
+    for (size_t i = 0; i < program->var_count; i++) {
+        Stack_pushFrom(sheet->cells[deps[i]].dependents, &index);
+    }
+
+    xfree(cell->expr);
+    xfree(cell->deps);
+    SftProgram_free(cell->program);
+
+    cell->expr    = copy_string(expr);
+    cell->program = program;
+    cell->deps    = deps;
+    cell->defined = TRUE;
+
+    sheet_recompute(sheet, index);
+    return TRUE;
+}
+
+BOOL sheet_eval(Sheet* sheet, const char* expr, double* out, SftError* error) {
+    SftProgram* program = compile_expr(expr, error);
+
+    if (!program) {
+        return FALSE;
+    }
+
+    size_t n = program->var_count;
+    double vars[n ? n : 1];
+
+    for (size_t i = 0; i < n; i++) {
+        Cell* cell = sheet_find(sheet, program->vars[i]);
+
+        if (!cell || !cell->defined || cell->failed) {
+            snprintf(error->message, sizeof(error->message),
+                     cell && cell->defined ? "'%s' has an error\n\n"
+                                           : "Unknown variable '%s'\n\n",
+                     program->vars[i]);
+
+            SftProgram_free(program);
+            return FALSE;
+        }
+
+        vars[i] = cell->value;
+    }
+
+    *out = SftProgram_eval(program, vars);
+
+    SftProgram_free(program);
+    return TRUE;
+}
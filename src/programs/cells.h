@@ -0,0 +1,73 @@
+#ifndef CELLS_H
+#define CELLS_H
+
+#include "../../lib/seqft/common.h"
+#include "../../lib/seqft/compiler.h"
+#include "../../lib/seqft/stack.h"
+
+// Named cells for the calculator, like a spreadsheet: "b = a*2+1" defines b in
+// terms of a. Every cell keeps its compiled program, the cells it reads and
+// the cells that read it. Changing a cell only recomputes its transitive
+// dependents, level by level in topological order, and a level with enough
+// independent cells in it is recomputed on the kernel's thread pool.
+
+typedef struct Cell {
+    char*       name;
+    char*       expr;
+    SftProgram* program;
+
+    // deps[i] is the cell bound to program->vars[i].
+    size_t* deps;
+    Stack*  dependents; // size_t indices of cells that read this one.
+
+    double value;
+    BOOL   defined; // FALSE for cells that are referenced but not yet defined.
+    BOOL   failed;  // TRUE if the value couldn't be computed; see error.
+    char   error[128];
+
+    // Scratch state for recomputation.
+    BOOL   dirty;
+    size_t pending;
+} Cell;
+
+typedef struct Sheet {
+    Cell*  cells;
+    size_t count;
+    size_t capacity;
+
+    // Open addressing table of cell index + 1 (0 is empty), keyed by name.
+    size_t* index;
+    size_t  index_size;
+
+    // Indices of the cells recomputed by the last sheet_define, in the order
+    // they were recomputed.
+    Stack* recomputed;
+
+    // Levels with at least this many cells are recomputed in parallel.
+    size_t parallel_threshold;
+} Sheet;
+
+#define SHEET_PARALLEL_THRESHOLD 64
+
+extern Sheet* sheet_new();
+extern void   sheet_free(Sheet* sheet);
+
+extern Cell* sheet_find(Sheet* sheet, const char* name);
+
+// Defines (or redefines) a cell, then recomputes it and everything that
+// depends on it. Returns FALSE and writes a message into error if the
+// expression doesn't compile, the name is invalid, or the definition would
+// make a cycle; the sheet is left unchanged in that case.
+extern BOOL sheet_define(Sheet*      sheet,
+                         const char* name,
+                         const char* expr,
+                         SftError*   error);
+
+// Evaluates an expression against the current cell values without defining
+// anything. Returns FALSE and writes a message into error on failure.
+extern BOOL sheet_eval(Sheet*      sheet,
+                       const char* expr,
+                       double*     out,
+                       SftError*   error);
+
+#endif // CELLS_H
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "compile.h"
+#include "../../lib/seqft/image.h"
+
+// Splits "name = expression" into its parts. Returns FALSE, leaving the line
+// alone, if there's no name before the '='.
+static BOOL compile_splitName(char* line, char** name, char** expr) {
+    char* eq = strchr(line, '=');
+    if (!eq) return FALSE;
+
+    char* begin = line;
+    char* end   = eq;
+
+    while (begin < end && isspace((unsigned char)*begin)) begin++;
+    while (end > begin && isspace((unsigned char)end[-1])) end--;
+
+    if (begin == end || !isalpha((unsigned char)*begin)) return FALSE;
+
+    for (char* c = begin; c < end; c++) {
+        if (!isalnum((unsigned char)*c) && *c != '_') return FALSE;
+    }
+
+    *end  = 0;
+    *name = begin;
+    *expr = eq + 1;
+
+    return TRUE;
+}
+
+long calculator_compile(const char* input, const char* output) {
+    FILE* in = strcmp(input, "-") == 0 ? stdin : fopen(input, "r");
+
+    if (!in) {
+        fprintf(stderr, "Can't open %s: %s\n", input, strerror(errno));
+        return -1;
+    }
+
+    Stack*     programs = Stack_new(sizeof(SftProgram*));
+    Stack*     names    = Stack_new(sizeof(char*));
+    Stack*     sources  = Stack_new(sizeof(char*));
+    Tokenizer* t        = Tokenizer_new();
+
+    char*  line     = 0;
+    size_t line_cap = 0;
+    size_t line_no  = 0;
+    long   failed   = 0;
+
+    for (ssize_t len; (len = getline(&line, &line_cap, in)) >= 0;) {
+        line_no++;
+
+        while (len && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = 0;
+
+        char* name = "";
+        char* expr = line;
+        compile_splitName(line, &name, &expr);
+
+        while (isspace((unsigned char)*expr)) expr++;
+        if (!*expr && !*name) continue;
+
+        TokenArray* tokens  = Tokenizer_parse(t, expr, strlen(expr));
+        SftProgram* program = 0;
+        SftError    error   = {0};
+
+        if (t->error) {
+            snprintf(error.message, sizeof(error.message), "%s", t->error->message);
+        } else if (!tokens) {
+            snprintf(error.message, sizeof(error.message), "Invalid expression, nothing to evaluate");
+        } else {
+            program = SftProgram_compile(tokens, &error);
+        }
+
+        TokenArray_free(tokens);
+
+        if (!program) {
+            size_t msg_len = strlen(error.message);
+            while (msg_len && error.message[msg_len - 1] == '\n') error.message[--msg_len] = 0;
+
+            fprintf(stderr, "%s:%zu: %s\n", input, line_no, error.message);
+            failed++;
+            continue;
+        }
+
+        char* name_copy = xmalloc(strlen(name) + 1);
+        char* expr_copy = xmalloc(strlen(expr) + 1);
+        strcpy(name_copy, name);
+        strcpy(expr_copy, expr);
+
+        Stack_pushFrom(programs, &program);
+        Stack_pushFrom(names, &name_copy);
+        Stack_pushFrom(sources, &expr_copy);
+
+        printf("%zu %s\n", Stack_getCount(programs), name);
+    }
+
+    free(line); // From getline, so libc's.
+    Tokenizer_free(t);
+    if (in != stdin) fclose(in);
+
+    size_t   count = Stack_getCount(programs);
+    SftError error;
+
+    if (!SftImage_write(output,
+                        (const SftProgram* const*)Stack_getBase(programs),
+                        (const char* const*)Stack_getBase(names),
+                        (const char* const*)Stack_getBase(sources),
+                        count,
+                        &error)) {
+        fprintf(stderr, "%s", error.message);
+        failed = -1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        SftProgram_free(*(SftProgram**)Stack_itemAt(programs, i));
+        xfree(*(char**)Stack_itemAt(names, i));
+        xfree(*(char**)Stack_itemAt(sources, i));
+    }
+
+    Stack_free(programs);
+    Stack_free(names);
+    Stack_free(sources);
+
+    return failed;
+}
@@ -0,0 +1,17 @@
+#ifndef COMPILE_H
+#define COMPILE_H
+
+#include <stddef.h>
+
+// Compiles a file of formulas into an image (see lib/seqft/image.h) that
+// other runs can map and evaluate without compiling anything. Every non blank
+// line is either "name = expression" or just an expression, which is then
+// only reachable by its position. The programs are listed on standard output,
+// one "id name" line each, with ids counting from 1 in input order; lines
+// that don't compile are reported on standard error and left out.
+//
+// Returns the number of lines that failed, or -1 if the input couldn't be
+// read or the image couldn't be written.
+extern long calculator_compile(const char* input, const char* output);
+
+#endif // COMPILE_H
@@ -0,0 +1,453 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "ring.h"
+
+// Waiting
+// ----------------------------------------------------------------------------
+
+static void ring_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// The rings are shared between processes, so these can't be private futexes.
+static void ring_futexWait(uint32_t* word, uint32_t seen) {
+    syscall(SYS_futex, word, FUTEX_WAIT, seen, 0, 0, 0);
+}
+
+static void ring_futexWake(uint32_t* word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, 1, 0, 0, 0);
+}
+
+// Waits until *word is no longer seen, spinning for up to *spin iterations
+// before sleeping. The waker stores to word, then checks sleeping, and the
+// waiter sets sleeping, then checks word, so one of them always sees the
+// other; the futex compares word again as it goes to sleep.
+static void ring_wait(uint32_t* word, uint32_t seen, uint32_t* sleeping, uint32_t* spin) {
+    for (uint32_t i = 0; i < *spin; i++) {
+        if (__atomic_load_n(word, __ATOMIC_ACQUIRE) != seen) {
+            if (*spin < RING_SPIN_MAX) *spin *= 2;
+            return;
+        }
+
+        ring_relax();
+    }
+
+    if (*spin > RING_SPIN_MIN) *spin /= 2;
+
+    while (__atomic_load_n(word, __ATOMIC_ACQUIRE) == seen) {
+        __atomic_store_n(sleeping, 1, __ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n(word, __ATOMIC_SEQ_CST) == seen) {
+            ring_futexWait(word, seen);
+        }
+
+        __atomic_store_n(sleeping, 0, __ATOMIC_RELAXED);
+    }
+}
+
+static void ring_wake(uint32_t* word, uint32_t* sleeping) {
+    if (__atomic_load_n(sleeping, __ATOMIC_SEQ_CST)) {
+        ring_futexWake(word);
+    }
+}
+
+// Server
+// ----------------------------------------------------------------------------
+
+static void ring_fail(RingCompletion* c, const char* message) {
+    size_t len = strlen(message);
+
+    // Messages from the evaluator end with blank lines meant for the shell.
+    while (len && message[len - 1] == '\n') len--;
+    if (len > sizeof(c->error) - 1) len = sizeof(c->error) - 1;
+
+    c->ok = 0;
+    memcpy(c->error, message, len);
+    c->error[len] = 0;
+}
+
+static void ring_eval(RingServer* server, const RingRequest* r, RingCompletion* c) {
+    SftResult result;
+
+    if (r->len > RING_PAYLOAD_SIZE) {
+        ring_fail(c, "Expression too long");
+    } else if (Sft_eval(server->context, r->expr, r->len, &result)) {
+        c->ok    = 1;
+        c->value = result.value;
+    } else {
+        ring_fail(c, result.error.message);
+    }
+}
+
+static void ring_compile(RingServer* server, const RingRequest* r, RingCompletion* c) {
+    if (r->len > RING_PAYLOAD_SIZE) {
+        ring_fail(c, "Expression too long");
+        return;
+    }
+
+    if (server->program_count == (server->image ? server->image->count : 0) + RING_MAX_PROGRAMS) {
+        ring_fail(c, "Too many compiled programs");
+        return;
+    }
+
+    Tokenizer*  t       = server->context->tokenizer;
+    TokenArray* tokens  = Tokenizer_parse(t, r->expr, r->len);
+    SftProgram* program = 0;
+    SftError    error   = {0};
+
+    if (t->error) {
+        ring_fail(c, t->error->message);
+    } else if (!tokens) {
+        ring_fail(c, "Invalid expression, nothing to evaluate");
+    } else if (!(program = SftProgram_compile(tokens, &error))) {
+        ring_fail(c, error.message);
+    } else if (program->var_count > RING_MAX_ARGS) {
+        // RING_OP_RUN couldn't pass it all its arguments.
+        ring_fail(c, "Too many variables");
+        SftProgram_free(program);
+        program = 0;
+    }
+
+    TokenArray_free(tokens);
+
+    if (program) {
+        server->programs[server->program_count++] = program;
+
+        c->ok        = 1;
+        c->program   = (uint32_t)server->program_count; // Ids start at 1.
+        c->var_count = (uint32_t)program->var_count;
+    }
+}
+
+static void ring_run(RingServer* server, const RingRequest* r, RingCompletion* c) {
+    if (r->program == 0 || r->program > server->program_count) {
+        ring_fail(c, "No such program");
+        return;
+    }
+
+    const SftProgram* program = server->programs[r->program - 1];
+
+    if (program->var_count > RING_MAX_ARGS) {
+        ring_fail(c, "Too many variables");
+        return;
+    }
+
+    if (r->len != program->var_count) {
+        ring_fail(c, "Wrong number of arguments");
+        return;
+    }
+
+    c->ok    = 1;
+    c->value = SftProgram_eval(program, r->args);
+}
+
+// Answers everything waiting on the channel, then publishes the completions
+// with a single store. Returns how many requests there were.
+static uint32_t ring_serveChannel(RingServer* server, RingChannel* ch) {
+    uint32_t head = ch->sq_head;
+    uint32_t tail = __atomic_load_n(&ch->sq_tail, __ATOMIC_ACQUIRE);
+
+    if (head == tail) return 0;
+
+    // The client never has more than RING_SLOTS requests in flight, so the
+    // completion for request n always has slot n free.
+    for (uint32_t i = head; i != tail; i++) {
+        const RingRequest* r = &ch->sq[i & (RING_SLOTS - 1)];
+        RingCompletion*    c = &ch->cq[i & (RING_SLOTS - 1)];
+
+        c->tag       = r->tag;
+        c->program   = 0;
+        c->value     = 0;
+        c->var_count = 0;
+        c->error[0]  = 0;
+
+        switch (r->op) {
+            case RING_OP_EVAL: ring_eval(server, r, c); break;
+            case RING_OP_COMPILE: ring_compile(server, r, c); break;
+            case RING_OP_RUN: ring_run(server, r, c); break;
+            default: ring_fail(c, "Unknown operation"); break;
+        }
+    }
+
+    __atomic_store_n(&ch->sq_head, tail, __ATOMIC_RELEASE);
+    __atomic_store_n(&ch->cq_tail, tail, __ATOMIC_SEQ_CST);
+    ring_wake(&ch->cq_tail, &ch->cq_sleeping);
+
+    return tail - head;
+}
+
+static void* ring_serverRun(void* arg) {
+    RingServer* server = arg;
+    RingShared* shared = server->shared;
+
+    while (!__atomic_load_n(&server->stopping, __ATOMIC_ACQUIRE)) {
+        // Read before looking at the channels, so a flush that comes after
+        // the scan has already changed it.
+        uint32_t doorbell = __atomic_load_n(&shared->doorbell, __ATOMIC_ACQUIRE);
+        uint32_t served   = 0;
+
+        for (size_t i = 0; i < RING_CHANNELS; i++) {
+            served += ring_serveChannel(server, &shared->channels[i]);
+        }
+
+        if (!served) {
+            ring_wait(&shared->doorbell, doorbell, &shared->server_sleeping, &server->spin);
+        }
+    }
+
+    return 0;
+}
+
+RingServer* ring_serverStart(const char* name, SftImage* image) {
+    if (!name) name = RING_DEFAULT_NAME;
+
+    for (size_t i = 0; image && i < image->count; i++) {
+        if (image->programs[i].var_count > RING_MAX_ARGS) {
+            fprintf(stderr, "Can't serve %s from the image: Too many variables\n", image->names[i]);
+            SftImage_close(image);
+            return 0;
+        }
+    }
+
+    // A segment left behind by a server that didn't exit cleanly.
+    shm_unlink(name);
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+    if (fd < 0 || ftruncate(fd, sizeof(RingShared)) < 0) {
+        fprintf(stderr, "Can't create shared memory %s: %s\n", name, strerror(errno));
+        if (fd >= 0) close(fd);
+        SftImage_close(image);
+        return 0;
+    }
+
+    RingShared* shared = mmap(0, sizeof(RingShared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (shared == MAP_FAILED) {
+        fprintf(stderr, "Can't map shared memory %s: %s\n", name, strerror(errno));
+        shm_unlink(name);
+        SftImage_close(image);
+        return 0;
+    }
+
+    // ftruncate zeroed it; the magic goes last, as clients check it first.
+    shared->size = sizeof(RingShared);
+    __atomic_store_n(&shared->magic, RING_MAGIC, __ATOMIC_RELEASE);
+
+    RingServer* server = xmalloc(sizeof(RingServer));
+
+    server->name          = xmalloc(strlen(name) + 1);
+    server->shared        = shared;
+    server->stopping      = FALSE;
+    server->context       = SftContext_new();
+    server->image         = image;
+    server->program_count = image ? image->count : 0;
+    server->programs      = xmalloc(sizeof(SftProgram*) * (server->program_count + RING_MAX_PROGRAMS));
+    server->spin          = RING_SPIN_MIN;
+
+    for (size_t i = 0; i < server->program_count; i++) {
+        server->programs[i] = &image->programs[i];
+    }
+
+    strcpy(server->name, name);
+    pthread_create(&server->thread, 0, ring_serverRun, server);
+
+    return server;
+}
+
+void ring_serverStop(RingServer* server) {
+    if (!server) return;
+
+    __atomic_store_n(&server->stopping, TRUE, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&server->shared->doorbell, 1, __ATOMIC_SEQ_CST);
+    ring_futexWake(&server->shared->doorbell);
+
+    pthread_join(server->thread, 0);
+
+    munmap(server->shared, sizeof(RingShared));
+    shm_unlink(server->name);
+
+    for (size_t i = server->image ? server->image->count : 0; i < server->program_count; i++) {
+        SftProgram_free(server->programs[i]);
+    }
+
+    SftImage_close(server->image);
+    SftContext_free(server->context);
+    xfree(server->programs);
+    xfree(server->name);
+    xfree(server);
+}
+
+// Client
+// ----------------------------------------------------------------------------
+
+// Claims a free channel, or one whose owner died without letting go of it.
+static RingChannel* ring_claim(RingShared* shared) {
+    uint32_t pid = (uint32_t)getpid();
+
+    for (size_t i = 0; i < RING_CHANNELS; i++) {
+        RingChannel* ch    = &shared->channels[i];
+        uint32_t     owner = __atomic_load_n(&ch->owner, __ATOMIC_ACQUIRE);
+
+        if (owner && (kill((pid_t)owner, 0) == 0 || errno != ESRCH)) continue;
+
+        if (__atomic_compare_exchange_n(&ch->owner, &owner, pid, FALSE,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            // Let the server finish whatever the last owner left, and drop
+            // its completions.
+            while (__atomic_load_n(&ch->sq_head, __ATOMIC_ACQUIRE) != ch->sq_tail) {
+                ring_relax();
+            }
+
+            ch->cq_head = __atomic_load_n(&ch->cq_tail, __ATOMIC_ACQUIRE);
+            return ch;
+        }
+    }
+
+    return 0;
+}
+
+RingClient* ring_connect(const char* name) {
+    if (!name) name = RING_DEFAULT_NAME;
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return 0;
+
+    RingShared* shared = mmap(0, sizeof(RingShared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (shared == MAP_FAILED) return 0;
+
+    RingChannel* channel = 0;
+
+    if (__atomic_load_n(&shared->magic, __ATOMIC_ACQUIRE) != RING_MAGIC ||
+        shared->size != sizeof(RingShared) ||
+        !(channel = ring_claim(shared))) {
+        munmap(shared, sizeof(RingShared));
+        return 0;
+    }
+
+    RingClient* client = xmalloc(sizeof(RingClient));
+
+    client->shared  = shared;
+    client->channel = channel;
+    client->sq_tail = channel->sq_tail;
+    client->spin    = RING_SPIN_MIN;
+
+    return client;
+}
+
+void ring_disconnect(RingClient* client) {
+    if (!client) return;
+
+    RingCompletion scratch[RING_SLOTS];
+    while (ring_reap(client, scratch, RING_SLOTS, TRUE)) {}
+
+    __atomic_store_n(&client->channel->owner, 0, __ATOMIC_RELEASE);
+    munmap(client->shared, sizeof(RingShared));
+    xfree(client);
+}
+
+size_t ring_inFlight(const RingClient* client) {
+    return client->sq_tail - client->channel->cq_head;
+}
+
+static RingRequest* ring_next(RingClient* client, uint32_t op, uint64_t tag) {
+    if (ring_inFlight(client) >= RING_SLOTS) return 0;
+
+    RingRequest* r = &client->channel->sq[client->sq_tail & (RING_SLOTS - 1)];
+
+    r->op      = op;
+    r->tag     = tag;
+    r->program = 0;
+
+    return r;
+}
+
+static BOOL ring_submitExpr(RingClient* client, uint32_t op, const char* expr, size_t len, uint64_t tag) {
+    if (len > RING_PAYLOAD_SIZE) return FALSE;
+
+    RingRequest* r = ring_next(client, op, tag);
+    if (!r) return FALSE;
+
+    r->len = (uint32_t)len;
+    memcpy(r->expr, expr, len);
+
+    client->sq_tail++;
+    return TRUE;
+}
+
+BOOL ring_submitEval(RingClient* client, const char* expr, size_t len, uint64_t tag) {
+    return ring_submitExpr(client, RING_OP_EVAL, expr, len, tag);
+}
+
+BOOL ring_submitCompile(RingClient* client, const char* expr, size_t len, uint64_t tag) {
+    return ring_submitExpr(client, RING_OP_COMPILE, expr, len, tag);
+}
+
+BOOL ring_submitRun(RingClient*   client,
+                    uint32_t      program,
+                    const double* args,
+                    size_t        count,
+                    uint64_t      tag) {
+
+    if (count > RING_MAX_ARGS) return FALSE;
+
+    RingRequest* r = ring_next(client, RING_OP_RUN, tag);
+    if (!r) return FALSE;
+
+    r->len     = (uint32_t)count;
+    r->program = program;
+    memcpy(r->args, args, count * sizeof(double));
+
+    client->sq_tail++;
+    return TRUE;
+}
+
+void ring_flush(RingClient* client) {
+    RingShared*  shared = client->shared;
+    RingChannel* ch     = client->channel;
+
+    if (ch->sq_tail == client->sq_tail) return;
+
+    __atomic_store_n(&ch->sq_tail, client->sq_tail, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&shared->doorbell, 1, __ATOMIC_SEQ_CST);
+    ring_wake(&shared->doorbell, &shared->server_sleeping);
+}
+
+size_t ring_reap(RingClient* client, RingCompletion* out, size_t max, BOOL wait) {
+    RingChannel* ch   = client->channel;
+    uint32_t     head = ch->cq_head;
+    uint32_t     tail = __atomic_load_n(&ch->cq_tail, __ATOMIC_ACQUIRE);
+
+    if (head == tail && wait && ring_inFlight(client)) {
+        // Waiting on requests the server hasn't been told about would never
+        // end.
+        ring_flush(client);
+        ring_wait(&ch->cq_tail, tail, &ch->cq_sleeping, &client->spin);
+        tail = __atomic_load_n(&ch->cq_tail, __ATOMIC_ACQUIRE);
+    }
+
+    size_t n = 0;
+
+    for (; head != tail && n < max; head++, n++) {
+        out[n] = ch->cq[head & (RING_SLOTS - 1)];
+    }
+
+    __atomic_store_n(&ch->cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
@@ -0,0 +1,171 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "../../lib/seqft/compiler.h"
+#include "../../lib/seqft/image.h"
+#include "../../lib/seqft/sft.h"
+
+// Shared memory submission rings, for processes on the same host that can't
+// afford a socket round trip per expression.
+//
+// The server creates a POSIX shared memory object holding RING_CHANNELS
+// channels. A client claims a free channel, and each channel is a pair of
+// single producer, single consumer rings: requests from the client to the
+// server, and completions back. With one channel per client, many producers
+// can submit at once without sharing a ring index, and the server consumes
+// every channel in batches from one thread.
+//
+// Nobody blocks while there's work in flight: both sides spin for a while
+// first, adapting how long to the recent past, and only then sleep on a futex
+// in the shared mapping. Wakeups are only issued to a side that has said it's
+// asleep, so a busy ring makes no system calls at all.
+
+#define RING_DEFAULT_NAME "/neptune"
+
+#define RING_CHANNELS 16
+#define RING_SLOTS    64 // Per ring. Must be a power of two.
+
+// Spin iterations before sleeping. Starts at RING_SPIN_MIN, doubles whenever
+// spinning paid off and halves whenever it didn't.
+#define RING_SPIN_MIN 64
+#define RING_SPIN_MAX (64 * 1024)
+
+// Programs clients can compile, shared by every client. Programs preloaded
+// from an image don't count.
+#define RING_MAX_PROGRAMS 1024
+
+typedef enum {
+    RING_OP_EVAL    = 0, // Evaluate the expression in expr.
+    RING_OP_COMPILE = 1, // Compile the expression in expr for RING_OP_RUN.
+    RING_OP_RUN     = 2, // Run a compiled program with args bound to its vars.
+} RingOp;
+
+#define RING_PAYLOAD_SIZE 232
+#define RING_MAX_ARGS     (RING_PAYLOAD_SIZE / sizeof(double))
+
+typedef struct RingRequest {
+    uint32_t op;
+    uint32_t len;     // Bytes of expr, or the number of args.
+    uint64_t tag;     // Returned in the completion.
+    uint32_t program; // For RING_OP_RUN.
+    uint32_t reserved;
+
+    union {
+        char   expr[RING_PAYLOAD_SIZE];
+        double args[RING_MAX_ARGS];
+    };
+} RingRequest;
+
+typedef struct RingCompletion {
+    uint64_t tag;
+    uint32_t ok;
+    uint32_t program;   // Id made by RING_OP_COMPILE.
+    double   value;     // Result of RING_OP_EVAL and RING_OP_RUN.
+    uint32_t var_count; // Variables the compiled program takes, in order.
+    uint32_t reserved;
+    char     error[96]; // When ok is 0, without the trailing newlines.
+} RingCompletion;
+
+typedef struct RingChannel {
+    _Alignas(64) uint32_t owner; // Pid of the client using it, 0 if free.
+
+    // Requests. The client writes slots and advances sq_tail; the server
+    // advances sq_head once it has answered them.
+    _Alignas(64) uint32_t sq_tail;
+    _Alignas(64) uint32_t sq_head;
+
+    // Completions. cq_tail doubles as the futex a waiting client sleeps on.
+    _Alignas(64) uint32_t cq_tail;
+    uint32_t cq_sleeping;
+    _Alignas(64) uint32_t cq_head;
+
+    RingRequest    sq[RING_SLOTS];
+    RingCompletion cq[RING_SLOTS];
+} RingChannel;
+
+#define RING_MAGIC 0x4e505452 // "NPTR"
+
+typedef struct RingShared {
+    uint32_t magic;
+    uint32_t size; // sizeof(RingShared), to catch mismatched builds.
+
+    // Bumped by every client flush; the server sleeps on it.
+    _Alignas(64) uint32_t doorbell;
+    uint32_t server_sleeping;
+
+    RingChannel channels[RING_CHANNELS];
+} RingShared;
+
+// Server
+// ----------------------------------------------------------------------------
+
+typedef struct RingServer {
+    char*       name;
+    RingShared* shared;
+    pthread_t   thread;
+    BOOL        stopping;
+
+    SftContext*  context;
+    SftImage*    image; // Preloaded programs, which come first in programs.
+    SftProgram** programs;
+    size_t       program_count;
+
+    uint32_t spin;
+} RingServer;
+
+// Creates the shared memory object called name (RING_DEFAULT_NAME if 0) and
+// starts answering requests on a thread of its own. The programs of image, if
+// not 0, can be run straight away with ids 1 to image->count; the server
+// takes ownership of it. Returns 0 on failure, including when one of the
+// image's programs takes more than RING_MAX_ARGS variables.
+extern RingServer* ring_serverStart(const char* name, SftImage* image);
+
+// Stops the server thread and removes the shared memory object.
+extern void ring_serverStop(RingServer* server);
+
+// Client
+// ----------------------------------------------------------------------------
+
+typedef struct RingClient {
+    RingShared*  shared;
+    RingChannel* channel;
+
+    uint32_t sq_tail; // Requests written, including ones not flushed yet.
+    uint32_t spin;
+} RingClient;
+
+// Maps the server's shared memory and claims a channel. Returns 0 if there's
+// no server or every channel is taken.
+extern RingClient* ring_connect(const char* name);
+
+// Waits for anything still in flight, then releases the channel.
+extern void ring_disconnect(RingClient* client);
+
+// Requests written but not completed. At most RING_SLOTS.
+extern size_t ring_inFlight(const RingClient* client);
+
+// Write a request into the next slot. Nothing is sent until ring_flush.
+// Return FALSE if RING_SLOTS requests are already in flight, or the payload
+// doesn't fit.
+extern BOOL ring_submitEval(RingClient* client, const char* expr, size_t len, uint64_t tag);
+extern BOOL ring_submitCompile(RingClient* client, const char* expr, size_t len, uint64_t tag);
+extern BOOL ring_submitRun(RingClient*   client,
+                           uint32_t      program,
+                           const double* args,
+                           size_t        count,
+                           uint64_t      tag);
+
+// Publishes every request written so far to the server, with one wakeup at
+// most.
+extern void ring_flush(RingClient* client);
+
+// Copies up to max completions into out, in submission order, and returns how
+// many. With wait set, blocks until there's at least one, unless nothing is
+// in flight.
+extern size_t ring_reap(RingClient* client, RingCompletion* out, size_t max, BOOL wait);
+
+#endif // RING_H
@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.h"
+
+#define SERVER_MAX_EVENTS 64
+
+static volatile sig_atomic_t server_stopping = 0;
+
+static ServerConnection* server_connections = 0;
+
+static void server_stop(int sig) {
+    (void)sig;
+    server_stopping = 1;
+}
+
+static ServerConnection* server_connectionNew(int fd) {
+    ServerConnection* c = xmalloc(sizeof(ServerConnection));
+
+    c->fd      = fd;
+    c->context = SftContext_new();
+    c->in_cap  = SERVER_READ_SIZE;
+    c->in      = xmalloc(c->in_cap);
+    c->in_len  = 0;
+    c->writing = FALSE;
+
+    batch_outputInit(&c->out, -1, SERVER_READ_SIZE);
+    c->out_sent = 0;
+
+    c->prev = 0;
+    c->next = server_connections;
+    if (c->next) c->next->prev = c;
+    server_connections = c;
+
+    return c;
+}
+
+static void server_connectionFree(int epoll_fd, ServerConnection* c) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, 0);
+    close(c->fd);
+
+    if (c->prev) c->prev->next = c->next;
+    else server_connections = c->next;
+    if (c->next) c->next->prev = c->prev;
+
+    SftContext_free(c->context);
+    batch_outputFree(&c->out);
+    xfree(c->in);
+    xfree(c);
+}
+
+// Evaluates every complete request in the input buffer and appends the
+// responses to the output. Returns FALSE if a request is too long.
+static BOOL server_handleRequests(ServerConnection* c) {
+    size_t at = 0;
+
+    while (c->in_len - at >= 4) {
+        uint32_t len;
+        memcpy(&len, c->in + at, 4);
+        len = ntohl(len);
+
+        if (len > SERVER_MAX_REQUEST) return FALSE;
+        if (c->in_len - at - 4 < len) break;
+
+        // Reserve the response header, then fill it in once the length of
+        // the output line is known.
+        size_t header = c->out.len;
+        batch_outputAppend(&c->out, "\0\0\0\0", 4);
+        batch_evalLine(c->context, c->in + at + 4, len, &c->out);
+
+        uint32_t out_len = htonl((uint32_t)(c->out.len - header - 4));
+        memcpy(c->out.data + header, &out_len, 4);
+
+        at += 4 + len;
+    }
+
+    memmove(c->in, c->in + at, c->in_len - at);
+    c->in_len -= at;
+
+    return TRUE;
+}
+
+// Sends as much pending output as the socket takes. Returns FALSE if the
+// connection failed.
+static BOOL server_send(ServerConnection* c) {
+    while (c->out_sent < c->out.len) {
+        ssize_t n = send(c->fd, c->out.data + c->out_sent, c->out.len - c->out_sent, MSG_NOSIGNAL);
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return TRUE;
+            return FALSE;
+        }
+
+        c->out_sent += (size_t)n;
+    }
+
+    c->out.len = c->out_sent = 0;
+    return TRUE;
+}
+
+// Waits for input while the connection has room for more output, and for
+// writability while it has output left to send.
+static void server_watch(int epoll_fd, ServerConnection* c) {
+    BOOL     pending = c->out_sent < c->out.len;
+    uint32_t events  = pending ? EPOLLOUT : 0;
+
+    if (c->out.len - c->out_sent < SERVER_OUTPUT_LIMIT) {
+        events |= EPOLLIN;
+    }
+
+    if (pending != c->writing || !(events & EPOLLIN)) {
+        struct epoll_event event = {.events = events, .data.ptr = c};
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &event);
+        c->writing = pending;
+    }
+}
+
+// Returns FALSE if the connection should be closed.
+static BOOL server_handle(int epoll_fd, ServerConnection* c, uint32_t events) {
+    if (events & (EPOLLERR | EPOLLHUP) && !(events & EPOLLIN)) return FALSE;
+
+    if (events & EPOLLIN) {
+        if (c->in_cap - c->in_len < SERVER_READ_SIZE) {
+            c->in_cap = c->in_len + SERVER_READ_SIZE;
+            c->in     = xrealloc(c->in, c->in_cap);
+        }
+
+        // One read per wakeup, so that a busy client can't starve the others.
+        ssize_t n = read(c->fd, c->in + c->in_len, SERVER_READ_SIZE);
+
+        if (n == 0) return FALSE;
+        if (n < 0) return errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK;
+
+        c->in_len += (size_t)n;
+
+        if (!server_handleRequests(c)) return FALSE;
+    }
+
+    if (!server_send(c)) return FALSE;
+
+    server_watch(epoll_fd, c);
+    return TRUE;
+}
+
+static int server_listen(const char* path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    // A socket file left behind by a server that didn't exit cleanly.
+    unlink(path);
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        fprintf(stderr, "Can't listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void server_accept(int epoll_fd, int listen_fd) {
+    for (;;) {
+        int fd = accept(listen_fd, 0, 0);
+
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            return; // EAGAIN, or out of descriptors until a client leaves.
+        }
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        ServerConnection*  c     = server_connectionNew(fd);
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = c};
+
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+int calculator_serve(const char* path, const char* ring, const char* programs) {
+    if (!path) path = SERVER_DEFAULT_PATH;
+
+    SftImage* image = 0;
+
+    if (programs) {
+        SftError error;
+
+        if (!(image = SftImage_open(programs, &error))) {
+            fprintf(stderr, "%s", error.message);
+            return -1;
+        }
+    }
+
+    int listen_fd = server_listen(path);
+
+    if (listen_fd < 0) {
+        SftImage_close(image);
+        return -1;
+    }
+
+    // Runs on its own thread; the socket still works without it.
+    RingServer* ring_server = ring_serverStart(ring, image);
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    // The listening socket is the only one registered without a connection.
+    struct epoll_event listen_event = {.events = EPOLLIN, .data.ptr = 0};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_event);
+
+    struct sigaction stop = {.sa_handler = server_stop};
+    sigaction(SIGINT, &stop, 0);
+    sigaction(SIGTERM, &stop, 0);
+
+    fprintf(stderr, "Listening on %s\n", path);
+
+    if (ring_server) {
+        fprintf(stderr, "Accepting shared memory requests on %s", ring_server->name);
+
+        if (ring_server->image) {
+            fprintf(stderr, " with %zu programs from %s", ring_server->image->count, programs);
+        }
+
+        fprintf(stderr, "\n");
+    }
+
+    struct epoll_event events[SERVER_MAX_EVENTS];
+
+    while (!server_stopping) {
+        int n = epoll_wait(epoll_fd, events, SERVER_MAX_EVENTS, -1);
+
+        for (int i = 0; i < n; i++) {
+            ServerConnection* c = events[i].data.ptr;
+
+            if (!c) {
+                server_accept(epoll_fd, listen_fd);
+                continue;
+            }
+
+            if (!server_handle(epoll_fd, c, events[i].events)) {
+                server_connectionFree(epoll_fd, c);
+            }
+        }
+    }
+
+    while (server_connections) {
+        server_connectionFree(epoll_fd, server_connections);
+    }
+
+    ring_serverStop(ring_server);
+
+    close(epoll_fd);
+    close(listen_fd);
+    unlink(path);
+
+    return 0;
+}
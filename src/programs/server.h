@@ -0,0 +1,56 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "batch.h"
+#include "ring.h"
+
+// Evaluation server. Listens on a UNIX domain socket so that local processes
+// can share one running evaluator instead of starting Neptune per job.
+//
+// Requests are framed: a 32 bit length in network byte order followed by that
+// many bytes of expression. Responses are framed the same way and hold one
+// line of batch output (see batch.h), newline included. Clients may pipeline
+// as many requests as they like; responses come back in request order, and
+// every response made from one read is sent with a single write.
+
+#define SERVER_DEFAULT_PATH "/tmp/neptune.sock"
+
+// Requests longer than this close the connection.
+#define SERVER_MAX_REQUEST (1 << 20)
+
+// Bytes read from a connection at a time.
+#define SERVER_READ_SIZE (64 * 1024)
+
+// A connection with this much unsent output isn't read from until the client
+// catches up.
+#define SERVER_OUTPUT_LIMIT (1 << 20)
+
+typedef struct ServerConnection {
+    int         fd;
+    SftContext* context; // Reused for every request on the connection.
+
+    char*  in;
+    size_t in_len;
+    size_t in_cap;
+
+    BatchOutput out;
+    size_t      out_sent;
+
+    BOOL writing; // Waiting for the socket to be writable.
+
+    // Every open connection, to close them all on shutdown.
+    struct ServerConnection* prev;
+    struct ServerConnection* next;
+} ServerConnection;
+
+// Serves requests on the socket at path (SERVER_DEFAULT_PATH if 0), and on
+// the shared memory rings called ring (RING_DEFAULT_NAME if 0, see ring.h),
+// until interrupted with SIGINT or SIGTERM, then removes both. The programs
+// in the image at programs, if not 0, are loaded for the rings' RING_OP_RUN.
+// Returns 0, or -1 if the socket or the image couldn't be set up.
+extern int calculator_serve(const char* path, const char* ring, const char* programs);
+
+#endif // SERVER_H
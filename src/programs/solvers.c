@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "solvers.h"
+
+typedef BOOL (*SolverFn)(SftClosure* f, double lo, double hi, double tol, SftSolution* out);
+
+typedef struct Solver {
+    const char* name;
+    SolverFn    fn;
+} Solver;
+
+static const Solver SOLVERS[] = {
+    {"solve", Sft_solve},
+    {"integrate", Sft_integrate},
+    {"minimize", Sft_minimize},
+};
+
+#define SOLVER_COUNT (sizeof(SOLVERS) / sizeof(SOLVERS[0]))
+
+static const Solver* solvers_find(const char* expr, const char** args) {
+    while (isspace((unsigned char)*expr)) expr++;
+
+    for (size_t i = 0; i < SOLVER_COUNT; i++) {
+        size_t len = strlen(SOLVERS[i].name);
+
+        if (strncmp(expr, SOLVERS[i].name, len) != 0) continue;
+
+        const char* c = expr + len;
+        while (isspace((unsigned char)*c)) c++;
+
+        if (*c == '(') {
+            *args = c + 1;
+            return &SOLVERS[i];
+        }
+    }
+
+    return 0;
+}
+
+BOOL solvers_isCall(const char* expr) {
+    const char* args;
+    return solvers_find(expr, &args) != 0;
+}
+
+static BOOL solvers_fail(SftSolution* out, const char* message, const char* name) {
+    snprintf(out->error.message, sizeof(out->error.message), message, name);
+    return FALSE;
+}
+
+// Compiles expr, binding every variable but free_var (which may be 0) to its
+// cell. vars gets one double per variable of the program, and a spare one at
+// the end.
+static SftProgram* solvers_compile(const char* expr,
+                                   size_t      len,
+                                   Sheet*      sheet,
+                                   const char* free_var,
+                                   double**    vars,
+                                   SftSolution* out) {
+
+    Tokenizer*  t       = Tokenizer_new();
+    TokenArray* tokens  = Tokenizer_parse(t, expr, len);
+    SftProgram* program = 0;
+
+    if (t->error) {
+        snprintf(out->error.message, sizeof(out->error.message), "%s\n\n", t->error->message);
+    } else if (!tokens) {
+        solvers_fail(out, "Invalid expression, nothing to evaluate\n\n", 0);
+    } else {
+        program = SftProgram_compile(tokens, &out->error);
+    }
+
+    TokenArray_free(tokens);
+    Tokenizer_free(t);
+
+    if (!program) return 0;
+
+    *vars = xmalloc(sizeof(double) * (program->var_count + 1));
+
+    for (size_t i = 0; i < program->var_count; i++) {
+        const char* name = program->vars[i];
+
+        if (free_var && strcmp(name, free_var) == 0) {
+            (*vars)[i] = 0;
+            continue;
+        }
+
+        Cell* cell = sheet ? sheet_find(sheet, name) : 0;
+
+        if (!cell || !cell->defined || cell->failed) {
+            solvers_fail(out, cell && cell->defined ? "'%s' has an error\n\n" : "Unknown variable '%s'\n\n", name);
+            SftProgram_free(program);
+            xfree(*vars);
+            return 0;
+        }
+
+        (*vars)[i] = cell->value;
+    }
+
+    return program;
+}
+
+static BOOL solvers_bound(const char* expr, size_t len, Sheet* sheet, double* value, SftSolution* out) {
+    double*     vars;
+    SftProgram* program = solvers_compile(expr, len, sheet, 0, &vars, out);
+
+    if (!program) return FALSE;
+
+    *value = SftProgram_eval(program, vars);
+
+    SftProgram_free(program);
+    xfree(vars);
+
+    return TRUE;
+}
+
+BOOL solvers_run(const char* expr, Sheet* sheet, SftSolution* out) {
+    const char*   args;
+    const Solver* solver = solvers_find(expr, &args);
+
+    out->evaluations = 0;
+
+    if (!solver) return solvers_fail(out, "Not a solver call\n\n", 0);
+
+    // Split the arguments at the top level commas.
+    const char* arg[4];
+    size_t      arg_len[4];
+    size_t      argc  = 0;
+    int         depth = 0;
+    const char* begin = args;
+    const char* c     = args;
+
+    for (; *c; c++) {
+        if (*c == '(') {
+            depth++;
+        } else if ((*c == ',' && depth == 0) || (*c == ')' && depth-- == 0)) {
+            if (argc == 4) break;
+
+            arg[argc]       = begin;
+            arg_len[argc++] = (size_t)(c - begin);
+            begin           = c + 1;
+
+            if (*c == ')') break;
+        }
+    }
+
+    const char* rest = *c ? c + 1 : c;
+    while (isspace((unsigned char)*rest)) rest++;
+
+    if (argc != 4 || *c != ')' || *rest) {
+        return solvers_fail(out, "Invalid expression, %s takes (expression, variable, from, to)\n\n",
+                            solver->name);
+    }
+
+    // The variable must be a plain name.
+    char   var[64];
+    size_t var_len = 0;
+
+    for (size_t i = 0; i < arg_len[1]; i++) {
+        char ch = arg[1][i];
+
+        if (isspace((unsigned char)ch)) continue;
+
+        if (var_len == sizeof(var) - 1 || !(isalnum((unsigned char)ch) || ch == '_') ||
+            (var_len == 0 && !isalpha((unsigned char)ch))) {
+            return solvers_fail(out, "Invalid expression, %s needs a variable name\n\n", solver->name);
+        }
+
+        var[var_len++] = ch;
+    }
+
+    var[var_len] = 0;
+
+    if (!var_len) {
+        return solvers_fail(out, "Invalid expression, %s needs a variable name\n\n", solver->name);
+    }
+
+    double lo, hi;
+
+    if (!solvers_bound(arg[2], arg_len[2], sheet, &lo, out) ||
+        !solvers_bound(arg[3], arg_len[3], sheet, &hi, out)) {
+        return FALSE;
+    }
+
+    double*     vars;
+    SftProgram* program = solvers_compile(arg[0], arg_len[0], sheet, var, &vars, out);
+
+    if (!program) return FALSE;
+
+    // An expression that doesn't use the variable is constant in it, which
+    // every method handles; the variable then goes in the spare slot.
+    size_t index = program->var_count;
+    SftProgram_findVar(program, var, &index);
+
+    SftClosure f = {.program = program, .vars = vars, .var = index};
+
+    BOOL ok = solver->fn(&f, lo, hi, 0, out);
+
+    SftProgram_free(program);
+    xfree(vars);
+
+    return ok;
+}
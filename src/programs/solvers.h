@@ -0,0 +1,25 @@
+#ifndef SOLVERS_H
+#define SOLVERS_H
+
+#include "../../lib/seqft/solver.h"
+#include "cells.h"
+
+// The calculator's solver built-ins:
+//
+//   solve(expr, x, lo, hi)      x in [lo, hi] where expr is 0
+//   integrate(expr, x, a, b)    the integral of expr over x from a to b
+//   minimize(expr, x, lo, hi)   x in [lo, hi] where expr is smallest
+//
+// expr is compiled once with x left free, and run for every evaluation the
+// method needs. Any other variable in expr, lo or hi is read from the sheet.
+// These take an expression rather than a number, so they can't go inside
+// other expressions; a solver call has to be the whole input.
+
+// TRUE if expr is a call to one of the solvers.
+extern BOOL solvers_isCall(const char* expr);
+
+// Runs the solver call in expr. Returns FALSE and writes a message into
+// out->error on failure. sheet may be 0.
+extern BOOL solvers_run(const char* expr, Sheet* sheet, SftSolution* out);
+
+#endif // SOLVERS_H
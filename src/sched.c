@@ -0,0 +1,686 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "console.h"
+#include "coroutine.h"
+#include "pool.h"
+#include "sched.h"
+
+// Older glibc headers only have the field under its internal name.
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+typedef struct Task {
+    Process*   process; // 0 if the slot's free.
+    Coroutine* coroutine;
+    TaskFn     fn;
+    void*      arg;
+    int        next; // Next slot in the same run queue, or -1.
+    int        cpu;  // The CPU whose run queue it's on, or was last on.
+
+    // Weighted CPU time, in nanoseconds, for the fair policy.
+    uint64_t vruntime;
+} Task;
+
+// A run queue, and with CPU threads, the thread that serves it.
+typedef struct Cpu {
+    // Round robin queues of slot indices, one per level, linked through
+    // Task.next.
+    int* heads;
+    int* tails;
+
+    // The fair policy's min-heap of slot indices, ordered by vruntime, and a
+    // floor that only ever rises, for jobs joining the heap.
+    int*     heap;
+    int      heap_len;
+    uint64_t min_vruntime;
+
+    int queued;  // Jobs on the queues.
+    int running; // Slot of the job having a turn, or -1.
+
+    pthread_t      thread;
+    pthread_cond_t wakeup;
+    int            core;
+
+    uint64_t started_ns;
+    uint64_t busy_ns;
+    uint64_t turns;
+    uint64_t migrations;
+} Cpu;
+
+static ProcessTable* table;
+static SchedPolicy   policy  = SCHED_POLICY_ROUND_ROBIN;
+static int           quantum = SCHED_DEFAULT_QUANTUM_MS;
+static int           levels  = 1;
+
+// One per process table slot, indexed the same way.
+static Task* tasks;
+
+// Without CPU threads there's a single run queue, served by sched_runNext.
+static Cpu* cpus;
+static int  cpu_count;
+static BOOL threaded;
+static BOOL stopping;
+
+// Held by whoever's touching the queues or the process table. The thread
+// that called sched_init holds it except while it gives a job a turn or
+// waits, so other threads have to wait for those to touch anything.
+static pthread_mutex_t kernel_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  turn_done   = PTHREAD_COND_INITIALIZER;
+static __thread BOOL   locked;
+
+// The pool limit CPU threads take from the thread that started them.
+static size_t cpu_poolLimit;
+
+// CPU time is worth 1024 / weight of vruntime. Each nice level is about 10%
+// more or less CPU than the one next to it; these are Linux's weights.
+static const int nice_weights[40] = {
+    88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+    9548,  7620,  6100,  4904,  3906,  3121,  2501,  1991,  1586,  1277,
+    1024,  820,   655,   526,   423,   335,   272,   215,   172,   137,
+    110,   87,    70,    56,    45,    36,    29,    23,    18,    15,
+};
+
+// Every thread that gives jobs turns has a timer on its own CPU clock, so
+// one thread's quantum running out doesn't cut short another's.
+static __thread volatile sig_atomic_t expired;
+static __thread timer_t               turn_timer;
+static __thread BOOL                  has_timer;
+
+// What the job did with its turn, for the thread that gave it the turn to
+// sort out once it's back.
+static __thread BOOL turn_blocked;
+static __thread BOOL turn_preempted;
+
+static void on_timer(int signal) {
+    expired = 1;
+}
+
+uint64_t sched_nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void arm_timer() {
+    if (!has_timer) {
+        struct sigevent event;
+        memset(&event, 0, sizeof(event));
+        event.sigev_notify           = SIGEV_THREAD_ID;
+        event.sigev_signo            = SIGVTALRM;
+        event.sigev_notify_thread_id = gettid();
+
+        has_timer = timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &turn_timer) == 0;
+    }
+
+    struct itimerspec spec = {{0, 0}, {quantum / 1000, (quantum % 1000) * 1000000L}};
+    expired                = 0;
+
+    if (has_timer) timer_settime(turn_timer, 0, &spec, 0);
+}
+
+static void cpu_init(Cpu* cpu) {
+    memset(cpu, 0, sizeof(Cpu));
+
+    cpu->heads   = xmalloc(sizeof(int) * (size_t)levels);
+    cpu->tails   = xmalloc(sizeof(int) * (size_t)levels);
+    cpu->heap    = xmalloc(sizeof(int) * (size_t)table->capacity);
+    cpu->running = -1;
+    cpu->core    = -1;
+
+    for (int i = 0; i < levels; i++) {
+        cpu->heads[i] = cpu->tails[i] = -1;
+    }
+
+    cpu->started_ns = sched_nowNs();
+}
+
+static void cpu_free(Cpu* cpu) {
+    xfree(cpu->heads);
+    xfree(cpu->tails);
+    xfree(cpu->heap);
+}
+
+void sched_init(ProcessTable* processes, SchedPolicy kind, int quantum_ms, int level_count) {
+    sched_stopCpus();
+
+    for (int i = 0; i < cpu_count; i++) {
+        cpu_free(&cpus[i]);
+    }
+
+    xfree(cpus);
+    xfree(tasks);
+
+    table   = processes;
+    policy  = kind;
+    quantum = quantum_ms > 0 ? quantum_ms : SCHED_DEFAULT_QUANTUM_MS;
+    levels  = level_count > 0 ? level_count : 1;
+
+    tasks = xmalloc(sizeof(Task) * (size_t)table->capacity);
+    memset(tasks, 0, sizeof(Task) * (size_t)table->capacity);
+
+    cpus      = xmalloc(sizeof(Cpu));
+    cpu_count = 1;
+    cpu_init(&cpus[0]);
+
+    // SA_RESTART, so the timer going off doesn't cut a read short.
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_timer;
+    action.sa_flags   = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGVTALRM, &action, 0);
+
+    sched_lock();
+}
+
+SchedPolicy sched_policy() {
+    return policy;
+}
+
+void sched_priorityRange(int* highest, int* lowest) {
+    if (policy == SCHED_POLICY_FAIR) {
+        *highest = SCHED_NICE_MIN;
+        *lowest  = SCHED_NICE_MAX;
+    } else {
+        *highest = 0;
+        *lowest  = levels - 1;
+    }
+}
+
+static BOOL heap_less(Cpu* cpu, int a, int b) {
+    return tasks[cpu->heap[a]].vruntime < tasks[cpu->heap[b]].vruntime;
+}
+
+static void heap_swap(Cpu* cpu, int a, int b) {
+    int slot     = cpu->heap[a];
+    cpu->heap[a] = cpu->heap[b];
+    cpu->heap[b] = slot;
+}
+
+static void heap_push(Cpu* cpu, int slot) {
+    int i = cpu->heap_len++;
+    cpu->heap[i] = slot;
+
+    while (i > 0 && heap_less(cpu, i, (i - 1) / 2)) {
+        heap_swap(cpu, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static int heap_pop(Cpu* cpu) {
+    int slot     = cpu->heap[0];
+    cpu->heap[0] = cpu->heap[--cpu->heap_len];
+
+    for (int i = 0;;) {
+        int least = i;
+        int left  = 2 * i + 1;
+        int right = left + 1;
+
+        if (left < cpu->heap_len && heap_less(cpu, left, least)) least = left;
+        if (right < cpu->heap_len && heap_less(cpu, right, least)) least = right;
+        if (least == i) break;
+
+        heap_swap(cpu, i, least);
+        i = least;
+    }
+
+    return slot;
+}
+
+static void enqueue(Cpu* cpu, int slot) {
+    tasks[slot].cpu = (int)(cpu - cpus);
+    cpu->queued++;
+
+    if (policy == SCHED_POLICY_FAIR) {
+        heap_push(cpu, slot);
+        return;
+    }
+
+    int level = tasks[slot].process->priority;
+
+    tasks[slot].next = -1;
+
+    if (cpu->tails[level] < 0) {
+        cpu->heads[level] = slot;
+    } else {
+        tasks[cpu->tails[level]].next = slot;
+    }
+
+    cpu->tails[level] = slot;
+}
+
+static int dequeue(Cpu* cpu) {
+    if (!cpu->queued) return -1;
+
+    cpu->queued--;
+
+    if (policy == SCHED_POLICY_FAIR) return heap_pop(cpu);
+
+    for (int level = 0;; level++) {
+        int slot = cpu->heads[level];
+
+        if (slot < 0) continue;
+
+        cpu->heads[level] = tasks[slot].next;
+        if (cpu->heads[level] < 0) cpu->tails[level] = -1;
+
+        return slot;
+    }
+}
+
+// Load balancing
+// ----------------------------------------------------------------------------
+// With CPU threads, a job that becomes ready goes back to the CPU it last ran
+// on unless that CPU is busy and another is idle. After every turn a CPU
+// hands a job to the least loaded one if it has two more than that, and a CPU
+// that runs out of jobs takes one from the longest queue.
+
+static int cpu_load(const Cpu* cpu) {
+    return cpu->queued + (cpu->running >= 0);
+}
+
+static Cpu* least_loaded() {
+    Cpu* least = &cpus[0];
+
+    for (int i = 1; i < cpu_count; i++) {
+        if (cpu_load(&cpus[i]) < cpu_load(least)) least = &cpus[i];
+    }
+
+    return least;
+}
+
+static void migrate(Task* task, Cpu* to) {
+    Cpu* from = &cpus[task->cpu];
+
+    if (from == to) return;
+
+    // It keeps its place relative to the jobs around it, not its vruntime.
+    int64_t lag     = (int64_t)(task->vruntime - from->min_vruntime);
+    int64_t shifted = (int64_t)to->min_vruntime + lag;
+
+    task->vruntime = shifted > 0 ? (uint64_t)shifted : 0;
+    task->cpu      = (int)(to - cpus);
+    to->migrations++;
+}
+
+static void make_ready(int slot) {
+    Task* task = &tasks[slot];
+    Cpu*  cpu  = &cpus[task->cpu];
+
+    if (threaded && cpu_load(cpu)) {
+        Cpu* least = least_loaded();
+        if (!cpu_load(least)) cpu = least;
+    }
+
+    migrate(task, cpu);
+    enqueue(cpu, slot);
+
+    if (threaded) pthread_cond_signal(&cpu->wakeup);
+}
+
+static void balance(Cpu* cpu) {
+    Cpu* least = least_loaded();
+
+    if (cpu_load(cpu) - cpu_load(least) < 2) return;
+
+    int slot = dequeue(cpu);
+
+    migrate(&tasks[slot], least);
+    enqueue(least, slot);
+    pthread_cond_signal(&least->wakeup);
+}
+
+static int steal(Cpu* cpu) {
+    Cpu* busiest = 0;
+
+    for (int i = 0; i < cpu_count; i++) {
+        if (cpus[i].queued && (!busiest || cpus[i].queued > busiest->queued)) busiest = &cpus[i];
+    }
+
+    if (!busiest) return -1;
+
+    int slot = dequeue(busiest);
+    migrate(&tasks[slot], cpu);
+
+    return slot;
+}
+
+// Turns
+// ----------------------------------------------------------------------------
+
+static void task_main(void* arg) {
+    Task* task = arg;
+    task->fn(task->arg);
+}
+
+Process* sched_spawn(const char* name, TaskFn fn, void* arg) {
+    Process* parent  = process_current(table);
+    Process* process = process_spawn(table, name, parent ? parent->pid : 0);
+
+    if (!process) return 0;
+
+    int   slot = (int)(process - table->slots);
+    Task* task = &tasks[slot];
+    Cpu*  cpu  = least_loaded();
+
+    task->process   = process;
+    task->fn        = fn;
+    task->arg       = arg;
+    task->coroutine = coroutine_new(task_main, task);
+    task->cpu       = (int)(cpu - cpus);
+
+    // A new job starts level with the others rather than owed all the CPU
+    // they've used so far.
+    task->vruntime = cpu->min_vruntime;
+
+    make_ready(slot);
+    return process;
+}
+
+BOOL sched_ready() {
+    return !threaded && cpus[0].queued > 0;
+}
+
+// Gives the job in slot a turn on cpu. The kernel lock is let go for the
+// turn itself.
+static void run_turn(Cpu* cpu, int slot) {
+    Task* task = &tasks[slot];
+
+    cpu->running = slot;
+    cpu->turns++;
+
+    turn_blocked   = FALSE;
+    turn_preempted = FALSE;
+    arm_timer();
+
+    uint64_t used   = task->process->cpu_ns;
+    Process* parent = process_switch(table, task->process);
+
+    BOOL held = locked;
+    locked    = FALSE;
+    pthread_mutex_unlock(&kernel_lock);
+
+    BOOL alive = coroutine_resume(task->coroutine);
+
+    if (threaded) console_flush(console);
+
+    // A job that blocked holding the kernel lock leaves it to us.
+    if (!locked) pthread_mutex_lock(&kernel_lock);
+    locked = held;
+
+    process_switch(table, parent);
+
+    used          = task->process->cpu_ns - used;
+    cpu->running  = -1;
+    cpu->busy_ns += used;
+
+    if (turn_preempted) task->process->preemptions++;
+    if (turn_blocked) task->process->state = PROCESS_BLOCKED;
+
+    if (policy == SCHED_POLICY_FAIR) {
+        task->vruntime += used * 1024 / (uint64_t)nice_weights[task->process->priority - SCHED_NICE_MIN];
+
+        uint64_t floor = task->vruntime;
+        if (cpu->heap_len && tasks[cpu->heap[0]].vruntime < floor) floor = tasks[cpu->heap[0]].vruntime;
+        if (floor > cpu->min_vruntime) cpu->min_vruntime = floor;
+    }
+
+    if (!alive) {
+        coroutine_free(task->coroutine);
+        process_exit(table, task->process->pid);
+        task->process = 0;
+    } else if (task->process->state == PROCESS_READY) {
+        make_ready(slot);
+    }
+}
+
+static BOOL jobs_active() {
+    for (int i = 0; i < cpu_count; i++) {
+        if (cpu_load(&cpus[i])) return TRUE;
+    }
+
+    return FALSE;
+}
+
+BOOL sched_runNext() {
+    if (threaded) {
+        if (!jobs_active()) return FALSE;
+
+        pthread_cond_wait(&turn_done, &kernel_lock);
+        return TRUE;
+    }
+
+    int slot = dequeue(&cpus[0]);
+
+    if (slot < 0) return FALSE;
+
+    run_turn(&cpus[0], slot);
+    return TRUE;
+}
+
+void sched_block() {
+    turn_blocked = TRUE;
+    coroutine_yield();
+}
+
+Process* sched_current() {
+    return table && coroutine_current() ? process_current(table) : 0;
+}
+
+void sched_wake(Process* process) {
+    BOOL took = sched_lock();
+
+    if (process->state != PROCESS_BLOCKED) {
+        if (took) sched_unlock();
+        return;
+    }
+
+    Task* task = &tasks[process - table->slots];
+    Cpu*  cpu  = &cpus[task->cpu];
+
+    // Time spent blocked doesn't add up to a claim on the CPU, but a job
+    // that was waiting gets in ahead of the ones that weren't, by up to half
+    // a quantum.
+    uint64_t credit = (uint64_t)quantum * 1000000 / 2;
+
+    if (cpu->min_vruntime > credit && task->vruntime < cpu->min_vruntime - credit) {
+        task->vruntime = cpu->min_vruntime - credit;
+    }
+
+    process->state = PROCESS_READY;
+    make_ready((int)(process - table->slots));
+
+    if (took) sched_unlock();
+}
+
+void sched_preemptPoint() {
+    if (!expired || !coroutine_current()) return;
+
+    expired        = 0;
+    turn_preempted = TRUE;
+    coroutine_yield();
+}
+
+BOOL sched_setPriority(int pid, int priority) {
+    Process* process = table ? process_find(table, pid) : 0;
+
+    if (!process) return FALSE;
+
+    int highest, lowest;
+    sched_priorityRange(&highest, &lowest);
+
+    if (priority < highest) priority = highest;
+    if (priority > lowest) priority = lowest;
+
+    process->priority = priority;
+    return TRUE;
+}
+
+// CPU threads
+// ----------------------------------------------------------------------------
+
+static void* cpu_main(void* arg) {
+    Cpu*    cpu = arg;
+    Console own;
+
+    console_init(&own, STDOUT_FILENO);
+    console = &own;
+    pool_setLimit(cpu_poolLimit);
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu->core, &set);
+
+    BOOL pinned = sched_setaffinity(0, sizeof(set), &set) == 0;
+
+    pthread_mutex_lock(&kernel_lock);
+
+    if (!pinned) cpu->core = -1;
+
+    while (!stopping) {
+        int slot = dequeue(cpu);
+
+        if (slot < 0) slot = steal(cpu);
+
+        if (slot < 0) {
+            pthread_cond_wait(&cpu->wakeup, &kernel_lock);
+            continue;
+        }
+
+        run_turn(cpu, slot);
+        balance(cpu);
+        pthread_cond_broadcast(&turn_done);
+    }
+
+    pthread_mutex_unlock(&kernel_lock);
+
+    console_flush(&own);
+    if (has_timer) timer_delete(turn_timer);
+
+    return 0;
+}
+
+void sched_startCpus(int count) {
+    if (threaded || count < 1) return;
+
+    // The real CPUs this process may use, so the virtual ones can be spread
+    // over them.
+    cpu_set_t allowed;
+    int       cores[CPU_SETSIZE];
+    int       core_count = 0;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int i = 0; i < CPU_SETSIZE; i++) {
+            if (CPU_ISSET(i, &allowed)) cores[core_count++] = i;
+        }
+    }
+
+    if (!core_count) cores[core_count++] = 0;
+
+    // Jobs already waiting stay on the first CPU.
+    cpus = xrealloc(cpus, sizeof(Cpu) * (size_t)count);
+
+    for (int i = 1; i < count; i++) {
+        cpu_init(&cpus[i]);
+    }
+
+    cpu_count     = count;
+    cpu_poolLimit = pool_limit();
+
+    threaded = TRUE;
+
+    for (int i = 0; i < count; i++) {
+        cpus[i].core       = cores[i % core_count];
+        cpus[i].started_ns = sched_nowNs();
+        pthread_cond_init(&cpus[i].wakeup, 0);
+        pthread_create(&cpus[i].thread, 0, cpu_main, &cpus[i]);
+    }
+}
+
+void sched_stopCpus() {
+    if (!threaded) return;
+
+    sched_lock();
+    stopping = TRUE;
+
+    for (int i = 0; i < cpu_count; i++) {
+        pthread_cond_signal(&cpus[i].wakeup);
+    }
+
+    sched_unlock();
+
+    for (int i = 0; i < cpu_count; i++) {
+        pthread_join(cpus[i].thread, 0);
+        pthread_cond_destroy(&cpus[i].wakeup);
+    }
+
+    sched_lock();
+    threaded = FALSE;
+    stopping = FALSE;
+
+    // Whatever's still waiting goes back on the one queue, and blocked jobs
+    // will when they wake.
+    for (int i = 1; i < cpu_count; i++) {
+        for (int slot; (slot = dequeue(&cpus[i])) >= 0;) {
+            migrate(&tasks[slot], &cpus[0]);
+            enqueue(&cpus[0], slot);
+        }
+    }
+
+    for (int slot = 0; slot < table->capacity; slot++) {
+        if (tasks[slot].process) migrate(&tasks[slot], &cpus[0]);
+    }
+
+    for (int i = 1; i < cpu_count; i++) {
+        cpu_free(&cpus[i]);
+    }
+
+    cpus[0].core = -1;
+    cpu_count    = 1;
+}
+
+int sched_cpus() {
+    return threaded ? cpu_count : 0;
+}
+
+BOOL sched_cpuStats(int index, SchedCpuStats* stats) {
+    if (index < 0 || index >= sched_cpus()) return FALSE;
+
+    const Cpu* cpu = &cpus[index];
+
+    stats->core       = cpu->core;
+    stats->queued     = cpu->queued;
+    stats->running    = cpu->running >= 0 ? tasks[cpu->running].process->pid : 0;
+    stats->busy_ns    = cpu->busy_ns;
+    stats->elapsed_ns = sched_nowNs() - cpu->started_ns;
+    stats->turns      = cpu->turns;
+    stats->migrations = cpu->migrations;
+
+    return TRUE;
+}
+
+BOOL sched_lock() {
+    if (locked) return FALSE;
+
+    pthread_mutex_lock(&kernel_lock);
+    locked = TRUE;
+
+    return TRUE;
+}
+
+BOOL sched_unlock() {
+    if (!locked) return FALSE;
+
+    locked = FALSE;
+    pthread_mutex_unlock(&kernel_lock);
+
+    return TRUE;
+}
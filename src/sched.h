@@ -0,0 +1,128 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "../lib/seqft/common.h"
+#include "process.h"
+
+// The kernel's scheduler. Jobs are coroutines with an entry each in the
+// process table, and one of two policies picks which ready job goes next.
+//
+// Round robin keeps one run queue per priority level; a level is only served
+// when every level above it is empty, and the jobs in a level take turns.
+//
+// The fair policy works like Linux's CFS. Each job has a virtual runtime:
+// the CPU time it has used, scaled down for jobs with a low nice value and
+// up for a high one. The job that's furthest behind runs next, out of a
+// min-heap. A job that spends most of its time waiting, like one reading
+// input, stays behind the ones that don't, so it gets the CPU soon after it
+// wakes however busy the others are.
+//
+// A turn lasts until the job waits for something or its quantum runs out.
+// The quantum is measured by a timer on the CPU clock of the thread giving
+// the turn, so only CPU time counts. Its signal handler just sets a flag,
+// since switching stacks from a handler would break anything the job was in
+// the middle of, like malloc. Jobs notice the flag at preemption points;
+// built in programs reach one before every input they handle.
+//
+// Normally the jobs take turns on whichever thread calls sched_runNext. With
+// sched_startCpus they run on simulated CPUs instead: a thread each, pinned
+// to a real CPU where it can be, and each with its own run queue. Jobs move
+// between the queues to even out the load. The queues and the process table
+// are then shared, so threads outside the jobs hold the kernel lock whenever
+// they use either.
+
+typedef void (*TaskFn)(void* arg);
+
+typedef enum SchedPolicy {
+    SCHED_POLICY_ROUND_ROBIN,
+    SCHED_POLICY_FAIR,
+} SchedPolicy;
+
+// Quantum used if none is configured.
+#define SCHED_DEFAULT_QUANTUM_MS 10
+
+// Nice values the fair policy accepts; 0 is the default.
+#define SCHED_NICE_MIN -20
+#define SCHED_NICE_MAX 19
+
+// Sets up the scheduler for the jobs in table. levels is the number of round
+// robin priorities, 0 being the highest. Calling it again starts over with a
+// new table, forgetting every job.
+extern void sched_init(ProcessTable* table, SchedPolicy policy, int quantum_ms, int levels);
+
+extern SchedPolicy sched_policy();
+
+// The priorities the policy takes, from the one that runs first to the one
+// that runs last: round robin levels, or nice values.
+extern void sched_priorityRange(int* highest, int* lowest);
+
+// Starts a job that runs fn(arg), as a ready child of the current process at
+// the highest priority. Returns its process, or 0 if the table is full.
+extern Process* sched_spawn(const char* name, TaskFn fn, void* arg);
+
+// TRUE if any job is waiting for sched_runNext, which it never is with CPU
+// threads running.
+extern BOOL sched_ready();
+
+// Gives the next ready job a turn. Returns FALSE if none was ready. Must be
+// called from outside every job. With CPU threads running, it waits until
+// one of them finishes a turn instead, returning FALSE if none had a job.
+extern BOOL sched_runNext();
+
+// Takes the calling job off the run queues until sched_wake. A job holding
+// the kernel lock keeps it until it's off the CPU, so whoever wakes it can't
+// get in first.
+extern void sched_block();
+
+// The calling job's process, or 0 outside of a job.
+extern Process* sched_current();
+
+// Puts a blocked job back on its run queue. Takes the kernel lock if the
+// calling thread doesn't have it, so any thread may call it.
+extern void sched_wake(Process* process);
+
+// Ends the calling job's turn if its quantum has run out. Does nothing
+// outside of a job, so code shared with other threads can call it freely.
+extern void sched_preemptPoint();
+
+// Sets the job's round robin level, or its nice value, from its next turn,
+// clamped to sched_priorityRange. Returns FALSE if there's no such job.
+extern BOOL sched_setPriority(int pid, int priority);
+
+typedef struct SchedCpuStats {
+    int      core;       // The real CPU it's pinned to, or -1.
+    int      queued;     // Jobs waiting for it.
+    int      running;    // PID of the job having a turn, or 0.
+    uint64_t busy_ns;    // CPU time its thread spent on turns.
+    uint64_t elapsed_ns; // Since it started.
+    uint64_t turns;
+    uint64_t migrations; // Jobs moved to it from another CPU.
+} SchedCpuStats;
+
+// Starts count CPU threads, which take over the jobs. Returns with the
+// calling thread holding the kernel lock.
+extern void sched_startCpus(int count);
+
+// Lets the CPU threads finish their turns and joins them. Jobs they hadn't
+// finished wait for sched_runNext again.
+extern void sched_stopCpus();
+
+// How many CPU threads are running; 0 without them.
+extern int sched_cpus();
+
+extern BOOL sched_cpuStats(int cpu, SchedCpuStats* stats);
+
+// Nanoseconds on the monotonic clock, which the scheduler's statistics and
+// the locks' are kept by.
+extern uint64_t sched_nowNs();
+
+// Takes the kernel lock, if the calling thread doesn't already have it.
+// Returns TRUE if it took it. Threads that aren't giving jobs turns, such as
+// the pool's, have to hold it to touch a job.
+extern BOOL sched_lock();
+
+// Lets go of the kernel lock, say before waiting on something, and returns
+// FALSE if the calling thread didn't have it.
+extern BOOL sched_unlock();
+
+#endif // SCHED_H
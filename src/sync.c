@@ -0,0 +1,380 @@
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "sched.h"
+#include "sync.h"
+
+// Named locks that have been used, newest first.
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static SyncObject*     registry;
+
+void sync_futexWait(uint32_t* word, uint32_t expected) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, 0, 0, 0);
+}
+
+void sync_futexWake(uint32_t* word, int count) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, 0, 0, 0);
+}
+
+// Wait queues and statistics
+// ----------------------------------------------------------------------------
+
+static void object_init(SyncObject* object, const char* name, SyncKind kind) {
+    memset(object, 0, sizeof(SyncObject));
+
+    object->name = name;
+    object->kind = kind;
+}
+
+// Counts a use, putting a named lock on the list the first time.
+static void object_use(SyncObject* object) {
+    __atomic_fetch_add(&object->stats.acquires, 1, __ATOMIC_RELAXED);
+
+    if (!object->name || __atomic_load_n(&object->registered, __ATOMIC_ACQUIRE)) return;
+
+    pthread_mutex_lock(&registry_lock);
+
+    if (!object->registered) {
+        object->next = registry;
+        registry     = object;
+        __atomic_store_n(&object->registered, TRUE, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&registry_lock);
+}
+
+static void queue_remove(SyncObject* object, Process* process) {
+    Process* previous = 0;
+
+    for (Process* p = object->wait_head; p; previous = p, p = p->wait_next) {
+        if (p != process) continue;
+
+        if (previous) {
+            previous->wait_next = p->wait_next;
+        } else {
+            object->wait_head = p->wait_next;
+        }
+
+        if (object->wait_tail == p) object->wait_tail = previous;
+
+        __atomic_fetch_sub(&object->waiting, 1, __ATOMIC_RELAXED);
+        break;
+    }
+
+    process->waiting_on = 0;
+}
+
+// Sleeps until *word may have changed from expected, returning straight away
+// if it already has. Callers check again either way, since other wakeups
+// (or none at all) are possible.
+static void object_sleep(SyncObject* object, uint32_t* word, uint32_t expected) {
+    Process* self  = sched_current();
+    uint64_t start = sched_nowNs();
+
+    __atomic_fetch_add(&object->stats.contended, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&object->stats.sleeping, 1, __ATOMIC_RELAXED);
+
+    if (self) {
+        BOOL took = sched_lock();
+
+        // On the queue before looking at word, so anyone who changes word
+        // after we've looked will find us there.
+        self->waiting_on = object;
+        self->wait_next  = 0;
+
+        if (object->wait_tail) {
+            object->wait_tail->wait_next = self;
+        } else {
+            object->wait_head = self;
+        }
+
+        object->wait_tail = self;
+        __atomic_fetch_add(&object->waiting, 1, __ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n(word, __ATOMIC_SEQ_CST) == expected) {
+            // Blocking hands the kernel lock to the scheduler.
+            sched_block();
+            took = sched_lock();
+        }
+
+        // Still on the queue if something else woke us.
+        if (self->waiting_on == object) queue_remove(object, self);
+        if (took) sched_unlock();
+    } else {
+        // The jobs keep their CPUs while the thread sleeps.
+        BOOL held = sched_unlock();
+        sync_futexWait(word, expected);
+        if (held) sched_lock();
+    }
+
+    __atomic_fetch_sub(&object->stats.sleeping, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&object->stats.wait_ns, sched_nowNs() - start, __ATOMIC_RELAXED);
+}
+
+// Wakes up to count of whoever's asleep on word: jobs on the queue first,
+// then threads.
+static void object_wake(SyncObject* object, uint32_t* word, int count) {
+    if (__atomic_load_n(&object->waiting, __ATOMIC_SEQ_CST)) {
+        BOOL took = sched_lock();
+
+        for (int i = 0; i < count && object->wait_head; i++) {
+            Process* process = object->wait_head;
+
+            queue_remove(object, process);
+            sched_wake(process);
+        }
+
+        if (took) sched_unlock();
+    }
+
+    sync_futexWake(word, count);
+}
+
+void sync_destroy(SyncObject* object) {
+    if (!object->registered) return;
+
+    pthread_mutex_lock(&registry_lock);
+
+    for (SyncObject** link = &registry; *link; link = &(*link)->next) {
+        if (*link == object) {
+            *link = object->next;
+            break;
+        }
+    }
+
+    object->registered = FALSE;
+    pthread_mutex_unlock(&registry_lock);
+}
+
+void sync_forEach(void (*fn)(const SyncObject* object, const SyncStats* stats, void* arg), void* arg) {
+    pthread_mutex_lock(&registry_lock);
+
+    for (SyncObject* object = registry; object; object = object->next) {
+        SyncStats stats = {
+            __atomic_load_n(&object->stats.acquires, __ATOMIC_RELAXED),
+            __atomic_load_n(&object->stats.contended, __ATOMIC_RELAXED),
+            __atomic_load_n(&object->stats.wait_ns, __ATOMIC_RELAXED),
+            __atomic_load_n(&object->stats.sleeping, __ATOMIC_RELAXED),
+        };
+
+        fn(object, &stats, arg);
+    }
+
+    pthread_mutex_unlock(&registry_lock);
+}
+
+const char* sync_kindName(SyncKind kind) {
+    switch (kind) {
+        case SYNC_MUTEX:     return "mutex";
+        case SYNC_COND:      return "cond";
+        case SYNC_SEMAPHORE: return "semaphore";
+        case SYNC_RWLOCK:    return "rwlock";
+    }
+
+    return "unknown";
+}
+
+// Mutexes
+// ----------------------------------------------------------------------------
+// Drepper's from "Futexes Are Tricky": unlocking only makes a system call
+// (or takes the scheduler's lock) when the state says someone may be
+// waiting.
+
+void sync_mutexInit(SyncMutex* mutex, const char* name) {
+    object_init(&mutex->object, name, SYNC_MUTEX);
+    mutex->state = 0;
+}
+
+BOOL sync_mutexTryLock(SyncMutex* mutex) {
+    uint32_t expected = 0;
+
+    if (!__atomic_compare_exchange_n(&mutex->state, &expected, 1, FALSE,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return FALSE;
+    }
+
+    object_use(&mutex->object);
+    return TRUE;
+}
+
+void sync_mutexLock(SyncMutex* mutex) {
+    uint32_t state = 0;
+
+    if (!__atomic_compare_exchange_n(&mutex->state, &state, 1, FALSE,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        if (state != 2) state = __atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE);
+
+        while (state != 0) {
+            object_sleep(&mutex->object, &mutex->state, 2);
+            state = __atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE);
+        }
+    }
+
+    object_use(&mutex->object);
+}
+
+void sync_mutexUnlock(SyncMutex* mutex) {
+    if (__atomic_fetch_sub(&mutex->state, 1, __ATOMIC_RELEASE) != 1) {
+        __atomic_store_n(&mutex->state, 0, __ATOMIC_SEQ_CST);
+        object_wake(&mutex->object, &mutex->state, 1);
+    }
+}
+
+// Condition variables
+// ----------------------------------------------------------------------------
+
+void sync_condInit(SyncCond* cond, const char* name) {
+    object_init(&cond->object, name, SYNC_COND);
+    cond->sequence = 0;
+    cond->waiters  = 0;
+}
+
+void sync_condWait(SyncCond* cond, SyncMutex* mutex) {
+    uint32_t sequence = __atomic_load_n(&cond->sequence, __ATOMIC_SEQ_CST);
+
+    object_use(&cond->object);
+    __atomic_fetch_add(&cond->waiters, 1, __ATOMIC_SEQ_CST);
+
+    sync_mutexUnlock(mutex);
+    object_sleep(&cond->object, &cond->sequence, sequence);
+    __atomic_fetch_sub(&cond->waiters, 1, __ATOMIC_RELAXED);
+
+    sync_mutexLock(mutex);
+}
+
+void sync_condSignal(SyncCond* cond) {
+    __atomic_fetch_add(&cond->sequence, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&cond->waiters, __ATOMIC_SEQ_CST)) {
+        object_wake(&cond->object, &cond->sequence, 1);
+    }
+}
+
+void sync_condBroadcast(SyncCond* cond) {
+    __atomic_fetch_add(&cond->sequence, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&cond->waiters, __ATOMIC_SEQ_CST)) {
+        object_wake(&cond->object, &cond->sequence, INT_MAX);
+    }
+}
+
+// Semaphores
+// ----------------------------------------------------------------------------
+
+void sync_semInit(SyncSemaphore* semaphore, const char* name, uint32_t value) {
+    object_init(&semaphore->object, name, SYNC_SEMAPHORE);
+    semaphore->value   = value;
+    semaphore->waiters = 0;
+}
+
+BOOL sync_semTryWait(SyncSemaphore* semaphore) {
+    uint32_t value = __atomic_load_n(&semaphore->value, __ATOMIC_RELAXED);
+
+    while (value) {
+        if (__atomic_compare_exchange_n(&semaphore->value, &value, value - 1, TRUE,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            object_use(&semaphore->object);
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+void sync_semWait(SyncSemaphore* semaphore) {
+    while (!sync_semTryWait(semaphore)) {
+        __atomic_fetch_add(&semaphore->waiters, 1, __ATOMIC_SEQ_CST);
+
+        if (!__atomic_load_n(&semaphore->value, __ATOMIC_SEQ_CST)) {
+            object_sleep(&semaphore->object, &semaphore->value, 0);
+        }
+
+        __atomic_fetch_sub(&semaphore->waiters, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void sync_semPost(SyncSemaphore* semaphore) {
+    __atomic_fetch_add(&semaphore->value, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&semaphore->waiters, __ATOMIC_SEQ_CST)) {
+        object_wake(&semaphore->object, &semaphore->value, 1);
+    }
+}
+
+// Read-write locks
+// ----------------------------------------------------------------------------
+// Everyone waits on state, which changes whenever a reader or writer comes
+// or goes, and checks again once it does.
+
+void sync_rwInit(SyncRwLock* lock, const char* name) {
+    object_init(&lock->object, name, SYNC_RWLOCK);
+    lock->state           = 0;
+    lock->readers_waiting = 0;
+    lock->writers_waiting = 0;
+}
+
+void sync_rwReadLock(SyncRwLock* lock) {
+    for (;;) {
+        uint32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+
+        if (state != SYNC_RW_WRITER && !__atomic_load_n(&lock->writers_waiting, __ATOMIC_RELAXED) &&
+            __atomic_compare_exchange_n(&lock->state, &state, state + 1, TRUE,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+
+        __atomic_fetch_add(&lock->readers_waiting, 1, __ATOMIC_SEQ_CST);
+        state = __atomic_load_n(&lock->state, __ATOMIC_SEQ_CST);
+
+        // Readers only wait out a writer, or one that's waiting.
+        if (state == SYNC_RW_WRITER || __atomic_load_n(&lock->writers_waiting, __ATOMIC_SEQ_CST)) {
+            object_sleep(&lock->object, &lock->state, state);
+        }
+
+        __atomic_fetch_sub(&lock->readers_waiting, 1, __ATOMIC_RELAXED);
+    }
+
+    object_use(&lock->object);
+}
+
+void sync_rwReadUnlock(SyncRwLock* lock) {
+    __atomic_fetch_sub(&lock->state, 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&lock->readers_waiting, __ATOMIC_SEQ_CST) ||
+        __atomic_load_n(&lock->writers_waiting, __ATOMIC_SEQ_CST)) {
+        object_wake(&lock->object, &lock->state, INT_MAX);
+    }
+}
+
+void sync_rwWriteLock(SyncRwLock* lock) {
+    for (;;) {
+        uint32_t state = 0;
+
+        if (__atomic_compare_exchange_n(&lock->state, &state, SYNC_RW_WRITER, FALSE,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+
+        __atomic_fetch_add(&lock->writers_waiting, 1, __ATOMIC_SEQ_CST);
+        state = __atomic_load_n(&lock->state, __ATOMIC_SEQ_CST);
+
+        if (state != 0) object_sleep(&lock->object, &lock->state, state);
+
+        __atomic_fetch_sub(&lock->writers_waiting, 1, __ATOMIC_SEQ_CST);
+    }
+
+    object_use(&lock->object);
+}
+
+void sync_rwWriteUnlock(SyncRwLock* lock) {
+    __atomic_store_n(&lock->state, 0, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&lock->readers_waiting, __ATOMIC_SEQ_CST) ||
+        __atomic_load_n(&lock->writers_waiting, __ATOMIC_SEQ_CST)) {
+        object_wake(&lock->object, &lock->state, INT_MAX);
+    }
+}
@@ -0,0 +1,121 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include "../lib/seqft/common.h"
+#include "process.h"
+
+#include <stdint.h>
+
+// Locks for programs, built on Linux futexes. Taking one that's free is a
+// single atomic instruction in user space. Whoever has to wait sleeps
+// rather than spinning: a job is taken off the run queues and put on the
+// lock's wait queue, linked through the waiting processes' table entries,
+// so its CPU goes to other jobs; any other thread sleeps on the futex.
+//
+// Every lock keeps count of how often it was taken, how often that meant
+// waiting and for how long. Named ones are listed by the shell's "locks"
+// command from their first use until sync_destroy.
+//
+// Any thread may wake a job. Without CPU threads, one woken by a thread of
+// the kernel's pool runs once the shell next gives out turns.
+
+typedef enum SyncKind {
+    SYNC_MUTEX,
+    SYNC_COND,
+    SYNC_SEMAPHORE,
+    SYNC_RWLOCK,
+} SyncKind;
+
+typedef struct SyncStats {
+    uint64_t acquires;  // Times taken (or waited on, for a condition).
+    uint64_t contended; // Times that meant going to sleep.
+    uint64_t wait_ns;   // Time spent asleep, in all.
+    uint32_t sleeping;  // Jobs and threads asleep on it now.
+} SyncStats;
+
+// What every lock starts with.
+typedef struct SyncObject {
+    const char* name; // 0 to leave it out of the list.
+    SyncKind    kind;
+    SyncStats   stats;
+
+    // Jobs waiting, under the scheduler's lock.
+    Process* wait_head;
+    Process* wait_tail;
+    uint32_t waiting;
+
+    BOOL               registered;
+    struct SyncObject* next;
+} SyncObject;
+
+typedef struct SyncMutex {
+    SyncObject object;
+    uint32_t   state; // 0 free, 1 taken, 2 taken with someone waiting.
+} SyncMutex;
+
+typedef struct SyncCond {
+    SyncObject object;
+    uint32_t   sequence; // Bumped by every signal.
+    uint32_t   waiters;
+} SyncCond;
+
+typedef struct SyncSemaphore {
+    SyncObject object;
+    uint32_t   value;
+    uint32_t   waiters;
+} SyncSemaphore;
+
+typedef struct SyncRwLock {
+    SyncObject object;
+    uint32_t   state; // Readers holding it, or SYNC_RW_WRITER.
+    uint32_t   readers_waiting;
+    uint32_t   writers_waiting;
+} SyncRwLock;
+
+#define SYNC_RW_WRITER UINT32_MAX
+
+// For locks with static storage, which need no other setup.
+#define SYNC_MUTEX_INIT(label)              {.object = {.name = (label), .kind = SYNC_MUTEX}}
+#define SYNC_COND_INIT(label)               {.object = {.name = (label), .kind = SYNC_COND}}
+#define SYNC_SEMAPHORE_INIT(label, initial) {.object = {.name = (label), .kind = SYNC_SEMAPHORE}, .value = (initial)}
+#define SYNC_RWLOCK_INIT(label)             {.object = {.name = (label), .kind = SYNC_RWLOCK}}
+
+extern void sync_mutexInit(SyncMutex* mutex, const char* name);
+extern void sync_mutexLock(SyncMutex* mutex);
+extern BOOL sync_mutexTryLock(SyncMutex* mutex);
+extern void sync_mutexUnlock(SyncMutex* mutex);
+
+// Condition variables work with a SyncMutex, and like pthread's may wake up
+// without being signalled.
+extern void sync_condInit(SyncCond* cond, const char* name);
+extern void sync_condWait(SyncCond* cond, SyncMutex* mutex);
+extern void sync_condSignal(SyncCond* cond);
+extern void sync_condBroadcast(SyncCond* cond);
+
+extern void sync_semInit(SyncSemaphore* semaphore, const char* name, uint32_t value);
+extern void sync_semWait(SyncSemaphore* semaphore);
+extern BOOL sync_semTryWait(SyncSemaphore* semaphore);
+extern void sync_semPost(SyncSemaphore* semaphore);
+
+// Waiting writers keep new readers out, so a steady stream of readers can't
+// starve them.
+extern void sync_rwInit(SyncRwLock* lock, const char* name);
+extern void sync_rwReadLock(SyncRwLock* lock);
+extern void sync_rwReadUnlock(SyncRwLock* lock);
+extern void sync_rwWriteLock(SyncRwLock* lock);
+extern void sync_rwWriteUnlock(SyncRwLock* lock);
+
+// Takes a lock with automatic or allocated storage off the list, once
+// nothing is using it.
+extern void sync_destroy(SyncObject* object);
+
+// Calls fn for every named lock in use, with a copy of its statistics.
+extern void sync_forEach(void (*fn)(const SyncObject* object, const SyncStats* stats, void* arg), void* arg);
+
+extern const char* sync_kindName(SyncKind kind);
+
+// Private futex calls, for other parts of the kernel that sleep on a word.
+extern void sync_futexWait(uint32_t* word, uint32_t expected);
+extern void sync_futexWake(uint32_t* word, int count);
+
+#endif // SYNC_H
@@ -2,116 +2,619 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
 
 // Stuff for the calculator 
 // Thanks to PsychedelicShayna for making seqft-c
 
 #include "../lib/seqft/common.h"
+#include "commands.h"
+#include "console.h"
+#include "coroutine.h"
+#include "pool.h"
+#include "sched.h"
+#include "sync.h"
 #include "programs/calculator.h"
 
+// Appends n copies of c to dest, writing only what fits within size, and
+// returns the new length as if it had all fit.
+static size_t fill(char* dest, size_t size, size_t at, char c, size_t n) {
+    for (size_t i = 0; i < n; i++, at++) {
+        if (at + 1 < size) dest[at] = c;
+    }
+
+    return at;
+}
+
+static size_t append(char* dest, size_t size, size_t at, const char* s) {
+    int n = snprintf(at < size ? dest + at : 0, at < size ? size - at : 0, "%s", s);
+    return at + (size_t)n;
+}
+
+size_t format_error(char*       dest,
+                    size_t      size,
+                    const char* expr,
+                    size_t      expr_len,
+                    IterErr     error,
+                    size_t      indent) {
+
+    char*  stripped = xmalloc(expr_len + 1);
+    size_t at       = 0;
+    size_t msg_len  = strlen(error.message);
+
+    filter_whitespace(expr, expr_len, stripped);
+
+    at = append(dest, size, at, "\n>");
+    at = fill(dest, size, at, ' ', indent);
+    at = append(dest, size, at, stripped);
+    at = append(dest, size, at, "\n");
+    at = fill(dest, size, at, '~', indent + error.index);
+    at = append(dest, size, at, " ^\n");
+    at = append(dest, size, at, error.message);
+    at = append(dest, size, at, "\n");
+    at = fill(dest, size, at, '~', msg_len);
+    at = append(dest, size, at, "\n\n\n");
+
+    if (size) {
+        dest[at < size ? at : size - 1] = 0;
+    }
+
+    xfree(stripped);
+    return at;
+}
+
 void highlight_error(const char* expr,
                      size_t      expr_len,
                      IterErr     error,
                      size_t      indent) {
 
-    printf("\n");
-    char stripped[expr_len];
-    filter_whitespace(expr, expr_len, stripped);
+    size_t size = format_error(0, 0, expr, expr_len, error, indent) + 1;
+    char*  text = xmalloc(size);
+
+    format_error(text, size, expr, expr_len, error, indent);
+    console_write(console, text, size - 1);
+    xfree(text);
+}
+
+// Commands
+// ----------------------------------------------------------------------------
+
+static void cmd_shutdown(Shell* shell, int argc, char** argv) {
+    console_literal(console, "Shutting down...\n");
+    exit(0);
+}
+
+static void cmd_processes(Shell* shell, int argc, char** argv) {
+    ProcessTable* table = shell->processes;
+
+    console_printf(console, "Processes: %d of %d, threads per process: %zu (pool workers: %zu)\n",
+                   table->count, table->capacity, pool_limit(), pool_workers());
+    console_literal(console, "  PID  PPID  PRI  STATE     CPU (ms)  SWITCHES  PREEMPTS    MEMORY      PEAK  NAME\n");
+
+    for (int i = 0; i < table->capacity; i++) {
+        const Process* process = &table->slots[i];
 
-    const size_t bufsize = indent + expr_len + strlen(error.message) + 1;
-    char         padding[bufsize];
-    memset(padding, 0, bufsize);
+        if (process->state == PROCESS_FREE) continue;
 
-    memset(padding, ' ', indent);
-    printf(">%s%s\n", padding, stripped);
-    memset(padding, 0, bufsize);
+        console_printf(console, "%5d %5d %4d  %-8s %9.3f %9llu %9llu %9zu %9zu  %s\n",
+                       process->pid,
+                       process->parent,
+                       process->priority,
+                       process_stateName(process->state),
+                       process_cpuTime(table, process) / 1e6,
+                       (unsigned long long)process->switches,
+                       (unsigned long long)process->preemptions,
+                       alloc_accountLive(&process->memory),
+                       process->memory.peak,
+                       process->name);
+    }
+
+    if (!sched_cpus()) return;
 
-    memset(padding, '~', indent + error.index);
-    printf("%s ^\n%s\n", padding, error.message);
-    memset(padding, 0, bufsize);
+    console_literal(console, "  CPU  CORE   UTIL     TURNS  MIGRATIONS  QUEUED  RUNNING\n");
 
-    memset(padding, '~', strlen(error.message));
-    printf("%s\n", padding);
-    memset(padding, 0, bufsize);
+    SchedCpuStats stats;
 
-    printf("\n\n");
+    for (int i = 0; sched_cpuStats(i, &stats); i++) {
+        console_printf(console, "%5d %5d %5.1f%% %9llu %11llu %7d  %7d\n",
+                       i,
+                       stats.core,
+                       stats.elapsed_ns ? 100.0 * stats.busy_ns / stats.elapsed_ns : 0.0,
+                       (unsigned long long)stats.turns,
+                       (unsigned long long)stats.migrations,
+                       stats.queued,
+                       stats.running);
+    }
 }
 
-int osmain(int *processes, int maxprocesses, int maxthreadsperprocess) {
-    char cmd[100];
+static void print_lock(const SyncObject* object, const SyncStats* stats, void* arg) {
+    console_printf(console, "%-16s %-9s %9llu %9llu %6.1f%% %9.3f %8u\n",
+                   object->name,
+                   sync_kindName(object->kind),
+                   (unsigned long long)stats->acquires,
+                   (unsigned long long)stats->contended,
+                   stats->acquires ? 100.0 * stats->contended / stats->acquires : 0.0,
+                   stats->wait_ns / 1e6,
+                   stats->sleeping);
+}
 
-    printf("Welcome to Neptune OS! Type 'help' for a list of commands.\n");
-    while (1) {
-        // Flush stdin to prevent leftover input from previous commands
-        int c;
-        while ((c = getchar()) != '\n' && c != EOF);
+static void cmd_locks(Shell* shell, int argc, char** argv) {
+    console_literal(console, "NAME             KIND       ACQUIRES CONTENDED    RATE WAIT (ms) SLEEPING\n");
+    sync_forEach(print_lock, 0);
+}
+
+static void cmd_help(Shell* shell, int argc, char** argv) {
+    console_literal(console, "List of commands:\n");
+
+    for (size_t i = 0; i < command_count(); i++) {
+        const Command* command = command_at(i);
+        char           aliases[128];
+
+        if (command_aliases(command, aliases, sizeof(aliases))) {
+            console_printf(console, "%zu: %s (%s) [also: %s]\n", i + 1, command->name, command->help, aliases);
+        } else {
+            console_printf(console, "%zu: %s (%s)\n", i + 1, command->name, command->help);
+        }
+    }
+}
+
+// Built in programs run as children of the current process, so the CPU time
+// and memory they use are charged to their own entry in the process table.
+static Process* program_begin(Shell* shell, const char* name) {
+    Process* parent  = process_current(shell->processes);
+    Process* process = process_spawn(shell->processes, name, parent ? parent->pid : 0);
+
+    if (process) process_switch(shell->processes, process);
+
+    return process;
+}
+
+static void program_end(Shell* shell, Process* process) {
+    if (!process) return;
+
+    Process* parent = process_find(shell->processes, process->parent);
+
+    process_exit(shell->processes, process->pid);
+    process_switch(shell->processes, parent);
+}
+
+// Jobs
+// ----------------------------------------------------------------------------
+// Programs started from the interactive shell run as jobs under the
+// scheduler, on the shell's own thread or, with "cpus" set in the kernel's
+// config, on the scheduler's CPU threads. A job that wants input blocks until
+// the shell reads a line for it. Every line goes to the foreground job, if
+// there is one, except lines starting with '!': "!" alone sends the job to
+// the background, and "!command" runs a shell command. Whenever there's no
+// line waiting to be read, the shell gives the CPU to the jobs.
+
+// PID of the foreground job, or 0.
+static int foreground;
+
+// The line the shell is handing to the foreground job, or end of input.
+static char job_line[256];
+static BOOL job_eof;
+
+// Input is read through a buffer of our own rather than stdio's, so the shell
+// can tell whether a whole line is waiting without blocking.
+static char   input[4096];
+static size_t input_len;
+static BOOL   input_eof;
+
+static BOOL input_hasLine() {
+    return input_eof || input_len == sizeof(input) || memchr(input, '\n', input_len);
+}
+
+// TRUE if reading a line won't have to wait for the user.
+static BOOL input_ready() {
+    if (input_hasLine()) return TRUE;
+
+    struct pollfd fd = {STDIN_FILENO, POLLIN, 0};
+    return poll(&fd, 1, 0) > 0;
+}
+
+static BOOL input_readLine(char* dest, size_t size) {
+    while (!input_hasLine()) {
+        // Jobs on CPU threads carry on while the shell waits for the user.
+        BOOL    held = sched_unlock();
+        ssize_t n    = read(STDIN_FILENO, input + input_len, sizeof(input) - input_len);
+
+        if (held) sched_lock();
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            input_eof = TRUE;
+            break;
+        }
+
+        input_len += (size_t)n;
+    }
+
+    if (!input_len) return FALSE;
+
+    // A line too long for the buffer is cut into pieces.
+    char*  end  = memchr(input, '\n', input_len);
+    size_t len  = end ? (size_t)(end - input) : input_len;
+    size_t used = end ? len + 1 : len;
+
+    snprintf(dest, size, "%.*s", (int)len, input);
+
+    memmove(input, input + used, input_len - used);
+    input_len -= used;
+
+    return TRUE;
+}
+
+BOOL terminal_readLine(char* dest, size_t size) {
+    console_flush(console);
+
+    if (coroutine_current()) {
+        // Under the kernel lock, so the shell can't see the job blocked
+        // before it knows what on.
+        sched_lock();
+        sched_current()->waiting_on = job_line;
+        sched_block();
+
+        if (job_eof) return FALSE;
+
+        snprintf(dest, size, "%s", job_line);
+        return TRUE;
+    }
+
+    return input_readLine(dest, size);
+}
+
+// TRUE if the job is blocked until the shell hands it a line, rather than
+// on a lock, say.
+static BOOL job_waiting(const Process* job) {
+    return job->state == PROCESS_BLOCKED && job->waiting_on == job_line;
+}
+
+static void job_hand(Process* job) {
+    job->waiting_on = 0;
+    sched_wake(job);
+}
+
+static void calculator_job(void* arg) {
+    calculator();
+}
+
+// Runs a NULL terminated array of inputs, allocated in one block along with
+// the strings, and then frees it.
+static void calculator_inputsJob(void* arg) {
+    char** inputs = arg;
+
+    for (size_t i = 0; inputs[i] && calculator_input(inputs[i]); i++) {}
+
+    xfree(inputs);
+}
+
+// Starts a job. One that reads input is brought to the foreground.
+static BOOL job_start(const char* name, TaskFn fn, void* arg, BOOL reads_input) {
+    Process* process = sched_spawn(name, fn, arg);
+
+    if (!process) {
+        console_literal(console, "Error: Maximum number of processes reached. Cannot run new program.\n");
+        return FALSE;
+    }
+
+    if (reads_input) foreground = process->pid;
+
+    return TRUE;
+}
+
+static void cmd_fg(Shell* shell, int argc, char** argv) {
+    ProcessTable* table = shell->processes;
+    Process*      job   = 0;
+
+    // Without a PID, the most recently started job.
+    for (int i = 0; i < table->capacity; i++) {
+        Process* process = &table->slots[i];
+
+        if (process->state == PROCESS_FREE || process == process_current(table)) continue;
+
+        if (argc > 1 ? process->pid == atoi(argv[1]) : !job || process->pid > job->pid) {
+            job = process;
+        }
+    }
+
+    if (!job) {
+        console_literal(console, "No such job.\n");
+        return;
+    }
+
+    foreground = job->pid;
+    console_printf(console, "[%d] %s\n", job->pid, job->name);
+}
+
+static void cmd_nice(Shell* shell, int argc, char** argv) {
+    if (argc < 3) {
+        int highest, lowest;
+        sched_priorityRange(&highest, &lowest);
+
+        console_printf(console, "Usage: nice PID LEVEL, where LEVEL is %d (runs first) to %d\n", highest, lowest);
+        return;
+    }
+
+    if (!sched_setPriority(atoi(argv[1]), atoi(argv[2]))) {
+        console_literal(console, "No such process.\n");
+    }
+}
+
+// "run [b] program [input...]" runs a built in program without any prompts,
+// giving it each input as if it had been typed at the program's own prompt.
+static void cmd_runInline(Shell* shell, int argc, char** argv) {
+    int i = 1;
+
+    if (strcmp(argv[i], "c") == 0) {
+        console_literal(console, "Custom programs will hopefully be added eventually!\n");
+        return;
+    }
+
+    if (strcmp(argv[i], "b") == 0) i++;
+
+    if (i == argc) {
+        console_literal(console, "Usage: run [b] program [input...]\n");
+        return;
+    }
+
+    const char* program = argv[i++];
+
+    if (strcmp(program, "1") == 0 || strcmp(program, "calculator") == 0 || strcmp(program, "calc") == 0) {
+        if (i == argc && shell->interactive) {
+            job_start("calculator", calculator_job, 0, TRUE);
+            return;
+        }
+
+        // At the shell the inputs run as a job too, so a long list of them
+        // doesn't hold up the prompt.
+        if (shell->interactive) {
+            size_t size = sizeof(char*) * (size_t)(argc - i + 1);
+
+            for (int j = i; j < argc; j++) size += strlen(argv[j]) + 1;
+
+            char** inputs = xmalloc(size);
+            char*  text   = (char*)(inputs + (argc - i + 1));
+
+            for (int j = i; j < argc; j++) {
+                inputs[j - i] = strcpy(text, argv[j]);
+                text += strlen(argv[j]) + 1;
+            }
+            inputs[argc - i] = 0;
+
+            if (!job_start("calculator", calculator_inputsJob, inputs, FALSE)) xfree(inputs);
+            return;
+        }
+
+        Process* process = program_begin(shell, "calculator");
+
+        while (i < argc && calculator_input(argv[i++])) {}
+
+        program_end(shell, process);
+    } else {
+        console_literal(console, "Invalid choice. Please enter a valid program number.\n");
+    }
+}
+
+static void cmd_run(Shell* shell, int argc, char** argv) {
+    if (shell->processes->free_head < 0) {
+        console_literal(console, "Error: Maximum number of processes reached. Cannot run new program.\n");
+        return;
+    }
+
+    if (argc > 1 || !shell->interactive) {
+        if (argc == 1) {
+            console_literal(console, "Usage: run [b] program [input...]\n");
+        } else {
+            cmd_runInline(shell, argc, argv);
+        }
+        return;
+    }
+
+    char line[100];
 
-        printf("> ");
-        fgets(cmd, sizeof(cmd), stdin);
-        cmd[strcspn(cmd, "\n")] = '\0';
+    console_literal(console, "Would you like to run a built in program or a custom program? [B/C]: ");
+    if (!terminal_readLine(line, sizeof(line))) return;
 
-        for (int i = 0; cmd[i]; i++) {
-            cmd[i] = tolower(cmd[i]);
+    char runchoice = tolower(line[strspn(line, " \t")]);
+
+    if (runchoice == 'b') {
+        console_literal(console, "Built in programs:\n");
+        console_literal(console, "1: Calculator\n");
+
+        console_literal(console, "What program would you like to run: ");
+        if (!terminal_readLine(line, sizeof(line))) return;
+
+        switch (atoi(line)) {
+            case 1:
+                job_start("calculator", calculator_job, 0, TRUE);
+                break;
+            default:
+                console_literal(console, "Invalid choice. Please enter a valid program number.\n");
         }
+    } else if (runchoice == 'c') {
+        console_literal(console, "Custom programs will hopefully be added eventually!\n");
+    } else {
+        console_literal(console, "Invalid choice. Please enter 'b' for built in or 'c' for custom.\n");
+    }
+}
+
+static void cmd_clear(Shell* shell, int argc, char** argv) {
+    console_clear(console);
+}
+
+static void cmd_credits(Shell* shell, int argc, char** argv) {
+    console_literal(console, "Heres a list of people who helped with Neptune OS!\n");
+    console_literal(console, "All of these usernames are github usernames.\n");
+
+    console_literal(console, "\n");
+
+    console_literal(console, "Thepuppetqueen57: Made Neptune OS\n");
+    console_literal(console, "PsychedelicShayna: Made the math library that the calculator uses\n");
+}
+
+static void register_commands() {
+    if (command_count()) return;
 
-        if (strcmp(cmd, "shutdown") == 0 || strcmp(cmd, "exit") == 0) {
-            printf("Shutting down...\n");
-            exit(0);
-        } else if (strcmp(cmd, "processes") == 0) {
-            printf("Processes: %d\n", processes[0]);
-        } else if (strcmp(cmd, "help") == 0 || strcmp(cmd, "commands") == 0) {
-            printf("List of commands:\n");
-            printf("1: shutdown (Shuts down Neptune OS)\n");
-            printf("2: processes (Shows the number of processes)\n");
-            printf("3: run (Runs a program)\n");
-            printf("4: clear (Clears the console)\n");
-            printf("5: credits (List of people who helped with Neptune OS)\n");
-        } else if (strcmp(cmd, "run") == 0) {
-            if (processes[0] >= maxprocesses) {
-                printf("Error: Maximum number of processes reached. Cannot run new program.\n");
+    command_register("shutdown", "Shuts down Neptune OS", cmd_shutdown);
+    command_register("processes", "Lists the running processes", cmd_processes);
+    command_register("locks", "Lists the locks programs have used and how contended they are", cmd_locks);
+    command_register("run", "Runs a program; 'run calc 1+2' skips the prompts", cmd_run);
+    command_register("fg", "Brings a program waiting in the background back; 'fg PID'", cmd_fg);
+    command_register("nice", "Sets a program's priority; 'nice PID LEVEL'", cmd_nice);
+    command_register("clear", "Clears the console", cmd_clear);
+    command_register("credits", "List of people who helped with Neptune OS", cmd_credits);
+    command_register("help", "Lists the commands", cmd_help);
+
+    command_alias("exit", "shutdown");
+    command_alias("commands", "help");
+}
+
+int osmain(ProcessTable* processes, int maxthreadsperprocess) {
+    char  cmd[256];
+    Shell shell = {processes, maxthreadsperprocess, TRUE};
+
+    register_commands();
+
+    console_literal(console, "Welcome to Neptune OS! Type 'help' for a list of commands.\n");
+
+    BOOL prompted = FALSE;
+    BOOL pending  = FALSE; // cmd holds a line that hasn't been dealt with.
+
+    while (1) {
+        Process* job = foreground ? process_find(processes, foreground) : 0;
+        if (!job) foreground = 0;
+
+        if (!pending) {
+            // A job in the foreground prints its own prompt.
+            if (!job && !prompted) {
+                console_literal(console, "> ");
+                prompted = TRUE;
+            }
+
+            // Jobs only get the CPU while nobody's waiting on the shell, and
+            // for a quantum at a time, so a busy one can't starve it.
+            if (sched_ready() && !input_ready()) {
+                sched_runNext();
+                console_flush(console);
+                continue;
+            }
+
+            // Jobs on CPU threads don't need the shell's, but it still waits
+            // for the foreground one to finish with its last line, so the
+            // prompt doesn't come before the answer.
+            if (job && !job_waiting(job) && sched_cpus() && !input_ready()) {
+                sched_runNext();
                 continue;
             }
 
-            printf("Would you like to run a built in program or a custom program? [B/C]: ");
-            char runchoice;
-            scanf(" %c", &runchoice);
-
-            runchoice = tolower(runchoice);
-
-            if (runchoice == 'b') {
-                printf("Built in programs:\n");
-                printf("1: Calculator\n");
-
-                printf("What program would you like to run: ");
-                int programchoice;
-                scanf("%d", &programchoice);
-
-                switch (programchoice) {
-                    case 1:
-                        calculator();
-                        break;
-                    default:
-                        printf("Invalid choice. Please enter a valid program number.\n");
-                }
-            } else if (runchoice == 'c') {
-                printf("Custom programs will hopefully be added eventually!\n");
-            } else {
-                printf("Invalid choice. Please enter 'b' for built in or 'c' for custom.\n");
+            if (!terminal_readLine(cmd, sizeof(cmd))) break;
+
+            prompted = FALSE;
+            pending  = TRUE;
+        }
+
+        if (job && cmd[0] != '!') {
+            // A line typed ahead waits until the job asks for it.
+            if (!job_waiting(job)) {
+                sched_runNext();
+                continue;
             }
-        } else if (strcmp(cmd, "clear") == 0) {
-            system("clear");
-        } else if (strcmp(cmd, "credits") == 0) {
-            printf("Heres a list of people who helped with Neptune OS!\n");
-            printf("All of these usernames are github usernames.\n");
 
-            printf("\n");
+            snprintf(job_line, sizeof(job_line), "%s", cmd);
+            job_hand(job);
+            pending = FALSE;
+            continue;
+        }
+
+        pending = FALSE;
 
-            printf("Thepuppetqueen57: Made Neptune OS\n");
-            printf("PsychedelicShayna: Made the math library that the calculator uses\n");
+        if (job && cmd[1] == '\0') {
+            console_printf(console, "[%d] %s is in the background; 'fg %d' brings it back.\n",
+                           job->pid, job->name, job->pid);
+            foreground = 0;
+            continue;
         }
 
-        else {
-            printf("Unknown command: %s\n", cmd);
+        if (!command_dispatch(&shell, job ? cmd + 1 : cmd)) {
+            console_printf(console, "Unknown command: %s\n", cmd);
         }
     }
-}
\ No newline at end of file
+
+    // At the end of input the jobs get to finish, the foreground one seeing
+    // the end of its input too, and then the shell does.
+    job_eof = TRUE;
+
+    do {
+        Process* job = foreground ? process_find(processes, foreground) : 0;
+        if (job && job_waiting(job)) job_hand(job);
+    } while (sched_runNext());
+
+    return 0;
+}
+
+int osscript(const char* path, ProcessTable* processes, int maxthreadsperprocess) {
+    Shell shell = {processes, maxthreadsperprocess, FALSE};
+
+    register_commands();
+    BOOL  from_stdin = !path || strcmp(path, "-") == 0;
+    int   fd         = from_stdin ? STDIN_FILENO : open(path, O_RDONLY);
+
+    if (fd < 0) {
+        fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    // The whole script is read up front and split in place, so a line costs
+    // no more than finding its end.
+    size_t cap  = 64 * 1024;
+    size_t len  = 0;
+    char*  data = xmalloc(cap + 1);
+
+    for (;;) {
+        if (len == cap) {
+            cap *= 2;
+            data = xrealloc(data, cap + 1);
+        }
+
+        ssize_t n = read(fd, data + len, cap - len);
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+
+        len += (size_t)n;
+    }
+
+    if (!from_stdin) close(fd);
+    data[len] = 0;
+
+    int    failed  = 0;
+    size_t line_no = 0;
+
+    for (char* line = data; line < data + len;) {
+        char* end = memchr(line, '\n', (size_t)(data + len - line));
+        if (!end) end = data + len;
+
+        *end = 0;
+        line_no++;
+
+        char* text = line;
+        while (isspace((unsigned char)*text)) text++;
+
+        if (*text != '#' && !command_dispatch(&shell, text)) {
+            console_flush(console);
+            fprintf(stderr, "%s:%zu: Unknown command: %s\n", from_stdin ? "-" : path, line_no, text);
+            failed++;
+        }
+
+        line = end + 1;
+    }
+
+    console_flush(console);
+    xfree(data);
+
+    return failed;
+}
@@ -2,12 +2,35 @@
 #define TERMINAL_H
 
 #include "../lib/seqft/common.h"
+#include "process.h"
 
+// Writes the expression with the error's position marked under it, like
+// snprintf: at most size chars including the terminator, returning the
+// length the whole text needs. Safe to call from any thread.
+extern size_t format_error(char*       dest,
+                           size_t      size,
+                           const char* expr,
+                           size_t      expr_len,
+                           IterErr     error,
+                           size_t      indent);
+
+// Prints format_error's text to stdout.
 extern void highlight_error(const char* expr,
                             size_t      expr_len,
                             IterErr     error,
                             size_t      indent);
 
-extern int osmain(int* processes, int maxprocesses, int maxthreadsperprocess);
+// Reads a line from the terminal into dest, without the newline. Inside a
+// program running as a job this waits, letting the shell and other programs
+// run, until the shell hands the job a line. Returns FALSE at end of input.
+extern BOOL terminal_readLine(char* dest, size_t size);
+
+extern int osmain(ProcessTable* processes, int maxthreadsperprocess);
+
+// Runs the commands in the file at path, or standard input if path is 0 or
+// "-", one per line, without prompts. Blank lines and lines starting with '#'
+// are skipped, and output is fully buffered. Returns the number of lines that
+// weren't a command, or -1 if the file couldn't be opened.
+extern int osscript(const char* path, ProcessTable* processes, int maxthreadsperprocess);
 
 #endif // TERMINAL_H
\ No newline at end of file